@@ -1,6 +1,8 @@
 #include <mpma/Setup.h>
 #include <mpma/base/DebugRouter.h>
+#include <mpma/base/Profiler.h>
 #include <mpma/gfxsetup/GFXSetup.h>
+#include <mpma/gfx/FrameStats.h>
 #include <mpma/gfx/Texture.h>
 #include <mpma/gfx/Shader.h>
 #include <mpma/gfx/TextWriter.h>
@@ -8,8 +10,6 @@
 
 #include <GL/glu.h>
 
-#include <chrono>
-
 //Platform independent entry point for the app.
 void AppMain()
 {
@@ -39,9 +39,11 @@ void AppMain()
 	GFX::Texture2D pawImage;
 	pawImage.CreateFromFile("data\\example.png");
 
-	//run example app loop
-	auto lastFrameTime = std::chrono::high_resolution_clock::now();
+	//watch how long drawing takes (the overlay is drawn over the app by UpdateWindow)
+	GFX::SetFrameStageBudget("Draw", 0.004);
+	GFX::ShowFrameStatsOverlay(true);
 
+	//run example app loop
 	float x = 0.0f, y = 0.0f;
 
 	const GFX::GraphicsSetup *state;
@@ -50,9 +52,7 @@ void AppMain()
 		GFX::UpdateWindow();
 
 		//handle time
-		auto now = std::chrono::high_resolution_clock::now();
-		float timePassed = std::chrono::duration_cast<std::chrono::microseconds>(now - lastFrameTime).count() / 1000000.0f;
-		lastFrameTime = now;
+		float timePassed = (float)GFX::GetLastFrameTime();
 
 		//handle input
 		for (auto &a: INPUT::GetCurrentlyPressedAxes())
@@ -61,6 +61,8 @@ void AppMain()
 			y -= timePassed * a->GetYValue() * 100;
 		}
 
+		MPMAProfileScope("Draw");
+
 		//set up opengl for 2d rendering
 		glViewport(0, 0, state->Width, state->Height);
 
@@ -19,6 +19,48 @@
 //!Enables or disables all use of MPMA's time profiler.
 #define TIMEPROFILE_ENABLED
 
+//!If defined, each profile also records which profile it was started inside of on the same thread.  The profile report then includes a call tree with inclusive and exclusive times, and a collapsed-stack file is written for flame graph tools.  This costs a few more nanoseconds per profile.
+#define TIMEPROFILE_CALL_TREE
+
+//!If defined, each profile keeps a histogram of its times on each thread, so the profile report can show percentiles (such as the 99th) along with the average.  Each profile takes about 8KB more on each thread it's used on.
+#define TIMEPROFILE_HISTOGRAMS
+
+//!If defined, each thread opens hardware performance counters (cycles, instructions, cache misses and branch misses) and the profile report shows how many of each every profile took per call, so memory-bound code can be told apart from compute-bound code.  Linux only (through perf_event_open), and only where the kernel allows it.  Reading the counters is a system call at each start and stop of an outermost profile, so this costs around a microsecond per profile.
+//#define TIMEPROFILE_HARDWARE_COUNTERS
+
+//!If defined, the profiles are written to _profile_dump.csv every this many seconds while the framework runs (see StartProfileDump in Profiler.h), so results aren't lost if the program never exits cleanly.
+//#define TIMEPROFILE_DUMP_SECONDS 10
+
+//!The number of events each thread keeps while a profile trace is recording (see StartProfileTrace in Profiler.h).  Once a thread has recorded this many, its oldest are overwritten.  Each event takes 24 bytes.
+#define TIMEPROFILE_TRACE_EVENTS (64*1024)
+
+
+// -- Timer --
+
+//!If defined, Timer reads the cpu's time stamp counter directly when it runs at a constant rate and is in step between cpus, instead of asking the operating system for the time.  This makes reading the time (and so each profile) much cheaper.
+#define TIMER_USE_TSC
+
+
+// -- Threads --
+
+//!If defined, the task scheduler's worker threads are each pinned to their own physical core, and look for jobs queued from their own NUMA node before others.
+#define TASK_PIN_WORKERS_TO_CORES
+
+//!If defined (along with MPMA_COMPILE_AUDIO), the background audio thread is pinned to the last physical core, and pools pinned per core (including the task scheduler's workers) stay off of it, so audio mixing is never held up by busy workers.  Only applies on machines with at least 4 cores.
+#define RESERVE_CORE_FOR_AUDIO
+
+
+// -- Locks --
+
+//!The number of separate reader counters in each RWSleepLock.  Readers on different threads are spread over these so they don't contend on the same cache line.  Each costs a cache line of memory per lock.
+#define RWLOCK_READER_SLOTS 16
+
+//!If defined, RWSleepLock keeps track of the read locks each thread holds, so a thread may take a read lock again (or upgrade to a write lock) while it already holds one.  Without this, only write locks are re-entrant.
+#define RWLOCK_TRACK_REENTRANCY
+
+//!If defined, MutexLock, SpinLock and RWSleepLock count how often they are taken, how often they are contended, and how long they are waited on and held (see LockStats.h).  This costs a few timer reads per acquisition, so leave it off unless looking for contention.
+//#define LOCK_CONTENTION_STATS
+
 
 // -- Memory Manager --
 
@@ -33,6 +75,39 @@
 //!If defined along with MEMMAN_TRACING, information about freed memory will be saved for later checks.  This essentially creates a leak since old information is never freed.
 //#define MEM_TRACK_OLD_FREE
 
+//!If defined along with MEMMAN_TRACING, a low priority thread checks the padding around the allocations a slice at a time while the framework is running, instead of only when memory is freed and at shutdown.
+//#define MEMMAN_BACKGROUND_PADDING_SCAN
+
+//!If defined along with MEMMAN_TRACING, allocations of at least this many bytes end right at an inaccessible page of memory, so writing past them crashes immediately.  Each one takes at least two pages.  This can also be changed at runtime with mpmaMemoryManager.SetGuardPageMinSize.
+//#define MEMMAN_GUARD_PAGE_MIN_SIZE 4096
+
+//!If defined (and MEMMAN_TRACING is not), single objects allocated with new3/new2 come from a size-class allocator with per-thread caches instead of the global new (see SmallObjects.h).  Arrays are not affected.
+#define SMALLOBJECT_ALLOCATOR
+
+//!If defined, about one allocation in every HEAP_PROFILER_SAMPLE_BYTES bytes is recorded along with its raw call stack, so live memory and allocation rates can be broken down by call site (see HeapProfiler.h).  This is cheap enough to leave on.  Without MEMMAN_TRACING, only allocations from the small object allocator are seen.
+#define HEAP_PROFILER
+
+//!The average number of bytes allocated between samples taken by the heap profiler.  It can also be changed at runtime.
+#define HEAP_PROFILER_SAMPLE_BYTES (512*1024)
+
+//!If defined, the sampling profiler can be used (see SamplingProfiler.h).  It costs nothing until it is started.  Only supported on linux.
+#define SAMPLING_PROFILER
+
+//!The default number of times a second (of cpu time used by a thread) that the sampling profiler records each thread's call stack.  An odd rate is less likely to line up with work that repeats at a fixed rate.  The kernel only checks a thread's cpu time on each scheduler tick, so rates above its tick rate (commonly 250) are not reached.
+#define SAMPLING_PROFILER_RATE 199
+
+//!The most frames recorded for each sample.
+#define SAMPLING_PROFILER_MAX_FRAMES 64
+
+//!The number of samples each thread can hold before they are collected (which happens 10 times a second).  Samples taken while a thread's buffer is full are dropped.  Each takes SAMPLING_PROFILER_MAX_FRAMES pointers.
+#define SAMPLING_PROFILER_BUFFER_SAMPLES 256
+
+//!If defined, the sampling profiler is started when the framework is initialized, and writes _sampling_profile.txt and _sampling_profile.folded at shutdown.
+//#define SAMPLING_PROFILER_AUTOSTART
+
+//!If defined, the sampling profiler follows frame pointers to find call stacks instead of using the system's unwinder.  This is always safe to do inside a signal handler, but code must be compiled with -fno-omit-frame-pointer to be seen past.  Leave it undefined unless the unwinder misbehaves (such as with old versions of glibc and libgcc that can deadlock if a sample lands in dlopen).
+//#define SAMPLING_PROFILER_FRAME_POINTERS
+
 
 // -- Debug --
 
@@ -94,6 +169,9 @@
 //!If defined, enables the TextWriter class.  This adds a dependency on libfreetype.
 #define GFX_USES_FREETYPE
 
+//!If defined, the frame stats overlay (see FrameStats.h) is shown from the start.
+//#define GFX_SHOW_FRAME_STATS_OVERLAY
+
 
 // -- Input --
 
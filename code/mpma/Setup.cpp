@@ -68,11 +68,14 @@ extern bool mpmaForceReferenceToPlayerCPP;
 #endif
 
 //#ifdef MPMA_COMPILE_BASE //base is not optional
+extern bool mpmaForceReferenceToCoroutineCPP;
 extern bool mpmaForceReferenceToDebugRouterCPP;
 extern bool mpmaForceReferenceToInfoCPP;
 extern bool mpmaForceReferenceToMemoryCPP;
+extern bool mpmaForceReferenceToObjectPoolCPP;
 extern bool mpmaForceReferenceToProfilerCPP;
 extern bool mpmaForceReferenceToReferenceCountCPP;
+extern bool mpmaForceReferenceToSamplingProfilerCPP;
 extern bool mpmaForceReferenceToThreadedTaskCPP;
 extern bool mpmaForceReferenceToTextureCPP;
 extern bool mpmaForceReferenceToTextWriterCPP;
@@ -85,6 +88,7 @@ extern bool mpmaForceReferenceToDebugWin32CPP;
 #endif
 
 #ifdef MPMA_COMPILE_GFX
+extern bool mpmaForceReferenceToFrameStatsCPP;
 #endif
 
 #ifdef MPMA_COMPILE_GFXSETUP
@@ -107,6 +111,7 @@ extern bool mpmaForceReferenceToHmdCPP;
 #endif
 
 #ifdef MPMA_COMPILE_NET
+extern bool mpmaForceReferenceToAsyncSocketsCPP;
 extern bool mpmaForceReferenceToUPNPCPP;
 #endif
 
@@ -141,11 +146,14 @@ namespace MPMA
         #endif
 
         //#ifdef MPMA_COMPILE_BASE //base is not optional
+        mpmaForceReferenceToCoroutineCPP=true;
         mpmaForceReferenceToDebugRouterCPP=true;
         mpmaForceReferenceToInfoCPP=true;
         mpmaForceReferenceToMemoryCPP=true;
+        mpmaForceReferenceToObjectPoolCPP=true;
         mpmaForceReferenceToProfilerCPP=true;
         mpmaForceReferenceToReferenceCountCPP=true;
+        mpmaForceReferenceToSamplingProfilerCPP=true;
         mpmaForceReferenceToThreadedTaskCPP=true;
         mpmaForceReferenceToTextureCPP=true;
         mpmaForceReferenceToTextWriterCPP=true;
@@ -158,6 +166,7 @@ namespace MPMA
         #endif
 
         #ifdef MPMA_COMPILE_GFX
+        mpmaForceReferenceToFrameStatsCPP=true;
         #endif
 
         #ifdef MPMA_COMPILE_GFXSETUP
@@ -180,6 +189,7 @@ namespace MPMA
         #endif
 
         #ifdef MPMA_COMPILE_NET
+        mpmaForceReferenceToAsyncSocketsCPP=true;
         mpmaForceReferenceToUPNPCPP=true;
         #endif
         
@@ -11,6 +11,8 @@
 #include "AL_LockedCalls.h"
 #include "../Setup.h"
 #include "../base/DebugRouter.h"
+#include "../base/ObjectPool.h"
+#include "../base/Profiler.h"
 
 //the number of buffer subdivisions to use for each streaming source
 #define STREAMING_BUFFER_SUBDIVISION_COUNT 16
@@ -244,6 +246,19 @@ namespace AUDIO_INTERNAL
     std::list<std::shared_ptr<StreamBuffer>> activeStreams;
     MPMA::MutexLock *activeStreamsLock;
 
+    //players and their stream buffers are made for every sound that is played, which can be many per frame
+    MPMA::ObjectPool<AUDIO::Player>& Players()
+    {
+        static MPMA::ObjectPool<AUDIO::Player> *players=MPMA::NewLeakedObjectPool<AUDIO::Player>("Audio players");
+        return *players;
+    }
+
+    MPMA::ObjectPool<StreamBuffer>& StreamBuffers()
+    {
+        static MPMA::ObjectPool<StreamBuffer> *streamBuffers=MPMA::NewLeakedObjectPool<StreamBuffer>("Audio stream buffers");
+        return *streamBuffers;
+    }
+
     //streaming worker
     class StreamProcessing
     {
@@ -254,6 +269,12 @@ namespace AUDIO_INTERNAL
 #ifdef HIGHER_PRIORITY_SOUND_THREAD
             mainThread->SetPriority(MPMA::THREAD_HIGH);
 #endif
+
+            //keep it on its own core, away from the task scheduler's workers
+            std::vector<nuint> reservedProcessors;
+            MPMA::GetReservedCoreProcessors(reservedProcessors);
+            if (!reservedProcessors.empty())
+                mainThread->SetProcessorAffinity(reservedProcessors);
         }
 
         ~StreamProcessing()
@@ -265,6 +286,7 @@ namespace AUDIO_INTERNAL
         static void ThreadMain(MPMA::Thread &myThread, MPMA::ThreadParam param)
         {
             StreamProcessing *me=(StreamProcessing*)param.ptr;
+            MPMAProfileSetThreadName("Audio Streaming");
 
             while (!myThread.IsEnding())
             {
@@ -283,6 +305,7 @@ namespace AUDIO_INTERNAL
 
         static nuint UpdateAllStreams()
         {
+            MPMAProfileScope("Audio UpdateAllStreams");
             MPMA::TakeMutexLock autoLock(*AUDIO_INTERNAL::activeStreamsLock);
 
             //we need to hold a reference to all players for the streams to prevent them from cleaning up and deleting themself from activeStreams while we're walking the list
@@ -311,6 +334,8 @@ namespace AUDIO_INTERNAL
                 }
             }
 
+            MPMAProfileCounter("Audio active streams", AUDIO_INTERNAL::activeStreams.size());
+
             return (nuint)(minBufferSize*1000.0f/STREAMING_BUFFER_SUBDIVISION_COUNT);
         }
 
@@ -325,6 +350,7 @@ namespace AUDIO_INTERNAL
     void InitAudioSystem()
     {
         activeStreamsLock=new3(MPMA::MutexLock);
+        activeStreamsLock->SetName("Audio active streams");
         AUDIO::SetBackgroundStreaming(true);
     }
 
@@ -463,7 +489,7 @@ namespace AUDIO
 
     std::shared_ptr<Player> Player::Create(bool allocateNow)
     {
-        std::shared_ptr<Player> newPlayer=std::shared_ptr<Player>(new3(Player), new3_delete<Player>());
+        std::shared_ptr<Player> newPlayer=AUDIO_INTERNAL::Players().NewShared();
         newPlayer->self=newPlayer;
 
         if (allocateNow)
@@ -523,7 +549,7 @@ namespace AUDIO
 
         //setup initial streaming buffers and play
         isStatic=false;
-        streamBuffer=std::make_shared<AUDIO_INTERNAL::StreamBuffer>(self.lock(), source, streamSizeInSeconds);
+        streamBuffer=AUDIO_INTERNAL::StreamBuffers().NewShared(self.lock(), source, streamSizeInSeconds);
         streamBuffer->UpdateStream();
 
         {
@@ -19,6 +19,11 @@ namespace AUDIO_INTERNAL
     class StreamBuffer;
 }
 
+namespace MPMA
+{
+    template <typename T> class ObjectPool;
+}
+
 namespace AUDIO
 {
     //!Determines how the sound should be played back.
@@ -144,6 +149,7 @@ namespace AUDIO
         std::weak_ptr<Player> self;
 
         friend class AUDIO_INTERNAL::StreamBuffer;
+        template <typename T> friend class MPMA::ObjectPool;
     };
 }
 
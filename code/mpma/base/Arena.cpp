@@ -0,0 +1,150 @@
+//Linear (bump pointer) allocators, for data that is all thrown away at once.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "Arena.h"
+#include "Memory.h"
+#include <string.h>
+
+namespace MPMA
+{
+    Arena::Arena(nuint blockSize, bool useHugePages):
+        currentBlock(0), currentOffset(0), blockSize(blockSize), useHugePages(useHugePages), highWaterBytes(0), resetCount(0)
+    {
+        if (useHugePages)
+            this->blockSize=(blockSize+ARENA_HUGE_PAGE_SIZE-1)&~(ARENA_HUGE_PAGE_SIZE-1);
+    }
+
+    Arena::~Arena()
+    {
+        for (std::vector<Block>::iterator b=blocks.begin(); b!=blocks.end(); ++b)
+            FreeBlock(*b);
+    }
+
+    //the current block is full (or there isn't one), so move on to one that fits
+    void* Arena::AllocSlow(nuint size, nuint alignment)
+    {
+        nuint usedBefore=BytesUsed();
+        if (usedBefore>highWaterBytes)
+            highWaterBytes=usedBefore;
+
+        //use the next block if it's big enough, otherwise put a new one before it
+        nuint needed=size+alignment;
+        nuint next=(currentBlock<blocks.size()) ? currentBlock+1 : currentBlock;
+        if (next>=blocks.size() || blocks[next].size<needed)
+            blocks.insert(blocks.begin()+next, NewBlock(needed));
+
+        blocks[next].usedBefore=usedBefore;
+        currentBlock=next;
+        currentOffset=0;
+
+        return Alloc(size, alignment);
+    }
+
+    //Frees everything allocated since the marker was taken.
+    void Arena::ResetToMarker(const Marker &marker)
+    {
+        nuint used=BytesUsed();
+        if (used>highWaterBytes)
+            highWaterBytes=used;
+
+        FreeAfter(marker.block, marker.offset);
+        currentBlock=marker.block;
+        currentOffset=marker.offset;
+    }
+
+    //Frees everything in the arena.
+    void Arena::Reset()
+    {
+        nuint used=BytesUsed();
+        if (used>highWaterBytes)
+            highWaterBytes=used;
+
+        FreeAfter(0, 0);
+        currentBlock=0;
+        currentOffset=0;
+        ++resetCount;
+    }
+
+    //Returns the blocks that are not in use to the system.
+    void Arena::FreeUnusedBlocks()
+    {
+        nuint keep=(currentBlock<blocks.size() && (currentBlock>0 || currentOffset>0)) ? currentBlock+1 : 0;
+        for (nuint i=keep; i<blocks.size(); ++i)
+            FreeBlock(blocks[i]);
+        blocks.resize(keep);
+
+        if (keep==0)
+        {
+            currentBlock=0;
+            currentOffset=0;
+        }
+    }
+
+    //Returns the arena's memory use.
+    ArenaStats Arena::GetStats() const
+    {
+        ArenaStats stats;
+        stats.bytesUsed=BytesUsed();
+        stats.highWaterBytes=(stats.bytesUsed>highWaterBytes) ? stats.bytesUsed : highWaterBytes;
+        stats.bytesReserved=0;
+        for (std::vector<Block>::const_iterator b=blocks.begin(); b!=blocks.end(); ++b)
+            stats.bytesReserved+=b->size;
+        stats.blockCount=blocks.size();
+        stats.resetCount=resetCount;
+        return stats;
+    }
+
+    Arena::Block Arena::NewBlock(nuint minSize)
+    {
+        Block block;
+        block.size=(minSize>blockSize) ? minSize : blockSize;
+        block.usedBefore=0;
+        block.hugePages=false;
+        block.mem=0;
+
+        if (useHugePages)
+        {
+            block.size=(block.size+ARENA_HUGE_PAGE_SIZE-1)&~(ARENA_HUGE_PAGE_SIZE-1);
+            block.mem=(uint8*)Internal_AllocHugePages(block.size);
+            block.hugePages=(block.mem!=0);
+        }
+
+        if (!block.mem)
+            block.mem=new3_array(uint8, block.size);
+
+        return block;
+    }
+
+    void Arena::FreeBlock(Block &block)
+    {
+        if (block.hugePages)
+            Internal_FreeHugePages(block.mem, block.size);
+        else
+            delete3_array(block.mem);
+        block.mem=0;
+    }
+
+    nuint Arena::BytesUsed() const
+    {
+        if (currentBlock>=blocks.size())
+            return 0;
+        return blocks[currentBlock].usedBefore+currentOffset;
+    }
+
+    //in tracing builds, fills memory that is being given back with garbage, so anything still using it shows up quickly
+    void Arena::FreeAfter(nuint block, nuint offset)
+    {
+#ifdef MEMMAN_TRACING
+        for (nuint b=block; b<=currentBlock && b<blocks.size(); ++b)
+        {
+            nuint start=(b==block) ? offset : 0;
+            nuint end=(b==currentBlock) ? currentOffset : blocks[b].size;
+            if (end>start)
+                memset(blocks[b].mem+start, 0x7e, end-start);
+        }
+#else
+        (void)block;
+        (void)offset;
+#endif
+    }
+}
@@ -0,0 +1,234 @@
+//!\file Arena.h Linear (bump pointer) allocators, for data that is all thrown away at once.
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include "Types.h"
+#include "../Config.h"
+#include <stddef.h>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+An example of per-frame scratch data:
+  MPMA::FrameArena frameArena;
+
+  //...during the frame, anything allocated from it stays valid until the end of the next frame
+  std::vector<Vertex, MPMA::ArenaAllocator<Vertex>> verts(frameArena.Current());
+  Particle *p=frameArena.Current().New<Particle>(position, velocity);
+
+  //temporary data inside of a function can be given back early
+  {
+      MPMA::ArenaScope scope(frameArena.Current());
+      float *samples=frameArena.Current().AllocArray<float>(sampleCount);
+      ...
+  } //samples are freed here
+
+  //once per frame
+  frameArena.EndFrame();
+*/
+
+namespace MPMA
+{
+    //!Memory use of an Arena.
+    struct ArenaStats
+    {
+        nuint bytesUsed; //!<Bytes handed out since the last reset, including alignment padding.
+        nuint highWaterBytes; //!<The most bytesUsed has ever been.
+        nuint bytesReserved; //!<Total size of the blocks the arena holds.
+        nuint blockCount; //!<Number of blocks the arena holds.
+        nuint resetCount; //!<Number of times Reset has been called.
+    };
+
+    //!\brief Hands out memory by moving a pointer through large blocks, and frees it all at once with Reset (or back to a Marker).
+    //!Destructors of things put in an arena are never called, so only use it for types that don't need them (or call them yourself).  An arena is not thread safe.
+    //!In MEMMAN_TRACING builds each block is one tracked allocation, and memory that is reset is filled with garbage to catch anything still using it.
+    class Arena
+    {
+    public:
+        //!ctor - blockSize is the size of each block that is allocated as the arena grows.  If useHugePages is set, blocks come directly from the OS using huge pages (2MB) where they are available, and blockSize is rounded up to a multiple of that.
+        Arena(nuint blockSize=64*1024, bool useHugePages=false);
+        ~Arena();
+
+        //!Returns size bytes with the given alignment (a power of 2).  Never returns 0, throws std::bad_alloc instead.
+        inline void* Alloc(nuint size, nuint alignment=16);
+
+        //!Returns uninitialized memory for count objects of type T.
+        template <typename T>
+        inline T* AllocArray(nuint count)
+            { return (T*)Alloc(count*sizeof(T), alignof(T)); }
+
+        //!Constructs a T in the arena.  Its destructor will not be called.
+        template <typename T, typename... Args>
+        inline T* New(Args&&... args)
+            { return new (Alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...); }
+
+        //!A position in the arena that it can be reset back to.
+        struct Marker
+        {
+            nuint block;
+            nuint offset;
+        };
+
+        //!Returns the current position, for use with ResetToMarker.
+        inline Marker GetMarker() const
+        {
+            Marker marker;
+            marker.block=currentBlock;
+            marker.offset=currentOffset;
+            return marker;
+        }
+
+        //!Frees everything allocated since the marker was taken.
+        void ResetToMarker(const Marker &marker);
+
+        //!Frees everything in the arena.  The blocks are kept for reuse.
+        void Reset();
+
+        //!Returns the blocks that are not in use to the system.
+        void FreeUnusedBlocks();
+
+        //!Returns the arena's memory use.
+        ArenaStats GetStats() const;
+
+    private:
+        struct Block
+        {
+            uint8 *mem;
+            nuint size;
+            nuint usedBefore; //bytes used in the blocks before this one, when this one was started
+            bool hugePages;
+        };
+
+        std::vector<Block> blocks;
+        nuint currentBlock; //blocks before this are full
+        nuint currentOffset; //used bytes in the current block
+        nuint blockSize;
+        bool useHugePages;
+
+        nuint highWaterBytes;
+        nuint resetCount;
+
+        void* AllocSlow(nuint size, nuint alignment);
+        Block NewBlock(nuint minSize);
+        void FreeBlock(Block &block);
+        nuint BytesUsed() const;
+        void FreeAfter(nuint block, nuint offset);
+
+        //you cannot duplicate this
+        Arena(const Arena&);
+        const Arena& operator=(const Arena&);
+    };
+
+    //!Resets an arena back to where it was when this was created, when this goes out of scope.
+    class ArenaScope
+    {
+    public:
+        inline ArenaScope(Arena &scopeArena): arena(scopeArena), marker(scopeArena.GetMarker()) //!<ctor
+            {}
+        inline ~ArenaScope() //!<dtor
+            { arena.ResetToMarker(marker); }
+
+    private:
+        Arena &arena;
+        Arena::Marker marker;
+
+        //you cannot duplicate this
+        ArenaScope(const ArenaScope&);
+        const ArenaScope& operator=(const ArenaScope&);
+    };
+
+    //!\brief A pair of arenas for per-frame data.  Anything allocated during a frame stays valid until the end of the next frame, so results from the last frame can still be read.
+    //!Not thread safe.
+    class FrameArena
+    {
+    public:
+        //!ctor - the parameters are passed to both arenas.
+        inline FrameArena(nuint blockSize=256*1024, bool useHugePages=false): arenaA(blockSize, useHugePages), arenaB(blockSize, useHugePages), current(&arenaA), previous(&arenaB)
+            {}
+
+        //!Returns the arena for the current frame.
+        inline Arena& Current()
+            { return *current; }
+
+        //!Returns the arena that was used for the previous frame.
+        inline Arena& Previous()
+            { return *previous; }
+
+        //!Call once at the end of each frame.  The previous frame's data is freed, and the current frame becomes the previous.
+        inline void EndFrame()
+        {
+            std::swap(current, previous);
+            current->Reset();
+        }
+
+    private:
+        Arena arenaA, arenaB;
+        Arena *current, *previous;
+
+        //you cannot duplicate this
+        FrameArena(const FrameArena&);
+        const FrameArena& operator=(const FrameArena&);
+    };
+
+    //!An STL allocator that allocates from an Arena.  Deallocation does nothing, the memory is freed when the arena is reset, so the container must not be used after that.
+    template <typename T>
+    class ArenaAllocator
+    {
+    public:
+        typedef T value_type;
+
+        inline ArenaAllocator(Arena &allocArena) noexcept: arena(&allocArena) //!<ctor
+            {}
+        template <typename U>
+        inline ArenaAllocator(const ArenaAllocator<U> &other) noexcept: arena(other.arena) //!<ctor
+            {}
+
+        inline T* allocate(size_t count)
+            { return arena->AllocArray<T>(count); }
+        inline void deallocate(T*, size_t)
+            {}
+
+        template <typename U>
+        struct rebind
+        {
+            typedef ArenaAllocator<U> other;
+        };
+
+        Arena *arena;
+    };
+
+    template <typename T, typename U>
+    inline bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+        { return a.arena==b.arena; }
+    template <typename T, typename U>
+    inline bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+        { return a.arena!=b.arena; }
+
+    //internal use: allocates memory backed by huge pages directly from the OS, falling back to normal pages if huge pages are not available.  size must be a multiple of the huge page size.  Returns 0 on failure.
+    void* Internal_AllocHugePages(nuint size);
+    void Internal_FreeHugePages(void *mem, nuint size);
+
+    //!The size of a huge page that Arena rounds its blocks to.
+    const nuint ARENA_HUGE_PAGE_SIZE=2*1024*1024;
+
+    // -- inline
+
+    inline void* Arena::Alloc(nuint size, nuint alignment)
+    {
+        if (currentBlock<blocks.size())
+        {
+            Block &block=blocks[currentBlock];
+            nuint start=(((nuint)block.mem+currentOffset+alignment-1)&~(alignment-1))-(nuint)block.mem;
+            if (start+size<=block.size)
+            {
+                currentOffset=start+size;
+                return block.mem+start;
+            }
+        }
+
+        return AllocSlow(size, alignment);
+    }
+}
@@ -0,0 +1,75 @@
+//!\file Atomic.h Atomic operations with explicit memory ordering.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "Types.h"
+
+#ifndef ATOMIC_H_INCLUDED
+#define ATOMIC_H_INCLUDED
+
+namespace MPMA
+{
+    //!\brief The ordering constraints an atomic operation places on the memory accesses around it.
+    //!These have the same meaning as the C++11 std::memory_order values of the same name.
+    enum MemoryOrder
+    {
+        MEMORY_ORDER_RELAXED, //!<Only the operation itself is atomic, no ordering is implied.
+        MEMORY_ORDER_ACQUIRE, //!<Later reads and writes may not be moved before the operation.
+        MEMORY_ORDER_RELEASE, //!<Earlier reads and writes may not be moved after the operation.
+        MEMORY_ORDER_ACQ_REL, //!<Both acquire and release.
+        MEMORY_ORDER_SEQ_CST  //!<Both acquire and release, and all seq_cst operations appear in a single total order.  This is what the older AtomicIntInc style functions in Locks.h provide.
+    };
+
+    //The following work on 32 and 64 bit integers (on all platforms, including 32 bit ones).  Load, Store, Exchange and CompareAndSwap also work on pointers.  All are inline.
+
+    //!Atomically reads a value.  order should be relaxed, acquire, or seq_cst.
+    template <typename T> T AtomicLoad(const volatile T *p, MemoryOrder order=MEMORY_ORDER_SEQ_CST);
+
+    //!Atomically writes a value.  order should be relaxed, release, or seq_cst.
+    template <typename T> void AtomicStore(volatile T *p, T value, MemoryOrder order=MEMORY_ORDER_SEQ_CST);
+
+    //!Atomically sets a value and returns the value it had before.
+    template <typename T> T AtomicExchange(volatile T *p, T value, MemoryOrder order=MEMORY_ORDER_SEQ_CST);
+
+    //!Atomically adds to a value and returns the value it had before.
+    template <typename T> T AtomicFetchAdd(volatile T *p, T value, MemoryOrder order=MEMORY_ORDER_SEQ_CST);
+
+    //!Atomically subtracts from a value and returns the value it had before.
+    template <typename T> T AtomicFetchSub(volatile T *p, T value, MemoryOrder order=MEMORY_ORDER_SEQ_CST);
+
+    //!Atomically bitwise-ors a value in and returns the value it had before.
+    template <typename T> T AtomicFetchOr(volatile T *p, T value, MemoryOrder order=MEMORY_ORDER_SEQ_CST);
+
+    //!Atomically bitwise-ands a value in and returns the value it had before.
+    template <typename T> T AtomicFetchAnd(volatile T *p, T value, MemoryOrder order=MEMORY_ORDER_SEQ_CST);
+
+    //!If *p is equal to expected, sets it to desired and returns true.  Otherwise returns false and sets expected to the value that was found at p.  The order applies when it succeeds, a failed compare is relaxed unless order is seq_cst (or acquire/acq_rel, in which case it is acquire).
+    template <typename T> bool AtomicCompareAndSwap(volatile T *p, T &expected, T desired, MemoryOrder order=MEMORY_ORDER_SEQ_CST);
+
+    //!Orders memory accesses on either side of it without being attached to a particular atomic operation.
+    void AtomicThreadFence(MemoryOrder order=MEMORY_ORDER_SEQ_CST);
+
+    //!Two native-sized integers that can be compare-and-swapped together (128 bits on 64 bit platforms, 64 bits on 32 bit ones).  Useful for pointer+counter pairs.
+    struct alignas(2*sizeof(nuint)) AtomicDoubleWord
+    {
+        nuint low;
+        nuint high;
+
+        inline AtomicDoubleWord(): low(0), high(0) //!<ctor
+            {}
+        inline AtomicDoubleWord(nuint lowWord, nuint highWord): low(lowWord), high(highWord) //!<ctor
+            {}
+    };
+
+    //!Same as AtomicCompareAndSwap, but for both words of an AtomicDoubleWord at once.  This is always seq_cst.  Reading the words without this is not atomic, but a torn read will simply fail the compare.
+    bool AtomicCompareAndSwapDoubleWord(volatile AtomicDoubleWord *p, AtomicDoubleWord &expected, const AtomicDoubleWord &desired);
+
+} //namespace MPMA
+
+//include the platform-specific headers
+#if defined(_WIN32) || defined(_WIN64)
+    #include "win32/AtomicWin32.h"
+#else
+    #include "linux/AtomicLin32.h"
+#endif
+
+#endif //ATOMIC_H_INCLUDED
@@ -0,0 +1,241 @@
+//Coroutine tasks that run on the task scheduler, and things for them to wait on without blocking a thread.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "Coroutine.h"
+
+#ifdef MPMA_COROUTINES_AVAILABLE
+
+#include "Thread.h"
+#include "Timer.h"
+#include "Memory.h"
+#include "DebugRouter.h"
+#include "../Setup.h"
+#include <algorithm>
+#include <stdio.h>
+
+namespace
+{
+    //the group every resumed coroutine is run in.  Nothing waits on it until shutdown.
+    MPMA::TaskGroup *coroutineGroup=0;
+
+    void ResumeJobProc(MPMA::ThreadedTaskJob &job)
+    {
+        std::coroutine_handle<>::from_address(job.param).resume();
+    }
+
+    // -- timers
+
+    MPMA::Timer *coroutineClock=0; //time since init
+    MPMA::Thread *timerThread=0;
+    MPMA::BlockingObject *timerWake=0;
+    MPMA::SpinLock *timersLock=0;
+    std::vector<MPMA::DelayAwaiter*> *timers=0; //a heap, earliest first
+    bool timersEnding=false;
+
+    bool TimerLater(const MPMA::DelayAwaiter *a, const MPMA::DelayAwaiter *b)
+    {
+        return a->wakeTime>b->wakeTime;
+    }
+
+    void TimerThreadProc(MPMA::Thread &thread, MPMA::ThreadParam)
+    {
+        std::vector<MPMA::DelayAwaiter*> expired;
+        while (!thread.IsEnding())
+        {
+            //take everything that is due, and find out how long until the next one
+            nuint msToSleep=0xffffffff;
+            {
+                MPMA::TakeSpinLock takeLock(*timersLock);
+                if (timersEnding)
+                    break;
+
+                double now=coroutineClock->Step(false);
+                while (!timers->empty() && timers->front()->wakeTime<=now)
+                {
+                    expired.push_back(timers->front());
+                    std::pop_heap(timers->begin(), timers->end(), TimerLater);
+                    timers->pop_back();
+                }
+
+                if (!timers->empty())
+                    msToSleep=(nuint)((timers->front()->wakeTime-now)*1000.0)+1;
+
+                //anyone adding an earlier timer (or shutting down) after this will clear it, so the wait below returns right away
+                timerWake->Set();
+            }
+
+            for (std::vector<MPMA::DelayAwaiter*>::iterator t=expired.begin(); t!=expired.end(); ++t)
+                MPMA::Internal_ResumeOnTaskScheduler((*t)->job, (*t)->coroutine);
+            expired.clear();
+
+            timerWake->WaitUntilClear(false, msToSleep);
+        }
+    }
+
+    // -- file reads
+
+    //the max number of io threads reading files at once
+    const nuint FILE_READ_THREADS=4;
+
+    MPMA::ThreadPool *fileReadPool=0;
+
+    void ReadWholeFile(MPMA::FileReadAwaiter &read)
+    {
+        FILE *f=fopen(read.file.c_str(), "rb");
+        if (!f)
+            return;
+
+        uint8 buff[32*1024];
+        nuint numRead;
+        while ((numRead=fread(buff, 1, sizeof(buff), f))!=0)
+            read.data->insert(read.data->end(), &buff[0], &buff[numRead]);
+
+        read.succeeded=(ferror(f)==0);
+        fclose(f);
+    }
+
+    void FileReadThreadProc(MPMA::Thread&, MPMA::ThreadParam param)
+    {
+        MPMA::FileReadAwaiter &read=*(MPMA::FileReadAwaiter*)param.ptr;
+        ReadWholeFile(read);
+        read.coroutine.resume();
+    }
+}
+
+namespace MPMA
+{
+    //queues a job that resumes a coroutine on the task scheduler
+    void Internal_ResumeOnTaskScheduler(ThreadedTaskJob &job, std::coroutine_handle<> handle)
+    {
+        job.func=ResumeJobProc;
+        job.param=handle.address();
+
+        if (coroutineGroup)
+            coroutineGroup->Run(job);
+        else //not initialized (or already shut down), so just keep going on this thread
+            handle.resume();
+    }
+
+    void DelayAwaiter::await_suspend(std::coroutine_handle<> handle)
+    {
+        coroutine=handle;
+        cancelled=(timersLock==0);
+        if (!cancelled)
+        {
+            TakeSpinLock takeLock(*timersLock);
+            cancelled=timersEnding;
+            if (!cancelled)
+            {
+                wakeTime=coroutineClock->Step(false)+seconds;
+                timers->push_back(this);
+                std::push_heap(timers->begin(), timers->end(), TimerLater);
+
+                //the timer thread may be sleeping past when this should wake
+                if (timers->front()==this)
+                    timerWake->Clear();
+                return; //the timer thread may resume us as soon as the lock is released, so this must not be touched after
+            }
+        }
+
+        //shutting down, so don't wait
+        Internal_ResumeOnTaskScheduler(job, coroutine);
+    }
+
+    bool FileReadAwaiter::await_suspend(std::coroutine_handle<> handle)
+    {
+        coroutine=handle;
+        if (fileReadPool && fileReadPool->RunThread(FileReadThreadProc, ThreadParam(this)))
+            return true;
+
+        //no io threads available, so read it here and keep going
+        ReadWholeFile(*this);
+        return false;
+    }
+
+    void Internal_DetachedTask::promise_type::unhandled_exception()
+    {
+        try
+        {
+            throw;
+        }
+        catch (const std::exception &e)
+        {
+            ErrorReport()<<"A task started with StartTask threw an exception: "<<e.what()<<"\n";
+        }
+        catch (...)
+        {
+            ErrorReport()<<"A task started with StartTask threw an exception.\n";
+        }
+    }
+}
+
+//init stuff
+namespace
+{
+    void CoroutineInitialize()
+    {
+        coroutineGroup=new2(MPMA::TaskGroup(), MPMA::TaskGroup);
+
+        coroutineClock=new2(MPMA::Timer(), MPMA::Timer);
+        timerWake=new2(MPMA::BlockingObject(), MPMA::BlockingObject);
+        timersLock=new2(MPMA::SpinLock(), MPMA::SpinLock);
+        timers=new2(std::vector<MPMA::DelayAwaiter*>(), std::vector<MPMA::DelayAwaiter*>);
+        timersEnding=false;
+        timerThread=new2(MPMA::Thread(TimerThreadProc, MPMA::ThreadParam()), MPMA::Thread);
+
+        fileReadPool=new2(MPMA::ThreadPool(0, FILE_READ_THREADS), MPMA::ThreadPool);
+    }
+    void CoroutineShutdown()
+    {
+        //finish any reads in progress
+        delete2(fileReadPool);
+        fileReadPool=0;
+
+        //stop the timer thread, then cut short any delays still waiting
+        std::vector<MPMA::DelayAwaiter*> cancelled;
+        {
+            MPMA::TakeSpinLock takeLock(*timersLock);
+            timersEnding=true;
+            timerWake->Clear();
+            cancelled.swap(*timers);
+        }
+        delete2(timerThread);
+        timerThread=0;
+
+        for (std::vector<MPMA::DelayAwaiter*>::iterator t=cancelled.begin(); t!=cancelled.end(); ++t)
+        {
+            (*t)->cancelled=true;
+            MPMA::Internal_ResumeOnTaskScheduler((*t)->job, (*t)->coroutine);
+        }
+
+        //everything that was resumed has to finish before the scheduler goes away
+        coroutineGroup->Wait();
+
+        delete2(timers);
+        timers=0;
+        delete2(timersLock);
+        timersLock=0;
+        delete2(timerWake);
+        timerWake=0;
+        delete2(coroutineClock);
+        coroutineClock=0;
+
+        delete2(coroutineGroup);
+        coroutineGroup=0;
+    }
+
+    class AutoInitCoroutine
+    {
+    public:
+        //hookup init callbacks
+        AutoInitCoroutine()
+        {
+            MPMA::Internal_AddInitCallback(CoroutineInitialize, -150);
+            MPMA::Internal_AddShutdownCallback(CoroutineShutdown, -150);
+        }
+    } autoInitCoroutine;
+}
+
+#endif //MPMA_COROUTINES_AVAILABLE
+
+bool mpmaForceReferenceToCoroutineCPP=false; //work around a problem using MPMA as a static library
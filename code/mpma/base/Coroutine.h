@@ -0,0 +1,355 @@
+//!\file Coroutine.h Coroutine tasks that run on the task scheduler, and things for them to wait on without blocking a thread.
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include "Types.h"
+#include "Atomic.h"
+#include "ThreadedTask.h"
+#include "Locks.h"
+#include "File.h"
+#include <vector>
+
+//coroutines need a compiler (and standard library) that supports C++20 coroutines.  Without them, nothing in this file is declared.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+    #if __has_include(<coroutine>)
+        #define MPMA_COROUTINES_AVAILABLE
+    #endif
+#endif
+
+#ifdef MPMA_COROUTINES_AVAILABLE
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/*
+An example of asset loading written sequentially, where no thread is held while the file is read or while waiting:
+  MPMA::Task<bool> LoadLevel(std::string name)
+  {
+      std::vector<uint8> data;
+      if (!co_await MPMA::ReadFileAsync(name, data))
+          co_return false;
+
+      co_await MPMA::ResumeOnThreadPool(); //the read finished on an io thread, so move back to the task scheduler for the heavy work
+      ParseLevel(data);
+      co_return true;
+  }
+
+  //from code that is not a coroutine:
+  MPMA::StartTask(LoadLevel("level1.dat")); //runs it in the background
+  bool loaded=MPMA::SyncWait(LoadLevel("level2.dat")); //or blocks until it finishes
+*/
+
+namespace MPMA
+{
+    template <typename T> class Task;
+
+    //internal use: the part of a Task's promise that does not depend on the result type
+    struct Internal_TaskPromiseBase
+    {
+        std::coroutine_handle<> continuation; //resumed when the task finishes
+        std::exception_ptr exception;
+
+        //tasks don't start until they are awaited
+        inline std::suspend_always initial_suspend() noexcept
+            { return std::suspend_always(); }
+
+        //when finished, continue whoever was waiting on us on the same thread
+        struct FinalAwaiter
+        {
+            inline bool await_ready() noexcept
+                { return false; }
+            template <typename Promise>
+            inline std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+                { return handle.promise().continuation ? handle.promise().continuation : std::noop_coroutine(); }
+            inline void await_resume() noexcept
+                {}
+        };
+        inline FinalAwaiter final_suspend() noexcept
+            { return FinalAwaiter(); }
+
+        inline void unhandled_exception()
+            { exception=std::current_exception(); }
+
+        inline void RethrowIfFailed()
+        {
+            if (exception)
+                std::rethrow_exception(exception);
+        }
+    };
+
+    //internal use: the promise for a Task with a result
+    template <typename T>
+    struct Internal_TaskPromise: public Internal_TaskPromiseBase
+    {
+        std::optional<T> result;
+
+        inline Task<T> get_return_object() noexcept
+            { return Task<T>(std::coroutine_handle<Internal_TaskPromise>::from_promise(*this)); }
+
+        inline void return_value(T value)
+            { result.emplace(std::move(value)); }
+
+        inline T TakeResult()
+        {
+            RethrowIfFailed();
+            return std::move(*result);
+        }
+    };
+
+    //internal use: the promise for a Task without a result
+    template <>
+    struct Internal_TaskPromise<void>: public Internal_TaskPromiseBase
+    {
+        inline Task<void> get_return_object() noexcept;
+
+        inline void return_void() noexcept
+            {}
+
+        inline void TakeResult()
+            { RethrowIfFailed(); }
+    };
+
+    //!\brief A coroutine that produces a T (or nothing if T is void).  A function becomes a Task by returning one and using co_await or co_return in its body.
+    //!A task does not start running until it is awaited (with co_await from another coroutine), or passed to StartTask or SyncWait.  It then runs on the thread that started it until it awaits something that has to wait, after which it continues on whatever thread finished that wait.  Use ResumeOnThreadPool to move it onto the task scheduler.
+    //!Exceptions thrown in a task are thrown again from the co_await that waits on it.
+    template <typename T=void>
+    class Task
+    {
+    public:
+        typedef Internal_TaskPromise<T> promise_type;
+
+        inline Task(): handle(0) //!<ctor - an empty task, which can't be awaited
+            {}
+        inline Task(Task &&other) noexcept: handle(other.handle) //!<move ctor
+            { other.handle=0; }
+        inline ~Task() //!<dtor - the task must not be running
+            { Reset(); }
+
+        inline Task& operator=(Task &&other) noexcept //!<move
+        {
+            if (this!=&other)
+            {
+                Reset();
+                handle=other.handle;
+                other.handle=0;
+            }
+            return *this;
+        }
+
+        //!Returns whether this refers to a coroutine.
+        inline bool IsValid() const
+            { return (bool)handle; }
+
+        //!Returns whether the coroutine has finished.
+        inline bool IsDone() const
+            { return !handle || handle.done(); }
+
+        // -- makes a task awaitable
+
+        inline bool await_ready() const noexcept
+            { return handle.done(); }
+        inline std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle.promise().continuation=awaiting;
+            return handle;
+        }
+        inline T await_resume()
+            { return handle.promise().TakeResult(); }
+
+        //internal use: awaits the task without taking its result
+        struct Internal_DoneAwaiter
+        {
+            std::coroutine_handle<promise_type> handle;
+
+            inline bool await_ready() const noexcept
+                { return handle.done(); }
+            inline std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+            {
+                handle.promise().continuation=awaiting;
+                return handle;
+            }
+            inline void await_resume() noexcept
+                {}
+        };
+        inline Internal_DoneAwaiter Internal_WhenDone() const
+            { return Internal_DoneAwaiter{handle}; }
+
+    private:
+        std::coroutine_handle<promise_type> handle;
+
+        inline explicit Task(std::coroutine_handle<promise_type> coroutine): handle(coroutine)
+            {}
+        friend struct Internal_TaskPromise<T>;
+
+        inline void Reset()
+        {
+            if (handle)
+                handle.destroy();
+            handle=0;
+        }
+
+        //you cannot duplicate this
+        Task(const Task&);
+        const Task& operator=(const Task&);
+    };
+
+    inline Task<void> Internal_TaskPromise<void>::get_return_object() noexcept
+        { return Task<void>(std::coroutine_handle<Internal_TaskPromise>::from_promise(*this)); }
+
+    // -- things to co_await
+
+    //internal use: queues a job that resumes a coroutine on the task scheduler
+    void Internal_ResumeOnTaskScheduler(ThreadedTaskJob &job, std::coroutine_handle<> handle);
+
+    //!Awaiter returned by ResumeOnThreadPool.
+    struct ThreadPoolAwaiter
+    {
+        ThreadedTaskJob job;
+
+        inline bool await_ready() const noexcept
+            { return false; }
+        inline void await_suspend(std::coroutine_handle<> handle)
+            { Internal_ResumeOnTaskScheduler(job, handle); }
+        inline void await_resume() noexcept
+            {}
+    };
+
+    //!co_await the result of this to continue the coroutine on one of the task scheduler's threads.
+    inline ThreadPoolAwaiter ResumeOnThreadPool()
+        { return ThreadPoolAwaiter(); }
+
+    //!Awaiter returned by Delay.  The result of the co_await is false if the delay was cut short because the framework is shutting down.
+    struct DelayAwaiter
+    {
+        double seconds;
+
+        inline bool await_ready() const noexcept
+            { return seconds<=0; }
+        void await_suspend(std::coroutine_handle<> handle);
+        inline bool await_resume() const noexcept
+            { return !cancelled; }
+
+        //internal use
+        double wakeTime;
+        std::coroutine_handle<> coroutine;
+        ThreadedTaskJob job;
+        bool cancelled;
+    };
+
+    //!co_await the result of this to continue the coroutine on the task scheduler after some number of seconds, without holding a thread while waiting.
+    inline DelayAwaiter Delay(double seconds)
+    {
+        DelayAwaiter awaiter;
+        awaiter.seconds=seconds;
+        awaiter.wakeTime=0;
+        awaiter.cancelled=false;
+        return awaiter;
+    }
+
+    //!Awaiter returned by ReadFileAsync.  The result of the co_await is false if the file could not be read.
+    struct FileReadAwaiter
+    {
+        Filename file;
+        std::vector<uint8> *data;
+
+        inline bool await_ready() const noexcept
+            { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        inline bool await_resume() const noexcept
+            { return succeeded; }
+
+        //internal use
+        std::coroutine_handle<> coroutine;
+        bool succeeded;
+    };
+
+    //!co_await the result of this to read an entire file and append it to data.  The read is done by a separate pool of io threads, so the task scheduler's threads are not blocked by it, and the coroutine continues on that io thread.
+    inline FileReadAwaiter ReadFileAsync(const Filename &file, std::vector<uint8> &data)
+    {
+        FileReadAwaiter awaiter;
+        awaiter.file=file;
+        awaiter.data=&data;
+        awaiter.succeeded=false;
+        return awaiter;
+    }
+
+    // -- starting tasks from code that is not a coroutine
+
+    //internal use: a coroutine that nothing waits on, which frees itself when it finishes
+    struct Internal_DetachedTask
+    {
+        struct promise_type
+        {
+            inline Internal_DetachedTask get_return_object() noexcept
+                { return Internal_DetachedTask(); }
+            inline std::suspend_never initial_suspend() noexcept
+                { return std::suspend_never(); }
+            inline std::suspend_never final_suspend() noexcept
+                { return std::suspend_never(); }
+            inline void return_void() noexcept
+                {}
+            void unhandled_exception();
+        };
+    };
+
+    template <typename T>
+    inline Internal_DetachedTask Internal_RunDetached(Task<T> task)
+    {
+        co_await ResumeOnThreadPool();
+        co_await task;
+    }
+
+    //!Starts a task running on the task scheduler, and returns without waiting for it.  Its result is discarded, and if it throws an exception that is reported to the error output.
+    template <typename T>
+    inline void StartTask(Task<T> &&task)
+        { Internal_RunDetached(std::move(task)); }
+
+    //internal use: lets SyncWait sleep until its task finishes
+    struct Internal_SyncWaitData
+    {
+        BlockingObject block;
+        volatile bool finished;
+
+        inline Internal_SyncWaitData(): finished(false) {}
+    };
+
+    //internal use: SyncWait and the coroutine that runs its task each hold a reference, so the state lives until both are done with it
+    class Internal_SyncWaitState: public ReferenceCountedData<Internal_SyncWaitData>
+    {
+    public:
+        inline BlockingObject& Block()
+            { return Data().block; }
+        inline volatile bool& Finished()
+            { return Data().finished; }
+    };
+
+    template <typename T>
+    inline Internal_DetachedTask Internal_RunSyncWait(const Task<T> &task, Internal_SyncWaitState state)
+    {
+        co_await ResumeOnThreadPool();
+        co_await task.Internal_WhenDone();
+
+        AtomicStore(&state.Finished(), true, MEMORY_ORDER_RELEASE);
+        state.Block().Clear();
+    }
+
+    //!Runs a task on the task scheduler, and blocks the calling thread until it finishes.  Returns its result, or throws the exception it threw.  This is meant for threads that are not part of the task scheduler (such as the main thread), it must not be called from a job or coroutine.
+    template <typename T>
+    inline T SyncWait(Task<T> &&task)
+    {
+        Internal_SyncWaitState state;
+        state.Block().Set();
+
+        Internal_RunSyncWait(task, state);
+        while (!AtomicLoad(&state.Finished(), MEMORY_ORDER_ACQUIRE))
+            state.Block().WaitUntilClear();
+
+        return task.await_resume();
+    }
+
+} //namespace MPMA
+
+#endif //MPMA_COROUTINES_AVAILABLE
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "../Config.h"
+#include "Types.h"
 #include <string>
 
 namespace MPMA
@@ -20,6 +21,13 @@ namespace MPMA
     inline std::string GetCallStack() { return std::string(); }
 #endif
 
+    //!\brief Fills frames with the return addresses on the current thread's stack, starting with the caller of this function, and returns how many there are.
+    //!This is much cheaper than GetCallStack, since no symbols are looked up.  Use GetCodeAddressName to get names for them later.
+    nuint GetRawCallStack(void **frames, nuint maxFrames);
+
+    //!Returns the name of the function that contains a code address (such as one from GetRawCallStack).  If symbols can't be looked up, the address is returned as hex.
+    std::string GetCodeAddressName(void *address);
+
 
 // --  misc  --
 
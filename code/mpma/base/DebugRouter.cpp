@@ -5,6 +5,7 @@
 #include "DebugRouter.h"
 #include "../Setup.h"
 #include "Memory.h"
+#include "Profiler.h"
 
 #include <iostream> //for RouterOutputStdout
 #include <algorithm>
@@ -109,6 +110,8 @@ namespace MPMA
 #ifdef DEBUGROUTER_ENABLED
     RouterInput::RouterInput()
     {
+        outputLock.SetName("DebugRouter output");
+
         bufferedDataProcessing=false;
         numNonbufferedOutputs=0;
 
@@ -315,6 +318,7 @@ namespace MPMA
     void RouterInput::ThreadProc(Thread& thread, ThreadParam param)
     {
         RouterInput *me=(RouterInput*)param.ptr;
+        MPMAProfileSetThreadName("Debug Router");
 
         uint8 *localData=new2_array(uint8, DEBUGROUTER_BUFFER_SIZE, uint8);
         nuint localDataLen=0;
@@ -342,6 +346,7 @@ namespace MPMA
                 //send to all outputs
                 if (localDataLen>0)
                 {
+                    MPMAProfileScope("DebugRouter Output");
                     TakeMutexLock takelock(me->outputLock);
 
                     for (std::list<RouterOutput*>::iterator i=me->outputs.begin(); i!=me->outputs.end(); ++i)
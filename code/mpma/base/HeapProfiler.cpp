@@ -0,0 +1,503 @@
+//A sampling heap profiler for memory allocated through MPMA.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "HeapProfiler.h"
+#include "Atomic.h"
+#include "Debug.h"
+#include "Info.h"
+#include "Locks.h"
+#include "Timer.h"
+#include <algorithm>
+#include <map>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace MPMA
+{
+    extern void Sleep(nuint time);
+}
+
+#ifdef HEAP_PROFILER
+
+namespace
+{
+    //most frames kept for each sample
+    const nuint HEAP_MAX_FRAMES=32;
+
+    //number of hash buckets the call sites are kept in.  Must be a power of 2.
+    const nuint HEAP_SITE_BUCKETS=4096;
+
+    //a thread that has sampling turned off checks again for it being turned on after this many bytes
+    const nsint HEAP_DISABLED_RECHECK_BYTES=64*1024*1024;
+
+    //everything that has been sampled from one call stack
+    struct HeapSite
+    {
+        HeapSite *next; //in the same bucket
+        nuint hash;
+        nuint depth;
+        void *frames[HEAP_MAX_FRAMES];
+
+        //estimates, scaled up from the samples
+        double liveBytes;
+        double liveObjects;
+        double allocatedBytes;
+        double allocatedObjects;
+
+        //the raw samples, which pprof scales up itself
+        uint64 liveSamples;
+        uint64 liveSampledBytes;
+        uint64 allocatedSamples;
+        uint64 allocatedSampledBytes;
+    };
+
+    //all of this is zero initialized static data, and only malloc is used, so the profiler never calls back in to the memory manager and works during static construction
+    volatile nuint heapSampleRate=HEAP_PROFILER_SAMPLE_BYTES;
+    volatile uint32 heapLock=0;
+    HeapSite *heapSites[HEAP_SITE_BUCKETS];
+    double heapRatesStartTime=0;
+
+    //the time since the process started, in seconds
+    double HeapProfilerTime()
+    {
+        static MPMA::Timer clock;
+        return clock.Step(false);
+    }
+
+    //a spin-lock that never allocates, like the memory manager uses
+    class TakeHeapLock
+    {
+    public:
+        inline TakeHeapLock()
+        {
+            while (MPMA::AtomicExchange(&heapLock, (uint32)1, MPMA::MEMORY_ORDER_ACQUIRE)!=0)
+            {
+                do
+                {
+                    if (MPMA::SystemInfo::SuggestSleepInSpinlock)
+                        MPMA::Sleep(0);
+                    else
+                        MPMA::CpuPause();
+                } while (MPMA::AtomicLoad(&heapLock, MPMA::MEMORY_ORDER_RELAXED)!=0);
+            }
+        }
+
+        inline ~TakeHeapLock()
+        {
+            MPMA::AtomicStore(&heapLock, (uint32)0, MPMA::MEMORY_ORDER_RELEASE);
+        }
+    };
+
+    // -- picking samples
+
+    THREAD_LOCAL uint64 heapRandomState=0;
+
+    //returns a random number in (0,1]
+    double HeapRandom()
+    {
+        uint64 x=heapRandomState;
+        if (x==0) //seed each thread differently
+            x=(((uint64)(nuint)&heapRandomState*0x9e3779b97f4a7c15ull)^(uint64)(HeapProfilerTime()*1.0e9))|1;
+
+        //xorshift64*
+        x^=x>>12;
+        x^=x<<25;
+        x^=x>>27;
+        heapRandomState=x;
+        return ((double)((x*0x2545f4914f6cdd1dull)>>11)+1.0)/9007199254740992.0;
+    }
+
+    //picks how many bytes until the next sample.  Spacing them randomly (exponentially distributed) means every byte has the same chance of being sampled, no matter the pattern of allocation sizes.
+    nsint NextSampleDistance(nuint rate)
+    {
+        if (rate==0)
+            return HEAP_DISABLED_RECHECK_BYTES;
+
+        double distance=-log(HeapRandom())*(double)rate;
+        if (distance<1)
+            return 1;
+        if (distance>(double)HEAP_DISABLED_RECHECK_BYTES)
+            return HEAP_DISABLED_RECHECK_BYTES;
+        return (nsint)distance;
+    }
+
+    // -- call sites
+
+    nuint HashStack(void **frames, nuint depth)
+    {
+        nuint hash=depth;
+        for (nuint i=0; i<depth; ++i)
+        {
+            nuint f=(nuint)frames[i];
+            hash^=f+0x9e3779b9+(hash<<6)+(hash>>2);
+        }
+        return hash;
+    }
+
+    //finds or adds the site for a stack.  The lock must be held.  Returns 0 if there is no memory for a new one.
+    HeapSite* FindSite(void **frames, nuint depth)
+    {
+        nuint hash=HashStack(frames, depth);
+        HeapSite *&bucket=heapSites[hash&(HEAP_SITE_BUCKETS-1)];
+        for (HeapSite *site=bucket; site; site=site->next)
+        {
+            if (site->hash==hash && site->depth==depth && memcmp(site->frames, frames, depth*sizeof(void*))==0)
+                return site;
+        }
+
+        HeapSite *site=(HeapSite*)calloc(1, sizeof(HeapSite));
+        if (!site)
+            return 0;
+
+        site->hash=hash;
+        site->depth=depth;
+        memcpy(site->frames, frames, depth*sizeof(void*));
+        site->next=bucket;
+        bucket=site;
+        return site;
+    }
+
+    //whether a function is part of the allocators rather than what called them
+    bool IsAllocatorFrame(const std::string &name)
+    {
+        static const char *prefixes[]={"MPMAMemoryManager::", "operator new", "MPMA::SmallObject", "MPMA::Internal_", "MPMA::ObjectPool", "MPMA::Arena", "std::", "__gnu_cxx::", "void* std::", 0};
+        for (const char **p=prefixes; *p; ++p)
+        {
+            if (name.compare(0, strlen(*p), *p)==0)
+                return true;
+        }
+        return false;
+    }
+
+    //looks up names, remembering ones already found since the same addresses show up in many stacks
+    class SymbolCache
+    {
+    public:
+        const std::string& Name(void *address)
+        {
+            std::map<void*, std::string>::iterator found=names.find(address);
+            if (found!=names.end())
+                return found->second;
+
+            //return addresses point after the call, so look up the byte before to get the right line (and function, if the call was the last thing in it)
+            return names[address]=MPMA::GetCodeAddressName((uint8*)address-1);
+        }
+
+    private:
+        std::map<void*, std::string> names;
+    };
+
+    bool MoreLiveBytes(const MPMA::HeapProfileSite &a, const MPMA::HeapProfileSite &b)
+    {
+        return a.liveBytes>b.liveBytes;
+    }
+
+    bool MoreBytesPerSecond(const MPMA::HeapProfileSite &a, const MPMA::HeapProfileSite &b)
+    {
+        return a.bytesPerSecond>b.bytesPerSecond;
+    }
+
+    //copies of the sites, taken under the lock so the reports can be built without it
+    void CopySites(std::vector<HeapSite> &outSites, double &outRatesTime)
+    {
+        TakeHeapLock takeLock;
+        for (nuint b=0; b<HEAP_SITE_BUCKETS; ++b)
+        {
+            for (HeapSite *site=heapSites[b]; site; site=site->next)
+            {
+                if (site->liveSamples>0 || site->allocatedSamples>0)
+                    outSites.push_back(*site);
+            }
+        }
+        outRatesTime=HeapProfilerTime()-heapRatesStartTime;
+    }
+}
+
+namespace MPMA
+{
+    //a sampled allocation
+    struct Internal_HeapSample
+    {
+        HeapSite *site;
+        nuint size;
+        double weight; //how many allocations this sample stands for
+    };
+
+    THREAD_LOCAL nsint internalHeapBytesUntilSample=0;
+
+    //records a sample of an allocation of size bytes, and picks when the next sample on this thread is
+    Internal_HeapSample* Internal_HeapProfileTakeSample(nuint size)
+    {
+        //the first time this is called on a thread, it's just to pick the first sample
+        nuint rate=AtomicLoad(&heapSampleRate, MEMORY_ORDER_RELAXED);
+        bool firstCall=(heapRandomState==0);
+        internalHeapBytesUntilSample=NextSampleDistance(rate);
+        if (firstCall || rate==0)
+            return 0;
+
+        //(the first frame is this function, which is left out)
+        void *stack[HEAP_MAX_FRAMES+1];
+        nuint depth=GetRawCallStack(stack, HEAP_MAX_FRAMES+1);
+        void **frames=stack+1;
+        depth=(depth>0) ? depth-1 : 0;
+
+        Internal_HeapSample *sample=(Internal_HeapSample*)malloc(sizeof(Internal_HeapSample));
+        if (!sample)
+            return 0;
+
+        //an allocation of size bytes had a 1-e^(-size/rate) chance of being sampled, so it stands for the inverse of that many allocations
+        double chance=1.0-exp(-(double)size/(double)rate);
+        sample->size=size;
+        sample->weight=(chance>0) ? 1.0/chance : 1.0;
+
+        TakeHeapLock takeLock;
+        sample->site=FindSite(frames, depth);
+        if (!sample->site)
+        {
+            free(sample);
+            return 0;
+        }
+
+        HeapSite &site=*sample->site;
+        site.liveBytes+=size*sample->weight;
+        site.liveObjects+=sample->weight;
+        site.allocatedBytes+=size*sample->weight;
+        site.allocatedObjects+=sample->weight;
+        ++site.liveSamples;
+        site.liveSampledBytes+=size;
+        ++site.allocatedSamples;
+        site.allocatedSampledBytes+=size;
+        return sample;
+    }
+
+    //called by the allocators when sampled memory is freed
+    void Internal_HeapProfileFree(Internal_HeapSample *sample)
+    {
+        {
+            TakeHeapLock takeLock;
+            HeapSite &site=*sample->site;
+            site.liveBytes-=sample->size*sample->weight;
+            site.liveObjects-=sample->weight;
+            --site.liveSamples;
+            site.liveSampledBytes-=sample->size;
+        }
+
+        free(sample);
+    }
+
+    //Sets the average number of bytes allocated between samples.
+    void SetHeapProfilerSampleRate(nuint bytes)
+    {
+        AtomicStore(&heapSampleRate, bytes, MEMORY_ORDER_RELAXED);
+        internalHeapBytesUntilSample=0; //other threads pick it up at their next sample
+    }
+
+    //Returns the average number of bytes allocated between samples.
+    nuint GetHeapProfilerSampleRate()
+    {
+        return AtomicLoad(&heapSampleRate, MEMORY_ORDER_RELAXED);
+    }
+
+    //Fills outSites with every call site that has been sampled, sorted by live bytes.
+    void GetHeapProfile(std::vector<HeapProfileSite> &outSites, bool lookupSymbols)
+    {
+        outSites.clear();
+
+        std::vector<HeapSite> sites;
+        double ratesTime;
+        CopySites(sites, ratesTime);
+
+        SymbolCache symbols;
+        for (std::vector<HeapSite>::iterator s=sites.begin(); s!=sites.end(); ++s)
+        {
+            HeapProfileSite site;
+            site.stack.assign(s->frames, s->frames+s->depth);
+            site.liveBytes=(uint64)(s->liveBytes+0.5);
+            site.liveObjects=(uint64)(s->liveObjects+0.5);
+            site.allocatedBytes=(uint64)(s->allocatedBytes+0.5);
+            site.allocatedObjects=(uint64)(s->allocatedObjects+0.5);
+            site.bytesPerSecond=(ratesTime>0) ? s->allocatedBytes/ratesTime : 0;
+
+            if (lookupSymbols)
+            {
+                for (nuint f=0; f<s->depth; ++f)
+                {
+                    const std::string &name=symbols.Name(s->frames[f]);
+                    if (site.name.empty())
+                        site.name=name;
+                    if (!IsAllocatorFrame(name))
+                    {
+                        site.name=name;
+                        break;
+                    }
+                }
+            }
+
+            outSites.push_back(site);
+        }
+
+        std::stable_sort(outSites.begin(), outSites.end(), MoreLiveBytes);
+    }
+
+    //Starts a new period for the allocated counts and rates.
+    void ResetHeapProfileRates()
+    {
+        TakeHeapLock takeLock;
+        for (nuint b=0; b<HEAP_SITE_BUCKETS; ++b)
+        {
+            for (HeapSite *site=heapSites[b]; site; site=site->next)
+            {
+                site->allocatedBytes=0;
+                site->allocatedObjects=0;
+                site->allocatedSamples=0;
+                site->allocatedSampledBytes=0;
+            }
+        }
+        heapRatesStartTime=HeapProfilerTime();
+    }
+
+    //Returns a human readable report of the call sites with the most live memory, and the ones allocating the fastest.
+    std::string GetHeapProfileReport(nuint maxSites)
+    {
+        std::vector<HeapProfileSite> sites;
+        GetHeapProfile(sites);
+
+        std::string report=" -- Heap Profile --\n\n";
+        if (sites.empty())
+            report+="No allocations have been sampled.\n";
+
+        uint64 totalLive=0;
+        double totalRate=0;
+        for (std::vector<HeapProfileSite>::iterator s=sites.begin(); s!=sites.end(); ++s)
+        {
+            totalLive+=s->liveBytes;
+            totalRate+=s->bytesPerSecond;
+        }
+
+        char buf[256];
+        sprintf(buf, "Sampling every %llu bytes.  Estimated %llu live bytes, allocating %.0f bytes/second.\n\n", (unsigned long long)GetHeapProfilerSampleRate(), (unsigned long long)totalLive, totalRate);
+        report+=buf;
+
+        report+="Most live memory:\n";
+        for (nuint i=0; i<sites.size() && i<maxSites && sites[i].liveBytes>0; ++i)
+        {
+            sprintf(buf, " %12llu bytes in %8llu objects  ", (unsigned long long)sites[i].liveBytes, (unsigned long long)sites[i].liveObjects);
+            report+=buf;
+            report+=sites[i].name;
+            report+="\n";
+        }
+
+        std::stable_sort(sites.begin(), sites.end(), MoreBytesPerSecond);
+        report+="\nFastest allocating:\n";
+        for (nuint i=0; i<sites.size() && i<maxSites && sites[i].bytesPerSecond>0; ++i)
+        {
+            sprintf(buf, " %12.0f bytes/second  %8llu objects total  ", sites[i].bytesPerSecond, (unsigned long long)sites[i].allocatedObjects);
+            report+=buf;
+            report+=sites[i].name;
+            report+="\n";
+        }
+
+        return report;
+    }
+
+    //Writes the samples in the legacy heap profile format that pprof reads.
+    bool WriteHeapProfilePprof(const std::string &filename)
+    {
+        std::vector<HeapSite> sites;
+        double ratesTime;
+        CopySites(sites, ratesTime);
+
+        FILE *file=fopen(filename.c_str(), "w");
+        if (!file)
+            return false;
+
+        uint64 liveSamples=0, liveBytes=0, allocSamples=0, allocBytes=0;
+        for (std::vector<HeapSite>::iterator s=sites.begin(); s!=sites.end(); ++s)
+        {
+            liveSamples+=s->liveSamples;
+            liveBytes+=s->liveSampledBytes;
+            allocSamples+=s->allocatedSamples;
+            allocBytes+=s->allocatedSampledBytes;
+        }
+
+        fprintf(file, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%llu\n", (unsigned long long)liveSamples, (unsigned long long)liveBytes, (unsigned long long)allocSamples, (unsigned long long)allocBytes, (unsigned long long)GetHeapProfilerSampleRate());
+        for (std::vector<HeapSite>::iterator s=sites.begin(); s!=sites.end(); ++s)
+        {
+            fprintf(file, "%llu: %llu [%llu: %llu] @", (unsigned long long)s->liveSamples, (unsigned long long)s->liveSampledBytes, (unsigned long long)s->allocatedSamples, (unsigned long long)s->allocatedSampledBytes);
+            for (nuint f=0; f<s->depth; ++f)
+                fprintf(file, " %p", s->frames[f]);
+            fprintf(file, "\n");
+        }
+
+#if !defined(_WIN32) && !defined(_WIN64)
+        //pprof needs to know where each library was loaded to find the symbols for an address
+        FILE *maps=fopen("/proc/self/maps", "r");
+        if (maps)
+        {
+            fprintf(file, "\nMAPPED_LIBRARIES:\n");
+            char line[1024];
+            while (fgets(line, sizeof(line), maps))
+                fputs(line, file);
+            fclose(maps);
+        }
+#endif
+
+        bool ok=(ferror(file)==0);
+        fclose(file);
+        return ok;
+    }
+
+    //Writes one line per call site, with the frames outermost first, followed by its live or allocated bytes.
+    bool WriteHeapProfileCollapsed(const std::string &filename, bool liveBytes)
+    {
+        std::vector<HeapSite> sites;
+        double ratesTime;
+        CopySites(sites, ratesTime);
+
+        FILE *file=fopen(filename.c_str(), "w");
+        if (!file)
+            return false;
+
+        SymbolCache symbols;
+        for (std::vector<HeapSite>::iterator s=sites.begin(); s!=sites.end(); ++s)
+        {
+            double bytes=liveBytes ? s->liveBytes : s->allocatedBytes;
+            if (bytes<0.5)
+                continue;
+
+            std::string line;
+            for (nuint f=s->depth; f>0; --f)
+            {
+                std::string name=symbols.Name(s->frames[f-1]);
+                std::replace(name.begin(), name.end(), ';', ':'); //; separates frames
+                std::replace(name.begin(), name.end(), ' ', '_'); //the last space separates the value
+                line+=name;
+                if (f>1)
+                    line+=";";
+            }
+
+            fprintf(file, "%s %llu\n", line.c_str(), (unsigned long long)(bytes+0.5));
+        }
+
+        bool ok=(ferror(file)==0);
+        fclose(file);
+        return ok;
+    }
+}
+
+#else //HEAP_PROFILER
+
+namespace MPMA
+{
+    void SetHeapProfilerSampleRate(nuint bytes) {}
+    nuint GetHeapProfilerSampleRate() { return 0; }
+    void GetHeapProfile(std::vector<HeapProfileSite> &outSites, bool lookupSymbols) { outSites.clear(); }
+    void ResetHeapProfileRates() {}
+    std::string GetHeapProfileReport(nuint maxSites) { return " -- Heap Profile --\n\nHEAP_PROFILER is not defined in Config.h.\n"; }
+    bool WriteHeapProfilePprof(const std::string &filename) { return false; }
+    bool WriteHeapProfileCollapsed(const std::string &filename, bool liveBytes) { return false; }
+}
+
+#endif //HEAP_PROFILER
@@ -0,0 +1,85 @@
+//!\file HeapProfiler.h A sampling heap profiler for memory allocated through MPMA (new3/new2, and the small object allocator).
+//!About one allocation in every HEAP_PROFILER_SAMPLE_BYTES bytes is recorded with its raw call stack, and the samples are scaled up to estimate what all allocations from each call site add up to.  Symbols are only looked up when a report is made.
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include "Types.h"
+#include "../Config.h"
+#include <string>
+#include <vector>
+
+/*
+An example of finding where memory is going while the application is running:
+  std::vector<MPMA::HeapProfileSite> sites;
+  MPMA::GetHeapProfile(sites);
+  for (auto &site: sites)
+      printf("%llu bytes live from %s\n", (unsigned long long)site.liveBytes, site.name.c_str());
+
+Or write files for other tools:
+  MPMA::WriteHeapProfilePprof("heap.prof"); //pprof --text ./app heap.prof
+  MPMA::WriteHeapProfileCollapsed("heap.folded"); //flamegraph.pl heap.folded > heap.svg
+*/
+
+namespace MPMA
+{
+    //!Estimated allocations from one call stack.
+    struct HeapProfileSite
+    {
+        std::vector<void*> stack; //!<Return addresses, innermost first.
+        std::string name; //!<The innermost function in the stack that is not part of MPMA's allocators (filled in if symbols were requested).
+
+        uint64 liveBytes; //!<Estimated bytes allocated here that have not been freed yet.
+        uint64 liveObjects; //!<Estimated number of allocations here that have not been freed yet.
+        uint64 allocatedBytes; //!<Estimated bytes allocated here since the rates were last reset.
+        uint64 allocatedObjects; //!<Estimated number of allocations here since the rates were last reset.
+        double bytesPerSecond; //!<allocatedBytes divided by the time since the rates were last reset.
+    };
+
+    //!Sets the average number of bytes allocated between samples.  0 stops sampling.  Samples that were already taken are kept.
+    void SetHeapProfilerSampleRate(nuint bytes);
+
+    //!Returns the average number of bytes allocated between samples.
+    nuint GetHeapProfilerSampleRate();
+
+    //!Fills outSites with every call site that has been sampled, sorted by live bytes (most first).  If lookupSymbols is set, the name of each site is filled in.
+    void GetHeapProfile(std::vector<HeapProfileSite> &outSites, bool lookupSymbols=true);
+
+    //!Starts a new period for the allocated counts and rates.  Live counts are not affected.
+    void ResetHeapProfileRates();
+
+    //!Returns a human readable report of the call sites with the most live memory, and the ones allocating the fastest.
+    std::string GetHeapProfileReport(nuint maxSites=20);
+
+    //!Writes the samples in the legacy heap profile format that pprof reads (with the raw addresses, which pprof symbolizes from the executable).  Returns false if the file couldn't be written.
+    bool WriteHeapProfilePprof(const std::string &filename);
+
+    //!Writes one line per call site, with the frames outermost first separated by semicolons, followed by its live bytes (or allocated bytes, if liveBytes is false).  This is the input format of flamegraph.pl and speedscope.  Returns false if the file couldn't be written.
+    bool WriteHeapProfileCollapsed(const std::string &filename, bool liveBytes=true);
+
+    // -- internal use below
+
+    //a sampled allocation (declared even without HEAP_PROFILER, since the allocators pass it around either way)
+    struct Internal_HeapSample;
+
+#ifdef HEAP_PROFILER
+
+    //bytes this thread can allocate before the next sample is taken
+    extern THREAD_LOCAL nsint internalHeapBytesUntilSample;
+
+    //records a sample of an allocation of size bytes, and picks when the next sample on this thread is.  Returns 0 if nothing was sampled.
+    Internal_HeapSample* Internal_HeapProfileTakeSample(nuint size);
+
+    //called by the allocators for every allocation.  Returns the sample to pass to Internal_HeapProfileFree when the memory is freed, or 0 if it wasn't sampled.
+    inline Internal_HeapSample* Internal_HeapProfileAlloc(nuint size)
+    {
+        internalHeapBytesUntilSample-=(nsint)size;
+        if (internalHeapBytesUntilSample>0)
+            return 0;
+        return Internal_HeapProfileTakeSample(size);
+    }
+
+    //called by the allocators when sampled memory is freed
+    void Internal_HeapProfileFree(Internal_HeapSample *sample);
+#endif
+}
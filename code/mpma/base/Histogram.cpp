@@ -0,0 +1,136 @@
+//A fixed-size histogram of integer values, for finding percentiles of latencies.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "Histogram.h"
+#include <string.h>
+
+namespace MPMA
+{
+    //adds the same value a number of times
+    void Histogram::Add(uint64 value, uint64 times)
+    {
+        if (times==0)
+            return;
+
+        counts[BucketIndex(value)]+=times;
+        if (count==0 || value<minValue)
+            minValue=value;
+        if (value>maxValue)
+            maxValue=value;
+        count+=times;
+        sum+=value*times;
+    }
+
+    //adds all values of another histogram to this one
+    void Histogram::Merge(const Histogram &other)
+    {
+        if (other.count==0)
+            return;
+
+        for (nuint i=0; i<BUCKET_COUNT; ++i)
+            counts[i]+=other.counts[i];
+
+        if (count==0 || other.minValue<minValue)
+            minValue=other.minValue;
+        if (other.maxValue>maxValue)
+            maxValue=other.maxValue;
+        count+=other.count;
+        sum+=other.sum;
+    }
+
+    //removes the values of an earlier copy of this histogram
+    void Histogram::Subtract(const Histogram &earlier)
+    {
+        nuint first=BUCKET_COUNT, last=0;
+        for (nuint i=0; i<BUCKET_COUNT; ++i)
+        {
+            counts[i]-=(earlier.counts[i]<counts[i]) ? earlier.counts[i] : counts[i];
+            if (counts[i])
+            {
+                if (first==BUCKET_COUNT)
+                    first=i;
+                last=i;
+            }
+        }
+
+        count-=(earlier.count<count) ? earlier.count : count;
+        sum-=(earlier.sum<sum) ? earlier.sum : sum;
+        if (count==0)
+        {
+            minValue=0;
+            maxValue=0;
+            return;
+        }
+
+        if (BucketLowest(first)>minValue)
+            minValue=BucketLowest(first);
+        if (BucketHighest(last)<maxValue)
+            maxValue=BucketHighest(last);
+    }
+
+    //removes all values
+    void Histogram::Clear()
+    {
+        memset(counts, 0, sizeof(counts));
+        count=0;
+        sum=0;
+        minValue=0;
+        maxValue=0;
+    }
+
+    //returns the value that a percentile of the values are at or below
+    uint64 Histogram::GetPercentile(double percentile) const
+    {
+        if (count==0)
+            return 0;
+
+        if (percentile<=0)
+            return minValue;
+        if (percentile>=100)
+            return maxValue;
+
+        //the rank of the value we want, counting from 1
+        uint64 rank=(uint64)(percentile/100.0*(double)count+0.5);
+        if (rank<1)
+            rank=1;
+
+        uint64 seen=0;
+        for (nuint i=0; i<BUCKET_COUNT; ++i)
+        {
+            seen+=counts[i];
+            if (seen>=rank)
+            {
+                //the middle of the bucket, but never outside of what was actually added
+                uint64 lowest=BucketLowest(i);
+                uint64 value=lowest+(BucketHighest(i)-lowest)/2;
+                if (value<minValue)
+                    value=minValue;
+                if (value>maxValue)
+                    value=maxValue;
+                return value;
+            }
+        }
+
+        return maxValue;
+    }
+
+    //returns the smallest value that is put in a bucket
+    uint64 Histogram::BucketLowest(nuint index)
+    {
+        if (index<SUB_BUCKETS)
+            return index;
+
+        nuint highBit=index/SUB_BUCKETS+SUB_BUCKET_BITS-1;
+        return (uint64)(SUB_BUCKETS+index%SUB_BUCKETS)<<(highBit-SUB_BUCKET_BITS);
+    }
+
+    //returns the largest value that is put in a bucket
+    uint64 Histogram::BucketHighest(nuint index)
+    {
+        if (index<SUB_BUCKETS)
+            return index;
+
+        nuint highBit=index/SUB_BUCKETS+SUB_BUCKET_BITS-1;
+        return BucketLowest(index)+(((uint64)1<<(highBit-SUB_BUCKET_BITS))-1);
+    }
+}
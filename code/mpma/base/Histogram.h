@@ -0,0 +1,121 @@
+//!\file Histogram.h A fixed-size histogram of integer values, for finding percentiles of latencies.
+//!Values are put in log-linear buckets: each power of two is split into 16 buckets, so a percentile is within about 3% of the real value no matter how big values get, and a histogram always takes the same memory (about 8KB).  Values under 16 are kept exactly.
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include "Types.h"
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+/*
+An example of finding the 99th percentile of a network round trip time:
+  MPMA::Histogram rtt;
+  //...for each packet
+  rtt.Add(microseconds);
+  //...later
+  uint64 p99=rtt.GetPercentile(99.0);
+
+A histogram is not thread-safe.  To gather values on several threads, give each thread its own and Merge them together.
+*/
+
+namespace MPMA
+{
+    //!A histogram of uint64 values (in whatever unit the caller likes), with a constant size.
+    class Histogram
+    {
+    public:
+        //!The number of buckets values are put in.
+        static const nuint BUCKET_COUNT=976;
+
+        //!ctor
+        inline Histogram() { Clear(); }
+
+        //!Adds a value.
+        inline void Add(uint64 value)
+        {
+            ++counts[BucketIndex(value)];
+            if (count==0 || value<minValue)
+                minValue=value;
+            if (value>maxValue)
+                maxValue=value;
+            ++count;
+            sum+=value;
+        }
+
+        //!Adds the same value a number of times.
+        void Add(uint64 value, uint64 times);
+
+        //!Adds all values of another histogram to this one.
+        void Merge(const Histogram &other);
+
+        //!Removes the values of an earlier copy of this histogram, leaving only the values that were added since.  The min and max then come from the buckets that are left, so they are only as close as a bucket.
+        void Subtract(const Histogram &earlier);
+
+        //!Removes all values.
+        void Clear();
+
+        //!Returns the number of values that were added.
+        inline uint64 GetCount() const { return count; }
+
+        //!Returns the smallest value added, or 0 if there are none.
+        inline uint64 GetMin() const { return count ? minValue : 0; }
+
+        //!Returns the largest value added, or 0 if there are none.
+        inline uint64 GetMax() const { return maxValue; }
+
+        //!Returns the average of the values added, or 0 if there are none.
+        inline double GetMean() const { return count ? (double)sum/(double)count : 0.0; }
+
+        //!Returns the value that percentile percent (0 to 100) of the values added are at or below, or 0 if there are none.
+        uint64 GetPercentile(double percentile) const;
+
+        //!Returns how many values were put in a bucket.
+        inline uint64 GetBucketCount(nuint index) const { return counts[index]; }
+
+        //!Returns which bucket a value is put in.
+        static inline nuint BucketIndex(uint64 value)
+        {
+            if (value<SUB_BUCKETS)
+                return (nuint)value;
+
+            nuint highBit=HighestBit(value);
+            return (highBit-SUB_BUCKET_BITS+1)*SUB_BUCKETS + (nuint)((value>>(highBit-SUB_BUCKET_BITS))&(SUB_BUCKETS-1));
+        }
+
+        //!Returns the smallest value that is put in a bucket.
+        static uint64 BucketLowest(nuint index);
+
+        //!Returns the largest value that is put in a bucket.
+        static uint64 BucketHighest(nuint index);
+
+    private:
+        static const nuint SUB_BUCKET_BITS=4;
+        static const nuint SUB_BUCKETS=1<<SUB_BUCKET_BITS;
+
+        uint64 counts[BUCKET_COUNT];
+        uint64 count;
+        uint64 sum;
+        uint64 minValue;
+        uint64 maxValue;
+
+        //returns the index of the highest bit set in a non-zero value
+        static inline nuint HighestBit(uint64 value)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return 63-(nuint)__builtin_clzll(value);
+#elif defined(_MSC_VER) && defined(_WIN64)
+            unsigned long index;
+            _BitScanReverse64(&index, value);
+            return index;
+#else
+            nuint index=0;
+            while (value>>=1)
+                ++index;
+            return index;
+#endif
+        }
+    };
+}
@@ -12,6 +12,15 @@ namespace MPMA
     nuint SystemInfo::ProcessorBogomips=3456;
     std::string SystemInfo::ProcessorName="NotPopulated";
     bool SystemInfo::ProcessorHyperthreading=false;
+    nuint SystemInfo::ProcessorSocketCount=0;
+    nuint SystemInfo::ProcessorCoreCount=0;
+    nuint SystemInfo::ProcessorLogicalCount=0;
+    nuint SystemInfo::NumaNodeCount=1;
+    std::vector<ProcessorLocation> SystemInfo::ProcessorLocations;
+    nuint SystemInfo::CacheL1DataSize=32;
+    nuint SystemInfo::CacheL2Size=256;
+    nuint SystemInfo::CacheL3Size=0;
+    nuint SystemInfo::CacheLineSize=64;
     nuint SystemInfo::MemoryPhysicalTotal=789;
     nuint SystemInfo::MemorySwapTotal=345;
     std::string SystemInfo::OperatingSystemName="NotPopulated";
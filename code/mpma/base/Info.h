@@ -4,10 +4,21 @@
 
 #pragma once
 #include <string>
+#include <vector>
 #include "Types.h"
 
 namespace MPMA
 {
+    //!Where one logical cpu sits in the machine.
+    struct ProcessorLocation
+    {
+        nuint logicalId; //!<The operating system's number for the cpu, as used for thread affinity.
+        nuint socket; //!<Physical package the cpu is in (0-based).
+        nuint core; //!<Physical core the cpu is part of, unique over all sockets (0-based).
+        nuint smtIndex; //!<Which hardware thread of its core this is (0 for the first).
+        nuint numaNode; //!<NUMA node whose memory is local to the cpu (0-based).
+    };
+
     //!\brief Information about the system.  These are readable anytime after init.
     //!Values which are not possible to obtain will be populated with sane defaults.
     struct SystemInfo
@@ -19,6 +30,19 @@ namespace MPMA
 
         //per-cpu facts
         static nuint ProcessorBogomips; //!<Very rough speed approximation of one CPU.
+
+        //topology (the counts are 0 if it could not be determined)
+        static nuint ProcessorSocketCount; //!<Number of physical cpu packages.
+        static nuint ProcessorCoreCount; //!<Number of physical cores over all sockets.
+        static nuint ProcessorLogicalCount; //!<Number of logical cpus (hardware threads) over all cores.
+        static nuint NumaNodeCount; //!<Number of NUMA memory nodes (1 on machines that aren't NUMA).
+        static std::vector<ProcessorLocation> ProcessorLocations; //!<Location of every logical cpu, ordered by core and then by smtIndex.  Empty if it could not be determined.
+
+        //cache info (sizes in KB, as seen by the first cpu)
+        static nuint CacheL1DataSize; //!<Size of the level 1 data cache of one core.
+        static nuint CacheL2Size; //!<Size of the level 2 cache.
+        static nuint CacheL3Size; //!<Size of the level 3 cache, 0 if there is none.
+        static nuint CacheLineSize; //!<Size of a cache line in bytes.
         
         //mem info (in MB)
         static nuint MemoryPhysicalTotal; //!<The amount of physical memory the machine has.
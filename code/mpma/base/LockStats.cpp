@@ -0,0 +1,259 @@
+//Contention and wait-time statistics for MutexLock, SpinLock and RWSleepLock.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "LockStats.h"
+#include "Locks.h"
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef LOCK_CONTENTION_STATS
+
+namespace
+{
+    //number of different lock names and call sites that can be told apart.  Anything past this is counted together in one entry.  Must be a power of 2.
+    const nuint LOCKSTATS_TABLE_SIZE=1024;
+
+    //this is plain static data rather than something set up at init, so locks may be taken (and named) before or after the framework is initialized
+    MPMA::Internal_LockStatsEntry statsTable[LOCKSTATS_TABLE_SIZE];
+    MPMA::Internal_LockStatsEntry overflowEntry={2, 0, 0, "(other locks)", 0, 0, 0, 0, 0, 0};
+
+    nuint HashName(const char *name)
+    {
+        nuint hash=2166136261u;
+        for (; *name; ++name)
+            hash=(hash^(uint8)*name)*16777619u;
+        return hash;
+    }
+
+    nuint HashCallSite(const char *file, int line)
+    {
+        nuint hash=(nuint)file;
+        hash^=hash>>9;
+        return hash*31+(nuint)line*2654435761u;
+    }
+
+    bool EntryMatches(const MPMA::Internal_LockStatsEntry &entry, const char *file, int line, const char *name)
+    {
+        if (file)
+            return entry.file==file && entry.line==line;
+        else
+            return entry.file==0 && strncmp(entry.name, name, sizeof(entry.name)-1)==0;
+    }
+
+    //finds the entry for a call site (if file is not 0) or a name, claiming an empty slot for it if it's new
+    MPMA::Internal_LockStatsEntry* FindEntry(const char *file, int line, const char *name, nuint hash)
+    {
+        for (nuint probe=0; probe<LOCKSTATS_TABLE_SIZE; ++probe)
+        {
+            MPMA::Internal_LockStatsEntry &entry=statsTable[(hash+probe)&(LOCKSTATS_TABLE_SIZE-1)];
+            nuint state=MPMA::AtomicLoad(&entry.state, MPMA::MEMORY_ORDER_ACQUIRE);
+            if (state==0)
+            {
+                nuint expected=0;
+                if (MPMA::AtomicCompareAndSwap(&entry.state, expected, (nuint)1, MPMA::MEMORY_ORDER_ACQ_REL))
+                {
+                    entry.file=file;
+                    entry.line=line;
+                    if (name)
+                        strncpy(entry.name, name, sizeof(entry.name)-1);
+                    MPMA::AtomicStore(&entry.state, (nuint)2, MPMA::MEMORY_ORDER_RELEASE);
+                    return &entry;
+                }
+                state=expected;
+            }
+
+            //someone else is filling it in, wait to see what it is
+            while (state==1)
+            {
+                MPMA::CpuPause();
+                state=MPMA::AtomicLoad(&entry.state, MPMA::MEMORY_ORDER_ACQUIRE);
+            }
+
+            if (EntryMatches(entry, file, line, name))
+                return &entry;
+        }
+
+        return &overflowEntry;
+    }
+
+    //raises a max to value if it's bigger
+    void RaiseMax(volatile uint64 *max, uint64 value)
+    {
+        uint64 current=MPMA::AtomicLoad(max, MPMA::MEMORY_ORDER_RELAXED);
+        while (value>current && !MPMA::AtomicCompareAndSwap(max, current, value, MPMA::MEMORY_ORDER_RELAXED))
+            {}
+    }
+
+    //what an entry is reported as
+    std::string EntryDisplayName(const MPMA::Internal_LockStatsEntry &entry)
+    {
+        if (!entry.file)
+            return entry.name;
+
+        const char *baseName=entry.file;
+        for (const char *c=entry.file; *c; ++c)
+        {
+            if (*c=='/' || *c=='\\')
+                baseName=c+1;
+        }
+
+        char lineText[16];
+        sprintf(lineText, ":%d", entry.line);
+        return std::string(baseName)+lineText;
+    }
+
+    void AddEntryStats(MPMA::LockStats &stats, const MPMA::Internal_LockStatsEntry &entry)
+    {
+        const double NS=1.0e-9;
+        stats.acquisitions+=MPMA::AtomicLoad(&entry.acquisitions, MPMA::MEMORY_ORDER_RELAXED);
+        stats.contendedAcquisitions+=MPMA::AtomicLoad(&entry.contendedAcquisitions, MPMA::MEMORY_ORDER_RELAXED);
+        stats.totalWaitTime+=MPMA::AtomicLoad(&entry.totalWait, MPMA::MEMORY_ORDER_RELAXED)*NS;
+        stats.maxWaitTime=std::max(stats.maxWaitTime, MPMA::AtomicLoad(&entry.maxWait, MPMA::MEMORY_ORDER_RELAXED)*NS);
+        stats.totalHoldTime+=MPMA::AtomicLoad(&entry.totalHold, MPMA::MEMORY_ORDER_RELAXED)*NS;
+        stats.maxHoldTime=std::max(stats.maxHoldTime, MPMA::AtomicLoad(&entry.maxHold, MPMA::MEMORY_ORDER_RELAXED)*NS);
+    }
+
+    void ResetEntry(MPMA::Internal_LockStatsEntry &entry)
+    {
+        MPMA::AtomicStore(&entry.acquisitions, (uint64)0, MPMA::MEMORY_ORDER_RELAXED);
+        MPMA::AtomicStore(&entry.contendedAcquisitions, (uint64)0, MPMA::MEMORY_ORDER_RELAXED);
+        MPMA::AtomicStore(&entry.totalWait, (uint64)0, MPMA::MEMORY_ORDER_RELAXED);
+        MPMA::AtomicStore(&entry.maxWait, (uint64)0, MPMA::MEMORY_ORDER_RELAXED);
+        MPMA::AtomicStore(&entry.totalHold, (uint64)0, MPMA::MEMORY_ORDER_RELAXED);
+        MPMA::AtomicStore(&entry.maxHold, (uint64)0, MPMA::MEMORY_ORDER_RELAXED);
+    }
+
+    bool MoreWaitTime(const MPMA::LockStats &a, const MPMA::LockStats &b)
+    {
+        return a.totalWaitTime>b.totalWaitTime;
+    }
+}
+
+namespace MPMA
+{
+    //finds (or creates) the entry for a name or a call site
+    Internal_LockStatsEntry* Internal_GetLockStatsEntry(const char *name)
+    {
+        if (!name)
+            name="(unnamed)";
+        return FindEntry(0, 0, name, HashName(name));
+    }
+
+    Internal_LockStatsEntry* Internal_GetLockStatsEntry(const Internal_LockCallSite &site)
+    {
+        if (!site.file) //the compiler can't tell us where
+            return Internal_GetLockStatsEntry("(unknown call site)");
+        return FindEntry(site.file, site.line, 0, HashCallSite(site.file, site.line));
+    }
+
+    //adds one acquisition (and its wait, if it was contended) to an entry
+    void Internal_RecordLockTaken(Internal_LockStatsEntry *entry, bool contended, uint64 waitTime)
+    {
+        AtomicFetchAdd(&entry->acquisitions, (uint64)1, MEMORY_ORDER_RELAXED);
+        if (contended)
+        {
+            AtomicFetchAdd(&entry->contendedAcquisitions, (uint64)1, MEMORY_ORDER_RELAXED);
+            AtomicFetchAdd(&entry->totalWait, waitTime, MEMORY_ORDER_RELAXED);
+            RaiseMax(&entry->maxWait, waitTime);
+        }
+    }
+
+    //adds how long the lock was held to an entry
+    void Internal_RecordLockHeld(Internal_LockStatsEntry *entry, uint64 holdTime)
+    {
+        AtomicFetchAdd(&entry->totalHold, holdTime, MEMORY_ORDER_RELAXED);
+        RaiseMax(&entry->maxHold, holdTime);
+    }
+}
+
+#endif //LOCK_CONTENTION_STATS
+
+namespace MPMA
+{
+    //Fills outStats with the statistics for every lock that has been taken, sorted by total wait time (worst first).
+    void GetLockStats(std::vector<LockStats> &outStats)
+    {
+        outStats.clear();
+
+#ifdef LOCK_CONTENTION_STATS
+        //the same call site can show up more than once (a header included in several places), so merge everything with the same name
+        std::map<std::string, LockStats> merged;
+        for (nuint i=0; i<=LOCKSTATS_TABLE_SIZE; ++i)
+        {
+            const Internal_LockStatsEntry &entry=(i<LOCKSTATS_TABLE_SIZE) ? statsTable[i] : overflowEntry;
+            if (AtomicLoad(&entry.state, MEMORY_ORDER_ACQUIRE)!=2 || AtomicLoad(&entry.acquisitions, MEMORY_ORDER_RELAXED)==0)
+                continue;
+
+            std::string name=EntryDisplayName(entry);
+            std::map<std::string, LockStats>::iterator found=merged.find(name);
+            if (found==merged.end())
+            {
+                LockStats stats;
+                stats.name=name;
+                stats.acquisitions=0;
+                stats.contendedAcquisitions=0;
+                stats.totalWaitTime=0;
+                stats.maxWaitTime=0;
+                stats.totalHoldTime=0;
+                stats.maxHoldTime=0;
+                found=merged.insert(std::make_pair(name, stats)).first;
+            }
+            AddEntryStats(found->second, entry);
+        }
+
+        for (std::map<std::string, LockStats>::iterator s=merged.begin(); s!=merged.end(); ++s)
+            outStats.push_back(s->second);
+        std::stable_sort(outStats.begin(), outStats.end(), MoreWaitTime);
+#endif
+    }
+
+    //Sets all lock statistics back to zero.
+    void ResetLockStats()
+    {
+#ifdef LOCK_CONTENTION_STATS
+        for (nuint i=0; i<LOCKSTATS_TABLE_SIZE; ++i)
+        {
+            if (AtomicLoad(&statsTable[i].state, MEMORY_ORDER_ACQUIRE)==2)
+                ResetEntry(statsTable[i]);
+        }
+        ResetEntry(overflowEntry);
+#endif
+    }
+
+    //Returns a human readable report of the lock statistics.
+    std::string GetLockStatsReport()
+    {
+        std::string report;
+#ifdef LOCK_CONTENTION_STATS
+        report+=" -- Lock Contention --\n\n";
+
+        std::vector<LockStats> stats;
+        GetLockStats(stats);
+        if (stats.empty())
+            report+="No locks were taken.\n";
+
+        char buf[256];
+        for (std::vector<LockStats>::iterator s=stats.begin(); s!=stats.end(); ++s)
+        {
+            report+=s->name;
+            report+="\n";
+
+            sprintf(buf, " Acquisitions: %llu\n", (unsigned long long)s->acquisitions);
+            report+=buf;
+            sprintf(buf, " Contended: %llu (%d%%)\n", (unsigned long long)s->contendedAcquisitions, (int)(s->contendedAcquisitions*100/s->acquisitions));
+            report+=buf;
+            sprintf(buf, " Total wait time: %f ms\n", s->totalWaitTime*1000);
+            report+=buf;
+            sprintf(buf, " Max wait time: %f ms\n", s->maxWaitTime*1000);
+            report+=buf;
+            sprintf(buf, " Total hold time: %f ms\n", s->totalHoldTime*1000);
+            report+=buf;
+            sprintf(buf, " Max hold time: %f ms\n\n", s->maxHoldTime*1000);
+            report+=buf;
+        }
+#endif
+        return report;
+    }
+}
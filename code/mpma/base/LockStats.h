@@ -0,0 +1,99 @@
+//!\file LockStats.h Contention and wait-time statistics for MutexLock, SpinLock and RWSleepLock.
+//!These are only gathered if LOCK_CONTENTION_STATS is defined in Config.h.  Otherwise the functions here return nothing, and the locks have no extra cost.
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include "Types.h"
+#include "../Config.h"
+#include <string>
+#include <vector>
+
+/*
+An example of finding out which locks are hurting:
+  //optionally give the interesting locks a name.  Locks without one are reported by the file and line they were taken from.
+  outputLock.SetName("DebugRouter output");
+
+  //...later, at runtime
+  std::vector<MPMA::LockStats> stats;
+  MPMA::GetLockStats(stats); //sorted by total wait time, worst first
+
+  //or just look in _profile.txt after the program ends, which includes the same report
+*/
+
+//the file and line that a function was called from, when used as a default argument
+#if defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER>=1926)
+    #define MPMA_CALL_SITE_FILE __builtin_FILE()
+    #define MPMA_CALL_SITE_LINE __builtin_LINE()
+#else
+    #define MPMA_CALL_SITE_FILE ((const char*)0)
+    #define MPMA_CALL_SITE_LINE 0
+#endif
+
+namespace MPMA
+{
+    //!Statistics for a named lock, or for a place in the code that takes an unnamed lock.  Times are in seconds.
+    struct LockStats
+    {
+        std::string name; //!<The lock's name, or "file:line" of where it was taken.
+        uint64 acquisitions; //!<Number of times the lock was taken.
+        uint64 contendedAcquisitions; //!<Number of times the lock was held by another thread when it was asked for.
+        double totalWaitTime; //!<Total time spent waiting for the lock when it was contended.
+        double maxWaitTime; //!<Longest single wait.
+        double totalHoldTime; //!<Total time the lock was held.
+        double maxHoldTime; //!<Longest single hold.
+    };
+
+    //!Fills outStats with the statistics for every lock that has been taken, sorted by total wait time (worst first).  Empty if LOCK_CONTENTION_STATS is not defined.
+    void GetLockStats(std::vector<LockStats> &outStats);
+
+    //!Sets all lock statistics back to zero.
+    void ResetLockStats();
+
+    //!Returns a human readable report of the lock statistics, in the same form that is written to the profile file.
+    std::string GetLockStatsReport();
+
+    //internal use: where a lock was taken from.  This is passed as a default argument so it picks up the caller's location.
+    struct Internal_LockCallSite
+    {
+#ifdef LOCK_CONTENTION_STATS
+        const char *file;
+        int line;
+
+        inline Internal_LockCallSite(const char *callFile=MPMA_CALL_SITE_FILE, int callLine=MPMA_CALL_SITE_LINE): file(callFile), line(callLine)
+            {}
+#endif
+    };
+
+#ifdef LOCK_CONTENTION_STATS
+    //internal use: the statistics for one lock name or call site.  Times are in nanoseconds.
+    struct Internal_LockStatsEntry
+    {
+        volatile nuint state; //0 unused, 1 being filled in, 2 in use
+        const char *file; //0 for named entries
+        int line;
+        char name[64];
+
+        volatile uint64 acquisitions;
+        volatile uint64 contendedAcquisitions;
+        volatile uint64 totalWait;
+        volatile uint64 maxWait;
+        volatile uint64 totalHold;
+        volatile uint64 maxHold;
+    };
+
+    //internal use: finds (or creates) the entry for a name or a call site
+    Internal_LockStatsEntry* Internal_GetLockStatsEntry(const char *name);
+    Internal_LockStatsEntry* Internal_GetLockStatsEntry(const Internal_LockCallSite &site);
+
+    //internal use: the current time in nanoseconds, for measuring waits and holds
+    uint64 Internal_LockStatsTime();
+
+    //internal use: adds one acquisition (and its wait, if it was contended) to an entry
+    void Internal_RecordLockTaken(Internal_LockStatsEntry *entry, bool contended, uint64 waitTime);
+
+    //internal use: adds how long the lock was held to an entry
+    void Internal_RecordLockHeld(Internal_LockStatsEntry *entry, uint64 holdTime);
+#endif
+
+} //namespace MPMA
@@ -9,26 +9,197 @@
 #include "DebugRouter.h"
 #include "Debug.h"
 #include "Thread.h"
+#include "Info.h"
+#include "Timer.h"
 #include "Types.h"
 #include <list>
 #include <algorithm>
 
+namespace
+{
+    //number of times a contended AdaptiveLock is retried before the thread goes to sleep on it
+    const nuint ADAPTIVELOCK_SPIN_ROUNDS=16;
+
+    //most cpu pauses done between retries (the number doubles each retry, starting from 1)
+    const nuint ADAPTIVELOCK_MAX_BACKOFF=256;
+
+    //number of cpu pauses a RWSleepLock reader or writer spends waiting before it goes to sleep
+    const nuint RWLOCK_READER_SPINS=128;
+    const nuint RWLOCK_WRITER_SPINS=1024;
+
+#ifdef RWLOCK_TRACK_REENTRANCY
+    //the read locks that the current thread holds
+    struct HeldReadLock
+    {
+        const void *lock;
+        nuint count;
+    };
+
+    const nuint RWLOCK_MAX_HELD_READ_LOCKS=32;
+    THREAD_LOCAL HeldReadLock heldReadLocks[RWLOCK_MAX_HELD_READ_LOCKS];
+
+    //finds this thread's entry for a lock, optionally creating it if it's not there.  Returns 0 if not found or if there's no room.
+    HeldReadLock* FindHeldReadLock(const void *lock, bool create)
+    {
+        HeldReadLock *empty=0;
+        for (nuint i=0; i<RWLOCK_MAX_HELD_READ_LOCKS; ++i)
+        {
+            if (heldReadLocks[i].lock==lock)
+                return &heldReadLocks[i];
+            else if (!empty && heldReadLocks[i].lock==0)
+                empty=&heldReadLocks[i];
+        }
+
+        if (!create)
+            return 0;
+
+        if (!empty)
+        {
+            MPMA::ErrorReport()<<"RWSleepLock: a thread holds read locks on more than "<<RWLOCK_MAX_HELD_READ_LOCKS<<" locks at once.  Re-entrancy on the extra locks will deadlock if a writer is waiting.\n";
+            return 0;
+        }
+
+        empty->lock=lock;
+        empty->count=0;
+        return empty;
+    }
+#endif
+}
+
 namespace MPMA
 {
+    // -- AdaptiveLock
+
+    //slow path of Lock, when someone else has it
+    void AdaptiveLock::LockContended()
+    {
+        //spin for a bit first, since most locks are held very briefly.  There is no point in this with a single cpu though, as the owner can't run while we spin.
+        if (!SystemInfo::SuggestSleepInSpinlock)
+        {
+            nuint backoff=1;
+            for (nuint round=0; round<ADAPTIVELOCK_SPIN_ROUNDS; ++round)
+            {
+                for (nuint i=0; i<backoff; ++i)
+                    CpuPause();
+                if (backoff<ADAPTIVELOCK_MAX_BACKOFF)
+                    backoff<<=1;
+
+                uint32 found;
+                if (state==0 && AtomicInt32CompareExchange(&state, 0, 1, found))
+                    return;
+            }
+        }
+
+        //sleep until it's released.  Since we can't know whether other threads are also sleeping on it, we always take it in the contended state, so our release will wake the next one.
+        while (AtomicInt32Exchange(&state, 2)!=0)
+            Internal_FutexWait(&state, 2);
+    }
+
+    //slow path of Unlock, when there may be threads sleeping on it
+    void AdaptiveLock::UnlockContended()
+    {
+        state=0;
+        Internal_FutexWakeOne(&state);
+    }
+
+    // -- MutexLock
+
+    TakeMutexLock::TakeMutexLock(MutexLock &critSection, bool takeNow, Internal_LockCallSite callSite):
+        crit(critSection), taken(false)
+    {
+        if (takeNow)
+            Take(callSite);
+    }
+
+    TakeMutexLock::~TakeMutexLock()
+    {
+        Leave();
+    }
+
+    //Manually takes the lock.
+    void TakeMutexLock::Take(Internal_LockCallSite callSite)
+    {
+        if (taken)
+            return;
+
+        //only this thread could have put its own id in owner, so this is safe to check without the lock
+        InternalMutexLockData &data=crit.Data();
+        nuint threadId=GetThreadUniqueIdentifier();
+        if (data.owner!=threadId)
+        {
+#ifdef LOCK_CONTENTION_STATS
+            Internal_LockStatsEntry *stats=data.namedStats ? data.namedStats : Internal_GetLockStatsEntry(callSite);
+            Internal_TakeAdaptiveLockWithStats(data.lock, stats);
+            data.heldStats=stats;
+            data.takenTime=Internal_LockStatsTime();
+#else
+            (void)callSite;
+            data.lock.Lock();
+#endif
+            data.owner=threadId;
+        }
+        ++data.recursion;
+
+        taken=true;
+    }
+
+    //Manually releases the lock.
+    void TakeMutexLock::Leave()
+    {
+        if (!taken)
+            return;
+
+        InternalMutexLockData &data=crit.Data();
+        if (--data.recursion==0)
+        {
+#ifdef LOCK_CONTENTION_STATS
+            Internal_RecordLockHeld(data.heldStats, Internal_LockStatsTime()-data.takenTime);
+#endif
+            data.owner=0;
+            data.lock.Unlock();
+        }
+
+        taken=false;
+    }
+
     // -- RWSleepLock
 
+    //total readers on all threads
+    static nuint RWLockReaderTotal(InternalRWSleepLockData &data)
+    {
+        nuint total=0;
+        for (nuint i=0; i<RWLOCK_READER_SLOTS; ++i)
+            total+=data.readerSlots[i].count;
+        return total;
+    }
+
+    //wakes the writer if it is waiting for readers to leave
+    static inline void RWLockNotifyWriter(InternalRWSleepLockData &data)
+    {
+        if (data.writerCount!=0)
+        {
+            AtomicInt32Add(&data.readerLeftSequence, 1);
+            Internal_FutexWakeOne(&data.readerLeftSequence);
+        }
+    }
+
     //Optionally takes the lock.
-    TakeRWSleepLock::TakeRWSleepLock(RWSleepLock &rwsLock, bool writeAccessIfTakenNow, bool takeNow): lock(rwsLock)
+    TakeRWSleepLock::TakeRWSleepLock(RWSleepLock &rwsLock, bool writeAccessIfTakenNow, bool takeNow, Internal_LockCallSite callSite): lock(rwsLock)
     {
         hasRead=false;
         hasWrite=false;
+        readSlot=0;
+#ifdef LOCK_CONTENTION_STATS
+        readHeldStats=0;
+        readTakenTime=0;
+#endif
 
         if (takeNow)
         {
             if (writeAccessIfTakenNow)
-                TakeWrite();
+                TakeWrite(callSite);
             else
-                TakeRead();
+                TakeRead(callSite);
         }
     }
 
@@ -40,38 +211,64 @@ namespace MPMA
     }
 
     //Takes the writer lock. (If a writer is already taken by this TakeRWSleepLock instance, the call is ignored)
-    void TakeRWSleepLock::TakeWrite()
+    void TakeRWSleepLock::TakeWrite(Internal_LockCallSite callSite)
     {
         if (hasWrite)
             return;
         hasWrite=true;
 
+        InternalRWSleepLockData &data=lock.Data();
         nuint threadId=GetThreadUniqueIdentifier();
 
-        //see how many writers this thread already has, and add us to the list
-        TakeSpinLock takeSpin(lock.Data().threadListLock);
-        nuint threadWriterCount=std::count(lock.Data().writerThreadList.begin(), lock.Data().writerThreadList.end(), threadId);
-        lock.Data().writerThreadList.insert(threadId);
-
-        //if this thread already has a writer, it's safe to just bump us in too
-        if (threadWriterCount>0)
+        //if this thread already has the writer, it's safe to just bump us in too
+        if (data.writerOwner==threadId)
         {
-            AtomicIntInc(&lock.Data().writerCount);
+            ++data.writerRecursion;
             return;
         }
 
-        //see how many readers this thread has
-        nuint threadReaderCount=std::count(lock.Data().readerThreadList.begin(), lock.Data().readerThreadList.end(), threadId);
-        takeSpin.Leave();
+        //announce ourself first so no new readers get in, then wait our turn among writers
+        AtomicInt32Add(&data.writerCount, 1);
+#ifdef LOCK_CONTENTION_STATS
+        uint64 waitStart=Internal_LockStatsTime();
+        bool contended=!data.writerLock.TryLock();
+        if (contended)
+            data.writerLock.Lock();
+#else
+        data.writerLock.Lock();
+#endif
+        data.writerOwner=threadId;
+        data.writerRecursion=1;
+
+        //wait for other threads' readers to go away
+        nuint ownReaders=0;
+#ifdef RWLOCK_TRACK_REENTRANCY
+        HeldReadLock *held=FindHeldReadLock(&data, false);
+        if (held)
+            ownReaders=held->count;
+#endif
 
-        //try to acquire the writer
-        nuint junk=0;
-        while (!AtomicCompareExchange(&lock.Data().writerCount, 0, 1, junk))
-            Sleep(0);
+#ifdef LOCK_CONTENTION_STATS
+        if (RWLockReaderTotal(data)>ownReaders)
+            contended=true;
+#endif
+
+        for (nuint spin=0; spin<RWLOCK_WRITER_SPINS && RWLockReaderTotal(data)>ownReaders; ++spin)
+            CpuPause();
+
+        while (true)
+        {
+            uint32 sequence=data.readerLeftSequence;
+            if (RWLockReaderTotal(data)<=ownReaders)
+                break;
+            Internal_FutexWait(&data.readerLeftSequence, sequence);
+        }
 
-        //wait for other thread readers to go away
-        while (lock.Data().readerCount>threadReaderCount)
-            Sleep(0);
+#ifdef LOCK_CONTENTION_STATS
+        data.writeHeldStats=data.namedStats ? data.namedStats : Internal_GetLockStatsEntry(callSite);
+        data.writeTakenTime=Internal_LockStatsTime();
+        Internal_RecordLockTaken(data.writeHeldStats, contended, contended ? data.writeTakenTime-waitStart : 0);
+#endif
     }
 
     //Releases a write lock. (If a writer is not taken by this TakeRWSleepLock instance, the call is ignored)
@@ -81,47 +278,79 @@ namespace MPMA
             return;
         hasWrite=false;
 
-        nuint threadId=GetThreadUniqueIdentifier();
+        InternalRWSleepLockData &data=lock.Data();
+        if (--data.writerRecursion>0)
+            return;
 
-        //remove us from the list and drop the writer count
-        TakeSpinLock takeSpin(lock.Data().threadListLock);
-        std::multiset<nuint>::iterator firstInList=lock.Data().writerThreadList.find(threadId);
-        lock.Data().writerThreadList.erase(firstInList);
-        AtomicIntDec(&lock.Data().writerCount);
+#ifdef LOCK_CONTENTION_STATS
+        Internal_RecordLockHeld(data.writeHeldStats, Internal_LockStatsTime()-data.writeTakenTime);
+#endif
+        data.writerOwner=0;
+        data.writerLock.Unlock();
 
+        //if we were the last writer, let the readers in
+        if (AtomicInt32Add(&data.writerCount, (uint32)-1)==1 && data.readersSleeping!=0)
+            Internal_FutexWakeAll(&data.writerCount);
     }
 
     //Takes a reader lock. (If a reader is already taken by this TakeRWSleepLock instance, the call is ignored)
-    void TakeRWSleepLock::TakeRead()
+    void TakeRWSleepLock::TakeRead(Internal_LockCallSite callSite)
     {
         if (hasRead)
             return;
         hasRead=true;
 
+        InternalRWSleepLockData &data=lock.Data();
         nuint threadId=GetThreadUniqueIdentifier();
+        readSlot=threadId%RWLOCK_READER_SLOTS;
+        volatile nuint *slotCount=&data.readerSlots[readSlot].count;
+
+        //if we already have a reader or the writer, it's safe to add another without waiting for writers (which would be waiting on us)
+        bool alreadyInside=(data.writerOwner==threadId);
+#ifdef RWLOCK_TRACK_REENTRANCY
+        HeldReadLock *held=FindHeldReadLock(&data, true);
+        if (held)
+        {
+            if (held->count>0)
+                alreadyInside=true;
+            ++held->count;
+        }
+#endif
 
-        //see how many readers and writers this thread has, and add us to the reader list
-        TakeSpinLock takeSpin(lock.Data().threadListLock);
-        nuint threadReaderCount=std::count(lock.Data().readerThreadList.begin(), lock.Data().readerThreadList.end(), threadId);
-        nuint threadWriterCount=std::count(lock.Data().writerThreadList.begin(), lock.Data().writerThreadList.end(), threadId);
-        lock.Data().readerThreadList.insert(threadId);
-        takeSpin.Leave();
+#ifdef LOCK_CONTENTION_STATS
+        readHeldStats=data.namedStats ? data.namedStats : Internal_GetLockStatsEntry(callSite);
+        uint64 waitStart=Internal_LockStatsTime();
+        bool contended=false;
+#endif
 
-        //if we already have a reader or a writer, it's safe to add another
-        if (threadReaderCount>0 || threadWriterCount>0)
+        while (true)
         {
-            AtomicIntInc(&lock.Data().readerCount);
-            return;
-        }
+            AtomicIntInc(slotCount);
+            if (alreadyInside || data.writerCount==0)
+            {
+#ifdef LOCK_CONTENTION_STATS
+                readTakenTime=Internal_LockStatsTime();
+                Internal_RecordLockTaken(readHeldStats, contended, contended ? readTakenTime-waitStart : 0);
+#endif
+                return;
+            }
+#ifdef LOCK_CONTENTION_STATS
+            contended=true;
+#endif
+
+            //a writer has it or wants it, so back out and wait for it to finish
+            AtomicIntDec(slotCount);
+            RWLockNotifyWriter(data);
 
-        //temporarily grab the writer, to prevent a writer lock from grabbing it at the same time we add our reader
-        nuint junk=0;
-        while (!AtomicCompareExchange(&lock.Data().writerCount, 0, 1, junk))
-            Sleep(0);
+            for (nuint spin=0; spin<RWLOCK_READER_SPINS && data.writerCount!=0; ++spin)
+                CpuPause();
 
-        //now it's safe to add our reader, then release the writer
-        AtomicIntInc(&lock.Data().readerCount);
-        AtomicIntDec(&lock.Data().writerCount);
+            AtomicInt32Add(&data.readersSleeping, 1);
+            uint32 writers;
+            while ((writers=data.writerCount)!=0)
+                Internal_FutexWait(&data.writerCount, writers);
+            AtomicInt32Add(&data.readersSleeping, (uint32)-1);
+        }
     }
 
     //Releases a reader lock. (If a reader is not taken by this TakeRWSleepLock instance, the call is ignored)
@@ -131,13 +360,138 @@ namespace MPMA
             return;
         hasRead=false;
 
-        nuint threadId=GetThreadUniqueIdentifier();
+        InternalRWSleepLockData &data=lock.Data();
+
+#ifdef RWLOCK_TRACK_REENTRANCY
+        HeldReadLock *held=FindHeldReadLock(&data, false);
+        if (held && --held->count==0)
+            held->lock=0;
+#endif
+
+#ifdef LOCK_CONTENTION_STATS
+        Internal_RecordLockHeld(readHeldStats, Internal_LockStatsTime()-readTakenTime);
+#endif
 
-        //remove us from the list and drop the reader count
-        TakeSpinLock takeSpin(lock.Data().threadListLock);
-        std::multiset<nuint>::iterator firstInList=lock.Data().readerThreadList.find(threadId);
-        lock.Data().readerThreadList.erase(firstInList);
-        AtomicIntDec(&lock.Data().readerCount);
+        AtomicIntDec(&data.readerSlots[readSlot].count);
+        RWLockNotifyWriter(data);
+    }
+
+    // -- lock benchmark
+
+    namespace
+    {
+        //a lock that spins, yielding between tries, and never sleeps.  Only used to compare against.
+        class YieldingSpinLock
+        {
+        public:
+            YieldingSpinLock(): state(0)
+                {}
+
+            void Lock()
+            {
+                volatile uint32 found;
+                while (!AtomicInt32CompareExchange(&state, 0, 1, found))
+                    Sleep(0);
+            }
+
+            void Unlock()
+                { AtomicInt32Exchange(&state, 0); }
+
+        private:
+            volatile uint32 state;
+        };
+
+        //shared by the threads of one MeasureLockContention run
+        template <typename Lock>
+        struct ContentionRun
+        {
+            Lock lock;
+            volatile nuint counter;
+            volatile nuint started;
+            volatile nuint stopping;
+            std::vector<nuint> takenByThread;
+        };
+
+        template <typename Lock>
+        struct ContentionThreadParam
+        {
+            ContentionRun<Lock> *run;
+            nuint index;
+        };
+
+        template <typename Lock>
+        void ContentionThread(Thread&, ThreadParam param)
+        {
+            ContentionThreadParam<Lock> *myParam=(ContentionThreadParam<Lock>*)param.ptr;
+            ContentionRun<Lock> *run=myParam->run;
+
+            AtomicIntInc(&run->started);
+            while (AtomicLoad(&run->started, MEMORY_ORDER_ACQUIRE)!=run->takenByThread.size())
+                Sleep(0);
+
+            nuint taken=0;
+            while (!AtomicLoad(&run->stopping, MEMORY_ORDER_RELAXED))
+            {
+                run->lock.Lock();
+                run->counter=run->counter+1;
+                run->lock.Unlock();
+                ++taken;
+            }
+            run->takenByThread[myParam->index]=taken;
+        }
+
+        //runs threads against one kind of lock for the given time, returning the locks per second and fairness
+        template <typename Lock>
+        void MeasureOneLock(nuint threadCount, double seconds, double &outLocksPerSecond, double &outFairness)
+        {
+            ContentionRun<Lock> run;
+            run.counter=0;
+            run.started=0;
+            run.stopping=0;
+            run.takenByThread.resize(threadCount, 0);
+
+            std::vector<ContentionThreadParam<Lock> > params(threadCount);
+            std::vector<Thread*> threads;
+            for (nuint i=0; i<threadCount; ++i)
+            {
+                params[i].run=&run;
+                params[i].index=i;
+                threads.push_back(new3(Thread(ContentionThread<Lock>, &params[i])));
+            }
+
+            //time from when every thread is ready, until the last one has stopped
+            while (AtomicLoad(&run.started, MEMORY_ORDER_ACQUIRE)!=threadCount)
+                Sleep(0);
+            Timer timer;
+            Sleep((nuint)(seconds*1000));
+            AtomicStore(&run.stopping, (nuint)1, MEMORY_ORDER_RELAXED);
+            for (std::vector<Thread*>::iterator i=threads.begin(); i!=threads.end(); ++i)
+                delete3(*i);
+            double elapsed=timer.Step();
+
+            nuint least=run.takenByThread[0], most=run.takenByThread[0];
+            for (nuint i=1; i<threadCount; ++i)
+            {
+                least=std::min(least, run.takenByThread[i]);
+                most=std::max(most, run.takenByThread[i]);
+            }
+            outLocksPerSecond=run.counter/elapsed;
+            outFairness=most ? (double)least/most : 0;
+        }
+    }
+
+    //Measures an AdaptiveLock under contention.
+    void MeasureLockContention(std::vector<LockContentionInfo> &outResults, nuint maxThreads, double seconds)
+    {
+        outResults.clear();
+        for (nuint threads=1; threads<=maxThreads; threads*=2)
+        {
+            LockContentionInfo info;
+            info.threads=threads;
+            MeasureOneLock<AdaptiveLock>(threads, seconds, info.locksPerSecond, info.fairness);
+            MeasureOneLock<YieldingSpinLock>(threads, seconds, info.spinLocksPerSecond, info.spinFairness);
+            outResults.push_back(info);
+        }
     }
 
 } //namespace MPMA
@@ -152,20 +506,80 @@ namespace MPMA
 {
     extern void Sleep(nuint time);
 
+// -- AdaptiveLock
+
+inline void AdaptiveLock::Lock()
+{
+    uint32 found;
+    if (!AtomicInt32CompareExchange(&state, 0, 1, found))
+        LockContended();
+}
+
+inline bool AdaptiveLock::TryLock()
+{
+    uint32 found;
+    return AtomicInt32CompareExchange(&state, 0, 1, found);
+}
+
+inline void AdaptiveLock::Unlock()
+{
+    if (AtomicInt32Add(&state, (uint32)-1)!=1)
+        UnlockContended();
+}
+
+#ifdef LOCK_CONTENTION_STATS
+//takes an AdaptiveLock, and counts whether someone else had it and how long we waited
+inline void Internal_TakeAdaptiveLockWithStats(AdaptiveLock &lock, Internal_LockStatsEntry *stats)
+{
+    if (lock.TryLock())
+    {
+        Internal_RecordLockTaken(stats, false, 0);
+        return;
+    }
+
+    uint64 waitStart=Internal_LockStatsTime();
+    lock.Lock();
+    Internal_RecordLockTaken(stats, true, Internal_LockStatsTime()-waitStart);
+}
+#endif
+
+// -- MutexLock
+
+inline void MutexLock::SetName(const char *name)
+{
+#ifdef LOCK_CONTENTION_STATS
+    Data().namedStats=Internal_GetLockStatsEntry(name);
+#else
+    (void)name;
+#endif
+}
+
 // -- Spinlock
 
-inline void TakeSpinLock::Take()
+inline void SpinLock::SetName(const char *name)
+{
+#ifdef LOCK_CONTENTION_STATS
+    Data().namedStats=Internal_GetLockStatsEntry(name);
+#else
+    (void)name;
+#endif
+}
+
+inline void TakeSpinLock::Take(Internal_LockCallSite callSite)
 {
     if (taken)
         return;
 
-    nuint yawn;
-    while (!AtomicCompareExchange(&locker.Data().taken, 0, 1, yawn))
-    {
-        locker.Data().collision=true;
-        if (SystemInfo::SuggestSleepInSpinlock)
-            Sleep(0);
-    }
+#ifdef LOCK_CONTENTION_STATS
+    InternalSpinLockData &data=locker.Data();
+    Internal_LockStatsEntry *stats=data.namedStats ? data.namedStats : Internal_GetLockStatsEntry(callSite);
+    Internal_TakeAdaptiveLockWithStats(data.lock, stats);
+    data.heldStats=stats;
+    data.takenTime=Internal_LockStatsTime();
+#else
+    (void)callSite;
+    locker.Data().lock.Lock();
+#endif
 
     taken=true;
 }
@@ -175,15 +589,26 @@ inline void TakeSpinLock::Leave()
     if (!taken)
         return;
 
-    bool wasCollision=locker.Data().collision;
-    locker.Data().collision=false;
-    locker.Data().taken=0;
-    if (wasCollision && SystemInfo::SuggestSleepInSpinlock)
-        Sleep(0);
+#ifdef LOCK_CONTENTION_STATS
+    InternalSpinLockData &data=locker.Data();
+    Internal_RecordLockHeld(data.heldStats, Internal_LockStatsTime()-data.takenTime);
+#endif
+    locker.Data().lock.Unlock();
 
     taken=false;
 }
 
+// -- RWSleepLock
+
+inline void RWSleepLock::SetName(const char *name)
+{
+#ifdef LOCK_CONTENTION_STATS
+    Data().namedStats=Internal_GetLockStatsEntry(name);
+#else
+    (void)name;
+#endif
+}
+
 } //namespace MPMA
 
 #endif
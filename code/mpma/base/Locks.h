@@ -4,8 +4,10 @@
 
 #include "Types.h"
 #include "ReferenceCount.h"
-
-#include <set>
+#include "Atomic.h"
+#include "LockStats.h"
+#include "../Config.h"
+#include <vector>
 
 #ifndef LOCKS_H_INCLUDED
 #define LOCKS_H_INCLUDED
@@ -13,7 +15,7 @@
 namespace MPMA
 {
 
-    //  -- Atomic Operations safe for multiprocessor operations
+    //  -- Atomic Operations safe for multiprocessor operations (these are all full barriers, see Atomic.h for ones with explicit ordering)
 
     //!Atomically increments an integer.
     void AtomicIntInc(volatile nuint *pint);
@@ -30,20 +32,97 @@ namespace MPMA
     //!Compares ptrExpected with the value at ptrToReplace, and if they are the same, sets ptrToReplace to ptrToSet and returns true with outResultValue set to ptrToSet.  If they are different then ptrToReplace is unaffected, and returns false with outResultValue set to the value that was found at ptrToReplace.
     template <typename T> inline bool AtomicCompareExchange(T **ptrToReplace, T *ptrExpected, T *ptrToSet, T *&outResultValue) { return AtomicCompareExchange((nuint*)ptrToReplace, (nuint)ptrExpected, (nuint)ptrToSet, (nuint&)outResultValue); }
 
+    //!Atomically adds one 32 bit integer to another and returns the value of the original.
+    uint32 AtomicInt32Add(volatile uint32 *pint, uint32 addValue);
+
+    //!Atomically sets a 32 bit integer to newValue and returns the value it had before.
+    uint32 AtomicInt32Exchange(volatile uint32 *pint, uint32 newValue);
+
+    //!Same as AtomicCompareExchange, but for a 32 bit integer (on all platforms, including 64 bit ones).
+    bool AtomicInt32CompareExchange(volatile uint32 *pInt, uint32 expectedValue, uint32 newValue, volatile uint32 &outResultValue);
+
+    //!Hints to the cpu that the calling thread is in a spin-wait loop.
+    void CpuPause();
+
+    //internal use: blocks the calling thread for as long as *address is equal to expectedValue (may also return early for no reason)
+    void Internal_FutexWait(volatile uint32 *address, uint32 expectedValue);
+
+    //internal use: wakes one thread blocked in Internal_FutexWait on address
+    void Internal_FutexWakeOne(volatile uint32 *address);
+
+    //internal use: wakes all threads blocked in Internal_FutexWait on address
+    void Internal_FutexWakeAll(volatile uint32 *address);
+
     // -- Locking constructs
 
+    //!\brief A light-weight lock (NOT re-entrant safe from the same thread) that spins briefly when contended, then sleeps until it is released.
+    //!Taking and releasing the lock when nobody else wants it is a single atomic operation each, and does not enter the operating system.  This is not reference counted, so it cannot be copied.  It is the lock used by SpinLock and MutexLock.
+    class AdaptiveLock
+    {
+    public:
+        inline AdaptiveLock(): state(0) //!<ctor
+            {}
+
+        //!Takes the lock, waiting if needed.
+        inline void Lock();
+        //!Takes the lock only if nobody else has it, and returns whether it was taken.
+        inline bool TryLock();
+        //!Releases the lock.
+        inline void Unlock();
+
+    private:
+        //0 is free, 1 is taken, 2 is taken and there may be threads sleeping on it
+        volatile uint32 state;
+
+        void LockContended();
+        void UnlockContended();
+
+        //you cannot duplicate this
+        AdaptiveLock(const AdaptiveLock&);
+        const AdaptiveLock& operator=(const AdaptiveLock&);
+    };
+
+    //!What MeasureLockContention found out for one number of threads.
+    struct LockContentionInfo
+    {
+        nuint threads; //!<Number of threads that were taking the lock.
+        double locksPerSecond; //!<Times an AdaptiveLock was taken and released in a second, over all of the threads together.
+        double fairness; //!<The fewest times one thread took the lock divided by the most times one did.  1 is perfectly fair, and 0 means a thread never got it.
+        double spinLocksPerSecond; //!<The same as locksPerSecond, for a lock that only spins and yields (the way SpinLock used to work), to compare against.
+        double spinFairness; //!<The same as fairness, for the spinning lock.
+    };
+
+    //!Measures an AdaptiveLock under contention, for 1 thread, then twice as many each time up to maxThreads.  Each thread repeatedly takes the lock, increments a counter, and releases it, for the given number of seconds (which this waits for, twice per thread count).  Fills outResults with one entry per thread count.
+    void MeasureLockContention(std::vector<LockContentionInfo> &outResults, nuint maxThreads=64, double seconds=0.1);
+
     //used by MutexLock
     struct InternalMutexLockData
     {
-        void *crit;
+        AdaptiveLock lock;
+        volatile nuint owner; //thread unique identifier of the owner, 0 if nobody
+        nuint recursion;
+#ifdef LOCK_CONTENTION_STATS
+        Internal_LockStatsEntry *namedStats; //set by SetName
+        Internal_LockStatsEntry *heldStats; //where the current hold is counted
+        uint64 takenTime;
+#endif
+
+        inline InternalMutexLockData(): owner(0), recursion(0)
+        {
+#ifdef LOCK_CONTENTION_STATS
+            namedStats=0;
+            heldStats=0;
+            takenTime=0;
+#endif
+        }
     };
 
-    //!A (re-entrant safe) lock based on the operating system's mutexes.
+    //!A (re-entrant safe) lock that spins briefly when contended, then sleeps.  This is a reference counted object, so all copies of the object still refer to the same lock.
     class MutexLock: public ReferenceCountedData<InternalMutexLockData>
     {
     public:
-        MutexLock();
-        ~MutexLock();
+        //!Sets the name this lock's statistics are reported under, instead of where it was taken from (see LockStats.h).  Does nothing unless LOCK_CONTENTION_STATS is defined.
+        inline void SetName(const char *name);
 
         friend class TakeMutexLock;
     };
@@ -53,12 +132,12 @@ namespace MPMA
     {
     public:
         //!Optionally takes the lock.
-        TakeMutexLock(MutexLock &critSection, bool takeNow=true);
+        TakeMutexLock(MutexLock &critSection, bool takeNow=true, Internal_LockCallSite callSite=Internal_LockCallSite());
         //!Releases the lock if it is currently taken.
         ~TakeMutexLock();
 
         //!Manually takes the lock. (If already taken by this TakeMutexLock instance, the call is ignored)
-        void Take();
+        void Take(Internal_LockCallSite callSite=Internal_LockCallSite());
         //!Manually releases the lock. (If not taken by this TakeMutexLock instance, the call is ignored)
         void Leave();
 
@@ -75,16 +154,24 @@ namespace MPMA
     //used by SpinLock
     struct InternalSpinLockData
     {
-        volatile nuint taken;
-        bool collision;
+        AdaptiveLock lock;
+#ifdef LOCK_CONTENTION_STATS
+        Internal_LockStatsEntry *namedStats; //set by SetName
+        Internal_LockStatsEntry *heldStats; //where the current hold is counted
+        uint64 takenTime;
 
-        inline InternalSpinLockData(): taken(0), collision(false)
+        inline InternalSpinLockData(): namedStats(0), heldStats(0), takenTime(0)
             {}
+#endif
     };
 
-    //!A light-weight spin-lock (NOT re-entrant safe from the same thread) that reverts to a sleeplock on single cpu systems.  This is a reference counted object, so all copies of the object still refer to the same lock.
+    //!A light-weight spin-lock (NOT re-entrant safe from the same thread) that sleeps if it can't get the lock after spinning briefly (or immediately on single cpu systems).  This is a reference counted object, so all copies of the object still refer to the same lock.
     class SpinLock: public ReferenceCountedData<InternalSpinLockData>
     {
+    public:
+        //!Sets the name this lock's statistics are reported under, instead of where it was taken from (see LockStats.h).  Does nothing unless LOCK_CONTENTION_STATS is defined.
+        inline void SetName(const char *name);
+
         friend class TakeSpinLock;
     };
 
@@ -93,14 +180,14 @@ namespace MPMA
     {
     public:
         //!Optionally takes the lock.
-        inline TakeSpinLock(SpinLock &slock, bool takeNow=true): locker(slock), taken(false)
-            { if (takeNow) Take(); }
+        inline TakeSpinLock(SpinLock &slock, bool takeNow=true, Internal_LockCallSite callSite=Internal_LockCallSite()): locker(slock), taken(false)
+            { if (takeNow) Take(callSite); }
         //!Releases the lock if it is currently taken.
         inline ~TakeSpinLock()
             { Leave(); }
 
         //!Manually takes the lock. (If already taken by this TakeSpinLock instance, the call is ignored)
-        inline void Take();
+        inline void Take(Internal_LockCallSite callSite=Internal_LockCallSite());
         //!Manually releases the lock. (If not taken by this TakeSpinLock instance, the call is ignored)
         inline void Leave();
 
@@ -116,22 +203,46 @@ namespace MPMA
     //used by RWSleepLock
     struct InternalRWSleepLockData
     {
-        volatile nuint readerCount;
-        volatile nuint writerCount;
-
-        std::multiset<nuint> readerThreadList;
-        std::multiset<nuint> writerThreadList;
-        SpinLock threadListLock;
+        //readers are counted in several slots (picked by thread) that are on separate cache lines, so readers on different threads don't contend with each other
+        struct ReaderSlot
+        {
+            volatile nuint count;
+            uint8 padding[64-sizeof(nuint)];
+        };
+        ReaderSlot readerSlots[RWLOCK_READER_SLOTS];
+
+        volatile uint32 writerCount; //writers that hold or are waiting for the lock.  New readers wait while this is non-zero.
+        volatile uint32 readersSleeping; //readers blocked waiting for writerCount to be zero
+        volatile uint32 readerLeftSequence; //bumped when a reader leaves while there's a writer, to wake the writer
+        AdaptiveLock writerLock;
+        volatile nuint writerOwner; //thread unique identifier of the writer, 0 if nobody
+        nuint writerRecursion;
+#ifdef LOCK_CONTENTION_STATS
+        Internal_LockStatsEntry *namedStats; //set by SetName
+        Internal_LockStatsEntry *writeHeldStats; //where the current write hold is counted
+        uint64 writeTakenTime;
+#endif
 
-        inline InternalRWSleepLockData(): readerCount(0), writerCount(0)
-            {}
+        inline InternalRWSleepLockData(): writerCount(0), readersSleeping(0), readerLeftSequence(0), writerOwner(0), writerRecursion(0)
+        {
+            for (nuint i=0; i<RWLOCK_READER_SLOTS; ++i)
+                readerSlots[i].count=0;
+#ifdef LOCK_CONTENTION_STATS
+            namedStats=0;
+            writeHeldStats=0;
+            writeTakenTime=0;
+#endif
+        }
     };
 
-    //!\brief ReaderWriter sleep-lock (re-entrant safe).
-    //!Read locks don't block each other, but Write locks are exclusive to all other locks.  This is a reference counted object, so all copies of the object still refer to the same lock.
+    //!\brief ReaderWriter sleep-lock (re-entrant safe, see RWLOCK_TRACK_REENTRANCY in Config.h).
+    //!Read locks don't block each other, but Write locks are exclusive to all other locks.  Taking a read lock does not allocate memory, and readers on different threads mostly touch separate cache lines.  Waiting writers are given preference over new readers.  This is a reference counted object, so all copies of the object still refer to the same lock.
     class RWSleepLock: public ReferenceCountedData<InternalRWSleepLockData>
     {
     public:
+        //!Sets the name this lock's statistics are reported under, instead of where it was taken from (see LockStats.h).  Does nothing unless LOCK_CONTENTION_STATS is defined.
+        inline void SetName(const char *name);
+
         friend class TakeRWSleepLock;
     };
 
@@ -140,17 +251,17 @@ namespace MPMA
     {
     public:
         //!Optionally takes the lock.
-        TakeRWSleepLock(RWSleepLock &rwsLock, bool writeAccessIfTakenNow=true, bool takeNow=true);
+        TakeRWSleepLock(RWSleepLock &rwsLock, bool writeAccessIfTakenNow=true, bool takeNow=true, Internal_LockCallSite callSite=Internal_LockCallSite());
         //!Releases the reader and writer lock, if they are currently taken.
         ~TakeRWSleepLock();
 
         //!Takes the writer lock. (If a writer is already taken by this TakeRWSleepLock instance, the call is ignored)
-        void TakeWrite();
+        void TakeWrite(Internal_LockCallSite callSite=Internal_LockCallSite());
         //!Releases a write lock. (If a writer is not taken by this TakeRWSleepLock instance, the call is ignored)
         void LeaveWrite();
 
         //!Takes a reader lock. (If a reader is already taken by this TakeRWSleepLock instance, the call is ignored)
-        void TakeRead();
+        void TakeRead(Internal_LockCallSite callSite=Internal_LockCallSite());
         //!Releases a reader lock. (If a reader is not taken by this TakeRWSleepLock instance, the call is ignored)
         void LeaveRead();
 
@@ -158,6 +269,11 @@ namespace MPMA
         RWSleepLock lock;
 
         bool hasRead, hasWrite;
+        nuint readSlot;
+#ifdef LOCK_CONTENTION_STATS
+        Internal_LockStatsEntry *readHeldStats;
+        uint64 readTakenTime;
+#endif
 
         //you cannot duplicate this
         TakeRWSleepLock(const TakeRWSleepLock&);
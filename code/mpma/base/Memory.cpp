@@ -5,8 +5,12 @@
 #include "Memory.h"
 #include "Debug.h"
 #include "DebugRouter.h"
+#include "HeapProfiler.h"
 #include "MiscStuff.h"
+#include "Thread.h"
+#include "Timer.h"
 #include "Vary.h"
+#include <stdlib.h>
 
 using MPMA::VaryString;
 
@@ -21,6 +25,14 @@ using MPMA::VaryString;
 MPMAMemoryManager mpmaMemoryManager;
 
 #ifdef MEMMAN_TRACING //if management is enabled
+namespace MPMA
+{
+    //platform specific
+    void* Internal_AllocGuardedPages(nuint size);
+    void Internal_FreeGuardedPages(void *mem, nuint size);
+    nuint Internal_GetPageSize();
+}
+
 namespace
 {
     class AutoInitMemMan
@@ -31,6 +43,10 @@ namespace
         {
             MPMA::Internal_AddInitCallback(MemManInitialize,-9500);
             MPMA::Internal_AddShutdownCallback(MemManShutdown,-9500);
+
+            //the background scan reports through the debug router, so it runs while that does
+            MPMA::Internal_AddInitCallback(ScanInitialize,-900);
+            MPMA::Internal_AddShutdownCallback(ScanShutdown,-900);
         }
     private:
         static void MemManInitialize()
@@ -41,49 +57,57 @@ namespace
         {
             mpmaMemoryManager.InternalShutdown();
         }
+        static void ScanInitialize()
+        {
+#ifdef MEMMAN_BACKGROUND_PADDING_SCAN
+            mpmaMemoryManager.StartBackgroundPaddingScan();
+#endif
+        }
+        static void ScanShutdown()
+        {
+            mpmaMemoryManager.StopBackgroundPaddingScan();
+        }
     } autoInitMemMan;
 
     const uint8 PAD_BYTE=0xA5; // 1010 0101
 
     //sets the padding around an allocation
-    void SetAllocPadding(uint8 *mem, nuint objSize)
+    void SetAllocPadding(uint8 *mem, nuint objSize, nuint afterPadding)
     {
         memset(mem, PAD_BYTE, dbgN2_padding);
-        memset(mem+dbgN2_padding+objSize, PAD_BYTE, dbgN2_padding);
+        memset(mem+dbgN2_padding+objSize, PAD_BYTE, afterPadding);
     }
 
-    //this is a simple spin-lock exclusive to the memory manager, that does not actually use the memory manager itself.
-    //it is otherwise identical to the normal spinlock
+    //this is a simple spin-lock exclusive to the memory manager, that does not actually use the memory manager itself (or anything else that could allocate).
     class MemSpinLock
     {
     public:
-        volatile nuint taken;
-        bool collision;
-        MemSpinLock(): taken(0), collision(false)
+        volatile uint32 taken;
+        MemSpinLock(): taken(0)
             {}
-    } allocDiffLock, syncLock;
+    } syncLock;
 
     class MemTakeSpinLock
     {
     public:
         MemTakeSpinLock(MemSpinLock &slock): locker(slock)
         {
-            nuint yawn;
-            while (!MPMA::AtomicCompareExchange(&locker.taken, 0, 1, yawn))
+            while (MPMA::AtomicExchange(&locker.taken, (uint32)1, MPMA::MEMORY_ORDER_ACQUIRE)!=0)
             {
-                locker.collision=true;
-                if (MPMA::SystemInfo::SuggestSleepInSpinlock)
-                    MPMA::Sleep(0);
+                //wait for it to look free before trying again, so we aren't bouncing the cache line around
+                do
+                {
+                    if (MPMA::SystemInfo::SuggestSleepInSpinlock)
+                        MPMA::Sleep(0);
+                    else
+                        MPMA::CpuPause();
+                } while (MPMA::AtomicLoad(&locker.taken, MPMA::MEMORY_ORDER_RELAXED)!=0);
             }
         }
 
         ~MemTakeSpinLock()
         {
-            bool wasCollision=locker.collision;
-            locker.collision=false;
-            locker.taken=0;
-            if (wasCollision && MPMA::SystemInfo::SuggestSleepInSpinlock)
-                MPMA::Sleep(0);
+            MPMA::AtomicStore(&locker.taken, (uint32)0, MPMA::MEMORY_ORDER_RELEASE);
         }
 
     private:
@@ -91,24 +115,356 @@ namespace
 
         void operator=(const MemTakeSpinLock &notallowed);
     };
+
+    //returns whether the padding before or after an allocation has been changed
+    bool IsPaddingBeforeDamaged(const uint8 *mem)
+    {
+        for (int i=0;i<dbgN2_padding;++i)
+        {
+            if (*(mem+i) != PAD_BYTE)
+                return true;
+        }
+        return false;
+    }
+
+    bool IsPaddingAfterDamaged(const uint8 *mem, nuint objSize, nuint afterPadding)
+    {
+        for (nuint i=0;i<afterPadding;++i)
+        {
+            if (*(mem+dbgN2_padding+objSize+i) != PAD_BYTE)
+                return true;
+        }
+        return false;
+    }
+
+    // -- tables of live allocations
+
+    //number of separately locked parts that the allocation records are split into, so threads allocating at once rarely wait on each other.  Must be a power of 2.
+    const nuint TRACE_SHARDS=64;
+
+    //most unused records each shard keeps for reuse
+    const nuint TRACE_MAX_FREE_RECORDS=1024;
+
+    inline nuint HashAddress(const volatile void *p)
+    {
+        nuint hash=(nuint)p>>4; //allocations are at least 16 byte aligned
+        hash^=hash>>17;
+        hash*=0x9e3779b1u;
+        hash^=hash>>13;
+        return hash;
+    }
+
+    inline nuint ShardOf(const volatile void *p)
+    {
+        return HashAddress(p)&(TRACE_SHARDS-1);
+    }
+
+    //an open addressing hash table keyed by address.  It uses malloc directly, so it never calls back in to the memory manager.  This is all plain data, so a zero initialized table is a valid empty one.
+    template <typename Value>
+    struct AddressTable
+    {
+        struct Slot
+        {
+            const volatile void *key; //0 for empty, REMOVED for a slot that was in use
+            Value value;
+        };
+
+        Slot *slots;
+        nuint capacity; //a power of 2, or 0
+        nuint used; //slots that are not empty, including removed ones
+        nuint live;
+
+        static const volatile void* Removed()
+            { return (const volatile void*)1; }
+
+        inline nuint StartSlot(const volatile void *key) const
+            { return (HashAddress(key)/TRACE_SHARDS)&(capacity-1); }
+
+        //returns the slot with the key, or 0 if it's not there
+        Slot* Find(const volatile void *key)
+        {
+            if (!capacity)
+                return 0;
+
+            for (nuint i=StartSlot(key); ; i=(i+1)&(capacity-1))
+            {
+                if (slots[i].key==key)
+                    return &slots[i];
+                if (slots[i].key==0)
+                    return 0;
+            }
+        }
+
+        //adds a key that is not already in the table.  Returns false if there was no memory to grow it.
+        bool Insert(const volatile void *key, const Value &value)
+        {
+            if ((used+1)*4>capacity*3 && !Resize())
+                return false;
+
+            for (nuint i=StartSlot(key); ; i=(i+1)&(capacity-1))
+            {
+                if (slots[i].key==0 || slots[i].key==Removed())
+                {
+                    if (slots[i].key==0)
+                        ++used;
+                    slots[i].key=key;
+                    slots[i].value=value;
+                    ++live;
+                    return true;
+                }
+            }
+        }
+
+        //takes a key out, returning whether it was there
+        bool Remove(const volatile void *key, Value &outValue)
+        {
+            Slot *slot=Find(key);
+            if (!slot)
+                return false;
+
+            outValue=slot->value;
+            slot->key=Removed();
+            --live;
+            return true;
+        }
+
+        //calls func(value) for every key in the table
+        template <typename Func>
+        void ForEach(Func &func)
+        {
+            for (nuint i=0; i<capacity; ++i)
+            {
+                if (slots[i].key!=0 && slots[i].key!=Removed())
+                    func(slots[i].value);
+            }
+        }
+
+        //rebuilds the table with room for twice as many as are live, which also clears out removed slots
+        bool Resize()
+        {
+            nuint newCapacity=64;
+            while (newCapacity<live*4)
+                newCapacity*=2;
+
+            Slot *newSlots=(Slot*)calloc(newCapacity, sizeof(Slot));
+            if (!newSlots)
+                return false;
+
+            Slot *oldSlots=slots;
+            nuint oldCapacity=capacity;
+            slots=newSlots;
+            capacity=newCapacity;
+            used=0;
+            live=0;
+
+            for (nuint i=0; i<oldCapacity; ++i)
+            {
+                if (oldSlots[i].key!=0 && oldSlots[i].key!=Removed())
+                    Insert(oldSlots[i].key, oldSlots[i].value);
+            }
+
+            free(oldSlots);
+            return true;
+        }
+    };
+
+    //live allocations by object address, and unused records to reuse
+    struct TraceShard
+    {
+        MemSpinLock lock;
+        AddressTable<MPMAMemoryManager::SAlloc*> allocs;
+        MPMAMemoryManager::SAlloc *freeRecords;
+        nuint freeRecordCount;
+    } traceShards[TRACE_SHARDS];
+
+    //the memory new gave us for an object, by the pointer that was returned to the caller, for the few cases where they are different
+    struct AllocDifferenceShard
+    {
+        MemSpinLock lock;
+        AddressTable<void*> differences;
+    } allocDifferenceShards[TRACE_SHARDS];
+
+    // -- guard pages
+
+    //allocations at least this big get a guard page, or 0 for none
+#ifdef MEMMAN_GUARD_PAGE_MIN_SIZE
+    volatile nuint guardPageMinSize=MEMMAN_GUARD_PAGE_MIN_SIZE;
+    volatile nuint guardPagesUsed=1;
+#else
+    volatile nuint guardPageMinSize=0;
+    volatile nuint guardPagesUsed=0; //set once guard pages have been turned on, so frees don't look them up otherwise
+#endif
+
+    //the size of the pages mapped for each allocation with a guard page, by the memory that was handed to TraceAlloc
+    struct GuardedShard
+    {
+        MemSpinLock lock;
+        AddressTable<nuint> mappedSizes;
+    } guardedShards[TRACE_SHARDS];
+
+    //allocates the memory for a traced object, with its padding.  Large objects end right at an inaccessible page if guard pages are on.
+    char* AllocTracedMemory(nuint objLen, nuint &outAfterPadding)
+    {
+        nuint minSize=MPMA::AtomicLoad(&guardPageMinSize, MPMA::MEMORY_ORDER_RELAXED);
+        if (minSize!=0 && objLen>=minSize)
+        {
+            //the object stays 16 byte aligned, so up to 15 bytes before the guard page are checked as padding instead
+            nuint pageSize=MPMA::Internal_GetPageSize();
+            nuint objSpan=(objLen+15)&~(nuint)15;
+            nuint used=dbgN2_padding+objSpan;
+            nuint mapped=(used+pageSize-1)&~(pageSize-1);
+
+            char *pages=(char*)MPMA::Internal_AllocGuardedPages(mapped);
+            if (pages)
+            {
+                char *mem=pages+mapped-used;
+                bool added;
+                {
+                    GuardedShard &shard=guardedShards[ShardOf(mem)];
+                    MemTakeSpinLock autoSync(shard.lock);
+                    added=shard.mappedSizes.Insert(mem, mapped);
+                }
+
+                if (added)
+                {
+                    outAfterPadding=objSpan-objLen;
+                    return mem;
+                }
+
+                MPMA::Internal_FreeGuardedPages(pages, mapped);
+            }
+        }
+
+        outAfterPadding=dbgN2_padding;
+        return new char[objLen+2*dbgN2_padding];
+    }
+
+    // -- incremental checks
+
+    //a spot in the allocation tables where the incremental check continues from
+    struct ScanPosition
+    {
+        MemSpinLock lock; //only one incremental check runs at once
+        nuint shard;
+        nuint slot;
+        nuint passes;
+    } scanPosition;
+
+    //most table slots that are looked at each time a shard's lock is taken, so allocations on other threads aren't held up for long
+    const nuint SCAN_SLOTS_PER_LOCK=256;
+
+    //the thread for StartBackgroundPaddingScan
+    struct BackgroundScan
+    {
+        MPMA::Thread *thread;
+        double secondsPerSlice;
+        nuint sleepMilliseconds;
+    } backgroundScan;
+
+    void BackgroundScanThread(MPMA::Thread &me, MPMA::ThreadParam param)
+    {
+        while (!me.IsEnding())
+        {
+            mpmaMemoryManager.CheckForPaddingCorruptionIncremental(backgroundScan.secondsPerSlice);
+            MPMA::Sleep(backgroundScan.sleepMilliseconds);
+        }
+    }
+
+    MPMAMemoryManager::SAlloc* TakeRecord(TraceShard &shard)
+    {
+        {
+            MemTakeSpinLock autoSync(shard.lock);
+            MPMAMemoryManager::SAlloc *record=shard.freeRecords;
+            if (record)
+            {
+                shard.freeRecords=record->next;
+                --shard.freeRecordCount;
+                return record;
+            }
+        }
+
+        return new MPMAMemoryManager::SAlloc;
+    }
+
+    void RecycleRecord(TraceShard &shard, MPMAMemoryManager::SAlloc *record)
+    {
+        {
+            MemTakeSpinLock autoSync(shard.lock);
+            if (shard.freeRecordCount<TRACE_MAX_FREE_RECORDS)
+            {
+                record->next=shard.freeRecords;
+                shard.freeRecords=record;
+                ++shard.freeRecordCount;
+                return;
+            }
+        }
+
+        delete record;
+    }
+
+    //collects the description of every allocation that counts as a leak
+    struct LeakCollector
+    {
+        size_t leakedBytes;
+        int leakedCount;
+        std::string descriptions;
+
+        void operator()(MPMAMemoryManager::SAlloc *cur)
+        {
+            if (cur->countsAsLeak)
+            {
+                leakedBytes+=cur->size;
+                leakedCount++;
+                descriptions+=cur->Describe();
+            }
+        }
+    };
+
+    //collects the description of every allocation with damaged padding
+    struct CorruptionCollector
+    {
+        std::list<std::string> errors;
+        bool skipReported; //don't report allocations that an incremental check already did
+
+        CorruptionCollector(bool skipAlreadyReported=false): skipReported(skipAlreadyReported)
+            {}
+
+        void operator()(MPMAMemoryManager::SAlloc *cur)
+        {
+            if (skipReported && cur->paddingReported)
+                return;
+
+            bool before=IsPaddingBeforeDamaged((uint8*)cur->allocMem);
+            bool after=IsPaddingAfterDamaged((uint8*)cur->allocMem, cur->size, cur->afterPadding);
+            if (before || after)
+            {
+                cur->paddingReported=true;
+
+                std::string error;
+                if (before)
+                    error+="WARNING: Damage to memory BEFORE an allocation.\n";
+                if (after)
+                    error+="WARNING: Damage to memory AFTER an allocation.\n";
+                error+="Memory corruption detected.\n";
+                error+=cur->Describe();
+                errors.push_back(error);
+            }
+        }
+    };
 };
 
 //checks that an allocations padding has not been corrupted
-bool MPMAMemoryManager::VerifyAllocPadding(uint8 *mem, nuint objSize)
+bool MPMAMemoryManager::VerifyAllocPadding(uint8 *mem, nuint objSize, nuint afterPadding)
 {
     bool bad=false;
 
     //check mem before
     try
     {
-        for (int i=0;i<dbgN2_padding;++i)
+        if (IsPaddingBeforeDamaged(mem))
         {
-            if (*(mem+i) != PAD_BYTE)
-            {
-                ReportLeak("WARNING: Damage to memory BEFORE an allocation.\n");
-                bad=true;
-                break;
-            }
+            ReportLeak("WARNING: Damage to memory BEFORE an allocation.\n");
+            bad=true;
         }
     }
     catch(...)
@@ -120,14 +476,10 @@ bool MPMAMemoryManager::VerifyAllocPadding(uint8 *mem, nuint objSize)
     //check mem after
     try
     {
-        for (int i=0;i<dbgN2_padding;++i)
+        if (IsPaddingAfterDamaged(mem, objSize, afterPadding))
         {
-            if (*(mem+dbgN2_padding+objSize+i) != PAD_BYTE)
-            {
-                ReportLeak("WARNING: Damage to memory AFTER an allocation.\n");
-                bad=true;
-                break;
-            }
+            ReportLeak("WARNING: Damage to memory AFTER an allocation.\n");
+            bad=true;
         }
     }
     catch(...)
@@ -147,7 +499,6 @@ MPMAMemoryManager::MPMAMemoryManager()
     m_ready=false;
 #ifdef MEMMAN_TRACING //if management is enabled
     m_critErrors=false;
-    m_head=0;
 #endif
 }
 
@@ -181,36 +532,22 @@ void MPMAMemoryManager::InternalShutdown()
     }
 
     //check if they didn't free memory
-    if (m_head)
+    LeakCollector leaks;
+    leaks.leakedBytes=0;
+    leaks.leakedCount=0;
+    for (nuint i=0; i<TRACE_SHARDS; ++i)
     {
-        SAlloc *cur;
-
-        //lets see how much was leaked total...
-        size_t leakedBytes=0;
-        int leakedCount=0;
-        for (cur=m_head;cur;cur=cur->next)
-        {
-            if (cur->countsAsLeak)
-            {
-                leakedBytes+=cur->size;
-                leakedCount++;
-            }
-        }
-
-        if (leakedCount>0)
-        {
-            ReportLeak("\nTotal memory leaks: "+VaryString((int)leakedBytes)+" bytes in "+VaryString(leakedCount)+" allocation(s).\n");
+        MemTakeSpinLock autoSync(traceShards[i].lock);
+        traceShards[i].allocs.ForEach(leaks);
+    }
 
-            //report all leaks
-            ReportLeak("\n -- List of memory leaks --\n");
-            for (cur=m_head;cur;)
-            {
-                if (cur->countsAsLeak)
-                    ReportLeak(cur->Describe());
+    if (leaks.leakedCount>0)
+    {
+        ReportLeak("\nTotal memory leaks: "+VaryString((int)leaks.leakedBytes)+" bytes in "+VaryString(leaks.leakedCount)+" allocation(s).\n");
 
-                cur=cur->next;
-            }
-        }
+        //report all leaks
+        ReportLeak("\n -- List of memory leaks --\n");
+        ReportLeak(leaks.descriptions);
     }
 
 #endif
@@ -238,12 +575,15 @@ std::string MPMAMemoryManager::SAlloc::Describe()
 //Marks an allocation as "intentionally leaked".  It won't be reported on at framework shutdown.
 void MPMAMemoryManager::MarkAsIntentionallyLeaked(void *mem)
 {
-    MemTakeSpinLock autoSync(syncLock);
-    for (SAlloc *cur=m_head;cur;cur=cur->next)
+    mem=DeallocDifferenceMap(mem, false);
+
     {
-        if (cur->objAddr==mem)
+        TraceShard &shard=traceShards[ShardOf(mem)];
+        MemTakeSpinLock autoSync(shard.lock);
+        AddressTable<SAlloc*>::Slot *found=shard.allocs.Find(mem);
+        if (found)
         {
-            cur->countsAsLeak=false;
+            found->value->countsAsLeak=false;
             return;
         }
     }
@@ -258,7 +598,7 @@ void MPMAMemoryManager::ReportLeak(const std::string &leak)
 }
 
 //records allocation of memory
-void MPMAMemoryManager::TraceAlloc(EMemAllocType type, void *memory, void *object, nuint objectSize, nsint count, const char *file, int line, const char *name)
+void MPMAMemoryManager::TraceAlloc(EMemAllocType type, void *memory, void *object, nuint objectSize, nsint count, const char *file, int line, const char *name, nuint afterPadding)
 {
     if (!memory || !object)
     {
@@ -269,7 +609,8 @@ void MPMAMemoryManager::TraceAlloc(EMemAllocType type, void *memory, void *objec
     }
 
     //create allocation data
-    SAlloc *newAlloc=new SAlloc;
+    TraceShard &shard=traceShards[ShardOf(object)];
+    SAlloc *newAlloc=TakeRecord(shard);
     if (!newAlloc)
     {
         ReportLeak("Alloc node in MemMan to trace an allocation failed to allocated.  Out of memory...?\n");
@@ -285,17 +626,35 @@ void MPMAMemoryManager::TraceAlloc(EMemAllocType type, void *memory, void *objec
     newAlloc->srcLine=line;
     newAlloc->name=name;
     newAlloc->countsAsLeak=m_ready;
+    newAlloc->afterPadding=afterPadding;
+    newAlloc->paddingReported=false;
+    newAlloc->next=0;
+#ifdef HEAP_PROFILER
+    newAlloc->heapSample=MPMA::Internal_HeapProfileAlloc(objectSize);
+#endif
 #ifdef SAVE_ALLOC_CALL_STACK
     newAlloc->allocStack=MISC::StripFirstLine(MPMA::GetCallStack());
 #endif
 
     //pad the allocation
-    SetAllocPadding((uint8*)memory, objectSize);
+    SetAllocPadding((uint8*)memory, objectSize, afterPadding);
+
+    //add it to the table
+    bool added;
+    {
+        MemTakeSpinLock autoSync(shard.lock);
+        added=shard.allocs.Insert(object, newAlloc);
+    }
 
-    //add it to front list
-    MemTakeSpinLock autoSync(syncLock);
-    newAlloc->next=m_head;
-    m_head=newAlloc;
+    if (!added)
+    {
+        ReportLeak("Failed to grow the allocation table in MemMan to trace an allocation.  Out of memory...?\n");
+#ifdef HEAP_PROFILER
+        if (newAlloc->heapSample)
+            MPMA::Internal_HeapProfileFree(newAlloc->heapSample);
+#endif
+        RecycleRecord(shard, newAlloc);
+    }
 }
 
 //records freeing of memory
@@ -327,87 +686,68 @@ EMemAllocType MPMAMemoryManager::TraceFree(EMemAllocType type, volatile void *ob
     //map what they gave us using the differences map
     object=(volatile void*)DeallocDifferenceMap((void*)object, true);
 
-    //
-    MemTakeSpinLock autoSync(syncLock);
-
-    SAlloc *cur;
-    SAlloc *prev=m_head;
-
-    bool found=false;
+    //take it out of the table.  Checking it happens after, so no lock is held while reporting problems.
+    TraceShard &shard=traceShards[ShardOf(object)];
+    SAlloc *cur=0;
+    bool found;
+    {
+        MemTakeSpinLock autoSync(shard.lock);
+        found=shard.allocs.Remove(object, cur);
+    }
 
-    //see if theres even anything allocated
-    if (m_head)
+    if (found)
     {
-        //find it in our list
-        for (cur=m_head;cur;cur=cur->next)
+        //check that correct free method was used
+        if (cur->type!=type)
         {
-            if (cur->objAddr==object) //found it    
-            {
-                found=true;
-
-                //check that correct free method was used
-                if (cur->type!=type)
-                {
-                    m_critErrors=true;
-
-                    ReportLeak("Error: Wrong delete operator used when freeing memory: ");
-                    ReportLeak(cur->Describe());
-
-                    if (cur->type==EMAT_One) ReportLeak("  -Delete array used on memory allocated with new (non-array).\n");
-                    else ReportLeak("  -Delete (non-array) used on memory allocated with new array.\n");
-
-                    if (file!=0)
-                    {
-                        ReportLeak("  -delete call made in "+VaryString(file)+" line "+VaryString(line)+".\n");
-                    }
+            m_critErrors=true;
 
-                    ReportLeak("  -call stack:\n");
-                    ReportLeak(MPMA::GetCallStack());
+            ReportLeak("Error: Wrong delete operator used when freeing memory: ");
+            ReportLeak(cur->Describe());
 
-                    realType=cur->type;
-                }
+            if (cur->type==EMAT_One) ReportLeak("  -Delete array used on memory allocated with new (non-array).\n");
+            else ReportLeak("  -Delete (non-array) used on memory allocated with new array.\n");
 
-                //check padding around the allocation
-                if (VerifyAllocPadding((uint8*)cur->allocMem, cur->size))
-                {
-                    m_critErrors=true;
-                    ReportLeak(cur->Describe());
-                    ReportLeak("  -call stack:\n");
-                    ReportLeak(MPMA::GetCallStack());
-                }
+            if (file!=0)
+            {
+                ReportLeak("  -delete call made in "+VaryString(file)+" line "+VaryString(line)+".\n");
+            }
 
-                //output params
-                if (outCount) *outCount=cur->count;
-                if (outObjectSize) *outObjectSize=cur->size;
-                outAllocMem=(char*)cur->allocMem;
+            ReportLeak("  -call stack:\n");
+            ReportLeak(MPMA::GetCallStack());
 
-                //if saving old ones, save a copy
-                #ifdef MEM_TRACK_OLD_FREE
-                    oldFreedAllocs.push_back(*cur);
-                    oldFreedAllocs.back().next=0;
-                    oldFreedAllocs.back().deleteStack=MISC::StripFirstLine(MPMA::GetCallStack());
-                #endif
+            realType=cur->type;
+        }
 
-                //remove from list
-                if (cur==m_head)
-                {
-                    m_head=m_head->next;
-                    delete cur;
-                    cur=0;
-                }
-                else
-                {
-                    prev->next=cur->next;
-                    delete cur;
-                    cur=0;
-                }
+        //check padding around the allocation
+        if (VerifyAllocPadding((uint8*)cur->allocMem, cur->size, cur->afterPadding))
+        {
+            m_critErrors=true;
+            ReportLeak(cur->Describe());
+            ReportLeak("  -call stack:\n");
+            ReportLeak(MPMA::GetCallStack());
+        }
 
-                //
-                break;
-            }
+        //output params
+        if (outCount) *outCount=cur->count;
+        if (outObjectSize) *outObjectSize=cur->size;
+        outAllocMem=(char*)cur->allocMem;
 
-            prev=cur;
+        //if saving old ones, save a copy
+        #ifdef MEM_TRACK_OLD_FREE
+        {
+            MemTakeSpinLock autoSync(syncLock);
+            oldFreedAllocs.push_back(*cur);
+            oldFreedAllocs.back().next=0;
+            oldFreedAllocs.back().deleteStack=MISC::StripFirstLine(MPMA::GetCallStack());
         }
+        #endif
+
+#ifdef HEAP_PROFILER
+        if (cur->heapSample)
+            MPMA::Internal_HeapProfileFree(cur->heapSample);
+#endif
+        RecycleRecord(shard, cur);
     }
 
     //if it wasn't found, they are deleting bad memory
@@ -426,6 +766,7 @@ EMemAllocType MPMAMemoryManager::TraceFree(EMemAllocType type, volatile void *ob
 
         //check old records
         #ifdef MEM_TRACK_OLD_FREE
+        MemTakeSpinLock autoSync(syncLock);
         bool oldFound=false;
         for (std::vector<MPMAMemoryManager::SAlloc>::iterator i=oldFreedAllocs.begin(); i!=oldFreedAllocs.end(); ++i)
         {
@@ -452,57 +793,172 @@ EMemAllocType MPMAMemoryManager::TraceFree(EMemAllocType type, volatile void *ob
 //checks for memory corruption around all allocated memory
 void MPMAMemoryManager::CheckForPaddingCorruption()
 {
-    MemTakeSpinLock autoSync(syncLock);
+    CorruptionCollector corrupt;
+    for (nuint i=0; i<TRACE_SHARDS; ++i)
+    {
+        MemTakeSpinLock autoSync(traceShards[i].lock);
+        traceShards[i].allocs.ForEach(corrupt);
+    }
 
-    for (SAlloc *cur=m_head; cur; cur=cur->next)
+    for (std::list<std::string>::iterator e=corrupt.errors.begin(); e!=corrupt.errors.end(); ++e)
     {
-        if (VerifyAllocPadding((uint8*)cur->allocMem, cur->size))
+        m_critErrors=true;
+        ReportLeak(*e);
+    }
+}
+
+//Checks for memory corruption around some of the allocated memory, continuing from where the last call left off.
+bool MPMAMemoryManager::CheckForPaddingCorruptionIncremental(double maxSeconds, nuint maxAllocations)
+{
+    MPMA::Timer timer;
+    CorruptionCollector corrupt(true);
+    bool finishedPass=false;
+
+    {
+        MemTakeSpinLock scanSync(scanPosition.lock);
+        nuint checkedCount=0;
+        while (!finishedPass && checkedCount<maxAllocations)
         {
-            m_critErrors=true;
-            std::string error="Memory corruption detected.\n";
+            {
+                TraceShard &shard=traceShards[scanPosition.shard];
+                MemTakeSpinLock autoSync(shard.lock);
+
+                //the table may have been resized since the last slice, which at worst means some allocations are checked twice or not until the next pass
+                AddressTable<SAlloc*> &table=shard.allocs;
+                nuint end=scanPosition.slot+SCAN_SLOTS_PER_LOCK;
+                if (end>table.capacity)
+                    end=table.capacity;
+                for (; scanPosition.slot<end && checkedCount<maxAllocations; ++scanPosition.slot)
+                {
+                    const volatile void *key=table.slots[scanPosition.slot].key;
+                    if (key!=0 && key!=AddressTable<SAlloc*>::Removed())
+                    {
+                        corrupt(table.slots[scanPosition.slot].value);
+                        ++checkedCount;
+                    }
+                }
 
-            error+=cur->Describe();
-            ReportLeak(error);
+                if (scanPosition.slot>=table.capacity)
+                {
+                    scanPosition.slot=0;
+                    if (++scanPosition.shard==TRACE_SHARDS)
+                    {
+                        scanPosition.shard=0;
+                        ++scanPosition.passes;
+                        finishedPass=true;
+                    }
+                }
+            }
+
+            if (timer.Step(false)>=maxSeconds)
+                break;
         }
     }
+
+    for (std::list<std::string>::iterator e=corrupt.errors.begin(); e!=corrupt.errors.end(); ++e)
+    {
+        m_critErrors=true;
+        ReportLeak(*e);
+    }
+
+    return finishedPass;
 }
 
-//checks if a pointer is an allocated object
-bool MPMAMemoryManager::IsPointerAnObject(void *p)
+//Starts a low priority thread that checks for memory corruption a slice at a time.
+void MPMAMemoryManager::StartBackgroundPaddingScan(double secondsPerSlice, nuint sleepMilliseconds)
 {
-    p=(void*)DeallocDifferenceMap((void*)p, false);
+    backgroundScan.secondsPerSlice=secondsPerSlice;
+    backgroundScan.sleepMilliseconds=sleepMilliseconds;
+    if (backgroundScan.thread)
+        return;
 
-    MemTakeSpinLock autoSync(syncLock);
+    backgroundScan.thread=new3(MPMA::Thread(BackgroundScanThread, 0));
+    backgroundScan.thread->SetPriority(MPMA::THREAD_LOW);
+}
 
-    for (SAlloc *cur=m_head; cur; cur=cur->next)
+//Stops the thread from StartBackgroundPaddingScan.
+void MPMAMemoryManager::StopBackgroundPaddingScan()
+{
+    if (backgroundScan.thread)
     {
-        if (cur->objAddr==p)
+        delete3(backgroundScan.thread);
+        backgroundScan.thread=0;
+    }
+}
+
+//Returns how many full passes over all allocations the incremental check has finished.
+nuint MPMAMemoryManager::GetPaddingScanPassCount() const
+{
+    MemTakeSpinLock scanSync(scanPosition.lock);
+    return scanPosition.passes;
+}
+
+//Allocations of at least minSize bytes are placed right before an inaccessible page of memory.
+void MPMAMemoryManager::SetGuardPageMinSize(nuint minSize)
+{
+    if (minSize!=0)
+        MPMA::AtomicStore(&guardPagesUsed, (nuint)1, MPMA::MEMORY_ORDER_RELAXED);
+    MPMA::AtomicStore(&guardPageMinSize, minSize, MPMA::MEMORY_ORDER_RELAXED);
+}
+
+//frees the memory given back by TraceFree
+void MPMAMemoryManager::FreeTracedMemory(char *mem)
+{
+    if (!mem)
+        return;
+
+    if (MPMA::AtomicLoad(&guardPagesUsed, MPMA::MEMORY_ORDER_RELAXED))
+    {
+        nuint mapped;
+        bool guarded;
         {
-            return true;
+            GuardedShard &shard=guardedShards[ShardOf(mem)];
+            MemTakeSpinLock autoSync(shard.lock);
+            guarded=shard.mappedSizes.Remove(mem, mapped);
+        }
+
+        if (guarded)
+        {
+            //the allocation always starts in the first page that was mapped
+            nuint pageSize=MPMA::Internal_GetPageSize();
+            MPMA::Internal_FreeGuardedPages((void*)((nuint)mem&~(pageSize-1)), mapped);
+            return;
         }
     }
 
-    return false;
+    delete[] mem;
+}
+
+//checks if a pointer is an allocated object
+bool MPMAMemoryManager::IsPointerAnObject(void *p)
+{
+    p=(void*)DeallocDifferenceMap((void*)p, false);
+
+    TraceShard &shard=traceShards[ShardOf(p)];
+    MemTakeSpinLock autoSync(shard.lock);
+    return shard.allocs.Find(p)!=0;
 }
 
 // -- operator overloads for new and delete
 
 void* operator new(size_t objLen, MPMAMemoryManager *theMan, const char *file, int line, const char *name)
 {
-    char *mem=new char[objLen+2*dbgN2_padding];
-    memset(mem, 0x7f, objLen+2*dbgN2_padding); //fill with crud
+    nuint afterPadding;
+    char *mem=AllocTracedMemory(objLen, afterPadding);
     char *obj=mem+dbgN2_padding;
-    theMan->TraceAlloc(EMAT_One, mem, obj, objLen, 1, file, line, name);
+    memset(obj, 0x7f, objLen); //fill with crud
+    theMan->TraceAlloc(EMAT_One, mem, obj, objLen, 1, file, line, name, afterPadding);
     MPMAMemoryManager::AllocDifferenceMapStart(obj);
     return obj;
 }
 
 void* operator new[](size_t objLen, MPMAMemoryManager *theMan, size_t count, const char *file, int line, const char *name)
 {
-    char *mem=new char[objLen+2*dbgN2_padding];
-    memset(mem, 0x7f, objLen+2*dbgN2_padding); //fill with crud
+    nuint afterPadding;
+    char *mem=AllocTracedMemory(objLen, afterPadding);
     char *obj=mem+dbgN2_padding;
-    theMan->TraceAlloc(EMAT_Array, mem, obj, objLen, (nuint)count, file, line, name);
+    memset(obj, 0x7f, objLen); //fill with crud
+    theMan->TraceAlloc(EMAT_Array, mem, obj, objLen, (nuint)count, file, line, name, afterPadding);
     MPMAMemoryManager::AllocDifferenceMapStart(obj);
     return obj;
 }
@@ -513,7 +969,7 @@ void operator delete(void *obj, MPMAMemoryManager *theMan, const char *file, int
     nsint size=0;
     theMan->TraceFree(EMAT_One, obj, memory, &size, 0, file, line);
     memset(obj, 0x7e, size); //fill with crud
-    delete[] memory;
+    MPMAMemoryManager::FreeTracedMemory(memory);
 }
 
 void operator delete[](void *obj, MPMAMemoryManager *theMan, size_t count, const char *file, int line, const char *name)
@@ -522,7 +978,7 @@ void operator delete[](void *obj, MPMAMemoryManager *theMan, size_t count, const
     nsint size=0;
     theMan->TraceFree(EMAT_Array, obj, memory, &size, 0, file, line);
     memset(obj, 0x7e, size); //fill with crud
-    delete[] memory;
+    MPMAMemoryManager::FreeTracedMemory(memory);
 }
 
 // -- allocation difference mapping
@@ -566,28 +1022,34 @@ void MPMAMemoryManager::AllocDifferenceMapEnd(void *mem)
         return;
     }
 
-    SMapAllocDifference diff;
-    diff.returned=mem;
-    diff.actual=allocDiffStartValue;
-    allocDiffStartValue=0;
+    bool added;
+    {
+        AllocDifferenceShard &shard=allocDifferenceShards[ShardOf(mem)];
+        MemTakeSpinLock takeLock(shard.lock);
+        added=shard.differences.Insert(mem, allocDiffStartValue);
+    }
 
-    MemTakeSpinLock takeLock(allocDiffLock);
-    mpmaMemoryManager.allocDifferences.emplace_back(std::move(diff));
+    if (!added)
+        mpmaMemoryManager.ReportLeak("Failed to grow the allocation difference table in MemMan.  Out of memory...?  Tracking may be wrong now.\n");
 }
 
 void* MPMAMemoryManager::DeallocDifferenceMap(void *mem, bool pop)
 {
-    //if it's in the list, return that item and remove it from the list... else it wasn't a deviation so just return it.
-    MemTakeSpinLock takeLock(allocDiffLock);
-    for (std::list<SMapAllocDifference>::iterator i=mpmaMemoryManager.allocDifferences.begin(); i!=mpmaMemoryManager.allocDifferences.end(); ++i)
+    //if it's in the table, return that item and remove it from the table... else it wasn't a deviation so just return it.
+    AllocDifferenceShard &shard=allocDifferenceShards[ShardOf(mem)];
+    MemTakeSpinLock takeLock(shard.lock);
+
+    void *actual;
+    if (pop)
     {
-        if (i->returned==mem)
-        {
-            void *actual=i->actual;
-            if (pop)
-                mpmaMemoryManager.allocDifferences.erase(i);
+        if (shard.differences.Remove(mem, actual))
             return actual;
-        }
+    }
+    else
+    {
+        AddressTable<void*>::Slot *found=shard.differences.Find(mem);
+        if (found)
+            return found->value;
     }
 
     return mem;
@@ -34,6 +34,18 @@
 #include <string.h> //for memset
 #include "Types.h"
 
+#if !defined(MEMMAN_TRACING) && defined(SMALLOBJECT_ALLOCATOR)
+    #include <type_traits>
+    #include "SmallObjects.h"
+#endif
+
+#ifdef HEAP_PROFILER
+namespace MPMA
+{
+    struct Internal_HeapSample;
+}
+#endif
+
 //internal use
 enum EMemAllocType
 {
@@ -55,8 +67,8 @@ public:
 
     // -- internal use below
 
-    //used by the allocation scheme, do not call directly - traces an alloc or free
-    void TraceAlloc(EMemAllocType type, void *memory, void *object, nuint objectSize, nsint count, const char *file, int line, const char *name);
+    //used by the allocation scheme, do not call directly - traces an alloc or free.  afterPadding is the number of check bytes after the object.
+    void TraceAlloc(EMemAllocType type, void *memory, void *object, nuint objectSize, nsint count, const char *file, int line, const char *name, nuint afterPadding);
     EMemAllocType TraceFree(EMemAllocType type, volatile void *object, char *&outAllocMem, nsint *outObjectSize, nsint *outCount, const char *file, int line);
 
     //used by the allocation scheme, do not call directly
@@ -70,6 +82,21 @@ public:
 
     //checks for memory corruption around all allocated memory
     inline void CheckForPaddingCorruption() {}
+
+    //checks for memory corruption around some of the allocated memory
+    inline bool CheckForPaddingCorruptionIncremental(double maxSeconds, nuint maxAllocations=~(nuint)0)
+        { return true; }
+
+    //checks for memory corruption on a low priority thread
+    inline void StartBackgroundPaddingScan(double secondsPerSlice=0.001, nuint sleepMilliseconds=10) {}
+    inline void StopBackgroundPaddingScan() {}
+
+    //number of full passes CheckForPaddingCorruptionIncremental has finished (always 0 if management is disabled)
+    inline nuint GetPaddingScanPassCount() const
+        { return 0; }
+
+    //puts large allocations right before an inaccessible page
+    inline void SetGuardPageMinSize(nuint minSize) {}
 #endif
 
 #ifdef MEMMAN_TRACING // -- if using management --
@@ -77,9 +104,25 @@ public:
     //Returns if a specific pointer is an allocated object (always returns true if management is disabled)
     bool IsPointerAnObject(void *p);
 
-    //checks for memory corruption around all allocated memory
+    //checks for memory corruption around all allocated memory.  This holds up the caller until every allocation is checked, so see below for ways to spread the checks out.
     void CheckForPaddingCorruption();
 
+    //!Checks for memory corruption around some of the allocated memory, continuing from where the last call left off.  Stops after maxSeconds, or once maxAllocations have been checked.  Returns true if this call finished a pass over every allocation.  Call this once per frame to check everything over time.
+    //!Each damaged allocation is only reported once by this (it is reported again when it is freed).
+    bool CheckForPaddingCorruptionIncremental(double maxSeconds, nuint maxAllocations=~(nuint)0);
+
+    //!Starts a low priority thread that calls CheckForPaddingCorruptionIncremental with a budget of secondsPerSlice, every sleepMilliseconds.  It is stopped at framework shutdown.
+    void StartBackgroundPaddingScan(double secondsPerSlice=0.001, nuint sleepMilliseconds=10);
+
+    //!Stops the thread from StartBackgroundPaddingScan.
+    void StopBackgroundPaddingScan();
+
+    //!Returns how many full passes over all allocations CheckForPaddingCorruptionIncremental has finished.
+    nuint GetPaddingScanPassCount() const;
+
+    //!Allocations of at least minSize bytes are placed right before an inaccessible page of memory, so writing past their end crashes right away instead of being found later by the padding checks.  Each one takes at least two pages of memory.  0 turns this off.  Memory that was already allocated is not affected.
+    void SetGuardPageMinSize(nuint minSize);
+
     struct SAlloc
     {
         EMemAllocType type;
@@ -93,8 +136,13 @@ public:
         std::string deleteStack;
         std::string name;
         bool countsAsLeak; //true for anything allocated between init and shutdown
+        nuint afterPadding; //check bytes after the object (less for allocations that end at a guard page)
+        bool paddingReported; //damage was already reported by an incremental check
+#ifdef HEAP_PROFILER
+        MPMA::Internal_HeapSample *heapSample; //set if the heap profiler sampled this allocation
+#endif
 
-        SAlloc *next;
+        SAlloc *next; //used to keep unused records for reuse
 
         std::string Describe();
     };
@@ -102,21 +150,12 @@ public:
 private:
     bool m_critErrors; //did any critical memory errors occur?
 
-    SAlloc *m_head; //first item in linked list of allocations
-
     //used internally
-    bool VerifyAllocPadding(uint8 *mem, nuint objSize);
-
-    //used as part of mapping the difference between the memory we provide for an object and the memory new return to the caller
-    struct SMapAllocDifference
-    {
-        void *actual;
-        void *returned;
-    };
-    std::list<SMapAllocDifference> allocDifferences;
+    bool VerifyAllocPadding(uint8 *mem, nuint objSize, nuint afterPadding);
 
 #endif // -- end if using management --
 
+
     //calls back to the leak report callbacks
     void ReportLeak(const std::string &leak);
 
@@ -149,8 +188,29 @@ public: //internal use, do not call directly
     static void AllocDifferenceMapEnd(void *mem);
 
     static void* DeallocDifferenceMap(void *mem, bool pop);
+
+    //frees the memory given back by TraceFree
+    static void FreeTracedMemory(char *mem);
 #endif // -- end if using management --
 
+#if !defined(MEMMAN_TRACING) && defined(SMALLOBJECT_ALLOCATOR) // -- if using the small object allocator --
+    //destructs an object and frees it.  The memory starts at the most derived object, which may not be where a base class pointer points.
+    template <typename T> static void smallN3_Delete(T *obj)
+    {
+        if (!obj)
+            return;
+
+        void *mem=smallN3_ObjectStart(obj, std::is_polymorphic<T>());
+        obj->~T();
+        MPMA::SmallObjectFree(mem);
+    }
+
+    template <typename T> static inline void* smallN3_ObjectStart(T *obj, std::true_type)
+        { return const_cast<void*>(dynamic_cast<const volatile void*>(obj)); }
+    template <typename T> static inline void* smallN3_ObjectStart(T *obj, std::false_type)
+        { return (void*)obj; }
+#endif // -- end if using the small object allocator --
+
     MPMAMemoryManager();
     ~MPMAMemoryManager();
 
@@ -194,7 +254,7 @@ do { \
     if (type==EMAT_One) MPMAMemoryManager::dbgN2_Destruct(obj); \
     else if (type==EMAT_Array) MPMAMemoryManager::dbgN2_Destruct_array(obj, count); \
     memset(pObj, 0x7e, objSize); \
-    delete[] realMem; \
+    MPMAMemoryManager::FreeTracedMemory(realMem); \
     *((nuint**)&obj)=(nuint*)-1; \
 } while(false)
 
@@ -210,12 +270,39 @@ do { \
     if (type==EMAT_One) MPMAMemoryManager::dbgN2_Destruct(obj); \
     else if (type==EMAT_Array) MPMAMemoryManager::dbgN2_Destruct_array(obj, count); \
     memset(pObj, 0x7e, objSize); \
-    delete[] realMem; \
+    MPMAMemoryManager::FreeTracedMemory(realMem); \
     *((nuint**)&obj)=(nuint*)-1; \
 } while(false)
 
 #define delete2_array(obj) delete3_array(obj)
 
+#elif defined(SMALLOBJECT_ALLOCATOR) // -- if using the small object allocator --
+
+//internal use: picks the allocators below
+struct MPMASmallObjectTag {};
+
+inline void* operator new(size_t objLen, const MPMASmallObjectTag&)
+    { return MPMA::SmallObjectAlloc(objLen); }
+inline void operator delete(void *obj, const MPMASmallObjectTag&) //only used if a constructor throws
+    { MPMA::SmallObjectFree(obj); }
+
+#ifdef __cpp_aligned_new
+inline void* operator new(size_t objLen, std::align_val_t alignment, const MPMASmallObjectTag&)
+    { return MPMA::SmallObjectAllocAligned(objLen, (nuint)alignment); }
+inline void operator delete(void *obj, std::align_val_t, const MPMASmallObjectTag&)
+    { MPMA::SmallObjectFree(obj); }
+#endif
+
+    #define new3(obj) new (MPMASmallObjectTag()) obj
+    #define new2(obj,junk) new3(obj)
+    #define new3_array(obj,count) new obj[count]
+    #define new2_array(obj,count,junk) new obj[count]
+
+    #define delete3(obj) MPMAMemoryManager::smallN3_Delete(obj)
+    #define delete2(obj) delete3(obj)
+    #define delete3_array(obj) delete[] obj
+    #define delete2_array(obj) delete[] obj
+
 #else // -- if NOT using management --
 
     #define new3(obj) new obj
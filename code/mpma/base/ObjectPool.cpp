@@ -0,0 +1,509 @@
+//Pools of same-typed objects, with a cache of free objects on each thread.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "ObjectPool.h"
+#include "Atomic.h"
+#include "Locks.h"
+#include "Info.h"
+#include "Memory.h"
+#include "../Setup.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace MPMA
+{
+    extern void Sleep(nuint time);
+}
+
+namespace
+{
+    //number of pools that get a cache on each thread
+    const nuint MAX_CACHED_POOLS=64;
+
+    //number of pools that are reported in the stats
+    const nuint MAX_REPORTED_POOLS=256;
+
+    //number of slots moved between a thread's cache and the shared list at once
+    const nuint CACHE_BATCH=16;
+
+    //a thread's counts for a pool are added to the pool's after this many objects are created, if they were not already
+    const nuint COUNT_FOLD_INTERVAL=256;
+
+    //all of this is zero initialized static data, so pools can be created during static construction
+    MPMA::Internal_ObjectPoolCore *volatile cachedPools[MAX_CACHED_POOLS];
+    volatile nuint cachedPoolCount=0;
+    MPMA::Internal_ObjectPoolCore *volatile reportedPools[MAX_REPORTED_POOLS];
+
+    inline nuint AlignUp(nuint value, nuint alignment)
+    {
+        return (value+alignment-1)&~(alignment-1);
+    }
+
+    //at the start of each slab, before its slots
+    struct SlabHeader
+    {
+        uint8 *next;
+        nuint objectCount;
+    };
+
+    //a spin-lock that never allocates, like the small object allocator uses
+    class TakePoolLock
+    {
+    public:
+        inline TakePoolLock(volatile nuint &plock): locker(plock)
+        {
+            while (MPMA::AtomicExchange(&locker, (nuint)1, MPMA::MEMORY_ORDER_ACQUIRE)!=0)
+            {
+                do
+                {
+                    if (MPMA::SystemInfo::SuggestSleepInSpinlock)
+                        MPMA::Sleep(0);
+                    else
+                        MPMA::CpuPause();
+                } while (MPMA::AtomicLoad(&locker, MPMA::MEMORY_ORDER_RELAXED)!=0);
+            }
+        }
+
+        inline ~TakePoolLock()
+        {
+            MPMA::AtomicStore(&locker, (nuint)0, MPMA::MEMORY_ORDER_RELEASE);
+        }
+
+    private:
+        volatile nuint &locker;
+
+        void operator=(const TakePoolLock &notallowed);
+    };
+
+    //raises a max to value if it's bigger
+    void RaiseMax(volatile nuint *max, nuint value)
+    {
+        nuint current=MPMA::AtomicLoad(max, MPMA::MEMORY_ORDER_RELAXED);
+        while (value>current && !MPMA::AtomicCompareAndSwap(max, current, value, MPMA::MEMORY_ORDER_RELAXED))
+            {}
+    }
+
+    // -- per thread caches
+
+    struct PoolCache
+    {
+        MPMA::Internal_ObjectPoolSlot *freeList;
+        nuint freeCount;
+        nuint generation; //the pool's generation when these slots were taken
+
+        //changes to the pool's counts that have not been added to it yet, so that creating an object doesn't need any locked operations
+        nsint liveDelta;
+        nuint created;
+    };
+
+    //adds a thread's counts to its pool
+    inline void FoldCounts(MPMA::Internal_ObjectPoolCore *pool, PoolCache &cache)
+    {
+        pool->AddCounts(cache.liveDelta, cache.created);
+        cache.liveDelta=0;
+        cache.created=0;
+    }
+
+    struct ThreadCache
+    {
+        PoolCache pools[MAX_CACHED_POOLS];
+    };
+
+    THREAD_LOCAL ThreadCache *threadCache=0;
+    THREAD_LOCAL bool threadCacheGone=false; //set once the thread is exiting, after which slots go straight to the shared lists
+
+    //gives a pool's cached slots and counts back to the pool
+    void FlushPoolCache(MPMA::Internal_ObjectPoolCore *pool, PoolCache &cache)
+    {
+        if (pool && cache.generation==MPMA::AtomicLoad(&pool->generation, MPMA::MEMORY_ORDER_ACQUIRE))
+        {
+            if (cache.freeList)
+            {
+                MPMA::Internal_ObjectPoolSlot *last=cache.freeList;
+                while (last->next)
+                    last=last->next;
+                pool->ReturnShared(cache.freeList, last);
+            }
+            FoldCounts(pool, cache);
+            MPMA::AtomicFetchAdd(&pool->cachingThreads, (nuint)-1, MPMA::MEMORY_ORDER_RELEASE);
+        }
+
+        cache.freeList=0;
+        cache.freeCount=0;
+        cache.liveDelta=0;
+        cache.created=0;
+    }
+
+    //gives the thread's cache back when the thread exits
+    struct ThreadCacheOwner
+    {
+        ThreadCache *cache;
+
+        ~ThreadCacheOwner()
+        {
+            if (cache)
+            {
+                for (nuint i=0; i<MAX_CACHED_POOLS; ++i)
+                    FlushPoolCache(MPMA::AtomicLoad(&cachedPools[i], MPMA::MEMORY_ORDER_ACQUIRE), cache->pools[i]);
+                free(cache);
+            }
+            threadCache=0;
+            threadCacheGone=true;
+        }
+    };
+
+    thread_local ThreadCacheOwner threadCacheOwner={0};
+
+    //returns the calling thread's cache for a pool, creating it if needed.  Returns 0 if the pool or thread doesn't have one.
+    inline PoolCache* GetPoolCache(MPMA::Internal_ObjectPoolCore *pool, nuint cacheIndex, nuint generation)
+    {
+        if (cacheIndex>=MAX_CACHED_POOLS)
+            return 0;
+
+        ThreadCache *cache=threadCache;
+        if (!cache)
+        {
+            if (threadCacheGone)
+                return 0;
+
+            cache=(ThreadCache*)calloc(1, sizeof(ThreadCache));
+            if (!cache)
+                return 0;
+
+            threadCacheOwner.cache=cache;
+            threadCache=cache;
+        }
+
+        //anything left from before the pool freed its memory is gone
+        PoolCache &poolCache=cache->pools[cacheIndex];
+        if (poolCache.generation!=generation)
+        {
+            poolCache.freeList=0;
+            poolCache.freeCount=0;
+            poolCache.generation=generation;
+            poolCache.liveDelta=0;
+            poolCache.created=0;
+            MPMA::AtomicFetchAdd(&pool->cachingThreads, (nuint)1, MPMA::MEMORY_ORDER_ACQUIRE);
+        }
+        return &poolCache;
+    }
+}
+
+namespace MPMA
+{
+    // -- Internal_ObjectPoolCore
+
+    Internal_ObjectPoolCore::Internal_ObjectPoolCore(const char *poolName, nuint objectSize, nuint objectAlignment, nuint objectsPerSlab, void (*destructObject)(void*)):
+        generation(1), cachingThreads(0), name(poolName), destructor(destructObject), lock(0), slabs(0), slabCount(0), sharedFree(0), capacity(0), liveObjects(0), peakLiveObjects(0), totalCreated(0)
+    {
+        alignment=(objectAlignment>sizeof(void*)) ? objectAlignment : sizeof(void*);
+        headerSize=AlignUp(sizeof(Internal_ObjectPoolSlot), alignment);
+        stride=AlignUp(headerSize+objectSize, alignment);
+        slabObjects=(objectsPerSlab>0) ? objectsPerSlab : 1;
+
+        cacheIndex=AtomicFetchAdd(&cachedPoolCount, (nuint)1);
+        if (cacheIndex<MAX_CACHED_POOLS)
+            AtomicStore(&cachedPools[cacheIndex], this, MEMORY_ORDER_RELEASE);
+        else
+            cacheIndex=MAX_CACHED_POOLS;
+
+        for (nuint i=0; i<MAX_REPORTED_POOLS; ++i)
+        {
+            Internal_ObjectPoolCore *expected=0;
+            if (AtomicCompareAndSwap(&reportedPools[i], expected, this, MEMORY_ORDER_ACQ_REL))
+                break;
+        }
+    }
+
+    Internal_ObjectPoolCore::~Internal_ObjectPoolCore()
+    {
+        if (cacheIndex<MAX_CACHED_POOLS)
+            AtomicStore(&cachedPools[cacheIndex], (Internal_ObjectPoolCore*)0, MEMORY_ORDER_RELEASE);
+
+        for (nuint i=0; i<MAX_REPORTED_POOLS; ++i)
+        {
+            Internal_ObjectPoolCore *expected=this;
+            if (AtomicCompareAndSwap(&reportedPools[i], expected, (Internal_ObjectPoolCore*)0, MEMORY_ORDER_ACQ_REL))
+                break;
+        }
+
+        //objects that are still in use are leaked along with their slabs, rather than pulled out from under whoever has them
+        FreeAllIfUnused();
+    }
+
+    //returns a free slot, from this thread's cache if it can
+    Internal_ObjectPoolSlot* Internal_ObjectPoolCore::AllocSlot()
+    {
+        PoolCache *cache=GetPoolCache(this, cacheIndex, AtomicLoad(&generation, MEMORY_ORDER_ACQUIRE));
+        if (!cache)
+        {
+            nuint taken;
+            Internal_ObjectPoolSlot *slot=TakeShared(1, taken);
+            AddCounts(1, 1);
+            return slot;
+        }
+
+        if (!cache->freeList)
+        {
+            cache->freeList=TakeShared(CACHE_BATCH, cache->freeCount);
+            FoldCounts(this, *cache);
+        }
+
+        Internal_ObjectPoolSlot *slot=cache->freeList;
+        cache->freeList=slot->next;
+        --cache->freeCount;
+
+        ++cache->liveDelta;
+        if (++cache->created>=COUNT_FOLD_INTERVAL)
+            FoldCounts(this, *cache);
+        return slot;
+    }
+
+    //returns a slot to this thread's cache, passing some on to the shared list if the cache gets too big
+    void Internal_ObjectPoolCore::FreeSlot(Internal_ObjectPoolSlot *slot)
+    {
+        PoolCache *cache=GetPoolCache(this, cacheIndex, AtomicLoad(&generation, MEMORY_ORDER_ACQUIRE));
+        if (!cache)
+        {
+            slot->next=0;
+            ReturnShared(slot, slot);
+            AddCounts(-1, 0);
+            return;
+        }
+
+        slot->next=cache->freeList;
+        cache->freeList=slot;
+        ++cache->freeCount;
+        --cache->liveDelta;
+
+        if (cache->freeCount>=CACHE_BATCH*2)
+        {
+            Internal_ObjectPoolSlot *first=cache->freeList;
+            Internal_ObjectPoolSlot *last=first;
+            for (nuint i=1; i<CACHE_BATCH; ++i)
+                last=last->next;
+
+            cache->freeList=last->next;
+            cache->freeCount-=CACHE_BATCH;
+            last->next=0;
+            ReturnShared(first, last);
+            FoldCounts(this, *cache);
+        }
+    }
+
+    //takes up to count slots from the shared list, and returns them linked together.  Throws std::bad_alloc if there are none and no more can be allocated.
+    Internal_ObjectPoolSlot* Internal_ObjectPoolCore::TakeShared(nuint count, nuint &outTaken)
+    {
+        TakePoolLock takeLock(lock);
+        if (!sharedFree && !AddSlab(slabObjects))
+            throw std::bad_alloc();
+
+        Internal_ObjectPoolSlot *first=sharedFree;
+        Internal_ObjectPoolSlot *last=first;
+        outTaken=1;
+        while (outTaken<count && last->next)
+        {
+            last=last->next;
+            ++outTaken;
+        }
+
+        sharedFree=last->next;
+        last->next=0;
+        return first;
+    }
+
+    //puts a linked list of slots back on the shared list
+    void Internal_ObjectPoolCore::ReturnShared(Internal_ObjectPoolSlot *first, Internal_ObjectPoolSlot *last)
+    {
+        TakePoolLock takeLock(lock);
+        last->next=sharedFree;
+        sharedFree=first;
+    }
+
+    //adds to the number of objects that are in use and have been created
+    void Internal_ObjectPoolCore::AddCounts(nsint liveDelta, nuint created)
+    {
+        if (liveDelta!=0)
+        {
+            nuint live=AtomicFetchAdd(&liveObjects, (nuint)liveDelta, MEMORY_ORDER_RELAXED)+(nuint)liveDelta;
+            if (liveDelta>0)
+                RaiseMax(&peakLiveObjects, live);
+        }
+        if (created!=0)
+            AtomicFetchAdd(&totalCreated, (uint64)created, MEMORY_ORDER_RELAXED);
+    }
+
+    //makes sure there are at least count slots in the pool
+    void Internal_ObjectPoolCore::Preallocate(nuint count)
+    {
+        TakePoolLock takeLock(lock);
+        if (capacity<count)
+            AddSlab(count-capacity);
+    }
+
+    //frees all of the pool's memory if nothing is using it
+    bool Internal_ObjectPoolCore::FreeAllIfUnused()
+    {
+        //only the calling thread's counts can be added in from here.  Another thread's cache may hold counts for objects that are still in use, so if any other thread has one, the memory is kept.
+        nuint ownCaches=0;
+        if (cacheIndex<MAX_CACHED_POOLS && threadCache)
+        {
+            PoolCache &cache=threadCache->pools[cacheIndex];
+            if (cache.generation==AtomicLoad(&generation, MEMORY_ORDER_ACQUIRE))
+            {
+                FoldCounts(this, cache);
+                ownCaches=1;
+            }
+        }
+
+        TakePoolLock takeLock(lock);
+        if (AtomicLoad(&cachingThreads, MEMORY_ORDER_ACQUIRE)!=ownCaches || AtomicLoad(&liveObjects, MEMORY_ORDER_ACQUIRE)!=0)
+            return false;
+
+        FreeSlabs();
+        return true;
+    }
+
+    //Returns the occupancy of the pool.
+    ObjectPoolStats Internal_ObjectPoolCore::GetStats() const
+    {
+        ObjectPoolStats stats;
+        stats.name=name;
+        stats.objectSize=stride;
+        stats.liveObjects=AtomicLoad(&liveObjects, MEMORY_ORDER_RELAXED);
+        stats.peakLiveObjects=AtomicLoad(&peakLiveObjects, MEMORY_ORDER_RELAXED);
+        stats.capacity=capacity;
+        stats.slabCount=slabCount;
+        stats.totalCreated=AtomicLoad(&totalCreated, MEMORY_ORDER_RELAXED);
+        return stats;
+    }
+
+    //allocates a slab of objectCount slots and puts them on the shared list
+    bool Internal_ObjectPoolCore::AddSlab(nuint objectCount)
+    {
+        uint8 *slab;
+        try
+        {
+            slab=new3_array(uint8, sizeof(SlabHeader)+alignment+objectCount*stride);
+        }
+        catch (std::bad_alloc&)
+        {
+            return false;
+        }
+
+        SlabHeader *header=(SlabHeader*)slab;
+        header->next=slabs;
+        header->objectCount=objectCount;
+        slabs=slab;
+        ++slabCount;
+
+        //link them so the first slot is handed out first
+        uint8 *first=(uint8*)AlignUp((nuint)(slab+sizeof(SlabHeader)), alignment);
+        for (nuint i=objectCount; i>0; --i)
+        {
+            Internal_ObjectPoolSlot *slot=(Internal_ObjectPoolSlot*)(first+(i-1)*stride);
+            slot->constructed=0;
+            slot->next=sharedFree;
+            sharedFree=slot;
+        }
+
+        capacity+=objectCount;
+        return true;
+    }
+
+    //destructs any recycled objects and frees all slabs.  Nothing may be in use.
+    void Internal_ObjectPoolCore::FreeSlabs()
+    {
+        //recycled objects may be in thread caches rather than the shared list, but since nothing is in use every slot is free, so check all of them
+        while (slabs)
+        {
+            SlabHeader *header=(SlabHeader*)slabs;
+            uint8 *first=(uint8*)AlignUp((nuint)(slabs+sizeof(SlabHeader)), alignment);
+            for (nuint i=0; i<header->objectCount; ++i)
+            {
+                Internal_ObjectPoolSlot *slot=(Internal_ObjectPoolSlot*)(first+i*stride);
+                if (slot->constructed)
+                    destructor(SlotObject(slot));
+            }
+
+            uint8 *next=header->next;
+            delete3_array(slabs);
+            slabs=next;
+        }
+
+        //slots still in thread caches are thrown out the next time each thread uses the pool, and each registers again then
+        AtomicStore(&cachingThreads, (nuint)0, MEMORY_ORDER_RELAXED);
+        AtomicFetchAdd(&generation, (nuint)1, MEMORY_ORDER_ACQ_REL);
+
+        sharedFree=0;
+        slabCount=0;
+        capacity=0;
+    }
+
+    // -- reporting
+
+    //Fills outStats with the occupancy of every pool that exists.
+    void GetObjectPoolStats(std::vector<ObjectPoolStats> &outStats)
+    {
+        outStats.clear();
+        for (nuint i=0; i<MAX_REPORTED_POOLS; ++i)
+        {
+            Internal_ObjectPoolCore *pool=AtomicLoad(&reportedPools[i], MEMORY_ORDER_ACQUIRE);
+            if (pool)
+                outStats.push_back(pool->GetStats());
+        }
+    }
+
+    //Returns a human readable report of the occupancy of every pool that exists.
+    std::string GetObjectPoolReport()
+    {
+        std::string report=" -- Object Pools --\n\n";
+
+        std::vector<ObjectPoolStats> stats;
+        GetObjectPoolStats(stats);
+        if (stats.empty())
+            report+="There are no object pools.\n";
+
+        char buf[256];
+        for (std::vector<ObjectPoolStats>::iterator s=stats.begin(); s!=stats.end(); ++s)
+        {
+            report+=s->name;
+            report+="\n";
+
+            sprintf(buf, " In use: %llu (peak %llu)\n", (unsigned long long)s->liveObjects, (unsigned long long)s->peakLiveObjects);
+            report+=buf;
+            sprintf(buf, " Capacity: %llu in %llu slabs, %llu bytes each\n", (unsigned long long)s->capacity, (unsigned long long)s->slabCount, (unsigned long long)s->objectSize);
+            report+=buf;
+            sprintf(buf, " Created: %llu\n\n", (unsigned long long)s->totalCreated);
+            report+=buf;
+        }
+        return report;
+    }
+}
+
+//init stuff
+namespace
+{
+    //pools are usually globals that outlive the framework, so give back the memory of any that are not in use before the memory manager checks for leaks
+    void ObjectPoolShutdown()
+    {
+        for (nuint i=0; i<MAX_REPORTED_POOLS; ++i)
+        {
+            MPMA::Internal_ObjectPoolCore *pool=MPMA::AtomicLoad(&reportedPools[i], MPMA::MEMORY_ORDER_ACQUIRE);
+            if (pool)
+                pool->FreeAllIfUnused();
+        }
+    }
+
+    class AutoInitObjectPool
+    {
+    public:
+        //hookup init callbacks
+        AutoInitObjectPool()
+        {
+            MPMA::Internal_AddShutdownCallback(ObjectPoolShutdown, -9400);
+        }
+    } autoInitObjectPool;
+}
+
+bool mpmaForceReferenceToObjectPoolCPP=false; //work around a problem using MPMA as a static library
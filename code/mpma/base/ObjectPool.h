@@ -0,0 +1,236 @@
+//!\file ObjectPool.h Pools of same-typed objects, with a cache of free objects on each thread.
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include "Types.h"
+#include "SmallObjects.h"
+#include "Memory.h"
+#include "../Config.h"
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+An example of a type that is created and freed often:
+  MPMA::ObjectPool<Connection> connectionPool("Connections");
+
+  Connection *con=connectionPool.New(socket);
+  ...
+  connectionPool.Delete(con);
+
+  //or for a shared_ptr, whose control block also avoids the general allocator
+  std::shared_ptr<Connection> shared=connectionPool.NewShared(socket);
+
+A pool whose objects may be given back after static destruction has started (such as shared_ptrs that other statics hold) should never be destroyed:
+  static MPMA::ObjectPool<Connection> *connectionPool=MPMA::NewLeakedObjectPool<Connection>("Connections");
+
+If T's constructor or destructor are private, the pool needs to be a friend:
+  template <typename T> friend class MPMA::ObjectPool;
+*/
+
+namespace MPMA
+{
+    //!Occupancy of an ObjectPool.
+    struct ObjectPoolStats
+    {
+        std::string name; //!<The name the pool was created with.
+        nuint objectSize; //!<Size of each object, including the pool's bookkeeping.
+        nuint liveObjects; //!<Objects that are currently in use.  Each thread adds its counts to the pool's every so often, so this can be behind by a few dozen objects per thread.
+        nuint peakLiveObjects; //!<The most objects that have been in use at once.
+        nuint capacity; //!<Objects that can be in use before the pool has to allocate more memory.
+        nuint slabCount; //!<Number of blocks of memory the pool holds.
+        uint64 totalCreated; //!<Number of times an object has been handed out.
+    };
+
+    //!Fills outStats with the occupancy of every pool that exists.
+    void GetObjectPoolStats(std::vector<ObjectPoolStats> &outStats);
+
+    //!Returns a human readable report of the occupancy of every pool that exists.
+    std::string GetObjectPoolReport();
+
+    //internal use: header in front of each object in a pool
+    struct Internal_ObjectPoolSlot
+    {
+        Internal_ObjectPoolSlot *next; //next free slot, while it's on a free list
+        nuint constructed; //whether a recycled object is still living in the slot
+    };
+
+    //internal use: the untyped part of a pool, which hands out slots
+    class Internal_ObjectPoolCore
+    {
+    public:
+        Internal_ObjectPoolCore(const char *poolName, nuint objectSize, nuint objectAlignment, nuint objectsPerSlab, void (*destructObject)(void*));
+        ~Internal_ObjectPoolCore();
+
+        Internal_ObjectPoolSlot* AllocSlot(); //never returns 0, throws std::bad_alloc instead
+        void FreeSlot(Internal_ObjectPoolSlot *slot);
+        void Preallocate(nuint count);
+        bool FreeAllIfUnused();
+        ObjectPoolStats GetStats() const;
+
+        inline void* SlotObject(Internal_ObjectPoolSlot *slot) const
+            { return (uint8*)slot+headerSize; }
+        inline Internal_ObjectPoolSlot* ObjectSlot(const void *obj) const
+            { return (Internal_ObjectPoolSlot*)((uint8*)obj-headerSize); }
+
+        //used by the per-thread caches
+        Internal_ObjectPoolSlot* TakeShared(nuint count, nuint &outTaken);
+        void ReturnShared(Internal_ObjectPoolSlot *first, Internal_ObjectPoolSlot *last);
+        void AddCounts(nsint liveDelta, nuint created);
+        volatile nuint generation; //changes whenever the pool frees its memory, so caches of old slots are thrown out
+        volatile nuint cachingThreads; //threads with a cache for this generation, whose counts may not all be added in yet
+
+    private:
+        std::string name;
+        nuint headerSize;
+        nuint stride;
+        nuint alignment;
+        nuint slabObjects;
+        void (*destructor)(void*);
+        nuint cacheIndex; //which entry of the per-thread caches this pool uses
+
+        volatile nuint lock;
+        uint8 *slabs; //linked through a header at the start of each slab
+        nuint slabCount;
+        Internal_ObjectPoolSlot *sharedFree;
+        nuint capacity;
+
+        volatile nuint liveObjects;
+        volatile nuint peakLiveObjects;
+        volatile uint64 totalCreated;
+
+        bool AddSlab(nuint objectCount); //lock must be held
+        void FreeSlabs(); //lock must be held
+
+        //you cannot duplicate this
+        Internal_ObjectPoolCore(const Internal_ObjectPoolCore&);
+        const Internal_ObjectPoolCore& operator=(const Internal_ObjectPoolCore&);
+    };
+
+    //!\brief A pool of objects of type T.  Freed objects are kept on a list for the thread that freed them, so creating and freeing them is cheap and rarely needs a lock.
+    //!Memory is taken in slabs of many objects, and is not returned until the pool is destroyed, or at framework shutdown if no objects are in use then.
+    //!Pools are meant to be long lived (usually global).  Only the first 64 pools that are created get per-thread caches, the rest always use the shared list.
+    template <typename T>
+    class ObjectPool
+    {
+    public:
+        //!ctor - name is used in the stats.  objectsPerSlab is how many objects' memory is allocated at once when the pool needs more.  preallocateCount objects are made room for right away.
+        inline ObjectPool(const char *name="(unnamed pool)", nuint objectsPerSlab=64, nuint preallocateCount=0): core(name, sizeof(T), alignof(T), objectsPerSlab, &DestructObject)
+        {
+            if (preallocateCount)
+                core.Preallocate(preallocateCount);
+        }
+
+        //!Constructs a new object in the pool.  Throws std::bad_alloc if there is no memory.
+        template <typename... Args>
+        inline T* New(Args&&... args)
+        {
+            Internal_ObjectPoolSlot *slot=core.AllocSlot();
+            if (slot->constructed) //left over from Release
+            {
+                DestructObject(core.SlotObject(slot));
+                slot->constructed=0;
+            }
+
+            try
+            {
+                return new (core.SlotObject(slot)) T(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                core.FreeSlot(slot);
+                throw;
+            }
+        }
+
+        //!Destructs an object from New and returns it to the pool.  0 is ignored.
+        inline void Delete(T *obj)
+        {
+            if (!obj)
+                return;
+
+            obj->~T();
+            Internal_ObjectPoolSlot *slot=core.ObjectSlot(obj);
+            slot->constructed=0;
+            core.FreeSlot(slot);
+        }
+
+        //!Returns an object that was given back with Release, exactly as it was left, or a newly default-constructed object if there are none.  Use this for objects that are expensive to set up, or that other threads may still touch briefly after they are released.
+        inline T* Acquire()
+        {
+            Internal_ObjectPoolSlot *slot=core.AllocSlot();
+            if (!slot->constructed)
+            {
+                try
+                {
+                    new (core.SlotObject(slot)) T();
+                }
+                catch (...)
+                {
+                    core.FreeSlot(slot);
+                    throw;
+                }
+                slot->constructed=1;
+            }
+            return (T*)core.SlotObject(slot);
+        }
+
+        //!Returns an object from Acquire to the pool without destructing it.  It is destructed when it is reused by New, or when the pool frees its memory.  0 is ignored.
+        inline void Release(T *obj)
+        {
+            if (obj)
+                core.FreeSlot(core.ObjectSlot(obj));
+        }
+
+        //!Constructs a new object in a shared_ptr that returns it to the pool.  The pool must outlive the pointer.
+        template <typename... Args>
+        inline std::shared_ptr<T> NewShared(Args&&... args)
+        {
+            //(if the control block can't be allocated, shared_ptr calls the deleter itself)
+            return std::shared_ptr<T>(New(std::forward<Args>(args)...), Deleter(this), SmallObjectAllocator<T>());
+        }
+
+        //!Makes sure there is room for at least count objects in use at once, without allocating later.
+        inline void Preallocate(nuint count)
+            { core.Preallocate(count); }
+
+        //!Returns the occupancy of the pool.
+        inline ObjectPoolStats GetStats() const
+            { return core.GetStats(); }
+
+        //!A deleter for smart pointers, that returns the object to a pool.
+        class Deleter
+        {
+        public:
+            inline Deleter(ObjectPool<T> *deleterPool): pool(deleterPool) //!<ctor
+                {}
+            inline void operator()(T *obj) const //!<Deletes obj.
+                { pool->Delete(obj); }
+
+        private:
+            ObjectPool<T> *pool;
+        };
+
+    private:
+        Internal_ObjectPoolCore core;
+
+        static void DestructObject(void *obj)
+            { ((T*)obj)->~T(); }
+
+        //you cannot duplicate this
+        ObjectPool(const ObjectPool&);
+        const ObjectPool& operator=(const ObjectPool&);
+    };
+
+    //!Creates a pool that is never destroyed, for objects that may be given back to it after static destruction has started.  It is marked as intentionally leaked, so it isn't reported as a leak.
+    template <typename T>
+    inline ObjectPool<T>* NewLeakedObjectPool(const char *name="(unnamed pool)", nuint objectsPerSlab=64)
+    {
+        ObjectPool<T> *pool=new3(ObjectPool<T>(name, objectsPerSlab));
+        mpmaMemoryManager.MarkAsIntentionallyLeaked(pool);
+        return pool;
+    }
+}
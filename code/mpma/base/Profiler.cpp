@@ -4,27 +4,1199 @@
 #include "../Setup.h"
 #include "Profiler.h"
 #include "DebugRouter.h"
+#include "Locks.h"
+#include "Memory.h"
+#include "Thread.h"
+#include "Timer.h"
 #include "Vary.h"
+#include "LockStats.h"
+#include "Histogram.h"
+#include <algorithm>
+#include <map>
 #include <string.h>
 #include <stdlib.h>
+#include <unordered_map>
+#include <vector>
 
 #ifdef TIMEPROFILE_ENABLED
 
-MPMA::Internal_Profiler *_instProfile=0; //instance of the profiler
-
 namespace
 {
     std::string profileFilename="_profile.txt";
+    std::string collapsedFilename="_profile.folded";
+
+    // -- names
+
+    struct ScopeName
+    {
+        std::string name;
+        std::string file; //where it was first used
+    };
+
+    //every name that has been used, by id.  These use the global new instead of new3 since ids must stay valid from one framework init to the next, so they are never freed.
+    MPMA::AdaptiveLock namesLock;
+    std::vector<ScopeName> *scopeNames=0;
+    std::unordered_map<std::string, MPMA::ProfileScopeId> *scopeIds=0;
+
+    //whether profiles are being recorded (between framework init and shutdown)
+    volatile nuint profilerReady=0;
+    uint64 profilerStartTicks=0;
+
+    // -- per thread data
+
+    //results for one profile on one thread.  Only that thread writes to it.
+    struct ScopeStats
+    {
+        uint64 count;
+        uint64 totalTicks;
+        uint64 minTicks;
+        uint64 maxTicks;
+        uint64 startTicks;
+        nuint depth; //how many times it's started on this thread (a scope may be recursive), only the outermost is timed
+#ifdef TIMEPROFILE_HISTOGRAMS
+        MPMA::Histogram *volatile histogram; //made the first time the profile stops on this thread
+#endif
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+        uint64 totalCounters[MPMA::Internal_PROFILE_COUNTER_COUNT];
+        MPMA::Internal_ProfileCounterReading startCounters;
+        bool countersStarted;
+#endif
+    };
+
+    //ScopeStats are in pages that are never moved, so other threads can read them while they are being written
+    const nuint SCOPES_PER_PAGE=256;
+    const nuint MAX_SCOPE_PAGES=256;
+
+#ifdef TIMEPROFILE_CALL_TREE
+    //one path through the profiles on one thread.  Only that thread writes to it, and a node is filled in before it is linked to its parent.
+    struct CallNode
+    {
+        MPMA::ProfileScopeId id;
+        CallNode *parent;
+        CallNode *volatile firstChild;
+        CallNode *volatile nextSibling;
+
+        uint64 count;
+        uint64 inclusiveTicks;
+        uint64 childTicks; //time spent in profiles started inside this one
+        uint64 startTicks;
+    };
+
+    //CallNodes are in pages that are never moved, like ScopeStats
+    const nuint NODES_PER_PAGE=1024;
+    const nuint MAX_NODE_PAGES=256;
+
+    //deepest a tree goes.  Profiles started deeper than this are left out of the tree.
+    const nuint MAX_CALL_DEPTH=128;
+#endif
+
+    //one thing that happened on a thread while a trace was recording
+    struct TraceEvent
+    {
+        uint64 ticks;
+        MPMA::ProfileScopeId id;
+        uint32 type; //Internal_ProfileEventType
+        double value; //for counters
+    };
+
+    const nuint TRACE_EVENTS_PER_THREAD=TIMEPROFILE_TRACE_EVENTS;
+
+    //all of one thread's results.  These are kept when their thread exits, and picked up by the next new thread.
+    struct ThreadProfile
+    {
+        ThreadProfile *next; //every one that was ever made
+        volatile nuint inUse;
+        nuint serial; //which thread this was made for, for reports
+        ScopeStats *volatile pages[MAX_SCOPE_PAGES];
+
+        TraceEvent *volatile traceEvents; //ring of the thread's latest events, made the first time it records one
+        volatile nuint traceCount; //events recorded in the current trace, including ones that were overwritten
+        volatile nuint traceGeneration; //which trace traceCount belongs to
+        char name[64]; //for traces, empty if it wasn't given one
+
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+        MPMA::Internal_ProfileCounters counters;
+        nuint countersState; //0 if not opened yet, 1 if open, 2 if they couldn't be
+#endif
+
+#ifdef TIMEPROFILE_CALL_TREE
+        CallNode *volatile nodePages[MAX_NODE_PAGES]; //the first node is the root of the tree
+        nuint nodeCount;
+        CallNode *stack[MAX_CALL_DEPTH]; //profiles running on the thread, innermost last
+        nuint stackDepth;
+        nuint overflowDepth; //profiles running deeper than MAX_CALL_DEPTH
+#endif
+    };
+
+    ThreadProfile *volatile threadProfiles=0;
+    volatile nuint threadProfileCount=0;
+
+    THREAD_LOCAL ThreadProfile *threadProfile=0;
+
+    //gives the thread's profile back when the thread exits, and remembers ids of names that were passed as strings
+    struct ThreadProfileOwner
+    {
+        ThreadProfile *profile;
+        std::unordered_map<std::string, MPMA::ProfileScopeId> stringIds;
+
+        ~ThreadProfileOwner()
+        {
+            if (profile)
+            {
+                for (nuint p=0; p<MAX_SCOPE_PAGES; ++p)
+                {
+                    if (profile->pages[p])
+                    {
+                        for (nuint s=0; s<SCOPES_PER_PAGE; ++s)
+                            profile->pages[p][s].depth=0;
+                    }
+                }
+#ifdef TIMEPROFILE_CALL_TREE
+                profile->stackDepth=0;
+                profile->overflowDepth=0;
+#endif
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+                if (profile->countersState==1)
+                    MPMA::Internal_CloseProfileCounters(profile->counters);
+                profile->countersState=0;
+#endif
+                threadProfile=0;
+                MPMA::AtomicStore(&profile->inUse, (nuint)0, MPMA::MEMORY_ORDER_RELEASE);
+            }
+        }
+    };
+
+    thread_local ThreadProfileOwner threadProfileOwner;
+
+    //returns the calling thread's profile, taking one if needed.  Returns 0 if there is no memory.
+    ThreadProfile* GetThreadProfile()
+    {
+        if (threadProfile)
+            return threadProfile;
+
+        //reuse one from a thread that exited
+        ThreadProfile *profile=MPMA::AtomicLoad(&threadProfiles, MPMA::MEMORY_ORDER_ACQUIRE);
+        for (; profile; profile=profile->next)
+        {
+            nuint expected=0;
+            if (MPMA::AtomicLoad(&profile->inUse, MPMA::MEMORY_ORDER_RELAXED)==0 && MPMA::AtomicCompareAndSwap(&profile->inUse, expected, (nuint)1, MPMA::MEMORY_ORDER_ACQUIRE))
+            {
+                profile->name[0]=0;
+                break;
+            }
+        }
+
+        if (!profile)
+        {
+            profile=(ThreadProfile*)calloc(1, sizeof(ThreadProfile));
+            if (!profile)
+                return 0;
+            profile->inUse=1;
+            profile->serial=MPMA::AtomicFetchAdd(&threadProfileCount, (nuint)1)+1;
+
+            ThreadProfile *head=MPMA::AtomicLoad(&threadProfiles, MPMA::MEMORY_ORDER_RELAXED);
+            do
+            {
+                profile->next=head;
+            } while (!MPMA::AtomicCompareAndSwap(&threadProfiles, head, profile, MPMA::MEMORY_ORDER_RELEASE));
+        }
+
+        threadProfileOwner.profile=profile;
+        threadProfile=profile;
+        return profile;
+    }
+
+    //returns the calling thread's results for a profile, or 0 if there is no memory
+    inline ScopeStats* GetScopeStats(MPMA::ProfileScopeId id)
+    {
+        ThreadProfile *profile=GetThreadProfile();
+        nuint page=id/SCOPES_PER_PAGE;
+        if (!profile || page>=MAX_SCOPE_PAGES)
+            return 0;
+
+        ScopeStats *stats=profile->pages[page];
+        if (!stats)
+        {
+            stats=(ScopeStats*)calloc(SCOPES_PER_PAGE, sizeof(ScopeStats));
+            if (!stats)
+                return 0;
+            MPMA::AtomicStore(&profile->pages[page], stats, MPMA::MEMORY_ORDER_RELEASE);
+        }
+
+        return &stats[id%SCOPES_PER_PAGE];
+    }
+
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+    //whether any thread could open the counters, and whether any couldn't
+    volatile nuint countersOpened=0;
+    volatile nuint countersFailed=0;
+
+    //reads the calling thread's counters, opening them the first time.  Returns false if they can't be read.
+    inline bool ReadCounters(ThreadProfile *profile, MPMA::Internal_ProfileCounterReading &outReading)
+    {
+        if (profile->countersState==0)
+        {
+            if (MPMA::Internal_OpenProfileCounters(profile->counters))
+            {
+                profile->countersState=1;
+                MPMA::AtomicStore(&countersOpened, (nuint)1, MPMA::MEMORY_ORDER_RELAXED);
+            }
+            else
+            {
+                profile->countersState=2;
+                MPMA::AtomicStore(&countersFailed, (nuint)1, MPMA::MEMORY_ORDER_RELAXED);
+            }
+        }
+
+        return profile->countersState==1 && MPMA::Internal_ReadProfileCounters(profile->counters, outReading);
+    }
+
+    //adds what the counters counted between two readings to totals.  When the kernel took turns between more events than there are hardware counters, they only counted for part of that time, so the counts are scaled up by how long they were enabled over how long they ran.
+    void AddCounterDifference(const MPMA::Internal_ProfileCounterReading &start, const MPMA::Internal_ProfileCounterReading &end, uint64 *totals)
+    {
+        uint64 enabled=end.timeEnabled-start.timeEnabled;
+        uint64 running=end.timeRunning-start.timeRunning;
+        if (running==0) //they never counted, so there's nothing to scale up
+            return;
+
+        double scale=running<enabled ? (double)enabled/(double)running : 1.0;
+        for (nuint c=0; c<MPMA::Internal_PROFILE_COUNTER_COUNT; ++c)
+        {
+            if (end.values[c]>start.values[c])
+                totals[c]+=(uint64)((double)(end.values[c]-start.values[c])*scale+0.5);
+        }
+    }
+#endif
+
+#ifdef TIMEPROFILE_CALL_TREE
+    inline CallNode* GetNode(ThreadProfile *profile, nuint index)
+    {
+        return &profile->nodePages[index/NODES_PER_PAGE][index%NODES_PER_PAGE];
+    }
+
+    //adds a node to the thread's tree.  Returns 0 if there is no room.
+    CallNode* NewNode(ThreadProfile *profile, MPMA::ProfileScopeId id, CallNode *parent)
+    {
+        nuint page=profile->nodeCount/NODES_PER_PAGE;
+        if (page>=MAX_NODE_PAGES)
+            return 0;
+
+        if (!profile->nodePages[page])
+        {
+            CallNode *nodes=(CallNode*)calloc(NODES_PER_PAGE, sizeof(CallNode));
+            if (!nodes)
+                return 0;
+            MPMA::AtomicStore(&profile->nodePages[page], nodes, MPMA::MEMORY_ORDER_RELEASE);
+        }
+
+        CallNode *node=GetNode(profile, profile->nodeCount++);
+        node->id=id;
+        node->parent=parent;
+        if (parent)
+        {
+            node->nextSibling=parent->firstChild;
+            MPMA::AtomicStore(&parent->firstChild, node, MPMA::MEMORY_ORDER_RELEASE);
+        }
+        return node;
+    }
+
+    //returns the node under the profile that is running now for id, adding it if needed.  Returns 0 if it can't be added.
+    inline CallNode* ChildNode(ThreadProfile *profile, MPMA::ProfileScopeId id)
+    {
+        if (profile->nodeCount==0 && !NewNode(profile, MPMA::PROFILE_SCOPE_NONE, 0))
+            return 0;
+
+        CallNode *parent=profile->stackDepth ? profile->stack[profile->stackDepth-1] : GetNode(profile, 0);
+        for (CallNode *child=parent->firstChild; child; child=child->nextSibling)
+        {
+            if (child->id==id)
+                return child;
+        }
+        return NewNode(profile, id, parent);
+    }
+
+    //records the time of the innermost running node, and takes it off the stack
+    inline void CloseNode(ThreadProfile *profile, uint64 endTicks)
+    {
+        CallNode *node=profile->stack[--profile->stackDepth];
+        uint64 ticks=endTicks-node->startTicks;
+        node->inclusiveTicks+=ticks;
+        ++node->count;
+        node->parent->childTicks+=ticks;
+    }
+
+    //adds a profile that was started to the calling thread's tree
+    inline void TreeBegin(MPMA::ProfileScopeId id, uint64 startTicks)
+    {
+        ThreadProfile *profile=threadProfile;
+        CallNode *node=0;
+        if (profile->overflowDepth==0 && profile->stackDepth<MAX_CALL_DEPTH)
+            node=ChildNode(profile, id);
+
+        if (!node)
+        {
+            ++profile->overflowDepth;
+            return;
+        }
+
+        node->startTicks=startTicks;
+        profile->stack[profile->stackDepth++]=node;
+    }
+
+    //records a profile that was stopped in the calling thread's tree.  If other profiles were started after it and are still running, they are stopped too.
+    inline void TreeEnd(MPMA::ProfileScopeId id, uint64 endTicks)
+    {
+        ThreadProfile *profile=threadProfile;
+        if (profile->overflowDepth)
+        {
+            --profile->overflowDepth;
+            return;
+        }
+
+        for (nuint i=profile->stackDepth; i>0; --i)
+        {
+            if (profile->stack[i-1]->id==id)
+            {
+                while (profile->stackDepth>=i)
+                    CloseNode(profile, endTicks);
+                return;
+            }
+        }
+    }
+#endif
+
+    // -- traces
+
+    volatile nuint traceRecording=0;
+    volatile nuint traceGeneration=0; //goes up each time a trace is started
+    uint64 traceStartTicks=0;
+    uint64 traceEndTicks=0; //when recording is to stop on its own
+    uint64 traceStopTicks=0; //when recording did stop
+
+    //adds an event to the thread's ring.  Recording stops here once the trace's time is up.
+    void RecordTraceEvent(ThreadProfile *profile, MPMA::ProfileScopeId id, MPMA::Internal_ProfileEventType type, uint64 ticks, double value)
+    {
+        nuint generation=MPMA::AtomicLoad(&traceGeneration, MPMA::MEMORY_ORDER_ACQUIRE);
+        if (ticks>traceEndTicks)
+        {
+            nuint expected=1;
+            if (MPMA::AtomicCompareAndSwap(&traceRecording, expected, (nuint)0, MPMA::MEMORY_ORDER_RELAXED))
+                traceStopTicks=traceEndTicks;
+            return;
+        }
+
+        TraceEvent *events=profile->traceEvents;
+        if (!events)
+        {
+            events=(TraceEvent*)calloc(TRACE_EVENTS_PER_THREAD, sizeof(TraceEvent));
+            if (!events)
+                return;
+            MPMA::AtomicStore(&profile->traceEvents, events, MPMA::MEMORY_ORDER_RELEASE);
+        }
+
+        //the first event of a new trace throws out what was kept from the last one
+        nuint count=profile->traceCount;
+        if (profile->traceGeneration!=generation)
+        {
+            count=0;
+            MPMA::AtomicStore(&profile->traceCount, count, MPMA::MEMORY_ORDER_RELEASE);
+            MPMA::AtomicStore(&profile->traceGeneration, generation, MPMA::MEMORY_ORDER_RELEASE);
+        }
+
+        TraceEvent &event=events[count%TRACE_EVENTS_PER_THREAD];
+        event.ticks=ticks;
+        event.id=id;
+        event.type=type;
+        event.value=value;
+        MPMA::AtomicStore(&profile->traceCount, count+1, MPMA::MEMORY_ORDER_RELEASE);
+    }
+
+    inline bool IsTraceRecording()
+    {
+        return MPMA::AtomicLoad(&traceRecording, MPMA::MEMORY_ORDER_RELAXED)!=0;
+    }
+
+    //returns a string as a quoted json string
+    std::string JsonString(const std::string &str)
+    {
+        std::string quoted="\"";
+        for (std::string::const_iterator c=str.begin(); c!=str.end(); ++c)
+        {
+            if (*c=='"' || *c=='\\')
+            {
+                quoted+='\\';
+                quoted+=*c;
+            }
+            else if ((unsigned char)*c<0x20)
+            {
+                char buf[8];
+                sprintf(buf, "\\u%04x", (unsigned int)(unsigned char)*c);
+                quoted+=buf;
+            }
+            else
+                quoted+=*c;
+        }
+        quoted+='"';
+        return quoted;
+    }
+
+    void WriteJsonString(FILE *f, const std::string &str)
+    {
+        std::string quoted=JsonString(str);
+        fwrite(quoted.c_str(), quoted.size(), 1, f);
+    }
+
+    //writes one event of a thread.  ph is the chrome trace event type.
+    void WriteJsonEvent(FILE *f, bool &first, const char *ph, const std::string &name, double timestamp, nuint tid)
+    {
+        fprintf(f, "%s\n{\"ph\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"name\":", first ? "" : ",", ph, (int)tid, timestamp);
+        WriteJsonString(f, name);
+        first=false;
+    }
+
+    //writes one thread's events from the trace.  Stops that were not started inside the trace are left out, and profiles still running at the end are stopped there.
+    void WriteThreadTrace(FILE *f, bool &first, ThreadProfile *profile, const std::vector<ScopeName> &names, uint64 stopTicks)
+    {
+        TraceEvent *events=MPMA::AtomicLoad(&profile->traceEvents, MPMA::MEMORY_ORDER_ACQUIRE);
+        nuint count=MPMA::AtomicLoad(&profile->traceCount, MPMA::MEMORY_ORDER_ACQUIRE);
+        if (!events || count==0)
+            return;
+
+        //thread name
+        std::string threadName=profile->name[0] ? std::string(profile->name) : "Thread "+(std::string)(MPMA::Vary)(nuint)profile->serial;
+        fprintf(f, "%s\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":", first ? "" : ",", (int)profile->serial);
+        WriteJsonString(f, threadName);
+        fprintf(f, "}}");
+        first=false;
+
+        double tickMicroseconds=1000000.0/(double)MPMA::Timer::GetTickFrequency();
+        std::vector<MPMA::ProfileScopeId> running;
+        nuint start=(count>TRACE_EVENTS_PER_THREAD) ? count-TRACE_EVENTS_PER_THREAD : 0;
+        for (nuint e=start; e<count; ++e)
+        {
+            const TraceEvent &event=events[e%TRACE_EVENTS_PER_THREAD];
+            if (event.ticks<traceStartTicks || event.ticks>stopTicks || event.id>=names.size())
+                continue;
+
+            const std::string &name=names[event.id].name;
+            double timestamp=(event.ticks-traceStartTicks)*tickMicroseconds;
+            if (event.type==MPMA::Internal_PROFILE_EVENT_BEGIN)
+            {
+                running.push_back(event.id);
+                WriteJsonEvent(f, first, "B", name, timestamp, profile->serial);
+                fprintf(f, "}");
+            }
+            else if (event.type==MPMA::Internal_PROFILE_EVENT_END)
+            {
+                //like the call tree, stopping a profile also stops ones that were started inside of it
+                std::vector<MPMA::ProfileScopeId>::reverse_iterator found=std::find(running.rbegin(), running.rend(), event.id);
+                if (found==running.rend())
+                    continue;
+
+                nuint stopCount=found-running.rbegin()+1;
+                for (nuint i=0; i<stopCount; ++i)
+                {
+                    WriteJsonEvent(f, first, "E", names[running.back()].name, timestamp, profile->serial);
+                    fprintf(f, "}");
+                    running.pop_back();
+                }
+            }
+            else if (event.type==MPMA::Internal_PROFILE_EVENT_INSTANT)
+            {
+                WriteJsonEvent(f, first, "i", name, timestamp, profile->serial);
+                fprintf(f, ",\"s\":\"t\"}");
+            }
+            else if (event.type==MPMA::Internal_PROFILE_EVENT_COUNTER)
+            {
+                WriteJsonEvent(f, first, "C", name, timestamp, profile->serial);
+                fprintf(f, ",\"args\":{\"value\":%.17g}}", event.value);
+            }
+        }
+
+        double endTimestamp=(stopTicks-traceStartTicks)*tickMicroseconds;
+        while (!running.empty())
+        {
+            WriteJsonEvent(f, first, "E", names[running.back()].name, endTimestamp, profile->serial);
+            fprintf(f, "}");
+            running.pop_back();
+        }
+    }
+
+    //adds a name, or finds the id it already has.  Returns PROFILE_SCOPE_NONE before init or after shutdown.
+    MPMA::ProfileScopeId LookupName(const std::string &name, const char *file)
+    {
+        if (!MPMA::AtomicLoad(&profilerReady, MPMA::MEMORY_ORDER_ACQUIRE))
+            return MPMA::PROFILE_SCOPE_NONE;
+
+        namesLock.Lock();
+
+        if (!scopeNames)
+        {
+            scopeNames=new std::vector<ScopeName>;
+            scopeIds=new std::unordered_map<std::string, MPMA::ProfileScopeId>;
+        }
+
+        MPMA::ProfileScopeId id;
+        std::unordered_map<std::string, MPMA::ProfileScopeId>::iterator found=scopeIds->find(name);
+        if (found!=scopeIds->end())
+        {
+            id=found->second;
+        }
+        else if (scopeNames->size()>=SCOPES_PER_PAGE*MAX_SCOPE_PAGES)
+        {
+            id=MPMA::PROFILE_SCOPE_NONE;
+        }
+        else
+        {
+            id=(MPMA::ProfileScopeId)scopeNames->size();
+            ScopeName newName;
+            newName.name=name;
+            newName.file=file;
+            scopeNames->push_back(newName);
+            (*scopeIds)[name]=id;
+        }
+
+        namesLock.Unlock();
+        return id;
+    }
+
+    //copies every name that has been used
+    void CopyNames(std::vector<ScopeName> &outNames)
+    {
+        namesLock.Lock();
+        if (scopeNames)
+            outNames=*scopeNames;
+        else
+            outNames.clear();
+        namesLock.Unlock();
+    }
+
+    // -- reporting
+
+    //one profile's results from all threads put together
+    struct ScopeTotal
+    {
+        MPMA::ProfileScopeId id;
+        uint64 count;
+        uint64 totalTicks;
+        uint64 minTicks;
+        uint64 maxTicks;
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+        uint64 counters[MPMA::Internal_PROFILE_COUNTER_COUNT];
+#endif
+
+        inline bool operator<(const ScopeTotal &o) const { return totalTicks>o.totalTicks; }
+    };
+
+    //adds up every thread's results
+    void GatherTotals(std::vector<ScopeTotal> &outTotals)
+    {
+        outTotals.clear();
+        for (ThreadProfile *profile=MPMA::AtomicLoad(&threadProfiles, MPMA::MEMORY_ORDER_ACQUIRE); profile; profile=profile->next)
+        {
+            for (nuint p=0; p<MAX_SCOPE_PAGES; ++p)
+            {
+                ScopeStats *page=MPMA::AtomicLoad(&profile->pages[p], MPMA::MEMORY_ORDER_ACQUIRE);
+                if (!page)
+                    continue;
+
+                for (nuint s=0; s<SCOPES_PER_PAGE; ++s)
+                {
+                    const ScopeStats &stats=page[s];
+                    if (stats.count==0)
+                        continue;
+
+                    nuint id=p*SCOPES_PER_PAGE+s;
+                    if (outTotals.size()<=id)
+                    {
+                        ScopeTotal empty={};
+                        outTotals.resize(id+1, empty);
+                    }
+
+                    ScopeTotal &total=outTotals[id];
+                    if (total.count==0 || stats.minTicks<total.minTicks)
+                        total.minTicks=stats.minTicks;
+                    if (stats.maxTicks>total.maxTicks)
+                        total.maxTicks=stats.maxTicks;
+                    total.count+=stats.count;
+                    total.totalTicks+=stats.totalTicks;
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+                    for (nuint c=0; c<MPMA::Internal_PROFILE_COUNTER_COUNT; ++c)
+                        total.counters[c]+=stats.totalCounters[c];
+#endif
+                }
+            }
+        }
+
+        //drop the ones that were never used, and sort by time total
+        nuint used=0;
+        for (nuint i=0; i<outTotals.size(); ++i)
+        {
+            if (outTotals[i].count!=0)
+            {
+                outTotals[used]=outTotals[i];
+                outTotals[used].id=(MPMA::ProfileScopeId)i;
+                ++used;
+            }
+        }
+        outTotals.resize(used);
+        std::sort(outTotals.begin(), outTotals.end());
+    }
+
+    //clears every thread's results.  Profiles that are running keep running.
+    void ClearResults()
+    {
+        for (ThreadProfile *profile=MPMA::AtomicLoad(&threadProfiles, MPMA::MEMORY_ORDER_ACQUIRE); profile; profile=profile->next)
+        {
+            for (nuint p=0; p<MAX_SCOPE_PAGES; ++p)
+            {
+                ScopeStats *page=profile->pages[p];
+                if (!page)
+                    continue;
+
+                for (nuint s=0; s<SCOPES_PER_PAGE; ++s)
+                {
+                    page[s].count=0;
+                    page[s].totalTicks=0;
+                    page[s].minTicks=0;
+                    page[s].maxTicks=0;
+#ifdef TIMEPROFILE_HISTOGRAMS
+                    if (page[s].histogram)
+                        page[s].histogram->Clear();
+#endif
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+                    memset(page[s].totalCounters, 0, sizeof(page[s].totalCounters));
+#endif
+                }
+            }
+
+#ifdef TIMEPROFILE_CALL_TREE
+            for (nuint n=0; n<profile->nodeCount; ++n)
+            {
+                CallNode *node=GetNode(profile, n);
+                node->count=0;
+                node->inclusiveTicks=0;
+                node->childTicks=0;
+            }
+#endif
+        }
+    }
+
+#ifdef TIMEPROFILE_HISTOGRAMS
+    //adds up every thread's histogram of a profile
+    void GatherHistogram(MPMA::ProfileScopeId id, MPMA::Histogram &outHistogram)
+    {
+        outHistogram.Clear();
+        for (ThreadProfile *profile=MPMA::AtomicLoad(&threadProfiles, MPMA::MEMORY_ORDER_ACQUIRE); profile; profile=profile->next)
+        {
+            ScopeStats *page=MPMA::AtomicLoad(&profile->pages[id/SCOPES_PER_PAGE], MPMA::MEMORY_ORDER_ACQUIRE);
+            if (!page)
+                continue;
+
+            MPMA::Histogram *histogram=MPMA::AtomicLoad(&page[id%SCOPES_PER_PAGE].histogram, MPMA::MEMORY_ORDER_ACQUIRE);
+            if (histogram)
+                outHistogram.Merge(*histogram);
+        }
+    }
+#endif
+
+    //writes a value to a file
+    void Write(FILE* f, double val)
+    {
+        char buf[64];
+        sprintf(buf, "%f", val);
+        fwrite(buf, strlen(buf), 1, f);
+    }
+
+    void Write(FILE* f, const char* str)
+    {
+        fwrite(str,strlen(str),1,f);
+    }
+
+    void Write(FILE* f, int num)
+    {
+        std::string buf=(MPMA::Vary)num;
+        fwrite(buf.c_str(), buf.size(), 1, f);
+    }
+
+#ifdef TIMEPROFILE_CALL_TREE
+    //one path through the profiles, with every thread's results put together
+    struct MergedNode
+    {
+        MPMA::ProfileScopeId id;
+        uint64 count;
+        uint64 inclusiveTicks;
+        uint64 childTicks;
+        std::map<nuint, uint64> threadTicks; //inclusive time by thread serial
+        std::map<MPMA::ProfileScopeId, MergedNode> children;
+
+        inline uint64 ExclusiveTicks() const { return (inclusiveTicks>childTicks) ? inclusiveTicks-childTicks : 0; }
+    };
+
+    void MergeNode(MergedNode &into, const CallNode *node, nuint threadSerial)
+    {
+        for (const CallNode *child=MPMA::AtomicLoad(&node->firstChild, MPMA::MEMORY_ORDER_ACQUIRE); child; child=MPMA::AtomicLoad(&child->nextSibling, MPMA::MEMORY_ORDER_ACQUIRE))
+        {
+            if (child->count==0 && MPMA::AtomicLoad(&child->firstChild, MPMA::MEMORY_ORDER_ACQUIRE)==0)
+                continue;
+
+            MergedNode &merged=into.children[child->id];
+            merged.id=child->id;
+            merged.count+=child->count;
+            merged.inclusiveTicks+=child->inclusiveTicks;
+            merged.childTicks+=child->childTicks;
+            if (child->inclusiveTicks)
+                merged.threadTicks[threadSerial]+=child->inclusiveTicks;
+            MergeNode(merged, child, threadSerial);
+        }
+    }
+
+    //puts every thread's tree together
+    void GatherTree(MergedNode &outRoot)
+    {
+        outRoot=MergedNode();
+        outRoot.id=MPMA::PROFILE_SCOPE_NONE;
+        for (ThreadProfile *profile=MPMA::AtomicLoad(&threadProfiles, MPMA::MEMORY_ORDER_ACQUIRE); profile; profile=profile->next)
+        {
+            CallNode *nodes=MPMA::AtomicLoad(&profile->nodePages[0], MPMA::MEMORY_ORDER_ACQUIRE);
+            if (nodes)
+                MergeNode(outRoot, &nodes[0], profile->serial);
+        }
+    }
+
+    //adds up the exclusive time of each profile over the whole tree
+    void SumExclusive(const MergedNode &node, std::vector<uint64> &exclusiveTicks)
+    {
+        for (std::map<MPMA::ProfileScopeId, MergedNode>::const_iterator c=node.children.begin(); c!=node.children.end(); ++c)
+        {
+            if (exclusiveTicks.size()<=c->first)
+                exclusiveTicks.resize(c->first+1, 0);
+            exclusiveTicks[c->first]+=c->second.ExclusiveTicks();
+            SumExclusive(c->second, exclusiveTicks);
+        }
+    }
+
+    bool MoreInclusiveTime(const MergedNode *a, const MergedNode *b)
+    {
+        return a->inclusiveTicks>b->inclusiveTicks;
+    }
+
+    //writes a node's children as indented lines, most time first
+    void WriteTreeLevel(FILE *f, const MergedNode &node, const std::vector<ScopeName> &names, nuint depth, double finalTime)
+    {
+        std::vector<const MergedNode*> children;
+        for (std::map<MPMA::ProfileScopeId, MergedNode>::const_iterator c=node.children.begin(); c!=node.children.end(); ++c)
+            children.push_back(&c->second);
+        std::sort(children.begin(), children.end(), MoreInclusiveTime);
+
+        double tickSeconds=1.0/(double)MPMA::Timer::GetTickFrequency();
+        for (std::vector<const MergedNode*>::iterator c=children.begin(); c!=children.end(); ++c)
+        {
+            const MergedNode &child=**c;
+            std::string line(depth*2, ' ');
+            line+=names[child.id].name;
+
+            char buf[256];
+            sprintf(buf, " - %.3f ms inclusive, %.3f ms exclusive, %llu calls, %d%% of total time", child.inclusiveTicks*tickSeconds*1000, child.ExclusiveTicks()*tickSeconds*1000, (unsigned long long)child.count, (int)(child.inclusiveTicks*tickSeconds/finalTime*100.0));
+            line+=buf;
+
+            //show how it was split between threads, if it ran on more than one
+            if (child.threadTicks.size()>1)
+            {
+                line+=" [";
+                for (std::map<nuint, uint64>::const_iterator t=child.threadTicks.begin(); t!=child.threadTicks.end(); ++t)
+                {
+                    sprintf(buf, "%sthread %d: %.3f ms", (t==child.threadTicks.begin()) ? "" : ", ", (int)t->first, t->second*tickSeconds*1000);
+                    line+=buf;
+                }
+                line+="]";
+            }
+
+            line+="\n";
+            Write(f, line.c_str());
+            WriteTreeLevel(f, child, names, depth+1, finalTime);
+        }
+    }
+
+    //writes one line per path through the tree: the names from the outermost in separated by semicolons, then the exclusive time in microseconds
+    void WriteCollapsedLevel(FILE *f, const MergedNode &node, const std::vector<ScopeName> &names, const std::string &path)
+    {
+        double tickMicroseconds=1000000.0/(double)MPMA::Timer::GetTickFrequency();
+        for (std::map<MPMA::ProfileScopeId, MergedNode>::const_iterator c=node.children.begin(); c!=node.children.end(); ++c)
+        {
+            std::string name=names[c->first].name;
+            std::replace(name.begin(), name.end(), ';', ':'); //; separates names
+            std::string childPath=path.empty() ? name : path+";"+name;
+
+            uint64 microseconds=(uint64)(c->second.ExclusiveTicks()*tickMicroseconds+0.5);
+            if (microseconds>0)
+                fprintf(f, "%s %llu\n", childPath.c_str(), (unsigned long long)microseconds);
+            WriteCollapsedLevel(f, c->second, names, childPath);
+        }
+    }
+#endif
+
+    //writes all profiles taken to file
+    void WriteProfilesToFile(FILE *f, double finalTime, const std::vector<ScopeName> &names, const std::vector<uint64> &exclusiveTicks)
+    {
+        //write header
+        const char lpzProMsg[]=" -- Profiles --\n\n";
+        fwrite(lpzProMsg, strlen(lpzProMsg), 1, f);
+
+        std::vector<ScopeTotal> totals;
+        GatherTotals(totals);
+
+        double tickSeconds=1.0/(double)MPMA::Timer::GetTickFrequency();
+
+        for (std::vector<ScopeTotal>::iterator cur=totals.begin(); cur!=totals.end(); ++cur)
+        {
+            const ScopeName &name=names[cur->id];
+            Write(f, name.name.c_str());
+            Write(f, " - ");
+            Write(f, name.file.c_str());
+            Write(f, "\n");
+
+            Write(f, " Average time: ");
+            Write(f, cur->totalTicks*tickSeconds/cur->count*1000);
+            Write(f, " ms\n");
+
+            Write(f, " Max time: ");
+            Write(f, cur->maxTicks*tickSeconds*1000);
+            Write(f, " ms\n");
+
+            Write(f, " Min time: ");
+            Write(f, cur->minTicks*tickSeconds*1000);
+            Write(f, " ms\n");
+
+#ifdef TIMEPROFILE_HISTOGRAMS
+            {
+                MPMA::Histogram histogram;
+                GatherHistogram(cur->id, histogram);
+                char buf[256];
+                sprintf(buf, " Percentiles: 50%% %f ms, 90%% %f ms, 99%% %f ms, 99.9%% %f ms\n", histogram.GetPercentile(50)*tickSeconds*1000, histogram.GetPercentile(90)*tickSeconds*1000, histogram.GetPercentile(99)*tickSeconds*1000, histogram.GetPercentile(99.9)*tickSeconds*1000);
+                Write(f, buf);
+            }
+#endif
+
+            double printTime=cur->totalTicks*tickSeconds;
+            Write(f, " Total time: ");
+            Write(f, printTime);
+            Write(f, " seconds\n");
+
+            //time not spent in other profiles started inside this one, which does not double count nested profiles
+            if (cur->id<exclusiveTicks.size())
+            {
+                Write(f, " Exclusive time: ");
+                Write(f, exclusiveTicks[cur->id]*tickSeconds);
+                Write(f, " seconds\n");
+            }
+
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+            //per call, so profiles that ran different numbers of times can be compared
+            if (cur->counters[0])
+            {
+                char buf[256];
+                double calls=(double)cur->count;
+                sprintf(buf, " Per call: %.0f cycles, %.0f instructions, %.2f instructions per cycle, %.1f cache misses, %.1f branch misses\n", cur->counters[0]/calls, cur->counters[1]/calls, (double)cur->counters[1]/(double)cur->counters[0], cur->counters[2]/calls, cur->counters[3]/calls);
+                Write(f, buf);
+            }
+#endif
+
+            Write(f, " Samples taken: ");
+            Write(f, (int)cur->count);
+
+            Write(f, "\n Percentage of total time: ");
+            Write(f, (int)((printTime/finalTime)*100.0));
+
+            Write(f, "%\n\n");
+        }
+    }
+
+    void WriteProfileFile()
+    {
+        //set up
+        FILE *f=fopen(profileFilename.c_str(), "wt"); //open file and kill old contents
+        if (!f)
+        {
+            MPMA::ErrorReport()<<"Unable to open file for Profiler(start).\n";
+            return;
+        }
+
+        const char startMsg[]="Profile File Started.\n\n";
+        fwrite(startMsg, strlen(startMsg), 1, f);
+
+        double printTime=(double)(MPMA::Timer::GetTicks()-profilerStartTicks)/(double)MPMA::Timer::GetTickFrequency();
+        Write(f, "Total time: ");
+        Write(f, printTime);
+        Write(f, " seconds.\n");
+
+        char clockLine[128];
+        if (MPMA::Timer::GetClockSource()==MPMA::CLOCK_SOURCE_TSC)
+            sprintf(clockLine, "Clock: time stamp counter at %.4f GHz.\n\n", MPMA::Timer::GetTickFrequency()/1e9);
+        else
+            sprintf(clockLine, "Clock: system clock.\n\n");
+        Write(f, clockLine);
+
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+        if (!countersOpened)
+            Write(f, "Hardware counters were not available on any thread (the kernel may not allow them, or there may be no PMU, as in many virtual machines).\n\n");
+        else if (countersFailed)
+            Write(f, "Hardware counters were not available on some threads, so their profiles show no counts.\n\n");
+#endif
+
+        std::vector<ScopeName> names;
+        CopyNames(names);
+
+        std::vector<uint64> exclusiveTicks;
+#ifdef TIMEPROFILE_CALL_TREE
+        MergedNode tree;
+        GatherTree(tree);
+        SumExclusive(tree, exclusiveTicks);
+#endif
+
+        WriteProfilesToFile(f, printTime, names, exclusiveTicks);
+
+#ifdef TIMEPROFILE_CALL_TREE
+        Write(f, " -- Call Tree --\n\n");
+        WriteTreeLevel(f, tree, names, 0, printTime);
+        Write(f, "\n");
+
+        if (!collapsedFilename.empty())
+        {
+            FILE *collapsed=fopen(collapsedFilename.c_str(), "wt");
+            if (collapsed)
+            {
+                WriteCollapsedLevel(collapsed, tree, names, "");
+                fclose(collapsed);
+            }
+            else
+                MPMA::ErrorReport()<<"Unable to open the collapsed stack file for Profiler.\n";
+        }
+#endif
+
+#ifdef LOCK_CONTENTION_STATS
+        Write(f, MPMA::GetLockStatsReport().c_str());
+#endif
+
+        fclose(f);
+    }
+
+    // -- snapshots
+
+#ifdef TIMEPROFILE_HISTOGRAMS
+    void SetPercentiles(MPMA::ProfileScopeResult &result, double tickSeconds)
+    {
+        result.p50Time=result.histogram.GetPercentile(50)*tickSeconds;
+        result.p90Time=result.histogram.GetPercentile(90)*tickSeconds;
+        result.p99Time=result.histogram.GetPercentile(99)*tickSeconds;
+        result.p999Time=result.histogram.GetPercentile(99.9)*tickSeconds;
+    }
+#endif
+
+    bool MoreTotalTime(const MPMA::ProfileScopeResult &a, const MPMA::ProfileScopeResult &b)
+    {
+        return a.totalTime>b.totalTime;
+    }
+
+    //fills a snapshot with everything since the profiler started
+    void TakeSnapshot(MPMA::ProfileSnapshot &outSnapshot)
+    {
+        double tickSeconds=1.0/(double)MPMA::Timer::GetTickFrequency();
+        outSnapshot.time=(double)(MPMA::Timer::GetTicks()-profilerStartTicks)*tickSeconds;
+        outSnapshot.duration=outSnapshot.time;
+        outSnapshot.scopes.clear();
+
+        std::vector<ScopeName> names;
+        CopyNames(names);
+
+        std::vector<uint64> exclusiveTicks;
+#ifdef TIMEPROFILE_CALL_TREE
+        MergedNode tree;
+        GatherTree(tree);
+        SumExclusive(tree, exclusiveTicks);
+#endif
+
+        std::vector<ScopeTotal> totals;
+        GatherTotals(totals);
+        outSnapshot.scopes.reserve(totals.size());
+        for (std::vector<ScopeTotal>::iterator cur=totals.begin(); cur!=totals.end(); ++cur)
+        {
+            if (cur->id>=names.size())
+                continue;
+
+            outSnapshot.scopes.push_back(MPMA::ProfileScopeResult());
+            MPMA::ProfileScopeResult &result=outSnapshot.scopes.back();
+            result.id=cur->id;
+            result.name=names[cur->id].name;
+            result.file=names[cur->id].file;
+            result.count=cur->count;
+            result.totalTime=cur->totalTicks*tickSeconds;
+            result.minTime=cur->minTicks*tickSeconds;
+            result.maxTime=cur->maxTicks*tickSeconds;
+            result.exclusiveTime=(cur->id<exclusiveTicks.size()) ? exclusiveTicks[cur->id]*tickSeconds : 0;
+            result.p50Time=result.p90Time=result.p99Time=result.p999Time=0;
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+            result.cycles=cur->counters[0];
+            result.instructions=cur->counters[1];
+            result.cacheMisses=cur->counters[2];
+            result.branchMisses=cur->counters[3];
+#else
+            result.cycles=result.instructions=result.cacheMisses=result.branchMisses=0;
+#endif
+#ifdef TIMEPROFILE_HISTOGRAMS
+            GatherHistogram(cur->id, result.histogram);
+            SetPercentiles(result, tickSeconds);
+#endif
+        }
+    }
+
+    //what ResetProfiles made later snapshots start from
+    MPMA::AdaptiveLock baselineLock;
+    MPMA::ProfileSnapshot *baseline=0;
+
+    //adds the csv lines for a snapshot.  If span is given, it's added as the first column.
+    void AppendCsv(std::string &out, const MPMA::ProfileSnapshot &snapshot, const char *span)
+    {
+        char buf[512];
+        for (std::vector<MPMA::ProfileScopeResult>::const_iterator s=snapshot.scopes.begin(); s!=snapshot.scopes.end(); ++s)
+        {
+            if (span)
+            {
+                out+=span;
+                out+=",";
+            }
+
+            //names are always quoted, with quotes doubled
+            std::string name=s->name, file=s->file;
+            for (nuint i=name.find('"'); i!=std::string::npos; i=name.find('"', i+2))
+                name.insert(i, 1, '"');
+            for (nuint i=file.find('"'); i!=std::string::npos; i=file.find('"', i+2))
+                file.insert(i, 1, '"');
+
+            sprintf(buf, "%f,%f,", snapshot.time, snapshot.duration);
+            out+=buf;
+            out+="\""+name+"\",\""+file+"\",";
+            sprintf(buf, "%llu,%f,%f,%f,%f,%f,%f,%f,%f,%f,%llu,%llu,%llu,%llu\n", (unsigned long long)s->count, s->totalTime*1000, (s->count ? s->totalTime/s->count*1000 : 0.0), s->minTime*1000, s->maxTime*1000, s->p50Time*1000, s->p90Time*1000, s->p99Time*1000, s->p999Time*1000, s->exclusiveTime*1000, (unsigned long long)s->cycles, (unsigned long long)s->instructions, (unsigned long long)s->cacheMisses, (unsigned long long)s->branchMisses);
+            out+=buf;
+        }
+    }
+
+    const char csvColumns[]="time_s,duration_s,name,file,count,total_ms,average_ms,min_ms,max_ms,p50_ms,p90_ms,p99_ms,p99.9_ms,exclusive_ms,cycles,instructions,cache_misses,branch_misses\n";
+
+    // -- periodic dumps
+
+    struct ProfileDump
+    {
+        MPMA::Thread *thread;
+        std::string filename;
+        double interval;
+        MPMA::ProfileDumpFormat format;
+        nuint keepFiles;
+        MPMA::ProfileSnapshot last; //what the last dump wrote
+    };
+
+    ProfileDump *profileDump=0;
+
+    //moves name to name.1, name.1 to name.2, and so on, dropping the oldest
+    void RotateFiles(const std::string &filename, nuint keepFiles)
+    {
+        if (keepFiles==0)
+        {
+            remove(filename.c_str());
+            return;
+        }
+
+        remove((filename+"."+(std::string)(MPMA::Vary)(uint64)keepFiles).c_str());
+        for (nuint i=keepFiles; i>1; --i)
+            rename((filename+"."+(std::string)(MPMA::Vary)(uint64)(i-1)).c_str(), (filename+"."+(std::string)(MPMA::Vary)(uint64)i).c_str());
+        rename(filename.c_str(), (filename+".1").c_str());
+    }
+
+    //writes the results since the last dump, and the totals
+    void WriteDump(ProfileDump &dump)
+    {
+        MPMA::ProfileSnapshot total, interval;
+        MPMA::GetProfileSnapshot(total);
+        MPMA::DiffProfileSnapshots(total, dump.last, interval);
+
+        std::string text;
+        if (dump.format==MPMA::PROFILE_DUMP_JSON)
+        {
+            text="{\"interval\":"+MPMA::ProfileSnapshotToJson(interval)+",\n\"total\":"+MPMA::ProfileSnapshotToJson(total)+"}\n";
+        }
+        else
+        {
+            text="span,";
+            text+=csvColumns;
+            AppendCsv(text, interval, "interval");
+            AppendCsv(text, total, "total");
+        }
+        std::swap(dump.last, total);
+
+        //write it all somewhere else first so there's never a partial file under the real name
+        std::string tempFilename=dump.filename+".tmp";
+        FILE *f=fopen(tempFilename.c_str(), "wb");
+        if (!f)
+        {
+            MPMA::ErrorReport()<<"Unable to open the profile dump file: "<<tempFilename<<"\n";
+            return;
+        }
+        bool ok=fwrite(text.c_str(), text.size(), 1, f)==1 || text.empty();
+        fclose(f);
+
+        if (ok)
+        {
+            RotateFiles(dump.filename, dump.keepFiles);
+            rename(tempFilename.c_str(), dump.filename.c_str());
+        }
+    }
+
+    void DumpThread(MPMA::Thread &me, MPMA::ThreadParam param)
+    {
+        ProfileDump *dump=(ProfileDump*)param.ptr;
+        MPMAProfileSetThreadName("Profile Dump");
+
+        MPMA::Timer timer;
+        while (!me.IsEnding())
+        {
+            MPMA::Sleep(50);
+            if (timer.Step(false)>=dump->interval)
+            {
+                timer.Step();
+                WriteDump(*dump);
+            }
+        }
+    }
+
+    void StartDumpAtInit()
+    {
+#ifdef TIMEPROFILE_DUMP_SECONDS
+        MPMA::StartProfileDump("_profile_dump.csv", TIMEPROFILE_DUMP_SECONDS);
+#endif
+    }
+
+    void StopDumpAtShutdown()
+    {
+        MPMA::StopProfileDump();
+    }
 
     void InitProfiler()
     {
-        _instProfile=new3(MPMA::Internal_Profiler);
+        ClearResults();
+        profilerStartTicks=MPMA::Timer::GetTicks();
+        MPMA::AtomicStore(&profilerReady, (nuint)1, MPMA::MEMORY_ORDER_RELEASE);
     }
 
     void CleanupProfiler()
     {
-        delete3(_instProfile);
-        _instProfile=0;
+        MPMA::AtomicStore(&profilerReady, (nuint)0, MPMA::MEMORY_ORDER_RELEASE);
+        WriteProfileFile();
+
+        if (baseline)
+        {
+            delete3(baseline);
+            baseline=0;
+        }
     }
 
     //hookup init callbacks
@@ -35,205 +1207,414 @@ namespace
         {
             MPMA::Internal_AddInitCallback(InitProfiler, -9000);
             MPMA::Internal_AddShutdownCallback(CleanupProfiler, -9000);
+
+            //the dump thread reports problems through the debug router, so it runs while that does
+            MPMA::Internal_AddInitCallback(StartDumpAtInit, -900);
+            MPMA::Internal_AddShutdownCallback(StopDumpAtShutdown, -900);
         }
     } autoSetup;
 }
 
 namespace MPMA
 {
-Internal_Profiler::~Internal_Profiler()
-{
-    //set up
-    FILE *f=fopen(profileFilename.c_str(), "wt"); //open file and kill old contents
-    if (!f)
+    //looks up the id of a name, adding it if it's new
+    ProfileScopeId Internal_ProfileLookup(const char *name, const char *file)
     {
-        MPMA::ErrorReport()<<"Unable to open file for Profiler(start).\n";
-        return;
+        return LookupName(name, file);
     }
 
-    const char startMsg[]="Profile File Started.\n\n";
-    fwrite(startMsg, strlen(startMsg), 1, f);
+    ProfileScopeId Internal_ProfileLookup(const std::string &name, const char *file)
+    {
+        //each thread remembers the names it has used, so it usually doesn't need the lock
+        std::unordered_map<std::string, ProfileScopeId> &stringIds=threadProfileOwner.stringIds;
+        std::unordered_map<std::string, ProfileScopeId>::iterator found=stringIds.find(name);
+        if (found!=stringIds.end())
+            return found->second;
 
-    double printTime = timeStart.Step();
-    Write(f, "Total time: ");
-    Write(f, printTime);
-    Write(f, " seconds.\n\n");
+        ProfileScopeId id=LookupName(name, file);
+        if (id!=PROFILE_SCOPE_NONE)
+            stringIds[name]=id;
+        return id;
+    }
 
-    WriteProfilesToFile(f, printTime);
+    //looks up the id for a site whose name isn't remembered yet
+    ProfileScopeId Internal_ProfileSite::Lookup(const char *siteName, const char *file)
+    {
+        ProfileScopeId foundId=LookupName(siteName, file);
 
-    fclose(f);
-}
+        //the first name used here is remembered
+        nuint expected=0;
+        if (foundId!=PROFILE_SCOPE_NONE && AtomicCompareAndSwap(&ready, expected, (nuint)1, MEMORY_ORDER_ACQUIRE))
+        {
+            name=siteName;
+            id=foundId;
+            AtomicStore(&ready, (nuint)2, MEMORY_ORDER_RELEASE);
+        }
 
-//writes a value to a file
-void Internal_Profiler::Write(FILE* f, double val)
-{
-    char buf[64];
-	sprintf(buf, "%f", val);
-    fwrite(buf, strlen(buf), 1, f);
-}
+        return foundId;
+    }
 
-void Internal_Profiler::Write(FILE* f, const char* str)
-{
-    fwrite(str,strlen(str),1,f);
-}
+    //starts timing a profile on the calling thread
+    void Internal_ProfileBegin(ProfileScopeId id)
+    {
+        if (id==PROFILE_SCOPE_NONE)
+            return;
 
-void Internal_Profiler::Write(FILE* f, int num)
-{
-    std::string buf=(MPMA::Vary)num;
-    fwrite(buf.c_str(), buf.size(), 1, f);
-}
+        ScopeStats *stats=GetScopeStats(id);
+        if (!stats)
+            return;
 
-//starts profiling
-void Internal_Profiler::_ProfileStart(const std::string &pName, const std::string &fName)
-{
-    MPMA::TakeMutexLock autoCrit(crit);
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+        //read before the time so the time doesn't include reading them
+        if (stats->depth==0)
+            stats->countersStarted=ReadCounters(threadProfile, stats->startCounters);
+#endif
+
+        uint64 startTicks=Timer::GetTicks();
+        if (stats->depth++==0)
+            stats->startTicks=startTicks;
+#ifdef TIMEPROFILE_CALL_TREE
+        TreeBegin(id, startTicks);
+#endif
 
-    //find profile
-    SProfile* pro=FindProfile(pName);
-    if (!pro) //profile doesn't exist
+        if (IsTraceRecording())
+            RecordTraceEvent(threadProfile, id, Internal_PROFILE_EVENT_BEGIN, startTicks, 0);
+    }
+
+    //stops timing a profile on the calling thread
+    void Internal_ProfileEnd(ProfileScopeId id)
     {
-        //allocate it
-        SProfile newPro;
+        if (id==PROFILE_SCOPE_NONE)
+            return;
+
+        uint64 endTicks=Timer::GetTicks();
+        ScopeStats *stats=GetScopeStats(id);
+        if (!stats)
+            return;
 
-        //initialize it
-        newPro.file=fName;
-        newPro.name=pName;
-        newPro.samples=0;
-        newPro.timeMax=0;
-        newPro.timeMin=0;
-        newPro.timeTotal=0;
-        newPro.started=false;
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+        Internal_ProfileCounterReading endCounters;
+        bool haveCounters=stats->depth==1 && stats->countersStarted && ReadCounters(threadProfile, endCounters);
+#endif
 
-        //add it to list
-        llProf.emplace_back(std::move(newPro));
+        if (stats->depth==0)
+        {
+            std::string name, file;
+            namesLock.Lock();
+            name=(*scopeNames)[id].name;
+            file=(*scopeNames)[id].file;
+            namesLock.Unlock();
 
-        pro=&*--llProf.end();
+            ErrorReport()<<"Warning: ProfileStop called without a matching ProfileStart\n  Name: "<<name<<"\n  File: "<<file<<"\n\n";
+            return;
+        }
+
+#ifdef TIMEPROFILE_CALL_TREE
+        TreeEnd(id, endTicks);
+#endif
+
+        if (IsTraceRecording())
+            RecordTraceEvent(threadProfile, id, Internal_PROFILE_EVENT_END, endTicks, 0);
+
+        if (--stats->depth!=0)
+            return;
+
+        //update profile appropriatly
+        uint64 ticks=endTicks-stats->startTicks;
+        if (ticks>stats->maxTicks) stats->maxTicks=ticks;
+        if (ticks<stats->minTicks || stats->count==0) stats->minTicks=ticks;
+        stats->totalTicks+=ticks;
+        ++stats->count;
+
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+        if (haveCounters)
+            AddCounterDifference(stats->startCounters, endCounters, stats->totalCounters);
+#endif
+
+#ifdef TIMEPROFILE_HISTOGRAMS
+        Histogram *histogram=stats->histogram;
+        if (!histogram)
+        {
+            //uses the global new for the same reason as the names
+            histogram=new Histogram;
+            AtomicStore(&stats->histogram, histogram, MEMORY_ORDER_RELEASE);
+        }
+        histogram->Add(ticks);
+#endif
     }
-    
-    if (pro->started)
+
+    void Internal_ProfileSetOutputFile(const std::string &filename)
     {
-        Error("Warning: ProfileStart called without a matching ProfileStop\n");
-        Error("  Name: ");
-        Error(pName.c_str());
-        Error("\n  File: ");
-        Error(fName.c_str());
-        Error("\n\n");
+        profileFilename=filename;
     }
 
-    //set start
-    pro->timeStart.Step();
-    pro->started=true;
-}
+    void Internal_ProfileSetCollapsedFile(const std::string &filename)
+    {
+        collapsedFilename=filename;
+    }
 
-//stops profiling
-void Internal_Profiler::_ProfileStop(const std::string &pName, const std::string &fName)
-{
-    MPMA::Timer searchTimer;
-
-    MPMA::TakeMutexLock autoCrit(crit);
-
-    //find the profile
-    SProfile* pro=FindProfile(pName);
-    if (!pro || !pro->started) //not found
-    {
-        Error("Warning: ProfileStop called without a matching ProfileStart\n");
-        Error("  Name: ");
-        Error(pName.c_str());
-        Error("\n  File: ");
-        Error(fName.c_str());
-        Error("\n\n");
-        return;
-    }
-
-    //get difference in time
-    double timeDif=pro->timeStart.Step();
-    pro->started=false;
-    
-    double searchTime=searchTimer.Step();
-    timeDif-=searchTime;
-
-    //update profile appropriatly
-    if (timeDif>pro->timeMax) pro->timeMax=timeDif;
-    if (timeDif<pro->timeMin || pro->samples==0) pro->timeMin=timeDif;
-    pro->timeTotal+=timeDif;
-    pro->samples++;
-}
+    //fills a snapshot with the results of every profile so far
+    void GetProfileSnapshot(ProfileSnapshot &outSnapshot)
+    {
+        ProfileSnapshot all;
+        TakeSnapshot(all);
 
-void Internal_Profiler::_SetOutputFile(const std::string &filename)
-{
-    profileFilename=filename;
-}
+        baselineLock.Lock();
+        if (baseline)
+            DiffProfileSnapshots(all, *baseline, outSnapshot);
+        else
+            std::swap(outSnapshot, all);
+        baselineLock.Unlock();
+    }
 
-//finds a profile, NULL if not found
-Internal_Profiler::SProfile* Internal_Profiler::FindProfile(const std::string &name)
-{
-    std::list<SProfile>::iterator cur=llProf.begin();
+    //gets the count and total time of one profile
+    void GetProfileTotals(const std::string &name, uint64 &outCount, double &outTotalTime)
+    {
+        outCount=0;
+        outTotalTime=0;
+
+        ProfileScopeId id=PROFILE_SCOPE_NONE;
+        namesLock.Lock();
+        if (scopeIds)
+        {
+            std::unordered_map<std::string, ProfileScopeId>::iterator found=scopeIds->find(name);
+            if (found!=scopeIds->end())
+                id=found->second;
+        }
+        namesLock.Unlock();
+
+        if (id==PROFILE_SCOPE_NONE)
+            return;
+
+        uint64 totalTicks=0;
+        for (ThreadProfile *profile=AtomicLoad(&threadProfiles, MEMORY_ORDER_ACQUIRE); profile; profile=profile->next)
+        {
+            ScopeStats *page=AtomicLoad(&profile->pages[id/SCOPES_PER_PAGE], MEMORY_ORDER_ACQUIRE);
+            if (page)
+            {
+                outCount+=page[id%SCOPES_PER_PAGE].count;
+                totalTicks+=page[id%SCOPES_PER_PAGE].totalTicks;
+            }
+        }
+        outTotalTime=(double)totalTicks/(double)Timer::GetTickFrequency();
+    }
 
-    while (cur!=llProf.end())
+    //makes later snapshots only include what happens from now on
+    void ResetProfiles()
     {
-        if (name==cur->name)
-            return &*cur;
+        ProfileSnapshot *all=new3(ProfileSnapshot);
+        TakeSnapshot(*all);
 
-        ++cur;
+        baselineLock.Lock();
+        std::swap(baseline, all);
+        baselineLock.Unlock();
+
+        if (all)
+            delete3(all);
     }
 
-    return 0;
-}
+    //fills outDiff with only what happened between two snapshots
+    void DiffProfileSnapshots(const ProfileSnapshot &later, const ProfileSnapshot &earlier, ProfileSnapshot &outDiff)
+    {
+#ifdef TIMEPROFILE_HISTOGRAMS
+        double tickSeconds=1.0/(double)Timer::GetTickFrequency();
+#endif
 
-//writes all profiles taken to file
-void Internal_Profiler::WriteProfilesToFile(FILE *f, double finalTime)
-{
-    //write header
-    const char lpzProMsg[]=" -- Profiles --\n\n";
-    fwrite(lpzProMsg, strlen(lpzProMsg), 1, f);
+        std::vector<const ProfileScopeResult*> earlierById;
+        for (std::vector<ProfileScopeResult>::const_iterator e=earlier.scopes.begin(); e!=earlier.scopes.end(); ++e)
+        {
+            if (earlierById.size()<=e->id)
+                earlierById.resize(e->id+1, 0);
+            earlierById[e->id]=&*e;
+        }
 
-    //sort by time total
-    llProf.sort();
+        ProfileSnapshot diff;
+        diff.time=later.time;
+        diff.duration=later.time-earlier.time;
+        for (std::vector<ProfileScopeResult>::const_iterator l=later.scopes.begin(); l!=later.scopes.end(); ++l)
+        {
+            const ProfileScopeResult *e=(l->id<earlierById.size()) ? earlierById[l->id] : 0;
+            if (e && e->count>=l->count)
+                continue;
 
-    std::list<SProfile>::iterator cur=llProf.begin();
+            diff.scopes.push_back(*l);
+            if (!e)
+                continue;
 
-    //write profiles
-    while (cur!=llProf.end())
+            ProfileScopeResult &result=diff.scopes.back();
+            result.count-=e->count;
+            result.totalTime-=e->totalTime;
+            result.exclusiveTime-=e->exclusiveTime;
+            result.cycles-=(e->cycles<result.cycles) ? e->cycles : result.cycles;
+            result.instructions-=(e->instructions<result.instructions) ? e->instructions : result.instructions;
+            result.cacheMisses-=(e->cacheMisses<result.cacheMisses) ? e->cacheMisses : result.cacheMisses;
+            result.branchMisses-=(e->branchMisses<result.branchMisses) ? e->branchMisses : result.branchMisses;
+#ifdef TIMEPROFILE_HISTOGRAMS
+            result.histogram.Subtract(e->histogram);
+            result.minTime=result.histogram.GetMin()*tickSeconds;
+            result.maxTime=result.histogram.GetMax()*tickSeconds;
+            SetPercentiles(result, tickSeconds);
+#else
+            //the later snapshot's are over all time, not just the interval
+            result.minTime=0;
+            result.maxTime=0;
+#endif
+        }
+
+        std::sort(diff.scopes.begin(), diff.scopes.end(), MoreTotalTime);
+        std::swap(outDiff, diff);
+    }
+
+    //returns a snapshot as csv text
+    std::string ProfileSnapshotToCsv(const ProfileSnapshot &snapshot)
     {
-        Write(f, cur->name.c_str());
-        Write(f, " - ");
-        Write(f, cur->file.c_str());
-        Write(f, "\n");
+        std::string csv=csvColumns;
+        AppendCsv(csv, snapshot, 0);
+        return csv;
+    }
 
-        Write(f, " Average time: ");
-        Write(f, cur->timeTotal/cur->samples*1000);
-        Write(f, " ms\n");
+    //returns a snapshot as json text
+    std::string ProfileSnapshotToJson(const ProfileSnapshot &snapshot)
+    {
+        char buf[512];
+        sprintf(buf, "{\"time_s\":%f,\"duration_s\":%f,\"scopes\":[", snapshot.time, snapshot.duration);
+        std::string json=buf;
 
-        Write(f, " Max time: ");
-        Write(f, cur->timeMax*1000);
-        Write(f, " ms\n");
+        for (std::vector<ProfileScopeResult>::const_iterator s=snapshot.scopes.begin(); s!=snapshot.scopes.end(); ++s)
+        {
+            json+=(s==snapshot.scopes.begin()) ? "\n{\"name\":" : ",\n{\"name\":";
+            json+=JsonString(s->name);
+            json+=",\"file\":";
+            json+=JsonString(s->file);
+            sprintf(buf, ",\"count\":%llu,\"total_ms\":%f,\"average_ms\":%f,\"min_ms\":%f,\"max_ms\":%f,\"p50_ms\":%f,\"p90_ms\":%f,\"p99_ms\":%f,\"p99.9_ms\":%f,\"exclusive_ms\":%f,\"cycles\":%llu,\"instructions\":%llu,\"cache_misses\":%llu,\"branch_misses\":%llu}", (unsigned long long)s->count, s->totalTime*1000, (s->count ? s->totalTime/s->count*1000 : 0.0), s->minTime*1000, s->maxTime*1000, s->p50Time*1000, s->p90Time*1000, s->p99Time*1000, s->p999Time*1000, s->exclusiveTime*1000, (unsigned long long)s->cycles, (unsigned long long)s->instructions, (unsigned long long)s->cacheMisses, (unsigned long long)s->branchMisses);
+            json+=buf;
+        }
 
-        Write(f, " Min time: ");
-        Write(f, cur->timeMin*1000);
-        Write(f, " ms\n");
+        json+="]}";
+        return json;
+    }
 
-        double printTime = cur->timeTotal;
-        Write(f, " Total time: ");
-        Write(f, printTime);
-        Write(f, " seconds\n");
+    //starts a thread that writes the profiles to a file every so often
+    void StartProfileDump(const std::string &filename, double intervalSeconds, ProfileDumpFormat format, nuint keepFiles)
+    {
+        StopProfileDump();
 
-        Write(f, " Samples taken: ");
-        Write(f, cur->samples);
+        profileDump=new3(ProfileDump);
+        profileDump->filename=filename;
+        profileDump->interval=intervalSeconds;
+        profileDump->format=format;
+        profileDump->keepFiles=keepFiles;
+        profileDump->last.time=0;
+        profileDump->last.duration=0;
+        profileDump->thread=new3(Thread(DumpThread, profileDump));
+        profileDump->thread->SetPriority(THREAD_LOW);
+    }
 
-        Write(f, "\n Percentage of total time: ");
-        Write(f, (int)((printTime/finalTime)*100.0));
+    //stops the thread started by StartProfileDump
+    void StopProfileDump()
+    {
+        if (!profileDump)
+            return;
 
-        Write(f, "%\n\n");
+        delete3(profileDump->thread);
+        WriteDump(*profileDump);
+        delete3(profileDump);
+        profileDump=0;
+    }
+
+    //records an instant or counter event in the trace
+    void Internal_ProfileTraceEvent(ProfileScopeId id, Internal_ProfileEventType type, double value)
+    {
+        if (id==PROFILE_SCOPE_NONE || !IsTraceRecording())
+            return;
 
-        ++cur;
+        ThreadProfile *profile=GetThreadProfile();
+        if (profile)
+            RecordTraceEvent(profile, id, type, Timer::GetTicks(), value);
     }
-}
 
-//opens profile file and writes error message
-void Internal_Profiler::Error(const char *lpzMsg)
-{
-    MPMA::ErrorReport()<<lpzMsg;
-}
+    void Internal_ProfileSetThreadName(const char *name)
+    {
+        ThreadProfile *profile=GetThreadProfile();
+        if (profile)
+        {
+            strncpy(profile->name, name, sizeof(profile->name)-1);
+            profile->name[sizeof(profile->name)-1]=0;
+        }
+    }
+
+    //starts recording a trace
+    void StartProfileTrace(double maxSeconds)
+    {
+        StopProfileTrace();
+
+        traceStartTicks=Timer::GetTicks();
+        if (maxSeconds>0)
+            traceEndTicks=traceStartTicks+(uint64)(maxSeconds*Timer::GetTickFrequency());
+        else
+            traceEndTicks=~(uint64)0;
+        traceStopTicks=traceEndTicks;
+
+        AtomicFetchAdd(&traceGeneration, (nuint)1);
+        AtomicStore(&traceRecording, (nuint)1, MEMORY_ORDER_RELEASE);
+    }
+
+    //stops recording the trace
+    void StopProfileTrace()
+    {
+        nuint expected=1;
+        if (AtomicCompareAndSwap(&traceRecording, expected, (nuint)0, MEMORY_ORDER_RELAXED))
+        {
+            uint64 now=Timer::GetTicks();
+            traceStopTicks=(now<traceEndTicks) ? now : traceEndTicks;
+        }
+    }
+
+    //returns whether a trace is recording
+    bool IsProfileTraceRecording()
+    {
+        if (!IsTraceRecording())
+            return false;
+        if (Timer::GetTicks()>traceEndTicks)
+        {
+            StopProfileTrace();
+            return false;
+        }
+        return true;
+    }
+
+    //writes the trace that was recorded as chrome trace event json
+    bool WriteProfileTrace(const std::string &filename)
+    {
+        StopProfileTrace();
+
+        FILE *f=fopen(filename.c_str(), "wt");
+        if (!f)
+        {
+            ErrorReport()<<"Unable to open the profile trace file: "<<filename<<"\n";
+            return false;
+        }
+
+        std::vector<ScopeName> names;
+        CopyNames(names);
+
+        fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+        bool first=true;
+        nuint generation=AtomicLoad(&traceGeneration, MEMORY_ORDER_ACQUIRE);
+        if (generation!=0)
+        {
+            for (ThreadProfile *profile=AtomicLoad(&threadProfiles, MEMORY_ORDER_ACQUIRE); profile; profile=profile->next)
+            {
+                if (AtomicLoad(&profile->traceGeneration, MEMORY_ORDER_ACQUIRE)==generation)
+                    WriteThreadTrace(f, first, profile, names, traceStopTicks);
+            }
+        }
+        fprintf(f, "\n]}\n");
+
+        bool ok=!ferror(f);
+        fclose(f);
+        return ok;
+    }
 } //namespace MPMA
 
 #endif
@@ -1,6 +1,8 @@
 //! \file Profiler.h \brief Profile the speed of sections of code.
 //!
-//!The names of a profile are "not" case sensitive.  The results of the profile will be written to the profile file (default _profile.txt) after the progam ends.
+//!The names of a profile are case sensitive.  The results of the profile will be written to the profile file (default _profile.txt) after the progam ends.
+//!If TIMEPROFILE_CALL_TREE is defined, profiles started inside other profiles are also shown as a tree, and the tree is written as collapsed stacks (default _profile.folded) which flamegraph.pl or speedscope can draw.
+//!Each name is looked up once per place in the code that uses it, after which starting and stopping a profile only touches data belonging to the calling thread (no locks), so profiles are cheap enough to leave in hot code.  The threads' results are added together when the report is made.
 
 /*
 An example of profiling a section of code:
@@ -15,6 +17,28 @@ An example of automatically profiling the scope of a function:
       MPMAProfileScope("name of a profile");
       //...code...
   }
+
+An example of recording a timeline of the next 5 seconds, to open in https://ui.perfetto.dev or chrome://tracing:
+  MPMA::StartProfileTrace(5.0);
+  ...
+  MPMA::StopProfileTrace();
+  MPMA::WriteProfileTrace("trace.json");
+
+An example of looking at profiles while the program runs:
+  MPMA::ProfileSnapshot before, after, frame;
+  MPMA::GetProfileSnapshot(before);
+  RunOneFrame();
+  MPMA::GetProfileSnapshot(after);
+  MPMA::DiffProfileSnapshots(after, before, frame); //just what happened during the frame
+
+  //or have a low priority thread write the profiles every 10 seconds, keeping the last 4 files as name.1 through name.4
+  MPMA::StartProfileDump("profile.csv", 10.0);
+
+While a trace is recording, events can also be marked on it:
+  MPMAProfileInstant("Level loaded");
+  MPMAProfileCounter("Streams playing", streamCount);
+
+Names given as a const char* are remembered by address at each place they are used, so they should be string literals.  A name that is built at runtime should be passed as a std::string.
 */
 /*
 Written by Luke Lenhart (2002-2008)
@@ -29,21 +53,34 @@ See /docs/License.txt for details on how this code may be used.
 //macro replacement
 #ifdef TIMEPROFILE_ENABLED
     //!Set the filename to save profile data to, after the program ends.
-    #define MPMAProfileSetOutputFile(filename) do { if (_instProfile) _instProfile->_SetOutputFile(filename); } while (false)
+    #define MPMAProfileSetOutputFile(filename) MPMA::Internal_ProfileSetOutputFile(filename)
+    //!Set the filename to save the call tree to as collapsed stacks (exclusive microseconds per stack), after the program ends.  An empty name turns it off.
+    #define MPMAProfileSetCollapsedFile(filename) MPMA::Internal_ProfileSetCollapsedFile(filename)
     //!Begin profiling a section of code.
-    #define MPMAProfileStart(name)  do { if (_instProfile) _instProfile->_ProfileStart(name,__FILE__); } while (false)
+    #define MPMAProfileStart(name)  do { static MPMA::Internal_ProfileSite _profile_site; MPMA::Internal_ProfileBegin(_profile_site.Id(name,__FILE__)); } while (false)
     //!End profiling a section of code.
-    #define MPMAProfileStop(name)  do { if (_instProfile) _instProfile->_ProfileStop(name,__FILE__); } while (false)
+    #define MPMAProfileStop(name)  do { static MPMA::Internal_ProfileSite _profile_site; MPMA::Internal_ProfileEnd(_profile_site.Id(name,__FILE__)); } while (false)
 
-    #define MPMAProfileScopeIter0(name, iter) MPMA::Internal_AutoProfileHelper _auto_scope_profiler##iter(name); MPMAProfileStart(name)
+    #define MPMAProfileScopeIter0(name, iter) static MPMA::Internal_ProfileSite _profile_site##iter; MPMA::Internal_AutoProfileHelper _auto_scope_profiler##iter(_profile_site##iter.Id(name,__FILE__))
     #define MPMAProfileScopeIter1(name, iter) MPMAProfileScopeIter0(name, iter)
     //!Profile a scope of code.
     #define MPMAProfileScope(name) MPMAProfileScopeIter1(name, __COUNTER__)
+
+    //!Marks a moment on the calling thread in the trace that is recording, if there is one.
+    #define MPMAProfileInstant(name)  do { static MPMA::Internal_ProfileSite _profile_site; MPMA::Internal_ProfileTraceEvent(_profile_site.Id(name,__FILE__), MPMA::Internal_PROFILE_EVENT_INSTANT, 0); } while (false)
+    //!Records the value of a counter in the trace that is recording, if there is one.
+    #define MPMAProfileCounter(name, value)  do { static MPMA::Internal_ProfileSite _profile_site; MPMA::Internal_ProfileTraceEvent(_profile_site.Id(name,__FILE__), MPMA::Internal_PROFILE_EVENT_COUNTER, (double)(value)); } while (false)
+    //!Sets the name the calling thread is shown with in traces.
+    #define MPMAProfileSetThreadName(name) MPMA::Internal_ProfileSetThreadName(name)
 #else
     #define MPMAProfileSetOutputFile(filename)
+    #define MPMAProfileSetCollapsedFile(filename)
     #define MPMAProfileStart(name)
     #define MPMAProfileStop(name)
     #define MPMAProfileScope(name)
+    #define MPMAProfileInstant(name)
+    #define MPMAProfileCounter(name, value)
+    #define MPMAProfileSetThreadName(name)
 #endif
 
 
@@ -51,82 +88,179 @@ See /docs/License.txt for details on how this code may be used.
 #ifdef TIMEPROFILE_ENABLED
 
 #include <string>
-#include <list>
-#include "Locks.h"
+#include <vector>
+#include "Atomic.h"
 #include "Types.h"
-#include "Timer.h"
+#ifdef TIMEPROFILE_HISTOGRAMS
+    #include "Histogram.h"
+#endif
 
 namespace MPMA
 {
-    //main profiler
-    class Internal_Profiler
+    //!Identifies a profile name.  Each name is given an id the first time it is used, which stays the same for the rest of the program.
+    typedef uint32 ProfileScopeId;
+
+    //!The id that is used when a profile can't be recorded (such as before the framework is initialized).  Profiles with it are ignored.
+    const ProfileScopeId PROFILE_SCOPE_NONE=0xffffffff;
+
+    //!The results of one profile, with every thread's results put together.  Times are in seconds.
+    struct ProfileScopeResult
     {
-    public:
-        ~Internal_Profiler();
+        ProfileScopeId id;
+        std::string name;
+        std::string file; //!<Where the name was first used.
+        uint64 count; //!<Number of times it was stopped.
+        double totalTime;
+        double minTime; //!<Shortest and longest times.  In the results of DiffProfileSnapshots, and in snapshots taken after ResetProfiles, these are 0 (unknown) unless TIMEPROFILE_HISTOGRAMS is defined.
+        double maxTime; //!<
+        double exclusiveTime; //!<Time not spent in other profiles started inside this one.  Only filled in if TIMEPROFILE_CALL_TREE is defined.
+        double p50Time; //!<Percentiles, only filled in if TIMEPROFILE_HISTOGRAMS is defined.
+        double p90Time; //!<
+        double p99Time; //!<
+        double p999Time; //!<
+        uint64 cycles; //!<Hardware counter totals, only filled in if TIMEPROFILE_HARDWARE_COUNTERS is defined and the counters could be opened.  When the kernel shares the counters out between more events than the cpu has, they are estimates, scaled up from the part of the time they were counting.
+        uint64 instructions; //!<
+        uint64 cacheMisses; //!<
+        uint64 branchMisses; //!<
+#ifdef TIMEPROFILE_HISTOGRAMS
+        Histogram histogram; //!<Every time it took, in Timer ticks (see Timer::GetTickFrequency).
+#endif
+    };
 
-        void _ProfileStart(const std::string &pName, const std::string &fName);
-        void _ProfileStop(const std::string &pName, const std::string &fName);
-        void _SetOutputFile(const std::string &filename);
+    //!The results of every profile at one moment.
+    struct ProfileSnapshot
+    {
+        double time; //!<When it was taken, in seconds since the framework was initialized.
+        double duration; //!<The number of seconds the results cover.
+        std::vector<ProfileScopeResult> scopes; //!<Sorted by total time, most first.
+    };
 
-    private:
-        struct SProfile
-        {
-            std::string name; //name for this profile
-            std::string file; //filename for this profile
+    //!How StartProfileDump writes its files.
+    enum ProfileDumpFormat
+    {
+        PROFILE_DUMP_CSV, //!<One line per profile, for the time since the last dump and then for the total.
+        PROFILE_DUMP_JSON //!<An object with the same results as the csv.
+    };
+
+    //!Fills a snapshot with the results of every profile so far (since the framework was initialized, or since ResetProfiles).  Profiled threads are not stopped or slowed down while this runs, so profiles that stop during it may or may not be included.
+    void GetProfileSnapshot(ProfileSnapshot &outSnapshot);
+
+    //!Gets the number of times one profile has stopped and its total time in seconds, with every thread's results added together.  This is much cheaper than a whole snapshot.  Both are 0 if the profile hasn't been used.  This is not affected by ResetProfiles.
+    void GetProfileTotals(const std::string &name, uint64 &outCount, double &outTotalTime);
 
-            double timeTotal; //total time spent
-            double timeMax; //largest time spent
-            double timeMin; //smallest time spent
+    //!Makes later snapshots only include what happens from now on.  This does not affect the profile file written at shutdown, which always has everything.
+    void ResetProfiles();
 
-            MPMA::Timer timeStart; //time of last profile start
+    //!Fills outDiff with only what happened between two snapshots.  Without TIMEPROFILE_HISTOGRAMS the min and max times of the interval can't be known, so they are 0.
+    void DiffProfileSnapshots(const ProfileSnapshot &later, const ProfileSnapshot &earlier, ProfileSnapshot &outDiff);
 
-            int samples; //number of samples taken
-            
-            bool started;
+    //!Returns a snapshot as csv text, with a header line.
+    std::string ProfileSnapshotToCsv(const ProfileSnapshot &snapshot);
 
-            inline bool operator <(const SProfile &o) { return timeTotal>o.timeTotal; }
-        };
+    //!Returns a snapshot as json text.
+    std::string ProfileSnapshotToJson(const ProfileSnapshot &snapshot);
 
-        std::list<SProfile> llProf; //profile list
+    //!Starts a low priority thread that writes the profiles to a file every intervalSeconds, until StopProfileDump is called or the framework shuts down.  The last keepFiles files written before the current one are kept, with .1 (the newest) through .keepFiles added to their names.  Each file is written completely before it replaces the last one.
+    void StartProfileDump(const std::string &filename, double intervalSeconds, ProfileDumpFormat format=PROFILE_DUMP_CSV, nuint keepFiles=4);
 
-        MPMA::Timer timeStart; //time class was created
+    //!Stops the thread started by StartProfileDump, after it writes one last file.
+    void StopProfileDump();
 
-        //
+    //!Starts recording every profile that starts or stops on every thread, with its time, until StopProfileTrace is called or maxSeconds pass (0 for no limit).  Each thread keeps its last TIMEPROFILE_TRACE_EVENTS events.  A trace that was already recorded is thrown out.
+    void StartProfileTrace(double maxSeconds=0);
 
-        void Write(FILE* f, double val);
-        void Write(FILE* f, const char* str);
-        void Write(FILE* f, int num);
+    //!Stops recording the trace.  What was recorded is kept until the next StartProfileTrace.
+    void StopProfileTrace();
 
-        SProfile* FindProfile(const std::string &name);
+    //!Returns whether a trace is recording.
+    bool IsProfileTraceRecording();
 
-        void WriteProfilesToFile(FILE *f, double finalTime);
+    //!Writes the trace that was recorded in the Chrome Trace Event JSON format, which Perfetto and chrome://tracing open.  The trace should be stopped first.  Returns false if the file couldn't be written.
+    bool WriteProfileTrace(const std::string &filename);
 
-        void Error(const char *lpzMsg);
+    // -- internal use below
 
-        //thread safety
-        MPMA::MutexLock crit;
+    enum Internal_ProfileEventType
+    {
+        Internal_PROFILE_EVENT_BEGIN,
+        Internal_PROFILE_EVENT_END,
+        Internal_PROFILE_EVENT_INSTANT,
+        Internal_PROFILE_EVENT_COUNTER
     };
-}
 
-#endif
+    //records an instant or counter event in the trace
+    void Internal_ProfileTraceEvent(ProfileScopeId id, Internal_ProfileEventType type, double value);
 
-//access to profiler object
-#ifdef TIMEPROFILE_ENABLED
-    extern MPMA::Internal_Profiler *_instProfile;
+    void Internal_ProfileSetThreadName(const char *name);
+
+#ifdef TIMEPROFILE_HARDWARE_COUNTERS
+    //cycles, instructions, cache misses, branch misses
+    const nuint Internal_PROFILE_COUNTER_COUNT=4;
+
+    //a thread's open hardware counters
+    struct Internal_ProfileCounters
+    {
+        nsint handle;
+        nsint members[Internal_PROFILE_COUNTER_COUNT];
+        bool available[Internal_PROFILE_COUNTER_COUNT];
+        nuint openCount;
+    };
+
+    //a reading of a thread's counters.  The values are raw, so when the kernel shares the counters out between more events than the cpu has, a difference between two readings must be scaled up by how long the group was enabled over how long it was actually counting in between.
+    struct Internal_ProfileCounterReading
+    {
+        uint64 values[Internal_PROFILE_COUNTER_COUNT];
+        uint64 timeEnabled;
+        uint64 timeRunning;
+    };
+
+    //platform-specific: opens the calling thread's counters, returning false if they can't be used.  Reads give 0 for any single counter that couldn't be opened.
+    bool Internal_OpenProfileCounters(Internal_ProfileCounters &counters);
+    bool Internal_ReadProfileCounters(const Internal_ProfileCounters &counters, Internal_ProfileCounterReading &outReading);
+    void Internal_CloseProfileCounters(Internal_ProfileCounters &counters);
 #endif
 
-//auto-scope profiler (exception-safe and return-safe) -- use macro, not this!!
-#ifdef TIMEPROFILE_ENABLED
-namespace MPMA
-{
+    //looks up the id of a name, adding it if it's new
+    ProfileScopeId Internal_ProfileLookup(const char *name, const char *file);
+    ProfileScopeId Internal_ProfileLookup(const std::string &name, const char *file);
+
+    //starts and stops timing a profile on the calling thread
+    void Internal_ProfileBegin(ProfileScopeId id);
+    void Internal_ProfileEnd(ProfileScopeId id);
+
+    void Internal_ProfileSetOutputFile(const std::string &filename);
+    void Internal_ProfileSetCollapsedFile(const std::string &filename);
+
+    //remembers the id of the name used at one place in the code.  This is plain data so a static one needs no construction.
+    struct Internal_ProfileSite
+    {
+        volatile nuint ready; //2 once name and id are filled in, after which they never change
+        const char *name;
+        ProfileScopeId id;
+
+        inline ProfileScopeId Id(const char *siteName, const char *file)
+        {
+            if (AtomicLoad(&ready, MEMORY_ORDER_ACQUIRE)==2 && name==siteName)
+                return id;
+            return Lookup(siteName, file);
+        }
+
+        inline ProfileScopeId Id(const std::string &siteName, const char *file)
+            { return Internal_ProfileLookup(siteName, file); }
+
+        ProfileScopeId Lookup(const char *siteName, const char *file);
+    };
+
+    //auto-scope profiler (exception-safe and return-safe) -- use macro, not this!!
     class Internal_AutoProfileHelper
     {
     public:
-        inline Internal_AutoProfileHelper(const std::string &profileName) { name=profileName; }
-        inline ~Internal_AutoProfileHelper() { MPMAProfileStop(name); }
+        inline Internal_AutoProfileHelper(ProfileScopeId profileId): id(profileId) { Internal_ProfileBegin(id); }
+        inline ~Internal_AutoProfileHelper() { Internal_ProfileEnd(id); }
 
     private:
-        std::string name;
+        ProfileScopeId id;
     };
 }
+
 #endif
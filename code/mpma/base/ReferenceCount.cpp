@@ -15,6 +15,7 @@ bool mpmaForceReferenceToReferenceCountCPP=false; //work around a problem using
 
 #include "Memory.h"
 #include "Locks.h"
+#include "Atomic.h"
 
 namespace MPMA
 {
@@ -39,12 +40,10 @@ namespace MPMA
     {
         if (referencedData)
         {
-            AtomicIntDec(&referencedData->count);
-            if (referencedData->count==0)
-            {
+            //only the thread that drops the last reference may free it, and it must see everything the other owners did first
+            if (AtomicFetchSub(&referencedData->count, (nuint)1, MEMORY_ORDER_ACQ_REL)==1)
                 delete3(referencedData);
-                referencedData=0;
-            }
+            referencedData=0;
         }
     }
 
@@ -64,7 +63,7 @@ namespace MPMA
 
         ReleaseReference();
 
-        AtomicIntInc(&other.referencedData->count);
+        AtomicFetchAdd(&other.referencedData->count, (nuint)1, MEMORY_ORDER_RELAXED);
         referencedData=other.referencedData;
 
         return *this;
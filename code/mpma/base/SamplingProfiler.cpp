@@ -0,0 +1,413 @@
+//A statistical cpu profiler, which records the call stack of each thread many times a second.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "SamplingProfiler.h"
+
+#ifdef SAMPLING_PROFILER
+
+#include "Debug.h"
+#include "DebugRouter.h"
+#include "Locks.h"
+#include "Memory.h"
+#include "Profiler.h"
+#include "Thread.h"
+#include "../Setup.h"
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+
+namespace MPMA
+{
+    extern void Sleep(nuint time);
+}
+
+namespace
+{
+    //how often the samples are taken from the threads' buffers, in milliseconds
+    const nuint COLLECT_INTERVAL=100;
+
+    typedef std::map<std::vector<void*>, uint64> StackCounts;
+
+    //the collected samples
+    MPMA::AdaptiveLock samplesLock; //taken before the platform's lock on the threads, never after
+    StackCounts *stacks=0;
+    uint64 sampleCount=0;
+    uint64 droppedCount=0;
+
+    bool running=false;
+    MPMA::Thread *collectThread=0;
+
+    class TakeSamplesLock
+    {
+    public:
+        inline TakeSamplesLock() { samplesLock.Lock(); }
+        inline ~TakeSamplesLock() { samplesLock.Unlock(); }
+    };
+
+    //adds a sample taken from a thread's buffer.  The samples lock must be held.
+    void AddStack(void **frames, nuint depth)
+    {
+        if (depth==0)
+            return;
+
+        if (!stacks)
+            stacks=new3(StackCounts);
+
+        std::vector<void*> stack(frames, frames+depth);
+        ++(*stacks)[stack];
+        ++sampleCount;
+    }
+
+    //takes the samples out of every thread's buffer
+    void Collect()
+    {
+        TakeSamplesLock takeLock;
+        droppedCount+=MPMA::Internal_CollectSamples(AddStack);
+    }
+
+    //empties the threads' buffers often enough that they don't fill up
+    void CollectThread(MPMA::Thread &me, MPMA::ThreadParam param)
+    {
+        MPMAProfileSetThreadName("Sampling Profiler");
+
+        while (!me.IsEnding())
+        {
+            MPMA::Sleep(COLLECT_INTERVAL);
+            Collect();
+        }
+    }
+
+    //looks up names, remembering ones already found since the same addresses show up in many stacks
+    class SymbolCache
+    {
+    public:
+        const std::string& Name(void *address)
+        {
+            std::map<void*, std::string>::iterator found=names.find(address);
+            if (found!=names.end())
+                return found->second;
+
+            //return addresses point after the call (and the sampled address was recorded plus one to match), so look up the byte before
+            return names[address]=MPMA::GetCodeAddressName((uint8*)address-1);
+        }
+
+    private:
+        std::map<void*, std::string> names;
+    };
+
+    bool MoreSamples(const MPMA::SamplingProfileStack &a, const MPMA::SamplingProfileStack &b)
+    {
+        return a.samples>b.samples;
+    }
+
+    //samples of one function, for the report
+    struct FunctionSamples
+    {
+        std::string name;
+        uint64 self;
+        uint64 total;
+
+        inline FunctionSamples(): self(0), total(0) {}
+    };
+
+    bool MoreSelf(const FunctionSamples &a, const FunctionSamples &b)
+    {
+        return a.self>b.self;
+    }
+
+    bool MoreTotal(const FunctionSamples &a, const FunctionSamples &b)
+    {
+        return a.total>b.total;
+    }
+
+#ifdef SAMPLING_PROFILER_AUTOSTART
+    //writes a text file, returning false if it couldn't be written
+    bool WriteTextFile(const std::string &filename, const std::string &text)
+    {
+        FILE *file=fopen(filename.c_str(), "w");
+        if (!file)
+            return false;
+
+        bool ok=fwrite(text.c_str(), text.size(), 1, file)==1 || text.empty();
+        fclose(file);
+        return ok;
+    }
+#endif
+
+    void InitSamplingProfiler()
+    {
+        MPMA::RegisterSamplingProfilerThread();
+
+#ifdef SAMPLING_PROFILER_AUTOSTART
+        if (!MPMA::StartSamplingProfiler())
+            MPMA::ErrorReport()<<"The sampling profiler could not be started.\n";
+#endif
+    }
+
+    void ShutdownSamplingProfiler()
+    {
+        MPMA::StopSamplingProfiler();
+
+#ifdef SAMPLING_PROFILER_AUTOSTART
+        if (!WriteTextFile("_sampling_profile.txt", MPMA::GetSamplingProfileReport()))
+            MPMA::ErrorReport()<<"Unable to write _sampling_profile.txt\n";
+        if (!MPMA::WriteSamplingProfileCollapsed("_sampling_profile.folded"))
+            MPMA::ErrorReport()<<"Unable to write _sampling_profile.folded\n";
+#endif
+
+        MPMA::UnregisterSamplingProfilerThread();
+        MPMA::ClearSamplingProfile();
+    }
+
+    //hookup init callbacks
+    class AutoSetup
+    {
+    public:
+        AutoSetup()
+        {
+            //the collecting thread reports problems through the debug router, so it runs while that does
+            MPMA::Internal_AddInitCallback(InitSamplingProfiler, -900);
+            MPMA::Internal_AddShutdownCallback(ShutdownSamplingProfiler, -900);
+        }
+    } autoSetup;
+}
+
+namespace MPMA
+{
+    //Starts recording the stack of each registered thread the given number of times a second of cpu time it uses.
+    bool StartSamplingProfiler(nuint samplesPerSecond)
+    {
+        if (running)
+            StopSamplingProfiler();
+
+        if (!Internal_StartSampling(samplesPerSecond))
+            return false;
+
+        running=true;
+        collectThread=new3(Thread(CollectThread, 0));
+        return true;
+    }
+
+    //Stops recording samples.
+    void StopSamplingProfiler()
+    {
+        if (!running)
+            return;
+
+        Internal_StopSampling();
+        delete3(collectThread);
+        collectThread=0;
+        running=false;
+
+        Collect();
+    }
+
+    //Returns whether samples are being recorded.
+    bool IsSamplingProfilerRunning()
+    {
+        return running;
+    }
+
+    //Throws away all samples recorded so far.
+    void ClearSamplingProfile()
+    {
+        Collect();
+
+        TakeSamplesLock takeLock;
+        if (stacks)
+        {
+            delete3(stacks);
+            stacks=0;
+        }
+        sampleCount=0;
+        droppedCount=0;
+    }
+
+    //Returns the number of samples recorded, and the number that were dropped.
+    void GetSamplingProfileCounts(uint64 &outSamples, uint64 &outDropped)
+    {
+        Collect();
+
+        TakeSamplesLock takeLock;
+        outSamples=sampleCount;
+        outDropped=droppedCount;
+    }
+
+    //Fills outStacks with every call stack that has been recorded, sorted by the number of samples.
+    void GetSamplingProfile(std::vector<SamplingProfileStack> &outStacks)
+    {
+        outStacks.clear();
+        Collect();
+
+        {
+            TakeSamplesLock takeLock;
+            if (stacks)
+            {
+                outStacks.reserve(stacks->size());
+                for (StackCounts::iterator s=stacks->begin(); s!=stacks->end(); ++s)
+                {
+                    SamplingProfileStack stack;
+                    stack.stack=s->first;
+                    stack.samples=s->second;
+                    outStacks.push_back(stack);
+                }
+            }
+        }
+
+        std::stable_sort(outStacks.begin(), outStacks.end(), MoreSamples);
+    }
+
+    //Returns a human readable report of the functions that the most samples were in, and that were on the stack for the most samples.
+    std::string GetSamplingProfileReport(nuint maxFunctions)
+    {
+        std::vector<SamplingProfileStack> profile;
+        GetSamplingProfile(profile);
+
+        uint64 samples, dropped;
+        GetSamplingProfileCounts(samples, dropped);
+        samples=0; //more may have been collected since, so count the ones in the report
+        for (std::vector<SamplingProfileStack>::iterator s=profile.begin(); s!=profile.end(); ++s)
+            samples+=s->samples;
+
+        //add up the samples by function.  A function that is on a stack more than once (recursion) is only counted once in its total.
+        SymbolCache symbols;
+        std::map<std::string, FunctionSamples> byName;
+        std::vector<const FunctionSamples*> seen;
+        for (std::vector<SamplingProfileStack>::iterator s=profile.begin(); s!=profile.end(); ++s)
+        {
+            seen.clear();
+            for (nuint f=0; f<s->stack.size(); ++f)
+            {
+                const std::string &name=symbols.Name(s->stack[f]);
+                FunctionSamples &function=byName[name];
+                function.name=name;
+                if (f==0)
+                    function.self+=s->samples;
+
+                if (std::find(seen.begin(), seen.end(), &function)==seen.end())
+                {
+                    function.total+=s->samples;
+                    seen.push_back(&function);
+                }
+            }
+        }
+
+        std::vector<FunctionSamples> functions;
+        functions.reserve(byName.size());
+        for (std::map<std::string, FunctionSamples>::iterator f=byName.begin(); f!=byName.end(); ++f)
+            functions.push_back(f->second);
+
+        std::string report=" -- Sampling Profile --\n\n";
+        if (samples==0)
+            report+="No samples have been recorded.\n";
+
+        char buf[256];
+        sprintf(buf, "%llu samples, %llu dropped because a thread's buffer was full.\n\n", (unsigned long long)samples, (unsigned long long)dropped);
+        report+=buf;
+
+        double percent=samples ? 100.0/samples : 0;
+
+        std::stable_sort(functions.begin(), functions.end(), MoreSelf);
+        report+="Most samples in the function itself:\n";
+        for (nuint i=0; i<functions.size() && i<maxFunctions && functions[i].self>0; ++i)
+        {
+            sprintf(buf, " %6.2f%% %10llu  ", functions[i].self*percent, (unsigned long long)functions[i].self);
+            report+=buf;
+            report+=functions[i].name;
+            report+="\n";
+        }
+
+        std::stable_sort(functions.begin(), functions.end(), MoreTotal);
+        report+="\nMost samples in the function or what it called:\n";
+        for (nuint i=0; i<functions.size() && i<maxFunctions; ++i)
+        {
+            sprintf(buf, " %6.2f%% %10llu  ", functions[i].total*percent, (unsigned long long)functions[i].total);
+            report+=buf;
+            report+=functions[i].name;
+            report+="\n";
+        }
+
+        return report;
+    }
+
+    //Writes one line per call stack, with the frames outermost first, followed by its number of samples.
+    bool WriteSamplingProfileCollapsed(const std::string &filename)
+    {
+        std::vector<SamplingProfileStack> profile;
+        GetSamplingProfile(profile);
+
+        //stacks that differ only by where in each function they were become the same line
+        SymbolCache symbols;
+        std::map<std::string, uint64> lines;
+        for (std::vector<SamplingProfileStack>::iterator s=profile.begin(); s!=profile.end(); ++s)
+        {
+            std::string line;
+            for (nuint f=s->stack.size(); f>0; --f)
+            {
+                std::string name=symbols.Name(s->stack[f-1]);
+                std::replace(name.begin(), name.end(), ';', ':'); //; separates frames
+                std::replace(name.begin(), name.end(), ' ', '_'); //the last space separates the value
+                line+=name;
+                if (f>1)
+                    line+=";";
+            }
+
+            lines[line]+=s->samples;
+        }
+
+        FILE *file=fopen(filename.c_str(), "w");
+        if (!file)
+            return false;
+
+        for (std::map<std::string, uint64>::iterator l=lines.begin(); l!=lines.end(); ++l)
+            fprintf(file, "%s %llu\n", l->first.c_str(), (unsigned long long)l->second);
+
+        bool ok=(ferror(file)==0);
+        fclose(file);
+        return ok;
+    }
+
+    //Makes the calling thread be sampled.
+    void RegisterSamplingProfilerThread()
+    {
+        Internal_AddSamplingThread();
+    }
+
+    //Stops sampling the calling thread.
+    void UnregisterSamplingProfilerThread()
+    {
+        TakeSamplesLock takeLock;
+        Internal_RemoveSamplingThread(AddStack);
+    }
+
+    void Internal_SamplingProfilerThreadStarted()
+    {
+        RegisterSamplingProfilerThread();
+    }
+
+    void Internal_SamplingProfilerThreadEnded()
+    {
+        UnregisterSamplingProfilerThread();
+    }
+}
+
+#else //SAMPLING_PROFILER
+
+namespace MPMA
+{
+    bool StartSamplingProfiler(nuint samplesPerSecond) { return false; }
+    void StopSamplingProfiler() {}
+    bool IsSamplingProfilerRunning() { return false; }
+    void ClearSamplingProfile() {}
+    void GetSamplingProfileCounts(uint64 &outSamples, uint64 &outDropped) { outSamples=0; outDropped=0; }
+    void GetSamplingProfile(std::vector<SamplingProfileStack> &outStacks) { outStacks.clear(); }
+    std::string GetSamplingProfileReport(nuint maxFunctions) { return " -- Sampling Profile --\n\nSAMPLING_PROFILER is not defined in Config.h.\n"; }
+    bool WriteSamplingProfileCollapsed(const std::string &filename) { return false; }
+    void RegisterSamplingProfilerThread() {}
+    void UnregisterSamplingProfilerThread() {}
+}
+
+#endif //SAMPLING_PROFILER
+
+bool mpmaForceReferenceToSamplingProfilerCPP=false; //work around a problem using MPMA as a static library
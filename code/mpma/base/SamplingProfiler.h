@@ -0,0 +1,89 @@
+//!\file SamplingProfiler.h A statistical cpu profiler, which records the call stack of each thread many times a second.
+//!Unlike the profiles in Profiler.h, nothing needs to be marked in the code, so it shows where time goes in the whole program.  Each thread gets a SIGPROF signal every so often (measured in the cpu time that thread has used), which copies the thread's return addresses into a buffer that belongs to that thread.  Symbols are only looked up when a report is made.
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include "Types.h"
+#include "../Config.h"
+#include <string>
+#include <vector>
+
+/*
+An example of finding where a slow part of the application spends its time:
+  MPMA::StartSamplingProfiler();
+  //...
+  MPMA::StopSamplingProfiler();
+  printf("%s", MPMA::GetSamplingProfileReport().c_str());
+  MPMA::WriteSamplingProfileCollapsed("cpu.folded"); //flamegraph.pl cpu.folded > cpu.svg
+
+Threads made with MPMA::Thread, and the thread that initialized the framework, are sampled automatically.  Other threads must call RegisterSamplingProfilerThread to be seen.
+*/
+
+namespace MPMA
+{
+    //!How many times one call stack was seen.
+    struct SamplingProfileStack
+    {
+        std::vector<void*> stack; //!<Code addresses, innermost first.  The first is where the thread was running, and the rest are return addresses.
+        uint64 samples; //!<Number of times the stack was recorded.
+    };
+
+    //!Starts recording the stack of each registered thread the given number of times a second of cpu time it uses.  Samples from earlier runs are kept until ClearSamplingProfile is called.  Returns false if sampling isn't supported.
+    bool StartSamplingProfiler(nuint samplesPerSecond=SAMPLING_PROFILER_RATE);
+
+    //!Stops recording samples.
+    void StopSamplingProfiler();
+
+    //!Returns whether samples are being recorded.
+    bool IsSamplingProfilerRunning();
+
+    //!Throws away all samples recorded so far.
+    void ClearSamplingProfile();
+
+    //!Returns the number of samples recorded, and the number that were dropped because a thread's buffer was full.
+    void GetSamplingProfileCounts(uint64 &outSamples, uint64 &outDropped);
+
+    //!Fills outStacks with every call stack that has been recorded, sorted by the number of samples (most first).
+    void GetSamplingProfile(std::vector<SamplingProfileStack> &outStacks);
+
+    //!Returns a human readable report of the functions that the most samples were in (self), and that were on the stack for the most samples (total).
+    std::string GetSamplingProfileReport(nuint maxFunctions=30);
+
+    //!Writes one line per call stack, with the frames outermost first separated by semicolons, followed by its number of samples.  This is the input format of flamegraph.pl and speedscope.  Returns false if the file couldn't be written.
+    bool WriteSamplingProfileCollapsed(const std::string &filename);
+
+    //!Makes the calling thread be sampled.  Only needed for threads that were not made with MPMA::Thread.
+    void RegisterSamplingProfilerThread();
+
+    //!Stops sampling the calling thread, which must be done before a thread passed to RegisterSamplingProfilerThread exits.  Its samples are kept.
+    void UnregisterSamplingProfilerThread();
+
+    // -- internal use below
+
+#ifdef SAMPLING_PROFILER
+    //called by MPMA::Thread as a thread starts and before it ends
+    void Internal_SamplingProfilerThreadStarted();
+    void Internal_SamplingProfilerThreadEnded();
+
+    // -- platform-specific, internal use
+
+    //takes the samples collected from a thread's buffer
+    typedef void (*Internal_SamplingStackCallback)(void **frames, nuint depth);
+
+    //installs the signal handler and starts a timer for every registered thread.  Returns false if sampling isn't supported.
+    bool Internal_StartSampling(nuint samplesPerSecond);
+
+    //stops every thread's timer
+    void Internal_StopSampling();
+
+    //adds the calling thread to those that are sampled
+    void Internal_AddSamplingThread();
+
+    //removes the calling thread, passing its remaining samples to callback
+    void Internal_RemoveSamplingThread(Internal_SamplingStackCallback callback);
+
+    //passes the samples in every thread's buffer to callback, and returns the number dropped since the last call
+    uint64 Internal_CollectSamples(Internal_SamplingStackCallback callback);
+#endif
+}
@@ -0,0 +1,586 @@
+//A size-class allocator for small objects, with a cache of free blocks on each thread.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "SmallObjects.h"
+#include "HeapProfiler.h"
+#include "Locks.h"
+#include "Info.h"
+#include "Thread.h"
+#include "Timer.h"
+#include <stdlib.h>
+#include <vector>
+
+namespace MPMA
+{
+    extern void Sleep(nuint time);
+}
+
+namespace
+{
+    //blocks of each size class are cut from spans of this size, all inside one reserved range of address space
+    const nuint SPAN_SIZE=64*1024;
+#if defined(_WIN64) || defined(__amd64__)
+    const nuint MAX_SPANS=65536; //4GB of address space
+#else
+    const nuint MAX_SPANS=4096; //256MB of address space
+#endif
+
+    //sizes are 16 to 256 in steps of 16, then up to SMALLOBJECT_MAX_SIZE in steps of 64
+    const nuint SIZE_CLASSES=16+(MPMA::SMALLOBJECT_MAX_SIZE-256)/64;
+
+    inline nuint SizeToClass(nuint size)
+    {
+        if (size<=256)
+            return (size-1)>>4;
+        return 16+((size-257)>>6);
+    }
+
+    inline nuint ClassToSize(nuint sizeClass)
+    {
+        if (sizeClass<16)
+            return (sizeClass+1)*16;
+        return 256+(sizeClass-15)*64;
+    }
+
+    //how many blocks move between a thread's cache and the shared list at once.  A thread's cache holds at most twice this.
+    inline nuint ClassBatchSize(nuint sizeClass)
+    {
+        nuint batch=4096/ClassToSize(sizeClass);
+        if (batch<4)
+            batch=4;
+        if (batch>64)
+            batch=64;
+        return batch;
+    }
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    //a simple spin-lock that never allocates, and works from zero initialized memory, so it can be used before static constructors have run
+    struct ClassLock
+    {
+        volatile uint32 taken;
+    };
+
+    class TakeClassLock
+    {
+    public:
+        inline TakeClassLock(ClassLock &slock): locker(slock)
+        {
+            while (MPMA::AtomicExchange(&locker.taken, (uint32)1, MPMA::MEMORY_ORDER_ACQUIRE)!=0)
+            {
+                do
+                {
+                    if (MPMA::SystemInfo::SuggestSleepInSpinlock)
+                        MPMA::Sleep(0);
+                    else
+                        MPMA::CpuPause();
+                } while (MPMA::AtomicLoad(&locker.taken, MPMA::MEMORY_ORDER_RELAXED)!=0);
+            }
+        }
+
+        inline ~TakeClassLock()
+        {
+            MPMA::AtomicStore(&locker.taken, (uint32)0, MPMA::MEMORY_ORDER_RELEASE);
+        }
+
+    private:
+        ClassLock &locker;
+
+        void operator=(const TakeClassLock &notallowed);
+    };
+
+    //the blocks of one size that no thread's cache is holding
+    struct SharedClass
+    {
+        ClassLock lock;
+        FreeBlock *freeList;
+        nuint freeCount;
+        uint8 *carveNext, *carveEnd; //the unused part of the span most recently given to this class
+    };
+
+    //all of this is zero initialized static data, so the allocator works during static construction and destruction
+    SharedClass sharedClasses[SIZE_CLASSES];
+
+    volatile nuint regionState=0; //0 not reserved, 1 being reserved, 2 ready, 3 failed
+    uint8 *regionStart=0;
+    volatile nuint spansUsed=0; //spans that have been committed and given to a size class
+    ClassLock spanLock; //taken while a span is added, after the class's lock
+    uint8 spanClass[MAX_SPANS]; //the size class each span was given to
+
+    //reserves the address space that spans come from, the first time it's needed.  Returns false if that failed.
+    bool RegionReady()
+    {
+        nuint state=MPMA::AtomicLoad(&regionState, MPMA::MEMORY_ORDER_ACQUIRE);
+        if (state==2)
+            return true;
+
+        if (state==0)
+        {
+            nuint expected=0;
+            if (MPMA::AtomicCompareAndSwap(&regionState, expected, (nuint)1, MPMA::MEMORY_ORDER_ACQ_REL))
+            {
+                regionStart=(uint8*)MPMA::Internal_ReserveAddressSpace(MAX_SPANS*SPAN_SIZE);
+                MPMA::AtomicStore(&regionState, (nuint)(regionStart ? 2 : 3), MPMA::MEMORY_ORDER_RELEASE);
+                return regionStart!=0;
+            }
+        }
+
+        while ((state=MPMA::AtomicLoad(&regionState, MPMA::MEMORY_ORDER_ACQUIRE))==1)
+            MPMA::CpuPause();
+        return state==2;
+    }
+
+    //gives a new span to a size class.  The class's lock must be held.  Returns false if there is no more room.
+    bool AddSpan(nuint sizeClass, SharedClass &shared)
+    {
+        if (!RegionReady())
+            return false;
+
+        //the count only goes up once the span is committed, so a failed commit can be tried again later
+        uint8 *spanStart;
+        {
+            TakeClassLock takeLock(spanLock);
+            nuint span=spansUsed;
+            if (span>=MAX_SPANS)
+                return false;
+
+            spanStart=regionStart+span*SPAN_SIZE;
+            if (!MPMA::Internal_CommitAddressSpace(spanStart, SPAN_SIZE))
+                return false;
+
+            spanClass[span]=(uint8)sizeClass;
+            MPMA::AtomicStore(&spansUsed, span+1, MPMA::MEMORY_ORDER_RELAXED);
+        }
+
+        shared.carveNext=spanStart;
+        shared.carveEnd=spanStart+SPAN_SIZE-SPAN_SIZE%ClassToSize(sizeClass);
+        return true;
+    }
+
+    //takes up to count blocks from the shared list of a size class, and returns them linked together.  outTaken is set to how many there are, which is 0 only if we are out of memory.
+    FreeBlock* TakeSharedBlocks(nuint sizeClass, nuint count, nuint &outTaken)
+    {
+        SharedClass &shared=sharedClasses[sizeClass];
+        TakeClassLock takeLock(shared.lock);
+
+        FreeBlock *first=0;
+        outTaken=0;
+
+        //previously freed blocks first
+        while (outTaken<count && shared.freeList)
+        {
+            FreeBlock *block=shared.freeList;
+            shared.freeList=block->next;
+            block->next=first;
+            first=block;
+            ++outTaken;
+        }
+        shared.freeCount-=outTaken;
+
+        //then new ones out of a span
+        nuint blockSize=ClassToSize(sizeClass);
+        while (outTaken<count)
+        {
+            if (shared.carveNext==shared.carveEnd && !AddSpan(sizeClass, shared))
+                break;
+
+            FreeBlock *block=(FreeBlock*)shared.carveNext;
+            shared.carveNext+=blockSize;
+            block->next=first;
+            first=block;
+            ++outTaken;
+        }
+
+        return first;
+    }
+
+    //puts a linked list of blocks back on the shared list of a size class
+    void ReturnSharedBlocks(nuint sizeClass, FreeBlock *first, FreeBlock *last, nuint count)
+    {
+        SharedClass &shared=sharedClasses[sizeClass];
+        TakeClassLock takeLock(shared.lock);
+
+        last->next=shared.freeList;
+        shared.freeList=first;
+        shared.freeCount+=count;
+    }
+
+    // -- per thread caches
+
+    struct ThreadCache
+    {
+        FreeBlock *freeLists[SIZE_CLASSES];
+        nuint freeCounts[SIZE_CLASSES];
+    };
+
+    THREAD_LOCAL ThreadCache *threadCache=0;
+    THREAD_LOCAL bool threadCacheGone=false; //set once the thread is exiting, after which blocks go straight to the shared lists
+
+    void FlushThreadCache(ThreadCache &cache)
+    {
+        for (nuint c=0; c<SIZE_CLASSES; ++c)
+        {
+            if (!cache.freeLists[c])
+                continue;
+
+            FreeBlock *last=cache.freeLists[c];
+            while (last->next)
+                last=last->next;
+            ReturnSharedBlocks(c, cache.freeLists[c], last, cache.freeCounts[c]);
+
+            cache.freeLists[c]=0;
+            cache.freeCounts[c]=0;
+        }
+    }
+
+    //gives the thread's cache back when the thread exits
+    struct ThreadCacheOwner
+    {
+        ThreadCache *cache;
+
+        ~ThreadCacheOwner()
+        {
+            if (cache)
+            {
+                FlushThreadCache(*cache);
+                free(cache);
+            }
+            threadCache=0;
+            threadCacheGone=true;
+        }
+    };
+
+    thread_local ThreadCacheOwner threadCacheOwner={0};
+
+    //returns the calling thread's cache, creating it if needed.  Returns 0 if the thread no longer has one.
+    inline ThreadCache* GetThreadCache()
+    {
+        ThreadCache *cache=threadCache;
+        if (cache || threadCacheGone)
+            return cache;
+
+        cache=(ThreadCache*)calloc(1, sizeof(ThreadCache));
+        if (!cache)
+            return 0;
+
+        threadCacheOwner.cache=cache;
+        threadCache=cache;
+        return cache;
+    }
+
+    // -- big allocations, which don't fit a size class, or happen after we've run out of spans
+
+    void* LargeAlloc(nuint size, nuint alignment, MPMA::Internal_HeapSample *sample=0)
+    {
+        //the pointer that malloc returned is kept just before the memory we hand out, and the heap profiler's sample before that
+        uint8 *raw=(uint8*)malloc(size+alignment+2*sizeof(void*));
+        if (!raw)
+        {
+#ifdef HEAP_PROFILER
+            if (sample)
+                MPMA::Internal_HeapProfileFree(sample);
+#endif
+            throw std::bad_alloc();
+        }
+
+        uint8 *mem=(uint8*)(((nuint)raw+2*sizeof(void*)+alignment-1)&~(alignment-1));
+        ((void**)mem)[-1]=raw;
+        ((void**)mem)[-2]=sample;
+        return mem;
+    }
+
+    void LargeFree(void *mem)
+    {
+#ifdef HEAP_PROFILER
+        MPMA::Internal_HeapSample *sample=(MPMA::Internal_HeapSample*)((void**)mem)[-2];
+        if (sample)
+            MPMA::Internal_HeapProfileFree(sample);
+#endif
+        free(((void**)mem)[-1]);
+    }
+
+    inline bool IsInRegion(void *mem)
+    {
+        return (nuint)((uint8*)mem-regionStart)<MAX_SPANS*SPAN_SIZE && regionStart!=0;
+    }
+
+    //allocates from the size classes, without the heap profiler seeing it
+    void* AllocSmall(nuint size)
+    {
+        if (size>MPMA::SMALLOBJECT_MAX_SIZE)
+            return LargeAlloc(size, 16);
+        if (size==0)
+            size=1;
+
+        nuint sizeClass=SizeToClass(size);
+        ThreadCache *cache=GetThreadCache();
+        if (cache)
+        {
+            FreeBlock *block=cache->freeLists[sizeClass];
+            if (!block)
+            {
+                nuint taken;
+                block=TakeSharedBlocks(sizeClass, ClassBatchSize(sizeClass), taken);
+                if (!block)
+                    return LargeAlloc(size, 16);
+                cache->freeCounts[sizeClass]=taken;
+            }
+
+            cache->freeLists[sizeClass]=block->next;
+            --cache->freeCounts[sizeClass];
+            return block;
+        }
+
+        //no cache on this thread anymore, so take one block at a time
+        nuint taken;
+        FreeBlock *block=TakeSharedBlocks(sizeClass, 1, taken);
+        if (!block)
+            return LargeAlloc(size, 16);
+        return block;
+    }
+}
+
+namespace MPMA
+{
+    //Allocates memory, which is aligned for any type that does not ask for more than 16 byte alignment.
+    void* SmallObjectAlloc(nuint size)
+    {
+#ifdef HEAP_PROFILER
+        if (Internal_HeapSample *sample=Internal_HeapProfileAlloc(size))
+            return LargeAlloc(size, 16, sample); //sampled memory needs room to remember its sample
+#endif
+        return AllocSmall(size);
+    }
+
+    //Allocates memory with a specific alignment.
+    void* SmallObjectAllocAligned(nuint size, nuint alignment)
+    {
+#ifdef HEAP_PROFILER
+        if (Internal_HeapSample *sample=Internal_HeapProfileAlloc(size))
+            return LargeAlloc(size, (alignment<16) ? 16 : alignment, sample);
+#endif
+        if (alignment<=16)
+            return AllocSmall(size);
+
+        //every size class that is a multiple of the alignment (up to 64) has all of its blocks aligned to it, since spans are page aligned
+        size=(size+alignment-1)&~(alignment-1);
+        if (alignment>64 || size>SMALLOBJECT_MAX_SIZE)
+            return LargeAlloc(size, alignment);
+        return AllocSmall(size);
+    }
+
+    //Frees memory from SmallObjectAlloc or SmallObjectAllocAligned.
+    void SmallObjectFree(void *mem)
+    {
+        if (!mem)
+            return;
+
+        if (!IsInRegion(mem))
+        {
+            LargeFree(mem);
+            return;
+        }
+
+        nuint sizeClass=spanClass[((uint8*)mem-regionStart)/SPAN_SIZE];
+        FreeBlock *block=(FreeBlock*)mem;
+        ThreadCache *cache=GetThreadCache();
+        if (!cache)
+        {
+            ReturnSharedBlocks(sizeClass, block, block, 1);
+            return;
+        }
+
+        block->next=cache->freeLists[sizeClass];
+        cache->freeLists[sizeClass]=block;
+
+        //if the cache has too many, give a batch back so other threads can use them
+        nuint batch=ClassBatchSize(sizeClass);
+        if (++cache->freeCounts[sizeClass]>=2*batch)
+        {
+            FreeBlock *first=cache->freeLists[sizeClass];
+            FreeBlock *last=first;
+            for (nuint i=1; i<batch; ++i)
+                last=last->next;
+
+            cache->freeLists[sizeClass]=last->next;
+            cache->freeCounts[sizeClass]-=batch;
+            ReturnSharedBlocks(sizeClass, first, last, batch);
+        }
+    }
+
+    //Returns the blocks that the calling thread is holding on to back to the shared lists.
+    void SmallObjectFlushThreadCache()
+    {
+        if (threadCache)
+            FlushThreadCache(*threadCache);
+    }
+
+    //Returns the current memory use of the small object allocator.
+    void GetSmallObjectStats(SmallObjectStats &outStats)
+    {
+        nuint spans=AtomicLoad(&spansUsed, MEMORY_ORDER_RELAXED);
+        if (spans>MAX_SPANS)
+            spans=MAX_SPANS;
+
+        outStats.reservedBytes=(regionStart ? MAX_SPANS*SPAN_SIZE : 0);
+        outStats.committedBytes=spans*SPAN_SIZE;
+        outStats.sharedFreeBytes=0;
+        for (nuint c=0; c<SIZE_CLASSES; ++c)
+        {
+            SharedClass &shared=sharedClasses[c];
+            TakeClassLock takeLock(shared.lock);
+            outStats.sharedFreeBytes+=shared.freeCount*ClassToSize(c)+(nuint)(shared.carveEnd-shared.carveNext);
+        }
+    }
+
+    // -- allocator benchmark
+
+    namespace
+    {
+        //the two allocators being compared
+        struct SmallObjectFunctions
+        {
+            static void* Alloc(nuint size) { return SmallObjectAlloc(size); }
+            static void Free(void *mem) { SmallObjectFree(mem); }
+        };
+
+        struct MallocFunctions
+        {
+            static void* Alloc(nuint size) { return malloc(size); }
+            static void Free(void *mem) { free(mem); }
+        };
+
+        //a quick random number generator (xorshift), so the benchmark doesn't measure rand's lock
+        struct BenchmarkRandom
+        {
+            uint32 state;
+
+            BenchmarkRandom(uint32 seed): state(seed ? seed : 1)
+                {}
+
+            inline uint32 Next()
+            {
+                state^=state<<13;
+                state^=state>>17;
+                state^=state<<5;
+                return state;
+            }
+
+            inline nuint NextSize()
+                { return 8+Next()%249; }
+        };
+
+        //shared by the threads of one throughput run
+        struct ThroughputRun
+        {
+            nuint operations;
+            nuint threadCount;
+            volatile nuint started;
+            volatile nuint finished;
+        };
+
+        template <typename Functions>
+        void ThroughputThread(Thread&, ThreadParam param)
+        {
+            ThroughputRun *run=(ThroughputRun*)param.ptr;
+            const nuint LIVE=1000;
+            std::vector<void*> live(LIVE, (void*)0);
+            BenchmarkRandom random((uint32)GetThreadUniqueIdentifier()*2654435761u);
+
+            AtomicIntInc(&run->started);
+            while (AtomicLoad(&run->started, MEMORY_ORDER_ACQUIRE)!=run->threadCount)
+                Sleep(0);
+
+            for (nuint i=0; i<LIVE; ++i)
+                live[i]=Functions::Alloc(random.NextSize());
+            for (nuint i=0; i<run->operations; ++i)
+            {
+                nuint slot=random.Next()%LIVE;
+                Functions::Free(live[slot]);
+                live[slot]=Functions::Alloc(random.NextSize());
+            }
+            for (nuint i=0; i<LIVE; ++i)
+                Functions::Free(live[i]);
+
+            AtomicIntInc(&run->finished);
+        }
+
+        template <typename Functions>
+        double MeasureThroughput(nuint threadCount, nuint operations)
+        {
+            ThroughputRun run;
+            run.operations=operations;
+            run.threadCount=threadCount;
+            run.started=0;
+            run.finished=0;
+
+            std::vector<Thread*> threads;
+            for (nuint i=0; i<threadCount; ++i)
+                threads.push_back(new3(Thread(ThroughputThread<Functions>, &run)));
+
+            while (AtomicLoad(&run.started, MEMORY_ORDER_ACQUIRE)!=threadCount)
+                Sleep(0);
+            Timer timer;
+            while (AtomicLoad(&run.finished, MEMORY_ORDER_ACQUIRE)!=threadCount)
+                Sleep(0);
+            double elapsed=timer.Step();
+
+            for (std::vector<Thread*>::iterator i=threads.begin(); i!=threads.end(); ++i)
+                delete3(*i);
+            return threadCount*operations/elapsed;
+        }
+
+        //returns how much resident memory grew per byte still allocated, after making lots of allocations and freeing most of them
+        template <typename Functions>
+        double MeasureFragmentation()
+        {
+            const nuint COUNT=100000;
+            std::vector<void*> allocations(COUNT, (void*)0);
+            BenchmarkRandom random(12345);
+            nuint residentBefore=Internal_GetResidentBytes();
+
+            for (nuint i=0; i<COUNT; ++i)
+                allocations[i]=Functions::Alloc(random.NextSize());
+
+            //keep 1 in 10 at random.  The sizes aren't stored, but the same random sequence gives them again.
+            BenchmarkRandom sizes(12345);
+            nuint liveBytes=0;
+            for (nuint i=0; i<COUNT; ++i)
+            {
+                nuint size=sizes.NextSize();
+                if (random.Next()%10==0)
+                    liveBytes+=size;
+                else
+                {
+                    Functions::Free(allocations[i]);
+                    allocations[i]=0;
+                }
+            }
+
+            nuint residentAfter=Internal_GetResidentBytes();
+            for (nuint i=0; i<COUNT; ++i)
+                Functions::Free(allocations[i]);
+
+            if (!residentBefore || !liveBytes || residentAfter<residentBefore)
+                return 0;
+            return (double)(residentAfter-residentBefore)/liveBytes;
+        }
+    }
+
+    //Measures the allocator against malloc.
+    SmallObjectAllocInfo MeasureSmallObjectAlloc(nuint threads, nuint operations)
+    {
+        if (threads==0)
+            threads=1;
+
+        SmallObjectAllocInfo info;
+        info.residentPerLiveByte=MeasureFragmentation<SmallObjectFunctions>();
+        info.mallocResidentPerLiveByte=MeasureFragmentation<MallocFunctions>();
+        info.allocsPerSecond=MeasureThroughput<SmallObjectFunctions>(threads, operations);
+        info.mallocAllocsPerSecond=MeasureThroughput<MallocFunctions>(threads, operations);
+        return info;
+    }
+}
@@ -0,0 +1,103 @@
+//!\file SmallObjects.h A size-class allocator for small objects, with a cache of free blocks on each thread.
+//!When SMALLOBJECT_ALLOCATOR is defined in Config.h (and MEMMAN_TRACING is not), new3/new2 and delete3/delete2 of single objects use this automatically.
+//!It can also be used directly, or through SmallObjectAllocator for STL containers.
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include "Types.h"
+#include "../Config.h"
+#include <stddef.h>
+#include <new>
+
+/*
+An example of a container whose nodes come from the small object allocator, since std::list and std::map make one small allocation per element:
+  std::list<Job, MPMA::SmallObjectAllocator<Job>> pendingJobs;
+*/
+
+namespace MPMA
+{
+    //!Allocations of up to this many bytes are handled by the size classes.  Bigger allocations are passed on to malloc.
+    const nuint SMALLOBJECT_MAX_SIZE=512;
+
+    //!Allocates memory, which is aligned for any type that does not ask for more than 16 byte alignment.  Throws std::bad_alloc if there is no memory left.
+    void* SmallObjectAlloc(nuint size);
+
+    //!Allocates memory with a specific alignment (a power of 2).  Throws std::bad_alloc if there is no memory left.
+    void* SmallObjectAllocAligned(nuint size, nuint alignment);
+
+    //!Frees memory from SmallObjectAlloc or SmallObjectAllocAligned.  0 is ignored.
+    void SmallObjectFree(void *mem);
+
+    //!Returns the blocks that the calling thread is holding on to back to the shared lists, so other threads can use them.  This is done automatically when a thread exits.
+    void SmallObjectFlushThreadCache();
+
+    //!Memory use of the small object allocator.
+    struct SmallObjectStats
+    {
+        nuint reservedBytes; //!<Address space set aside for size classes.
+        nuint committedBytes; //!<Memory that has been handed to size classes.
+        nuint sharedFreeBytes; //!<Memory in the shared lists that is not in use.  This does not include blocks held by a thread's cache.
+    };
+
+    //!Returns the current memory use of the small object allocator.
+    void GetSmallObjectStats(SmallObjectStats &outStats);
+
+    //!What MeasureSmallObjectAlloc found out about the allocator, and about malloc to compare against.
+    struct SmallObjectAllocInfo
+    {
+        double allocsPerSecond; //!<Allocations (each with a free) done in a second, over all of the threads together.
+        double mallocAllocsPerSecond; //!<The same, for malloc and free.
+        double residentPerLiveByte; //!<How much the process's resident memory grew, per byte still allocated, after many allocations were made and most of them freed again.  1 would be no overhead and no fragmentation at all.  This is 0 if resident memory didn't grow, which happens when memory freed earlier (such as by an earlier call) is reused, so the first call is the one to look at.
+        double mallocResidentPerLiveByte; //!<The same, for malloc and free.
+    };
+
+    //!\brief Measures the allocator against malloc.
+    //!For throughput, each thread keeps 1000 allocations of between 8 and 256 bytes, and the given number of times frees a random one and allocates another in its place.  For fragmentation, the calling thread makes 100000 allocations of the same sizes, then frees 9 in 10 of them at random.  Memory used by other threads while this runs is counted too.
+    SmallObjectAllocInfo MeasureSmallObjectAlloc(nuint threads=4, nuint operations=1000000);
+
+    //!An STL allocator that uses SmallObjectAlloc.  Best for node based containers (std::list, std::map, std::set), which allocate one element at a time.
+    template <typename T>
+    class SmallObjectAllocator
+    {
+    public:
+        typedef T value_type;
+
+        inline SmallObjectAllocator() noexcept
+            {}
+        template <typename U>
+        inline SmallObjectAllocator(const SmallObjectAllocator<U>&) noexcept
+            {}
+
+        inline T* allocate(size_t count)
+        {
+            if (alignof(T)>16)
+                return (T*)SmallObjectAllocAligned(count*sizeof(T), alignof(T));
+            return (T*)SmallObjectAlloc(count*sizeof(T));
+        }
+        inline void deallocate(T *mem, size_t)
+            { SmallObjectFree(mem); }
+
+        template <typename U>
+        struct rebind
+        {
+            typedef SmallObjectAllocator<U> other;
+        };
+    };
+
+    template <typename T, typename U>
+    inline bool operator==(const SmallObjectAllocator<T>&, const SmallObjectAllocator<U>&)
+        { return true; }
+    template <typename T, typename U>
+    inline bool operator!=(const SmallObjectAllocator<T>&, const SmallObjectAllocator<U>&)
+        { return false; }
+
+    //internal use: reserves address space without using any memory.  Returns 0 on failure.
+    void* Internal_ReserveAddressSpace(nuint bytes);
+
+    //internal use: makes part of reserved address space usable
+    bool Internal_CommitAddressSpace(void *mem, nuint bytes);
+
+    //internal use: returns the memory the process is using that is resident in ram, or 0 if it isn't known
+    nuint Internal_GetResidentBytes();
+}
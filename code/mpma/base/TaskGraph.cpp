@@ -0,0 +1,192 @@
+//A graph of dependent jobs that is built once and then run repeatedly on the task scheduler.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "TaskGraph.h"
+#include "Atomic.h"
+#include "DebugRouter.h"
+#include "Vary.h"
+
+namespace MPMA
+{
+    TaskGraph::TaskGraph(): finalized(false), valid(false), lastRunTime(0)
+    {
+    }
+
+    TaskGraph::~TaskGraph()
+    {
+        for (std::vector<Node>::iterator n=nodes.begin(); n!=nodes.end(); ++n)
+        {
+            if (n->deleteParam)
+                n->deleteParam(n->param);
+        }
+    }
+
+    //Adds a node that calls func(param) when it is run.
+    TaskGraph::NodeId TaskGraph::AddNode(const std::string &name, void (*func)(void *param), void *param)
+    {
+        return AddNodeInternal(name, func, param, 0);
+    }
+
+    TaskGraph::NodeId TaskGraph::AddNodeInternal(const std::string &name, void (*func)(void*), void *param, void (*deleteParam)(void*))
+    {
+        Node node;
+        node.name=name;
+        node.func=func;
+        node.param=param;
+        node.deleteParam=deleteParam;
+        node.dependencyCount=0;
+        node.graph=this;
+        node.remainingDependencies=0;
+        node.startTime=0;
+        node.duration=0;
+
+        nodes.push_back(node);
+        finalized=false;
+        return nodes.size()-1;
+    }
+
+    //Makes the node after wait for the node before to finish before it starts.
+    void TaskGraph::AddDependency(NodeId before, NodeId after)
+    {
+        if (before>=nodes.size() || after>=nodes.size())
+        {
+            ErrorReport()<<"TaskGraph::AddDependency: node id out of range.\n";
+            return;
+        }
+
+        nodes[before].successors.push_back(after);
+        ++nodes[after].dependencyCount;
+        finalized=false;
+    }
+
+    //Prepares the graph to run.
+    bool TaskGraph::Finalize()
+    {
+        finalized=true;
+
+        //the nodes won't move any more, so the jobs can point at them
+        roots.clear();
+        for (nuint i=0; i<nodes.size(); ++i)
+        {
+            nodes[i].job=ThreadedTaskJob(NodeJobProc, &nodes[i]);
+            nodes[i].graph=this;
+            if (nodes[i].dependencyCount==0)
+                roots.push_back(i);
+        }
+
+        //find an order that respects all the dependencies, which also tells us if there's a cycle
+        topologicalOrder.clear();
+        topologicalOrder.reserve(nodes.size());
+        std::vector<nuint> remaining(nodes.size());
+        for (nuint i=0; i<nodes.size(); ++i)
+            remaining[i]=nodes[i].dependencyCount;
+
+        topologicalOrder=roots;
+        for (nuint i=0; i<topologicalOrder.size(); ++i)
+        {
+            const Node &node=nodes[topologicalOrder[i]];
+            for (std::vector<NodeId>::const_iterator s=node.successors.begin(); s!=node.successors.end(); ++s)
+            {
+                if (--remaining[*s]==0)
+                    topologicalOrder.push_back(*s);
+            }
+        }
+
+        valid=(topologicalOrder.size()==nodes.size());
+        if (!valid)
+            ErrorReport()<<"TaskGraph::Finalize: the dependencies between nodes form a cycle, so the graph can't be run.\n";
+
+        return valid;
+    }
+
+    //Runs every node once, each after all of the nodes it depends on.
+    void TaskGraph::Run()
+    {
+        if (!finalized)
+            Finalize();
+        if (!valid)
+            return;
+
+        for (std::vector<Node>::iterator n=nodes.begin(); n!=nodes.end(); ++n)
+            n->remainingDependencies=n->dependencyCount;
+
+        runTimer.Step();
+        {
+            TaskGroup group;
+            for (std::vector<NodeId>::iterator r=roots.begin(); r!=roots.end(); ++r)
+                group.Run(nodes[*r].job);
+            group.Wait();
+        }
+        lastRunTime=runTimer.Step(false);
+    }
+
+    //each node in the graph runs this
+    void TaskGraph::NodeJobProc(ThreadedTaskJob &job)
+    {
+        Node &node=*(Node*)job.param;
+        TaskGraph &graph=*node.graph;
+
+        node.startTime=graph.runTimer.Step(false);
+        node.func(node.param);
+        node.duration=graph.runTimer.Step(false)-node.startTime;
+
+        //start anything that was only waiting on us.  The release makes our work visible to them, and the acquire makes the others' work visible to us if we're the one starting it.
+        for (std::vector<NodeId>::iterator s=node.successors.begin(); s!=node.successors.end(); ++s)
+        {
+            Node &successor=graph.nodes[*s];
+            if (AtomicFetchSub(&successor.remainingDependencies, (nuint)1, MEMORY_ORDER_ACQ_REL)==1)
+                job.group->Run(successor.job);
+        }
+    }
+
+    //Fills outPath with the nodes on the critical path of the last Run.
+    double TaskGraph::GetCriticalPath(std::vector<NodeId> &outPath) const
+    {
+        outPath.clear();
+        if (!valid || nodes.empty())
+            return 0;
+
+        //longest chain ending at each node, going through the nodes in dependency order
+        std::vector<double> chainTime(nodes.size(), 0.0);
+        std::vector<NodeId> chainPrevious(nodes.size(), (NodeId)-1);
+        NodeId last=topologicalOrder[0];
+        for (std::vector<NodeId>::const_iterator i=topologicalOrder.begin(); i!=topologicalOrder.end(); ++i)
+        {
+            chainTime[*i]+=nodes[*i].duration;
+            if (chainTime[*i]>chainTime[last])
+                last=*i;
+
+            for (std::vector<NodeId>::const_iterator s=nodes[*i].successors.begin(); s!=nodes[*i].successors.end(); ++s)
+            {
+                if (chainPrevious[*s]==(NodeId)-1 || chainTime[*i]>chainTime[*s])
+                {
+                    chainTime[*s]=chainTime[*i];
+                    chainPrevious[*s]=*i;
+                }
+            }
+        }
+
+        //then walk back from the end of the longest one
+        for (NodeId n=last; n!=(NodeId)-1; n=chainPrevious[n])
+            outPath.insert(outPath.begin(), n);
+
+        return chainTime[last];
+    }
+
+    //Returns a human readable report of the timing of the last Run.
+    std::string TaskGraph::GetTimingReport() const
+    {
+        std::string report="Task graph run took "+(std::string)VaryString((float)(lastRunTime*1000.0))+" ms\n";
+        for (nuint i=0; i<nodes.size(); ++i)
+            report+="  "+nodes[i].name+": started at "+(std::string)VaryString((float)(nodes[i].startTime*1000.0))+" ms, took "+(std::string)VaryString((float)(nodes[i].duration*1000.0))+" ms\n";
+
+        std::vector<NodeId> path;
+        double pathTime=GetCriticalPath(path);
+        report+="Critical path ("+(std::string)VaryString((float)(pathTime*1000.0))+" ms):";
+        for (std::vector<NodeId>::iterator n=path.begin(); n!=path.end(); ++n)
+            report+=(n==path.begin() ? " " : " -> ")+nodes[*n].name;
+        report+="\n";
+
+        return report;
+    }
+}
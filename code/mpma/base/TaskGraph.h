@@ -0,0 +1,130 @@
+//!\file TaskGraph.h A graph of dependent jobs that is built once and then run repeatedly on the task scheduler.
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include "Types.h"
+#include "ThreadedTask.h"
+#include "Memory.h"
+#include "Timer.h"
+#include <string>
+#include <vector>
+
+/*
+An example of a per-frame pipeline where physics and audio overlap, and rendering waits on both:
+  MPMA::TaskGraph frame;
+  MPMA::TaskGraph::NodeId input=frame.AddNode("input", [&]() { PollInput(); });
+  MPMA::TaskGraph::NodeId physics=frame.AddNode("physics", [&]() { StepPhysics(); });
+  MPMA::TaskGraph::NodeId audio=frame.AddNode("audio", [&]() { AUDIO::UpdateStreams(); });
+  MPMA::TaskGraph::NodeId render=frame.AddNode("render", [&]() { Render(); });
+  frame.AddDependency(input, physics);
+  frame.AddDependency(physics, render);
+  frame.AddDependency(audio, render);
+
+  //then every frame:
+  frame.Run();
+*/
+
+namespace MPMA
+{
+    //!\brief A set of jobs with dependencies between them, run on the task scheduler so that independent jobs overlap.
+    //!All memory is allocated while the graph is being built (or by the first Run after it changes), so running it again does not allocate.  The time each node took during the last run is kept, along with the critical path through the graph.
+    class TaskGraph
+    {
+    public:
+        //!Identifies a node in the graph.
+        typedef nuint NodeId;
+
+        TaskGraph();
+        ~TaskGraph();
+
+        //!Adds a node that calls func(param) when it is run.  name is used in timing reports.
+        NodeId AddNode(const std::string &name, void (*func)(void *param), void *param);
+
+        //!Adds a node that calls func() when it is run.  func may be any callable object (including a lambda) and is copied into the graph.
+        template <typename Func>
+        inline NodeId AddNode(const std::string &name, const Func &func)
+            { return AddNodeInternal(name, CallFunctor<Func>, new3(Func(func)), DeleteFunctor<Func>); }
+
+        //!Makes the node after wait for the node before to finish before it starts.
+        void AddDependency(NodeId before, NodeId after);
+
+        //!Prepares the graph to run.  Returns false (and reports an error) if the dependencies have a cycle, in which case the graph can't be run.  This is done automatically by Run if the graph changed since the last call.
+        bool Finalize();
+
+        //!Runs every node once, each after all of the nodes it depends on, and returns when all are finished.  The calling thread helps run nodes.  This may be called from inside a job.
+        void Run();
+
+        // -- timing information from the last Run
+
+        //!Returns the number of nodes in the graph.
+        inline nuint GetNodeCount() const
+            { return nodes.size(); }
+
+        //!Returns the name a node was added with.
+        inline const std::string& GetNodeName(NodeId node) const
+            { return nodes[node].name; }
+
+        //!Returns how long (in seconds) a node took to run during the last Run.
+        inline double GetNodeTime(NodeId node) const
+            { return nodes[node].duration; }
+
+        //!Returns when (in seconds since the start of the last Run) a node started running.
+        inline double GetNodeStartTime(NodeId node) const
+            { return nodes[node].startTime; }
+
+        //!Returns how long (in seconds) the last Run took overall.
+        inline double GetLastRunTime() const
+            { return lastRunTime; }
+
+        //!Fills outPath with the nodes on the critical path of the last Run (the chain of dependencies whose node times add up to the most), in the order they ran.  Returns the sum of their times.
+        double GetCriticalPath(std::vector<NodeId> &outPath) const;
+
+        //!Returns a human readable report of the timing of the last Run, with one line per node and the critical path at the end.
+        std::string GetTimingReport() const;
+
+    private:
+        struct Node
+        {
+            std::string name;
+            void (*func)(void*);
+            void *param;
+            void (*deleteParam)(void*);
+
+            std::vector<NodeId> successors;
+            nuint dependencyCount;
+
+            //per run state
+            ThreadedTaskJob job;
+            TaskGraph *graph;
+            volatile nuint remainingDependencies;
+            double startTime;
+            double duration;
+        };
+
+        std::vector<Node> nodes;
+        std::vector<NodeId> roots;
+        std::vector<NodeId> topologicalOrder;
+        bool finalized;
+        bool valid;
+
+        Timer runTimer;
+        double lastRunTime;
+
+        NodeId AddNodeInternal(const std::string &name, void (*func)(void*), void *param, void (*deleteParam)(void*));
+
+        static void NodeJobProc(ThreadedTaskJob &job);
+
+        template <typename Func>
+        static void CallFunctor(void *param)
+            { (*(Func*)param)(); }
+
+        template <typename Func>
+        static void DeleteFunctor(void *param)
+            { Func *func=(Func*)param; delete3(func); }
+
+        //you cannot duplicate this
+        TaskGraph(const TaskGraph&);
+        const TaskGraph& operator=(const TaskGraph&);
+    };
+}
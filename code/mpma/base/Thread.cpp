@@ -4,6 +4,10 @@
 
 #include "Thread.h"
 #include "Memory.h"
+#include "Info.h"
+#include "Timer.h"
+#include <algorithm>
+#include "../Config.h"
 
 namespace
 {
@@ -15,147 +19,323 @@ namespace MPMA
 {
     // -- Threadpool class
 
+    namespace
+    {
+        //number of times an idle pool thread will yield and look for work again before it blocks
+        const nuint POOL_IDLE_SPINS=64;
+
+        //threads of all thread pools, so pools that grow and shrink in bursts don't go to the general allocator.  Created on first use, since a pool may be made during static construction.
+        ObjectPool<Thread>& PoolThreads()
+        {
+            static ObjectPool<Thread> *threads=NewLeakedObjectPool<Thread>("Thread pool threads");
+            return *threads;
+        }
+    }
+
+    //the per-thread state of all thread pools
+    ObjectPool<ThreadPool::ThreadPoolThread>& ThreadPool::PoolThreadObjects()
+    {
+        static ObjectPool<ThreadPoolThread> *threadObjects=NewLeakedObjectPool<ThreadPoolThread>("Thread pool thread states");
+        return *threadObjects;
+    }
+
     //ctor
-    ThreadPool::ThreadPool(nuint initialThreads, nuint maxThreads)
+    ThreadPool::ThreadPool(nuint initialThreads, nuint maxThreads, nuint queueSize, ThreadAffinityPolicy affinity)
     {
+        affinityPolicy=affinity;
         threadLimit=maxThreads;
+        if (threadLimit==0) threadLimit=1;
         threadCount=0;
+        unfinishedJobs=0;
+        sleepingThreads=0;
+
+        allThreads=new2_array(ThreadPoolThread*, threadLimit, ThreadPoolThread*);
+        for (nuint i=0; i<threadLimit; ++i)
+            allThreads[i]=0;
+
+        //set up the queue.  Each cell's sequence tracks which lap of the ring it's ready for.
+        nuint cellCount=2;
+        while (cellCount<queueSize)
+            cellCount<<=1;
+        jobMask=cellCount-1;
+        jobCells=new2_array(JobCell, cellCount, JobCell);
+        for (nuint i=0; i<cellCount; ++i)
+        {
+            jobCells[i].sequence=i;
+            jobCells[i].func=0;
+        }
+        enqueuePos=0;
+        dequeuePos=0;
 
         //make initial threads
-        for (nuint i=0; i<initialThreads; ++i)
-            GrowPool();
+        TakeSpinLock takeLock(growLock);
+        while (threadCount<initialThreads && threadCount<threadLimit)
+            AddThread();
     }
 
     //dtor
     ThreadPool::~ThreadPool()
     {
-        //tell all threads to die
+        //tell all threads to finish what's queued then end
+        TakeSpinLock takeLock(growLock);
+        for (nuint i=0; i<threadCount; ++i)
         {
-            TakeSpinLock takeLock(listLock);
+            allThreads[i]->thread->SetEnding();
+            allThreads[i]->block.Clear();
+        }
 
-            if (allThreads.size()!=availableThreads.size())
-                threadReturnBlock.Set();
-            else
-                threadReturnBlock.Clear();
+        //wait for them to end and free them
+        for (nuint i=0; i<threadCount; ++i)
+        {
+            PoolThreads().Delete(allThreads[i]->thread);
+            allThreads[i]->thread=0;
+            PoolThreadObjects().Delete(allThreads[i]);
+            allThreads[i]=0;
+        }
 
-            for (std::list<ThreadPoolThread*>::iterator i=allThreads.begin(); i!=allThreads.end(); ++i)
-            {
-                (**i).thread->SetEnding();
-                (**i).isEnding=true;
-                (**i).block.Clear();
-            }
+        delete2_array(allThreads);
+        delete2_array(jobCells);
+    }
+
+    //creates a new thread in the pool (growLock must be held)
+    void ThreadPool::AddThread()
+    {
+        ThreadPoolThread *tpt=PoolThreadObjects().New();
+        tpt->pool=this;
+        tpt->isSleeping=0;
+        tpt->thread=PoolThreads().New(ThreadProc, tpt);
+
+        if (affinityPolicy!=THREAD_AFFINITY_NONE)
+        {
+            std::vector<nuint> processors;
+            GetThreadAffinityProcessors(affinityPolicy, threadCount, processors);
+            if (!processors.empty())
+                tpt->thread->SetProcessorAffinity(processors);
         }
 
-        //wait until all threads are in the available bucket
-        do
+        //publish the entry before the count, since WakeThread reads it without the lock
+        allThreads[threadCount]=tpt;
+        AtomicIntInc(&threadCount);
+    }
+
+    //adds threads to the pool until there's one for each unfinished job, or the limit is reached
+    void ThreadPool::GrowPool()
+    {
+        TakeSpinLock takeLock(growLock);
+        while (threadCount<threadLimit && threadCount<unfinishedJobs)
+            AddThread();
+    }
+
+    //adds a job to the queue, returns false if it's full
+    bool ThreadPool::PushJob(ThreadFunc proc, ThreadParam param)
+    {
+        nuint pos=enqueuePos;
+        JobCell *cell;
+        while (true)
         {
-            threadReturnBlock.WaitUntilClear(true);
+            cell=&jobCells[pos&jobMask];
+            nsint dif=(nsint)cell->sequence-(nsint)pos;
+            if (dif==0) //cell is free for this lap, try to claim it
+            {
+                nuint found;
+                if (AtomicCompareExchange(&enqueuePos, pos, pos+1, found))
+                    break;
+                pos=found;
+            }
+            else if (dif<0) //cell still holds a job from the last lap, so we're full
+                return false;
+            else //someone else claimed it, catch up
+                pos=enqueuePos;
+        }
 
-            TakeSpinLock takeLock(listLock);
-            if (allThreads.size()==availableThreads.size())
-                break;
-        } while (true);
+        cell->func=proc;
+        cell->param=param;
+        AtomicIntInc(&cell->sequence); //locked op, so the job is visible before the cell is marked as ready
+        return true;
+    }
 
-        //free all threads
+    //removes a job from the queue, returns false if it's empty
+    bool ThreadPool::PopJob(ThreadFunc &outProc, ThreadParam &outParam)
+    {
+        nuint pos=dequeuePos;
+        JobCell *cell;
+        while (true)
         {
-            TakeSpinLock takeLock(listLock);
-            for (std::list<ThreadPoolThread*>::iterator i=allThreads.begin(); i!=allThreads.end(); ++i)
+            cell=&jobCells[pos&jobMask];
+            nsint dif=(nsint)cell->sequence-(nsint)(pos+1);
+            if (dif==0) //cell has a job for this lap, try to claim it
             {
-                delete2((**i).thread);
-                (**i).thread=0;
-                delete2(*i);
+                nuint found;
+                if (AtomicCompareExchange(&dequeuePos, pos, pos+1, found))
+                    break;
+                pos=found;
             }
+            else if (dif<0) //nothing queued here yet
+                return false;
+            else //someone else took it, catch up
+                pos=dequeuePos;
         }
+
+        outProc=cell->func;
+        outParam=cell->param;
+        AtomicIntAdd((volatile nsint*)&cell->sequence, (nsint)jobMask); //frees the cell for the next lap
+        return true;
     }
 
-    //attempts to increase the size of the thread pool
-    void ThreadPool::GrowPool()
+    //wakes one thread that is blocked waiting for a job, if there are any
+    void ThreadPool::WakeThread()
     {
-        TakeSpinLock takeLock(listLock);
-        if (threadCount>=threadLimit)
+        //locked read, so the job we just queued is visible before we check for sleepers
+        if (AtomicIntAdd((volatile nsint*)&sleepingThreads, 0)==0)
             return;
 
-        //make the new one
-        ThreadPoolThread *tpt=new2(ThreadPoolThread(),ThreadPoolThread);
-        tpt->pool=this;
-        tpt->isEnding=false;
-        tpt->isAssigned=false;
-        tpt->isReadyToRun=false;
-        tpt->runFunc=0;
-        tpt->thread=new2(Thread(ThreadProc,tpt),Thread);
-        availableThreads.push_back(tpt);
-        allThreads.push_back(tpt);
-        ++threadCount;
+        nuint count=threadCount;
+        for (nuint i=0; i<count; ++i)
+        {
+            nuint junk;
+            ThreadPoolThread *tpt=allThreads[i];
+            if (tpt->isSleeping && AtomicCompareExchange(&tpt->isSleeping, 1, 0, junk))
+            {
+                tpt->block.Clear();
+                return;
+            }
+        }
     }
 
-    //removes a thread from the pool, growing or blocking if needed until one is available
-    ThreadPool::ThreadPoolThread* ThreadPool::GetThreadFromPool()
+    //static thread proc
+    void ThreadPool::ThreadProc(Thread &myThread, ThreadParam param)
     {
-        TakeSpinLock takeLock(listLock);
-        threadReturnBlock.Set();
-        while (availableThreads.size()==0)
+        ThreadPoolThread *tpt=(ThreadPoolThread*)param.ptr;
+        ThreadPool *pool=tpt->pool;
+
+        nuint idleSpins=0;
+        while (true)
         {
-            //grow it if possible
-            if (threadCount<threadLimit)
+            //run the next job if there is one
+            ThreadFunc runFunc;
+            ThreadParam runParam;
+            if (pool->PopJob(runFunc, runParam))
             {
-                takeLock.Leave();
-                GrowPool();
-                takeLock.Take();
+                runFunc(myThread, runParam);
+                AtomicIntDec(&pool->unfinishedJobs);
+                idleSpins=0;
                 continue;
             }
 
-            //block and wait for a thread to return to the pool
-            takeLock.Leave();
-            threadReturnBlock.WaitUntilClear(true);
-            takeLock.Take();
-        }
+            //the queue is drained, so we can stop if we've been asked to
+            if (myThread.IsEnding())
+                break;
+
+            if (idleSpins<POOL_IDLE_SPINS)
+            {
+                ++idleSpins;
+                Sleep(0);
+                continue;
+            }
+
+            //block until woken.  We announce that we're sleeping before the final check, so a job queued after the check will always wake us.
+            tpt->block.Set();
+            tpt->isSleeping=1;
+            AtomicIntInc(&pool->sleepingThreads);
 
-        ThreadPoolThread *useThread=availableThreads.front();
-        availableThreads.pop_front();
-        useThread->isAssigned=true;
-        return useThread;
+            if (!myThread.IsEnding() && pool->dequeuePos==pool->enqueuePos)
+                tpt->block.WaitUntilClear();
+
+            nuint junk;
+            AtomicCompareExchange(&tpt->isSleeping, 1, 0, junk);
+            AtomicIntDec(&pool->sleepingThreads);
+            idleSpins=0;
+        }
     }
 
-    //returns a thread to the pool
-    void ThreadPool::ReturnThreadToPool(ThreadPoolThread *thread)
+    //Queues a function to be run on a thread in the pool.
+    bool ThreadPool::RunThread(ThreadFunc proc, ThreadParam param)
     {
-        TakeSpinLock takeLock(listLock);
-        thread->isAssigned=false;
-        thread->isReadyToRun=false;
-        availableThreads.push_front(thread);
-        threadReturnBlock.Clear();
+        AtomicIntInc(&unfinishedJobs);
+        if (!PushJob(proc, param))
+        {
+            AtomicIntDec(&unfinishedJobs);
+            return false;
+        }
+
+        //make sure there's a thread for every job, if we're allowed
+        if (threadCount<unfinishedJobs && threadCount<threadLimit)
+            GrowPool();
+
+        WakeThread();
+        return true;
     }
 
-    //static thread proc
-    void ThreadPool::ThreadProc(Thread &myThread, ThreadParam param)
+    namespace
     {
-        ThreadPoolThread *tpt=(ThreadPoolThread*)param.ptr;
-        tpt->block.Set();
-        while (!myThread.IsEnding() && !tpt->isEnding)
+        //what the jobs run by Internal_MeasureThreadPoolJobs report back
+        struct MeasuredJobs
+        {
+            volatile nuint finished;
+            volatile uint64 startTicks;
+        };
+
+        void CountJob(Thread&, ThreadParam param)
         {
-            //if we are assigned a task, run it
-            if (tpt->isAssigned)
+            AtomicIntInc(&((MeasuredJobs*)param.ptr)->finished);
+        }
+
+        void TimeJob(Thread&, ThreadParam param)
+        {
+            MeasuredJobs *jobs=(MeasuredJobs*)param.ptr;
+            jobs->startTicks=Timer::GetTicks();
+            AtomicIntInc(&jobs->finished); //locked op, so the time is visible before the count
+        }
+
+        //runs the jobs of Internal_MeasureThreadPoolJobs through a pool
+        void MeasurePool(ThreadPool &pool, nuint jobCount, double &outJobsPerSecond, double &outMedianLatency, double &outP99Latency)
+        {
+            MeasuredJobs jobs;
+            jobs.finished=0;
+            jobs.startTicks=0;
+
+            //throughput, queueing as fast as jobs are accepted
+            Timer timer;
+            for (nuint i=0; i<jobCount; ++i)
             {
-                while (!tpt->isReadyToRun)
+                while (!pool.RunThread(CountJob, &jobs))
                     Sleep(0);
+            }
+            while (AtomicLoad(&jobs.finished, MEMORY_ORDER_ACQUIRE)<jobCount)
+                Sleep(0);
+            outJobsPerSecond=jobCount/timer.Step();
 
-                tpt->runFunc(*tpt->thread, tpt->runParam);
-                tpt->pool->ReturnThreadToPool(tpt);
+            //latency, one job at a time
+            const nuint LATENCY_SAMPLES=1000;
+            std::vector<uint64> latencies;
+            latencies.reserve(LATENCY_SAMPLES);
+            for (nuint i=0; i<LATENCY_SAMPLES; ++i)
+            {
+                jobs.finished=0;
+                uint64 queuedTicks=Timer::GetTicks();
+                while (!pool.RunThread(TimeJob, &jobs))
+                    Sleep(0);
+                while (AtomicLoad(&jobs.finished, MEMORY_ORDER_ACQUIRE)==0)
+                    Sleep(0);
+                latencies.push_back(jobs.startTicks-queuedTicks);
             }
 
-            //block until woken
-            tpt->block.WaitUntilClear(true);
+            std::sort(latencies.begin(), latencies.end());
+            outMedianLatency=Timer::TicksToSeconds(latencies[LATENCY_SAMPLES/2]);
+            outP99Latency=Timer::TicksToSeconds(latencies[LATENCY_SAMPLES*99/100]);
         }
     }
 
-    //Exectutes a function on a thread in the pool.  The thread returns to the pool when the function returns.  Blocks if needed until there is a thread available.
-    void ThreadPool::RunThread(ThreadFunc proc, ThreadParam param)
+    //benchmark of the pool's job queue
+    Internal_ThreadPoolJobInfo Internal_MeasureThreadPoolJobs(nuint threads, nuint jobs)
     {
-        ThreadPoolThread *tpt=GetThreadFromPool();
-        tpt->runFunc=proc;
-        tpt->runParam=param;
-        tpt->isReadyToRun=true;
-        tpt->block.Clear();
+        if (threads==0)
+            threads=1;
+
+        Internal_ThreadPoolJobInfo info;
+        ThreadPool pool(threads, threads, 1024);
+        MeasurePool(pool, jobs, info.jobsPerSecond, info.medianLatency, info.p99Latency);
+        return info;
     }
 
     // --
@@ -169,4 +349,68 @@ namespace MPMA
         return currentThreadId;
     }
 
+    //Fills outProcessors with the logical processors of the core reserved for the audio thread.
+    void GetReservedCoreProcessors(std::vector<nuint> &outProcessors)
+    {
+        outProcessors.clear();
+
+#if defined(RESERVE_CORE_FOR_AUDIO) && defined(MPMA_COMPILE_AUDIO)
+        //not worth giving up a core on smaller machines
+        if (SystemInfo::ProcessorCoreCount<4)
+            return;
+
+        nuint reservedCore=SystemInfo::ProcessorCoreCount-1;
+        for (std::vector<ProcessorLocation>::const_iterator loc=SystemInfo::ProcessorLocations.begin(); loc!=SystemInfo::ProcessorLocations.end(); ++loc)
+        {
+            if (loc->core==reservedCore)
+                outProcessors.push_back(loc->logicalId);
+        }
+#endif
+    }
+
+    //Fills outProcessors with the logical processors that the threadIndex'th thread of a pool should be restricted to under a policy.
+    void GetThreadAffinityProcessors(ThreadAffinityPolicy policy, nuint threadIndex, std::vector<nuint> &outProcessors)
+    {
+        outProcessors.clear();
+        if (policy==THREAD_AFFINITY_NONE || SystemInfo::ProcessorLocations.empty())
+            return;
+
+        std::vector<nuint> reserved;
+        GetReservedCoreProcessors(reserved);
+        nuint usableCores=SystemInfo::ProcessorCoreCount;
+        if (!reserved.empty())
+            --usableCores; //the reserved core is always the last one
+
+        if (policy==THREAD_AFFINITY_PER_CORE)
+        {
+            nuint core=threadIndex%usableCores;
+            for (std::vector<ProcessorLocation>::const_iterator loc=SystemInfo::ProcessorLocations.begin(); loc!=SystemInfo::ProcessorLocations.end(); ++loc)
+            {
+                if (loc->core==core)
+                    outProcessors.push_back(loc->logicalId);
+            }
+        }
+        else if (policy==THREAD_AFFINITY_PER_NODE)
+        {
+            nuint node=threadIndex%SystemInfo::NumaNodeCount;
+            for (std::vector<ProcessorLocation>::const_iterator loc=SystemInfo::ProcessorLocations.begin(); loc!=SystemInfo::ProcessorLocations.end(); ++loc)
+            {
+                if (loc->numaNode==node && loc->core<usableCores)
+                    outProcessors.push_back(loc->logicalId);
+            }
+        }
+    }
+
+    //Returns the NUMA node that a logical processor belongs to.
+    nuint GetProcessorNumaNode(nuint logicalProcessor)
+    {
+        for (std::vector<ProcessorLocation>::const_iterator loc=SystemInfo::ProcessorLocations.begin(); loc!=SystemInfo::ProcessorLocations.end(); ++loc)
+        {
+            if (loc->logicalId==logicalProcessor)
+                return loc->numaNode;
+        }
+
+        return 0;
+    }
+
 }
@@ -6,7 +6,9 @@
 
 #include "Types.h"
 #include "Locks.h"
+#include "ObjectPool.h"
 #include <list>
+#include <vector>
 
 namespace MPMA
 {
@@ -20,6 +22,14 @@ namespace MPMA
         THREAD_HIGH //!<Higher than normal thread priority
     };
 
+    //!How the threads of a ThreadPool are placed on processors.
+    enum ThreadAffinityPolicy
+    {
+        THREAD_AFFINITY_NONE, //!<Threads may run on any processor, and the operating system moves them around as it likes.
+        THREAD_AFFINITY_PER_CORE, //!<Each thread is pinned to a different physical core (wrapping around if there are more threads than cores), skipping the core reserved for audio if there is one.
+        THREAD_AFFINITY_PER_NODE //!<Each thread is restricted to the processors of one NUMA node, spreading the threads evenly over the nodes.
+    };
+
     //!A user-defined parameter passed to the thread procedure.
     union ThreadParam
     {
@@ -56,6 +66,9 @@ namespace MPMA
         //!Sets the thread to run at a specific priority.
         void SetPriority(ThreadPriority newPriority);
 
+        //!Restricts the thread to run only on the given logical processors (see SystemInfo::ProcessorLocations for their ids).  An empty list removes the restriction.  Returns false if the operating system refused.
+        bool SetProcessorAffinity(const std::vector<nuint> &logicalProcessors);
+
         //!Returns true if the thread is still running
         bool IsRunning() const;
 
@@ -79,17 +92,18 @@ namespace MPMA
 
     // -- Threadpool class
 
-    //!A pool of pre-created threads.
+    //!A pool of pre-created threads that run queued jobs.
     class ThreadPool
     {
     public:
-        //!ctor
-        ThreadPool(nuint initialThreads=1, nuint maxThreads=100);
-      //!When this object destructs, we block until all threads are returned to the pool.
+        //!ctor.  queueSize is the max number of jobs that can be waiting for a thread at once, and is rounded up to a power of 2.  Each thread is placed on processors according to affinity as it is created.
+        ThreadPool(nuint initialThreads=1, nuint maxThreads=100, nuint queueSize=256, ThreadAffinityPolicy affinity=THREAD_AFFINITY_NONE);
+        //!When this object destructs, all jobs that were already queued are run, and we block until they all return.
         ~ThreadPool();
 
-        //!Exectutes a function on a thread in the pool.  The thread returns to the pool when the function returns.  Blocks if needed until there is a thread available.
-        void RunThread(ThreadFunc proc, ThreadParam param);
+        //!\brief Queues a function to be run on a thread in the pool.  The thread returns to the pool when the function returns.
+        //!This never blocks.  The pool grows (up to maxThreads) if there are more unfinished jobs than threads, otherwise the job waits for the next idle thread.  Returns false if the queue is full, in which case the job was not queued.
+        bool RunThread(ThreadFunc proc, ThreadParam param);
 
     private:
         class ThreadPoolThread
@@ -97,26 +111,44 @@ namespace MPMA
         public:
             ThreadPool *pool;
             Thread *thread;
-            ThreadFunc runFunc;
-            ThreadParam runParam;
             BlockingObject block;
-            bool isEnding;
-            bool isAssigned;
-            bool isReadyToRun;
+            volatile nuint isSleeping;
+        };
+
+        //an entry in the job queue
+        struct JobCell
+        {
+            volatile nuint sequence;
+            ThreadFunc func;
+            ThreadParam param;
         };
 
+        static ObjectPool<ThreadPoolThread>& PoolThreadObjects();
+
+        void AddThread();
         void GrowPool();
-        ThreadPoolThread* GetThreadFromPool();
-        void ReturnThreadToPool(ThreadPoolThread *thread);
+        bool PushJob(ThreadFunc proc, ThreadParam param);
+        bool PopJob(ThreadFunc &outProc, ThreadParam &outParam);
+        void WakeThread();
 
         static void ThreadProc(Thread &myThread, ThreadParam param);
 
-        std::list<ThreadPoolThread*> availableThreads;
-        std::list<ThreadPoolThread*> allThreads;
+        //bounded lock-free multi-producer multi-consumer job queue
+        JobCell *jobCells;
+        nuint jobMask;
+        volatile nuint enqueuePos;
+        uint8 padding0[64]; //keep producers and consumers off the same cache line
+        volatile nuint dequeuePos;
+        uint8 padding1[64];
+
+        volatile nuint unfinishedJobs; //queued or running
+        volatile nuint sleepingThreads;
+
+        ThreadPoolThread **allThreads; //fixed size array of threadLimit entries
+        volatile nuint threadCount;
         nuint threadLimit;
-        nuint threadCount;
-        SpinLock listLock;
-        BlockingObject threadReturnBlock;
+        SpinLock growLock;
+        ThreadAffinityPolicy affinityPolicy;
 
         //you cannot duplicate a threadpool
         ThreadPool(const ThreadPool&);
@@ -131,4 +163,29 @@ namespace MPMA
 
     //!Gets a value that is unique to the calling thread.  Any given thread will always return the same value.
     nuint GetThreadUniqueIdentifier();
+
+    //!Returns the logical processor the calling thread is running on right now (which may change at any time unless it is pinned).
+    nuint GetCurrentLogicalProcessor();
+
+    //!Fills outProcessors with the logical processors that the threadIndex'th thread of a pool should be restricted to under a policy.  It is left empty if the thread should not be restricted, or if the processor topology is not known.
+    void GetThreadAffinityProcessors(ThreadAffinityPolicy policy, nuint threadIndex, std::vector<nuint> &outProcessors);
+
+    //!Fills outProcessors with the logical processors of the core reserved for the audio thread (see RESERVE_CORE_FOR_AUDIO in Config.h), which pools pinned per core stay off of.  It is left empty if no core is reserved.
+    void GetReservedCoreProcessors(std::vector<nuint> &outProcessors);
+
+    //!Returns the NUMA node that a logical processor belongs to.
+    nuint GetProcessorNumaNode(nuint logicalProcessor);
+
+    // -- internal use below
+
+    //what Internal_MeasureThreadPoolJobs found out: empty jobs started and finished in a second when they are queued as fast as the pool accepts them, and the median and 99th percentile seconds from RunThread to a job starting when they are queued one at a time
+    struct Internal_ThreadPoolJobInfo
+    {
+        double jobsPerSecond;
+        double medianLatency;
+        double p99Latency;
+    };
+
+    //benchmark of the pool's job queue: runs the given number of empty jobs through a pool of the given number of threads, then times 1000 jobs queued one at a time
+    Internal_ThreadPoolJobInfo Internal_MeasureThreadPoolJobs(nuint threads=4, nuint jobs=100000);
 }
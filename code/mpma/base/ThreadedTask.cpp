@@ -7,117 +7,241 @@
 
 #include "ThreadedTask.h"
 #include "Info.h"
-#include "Memory.h"
 #include "Locks.h"
-#include "Thread.h"
+#include "Atomic.h"
 
-extern MPMA::ThreadPool *internalTaskPool;
-extern std::list<MPMA::BlockingObject*> *internalTaskBlocks;
-extern MPMA::SpinLock *internalTaskLock;
-
-namespace
+namespace MPMA
 {
-    //param to worker thread
-    template <typename FuncType, FuncType func, typename UserParamType>
-    struct TaskWorkerThreadParam
+    //max number of blocks ParallelScan splits its range into
+    const nuint PARALLEL_SCAN_MAX_BLOCKS=64;
+
+    //shared state used to hand out chunks of a range to the threads working on it
+    struct Internal_ParallelRange
     {
-        UserParamType *param;
+        volatile sint64 next;
+        sint64 end;
+        sint64 grain;
+        sint64 initialChunk;
+        sint64 bigChunkLimit;
 
-        volatile nuint &currentCount;
-        nuint &maxCount;
+        //sets up the range, and returns how many threads are worth using on it
+        inline nuint Setup(sint64 rangeBegin, sint64 rangeEnd, sint64 minChunk)
+        {
+            sint64 count=rangeEnd-rangeBegin;
+            next=rangeBegin;
+            end=rangeEnd;
+            grain=minChunk>0 ? minChunk : 1;
 
-        MPMA::BlockingObject *block;
-        volatile nuint *threadsAlive;
+            sint64 threadCount=(sint64)SystemInfo::ProcessorCount;
+            if (threadCount>(count+grain-1)/grain) threadCount=(count+grain-1)/grain;
+            if (threadCount<1) threadCount=1;
 
-        inline TaskWorkerThreadParam(UserParamType *userParam, volatile nuint &curCount, nuint &maxCount, MPMA::BlockingObject *blocker, volatile nuint *threadCount):
-            param(userParam), currentCount(curCount), maxCount(maxCount), block(blocker), threadsAlive(threadCount)
-        {}
+            //start with big chunks, then switch to smaller ones 80% in
+            bigChunkLimit=rangeBegin+(count/5)*4;
+            initialChunk=count/threadCount/4;
+            if (initialChunk<grain) initialChunk=grain;
 
-    private:
-        void operator=(const TaskWorkerThreadParam<FuncType, func, UserParamType> &notAllowed); //disable
+            return (nuint)threadCount;
+        }
+
+        //repeatedly grabs a chunk of the range and calls chunkFunc(chunkBegin, chunkEnd) for it, until the range is used up
+        template <typename ChunkFunc>
+        inline void ForEachChunk(const ChunkFunc &chunkFunc)
+        {
+            sint64 chunkSize=initialChunk;
+            while (true)
+            {
+                //grab a range of space to work on
+                sint64 startRange=AtomicFetchAdd(&next, chunkSize, MEMORY_ORDER_RELAXED);
+                if (startRange>=end) break;
+                sint64 endRange=startRange+chunkSize;
+                if (endRange>end) endRange=end;
+
+                if (startRange>bigChunkLimit) //time to switch to smaller chunks
+                {
+                    chunkSize>>=1;
+                    chunkSize+=1;
+                    if (chunkSize<grain) chunkSize=grain;
+                }
+
+                //run them
+                chunkFunc(startRange, endRange);
+            }
+        }
     };
 
-    //each worker thread runs this
-    template <typename FuncType, FuncType func, typename UserParamType>
-    void ExecuteThreadedTask_ThreadProc(MPMA::Thread &thread, MPMA::ThreadParam threadParam)
+    //param to the ParallelFor jobs
+    template <typename Func>
+    struct Internal_ParallelForParam
     {
-        TaskWorkerThreadParam<FuncType, func, UserParamType> &runInfo=*(TaskWorkerThreadParam<FuncType, func, UserParamType>*)threadParam.ptr;
+        Internal_ParallelRange range;
+        const Func *func;
+    };
 
-        //calc initial chunk size and big-chunk limit
-        nuint bigChunkLimit=(runInfo.maxCount*4)/5; //80% in
-        uint32 chunkSize=(uint32)(runInfo.maxCount/MPMA::SystemInfo::ProcessorCount)/4; //TODO: use nuint once atomic stuff supports 64-bit
-        if (chunkSize==0) chunkSize=1;
+    //each thread that takes part in a ParallelFor runs this
+    template <typename Func>
+    void Internal_ParallelFor_JobProc(ThreadedTaskJob &job)
+    {
+        Internal_ParallelForParam<Func> &runInfo=*(Internal_ParallelForParam<Func>*)job.param;
+        const Func &func=*runInfo.func;
 
-        nuint startRange;
-        do
+        runInfo.range.ForEachChunk([&func](sint64 chunkBegin, sint64 chunkEnd)
         {
-            //grab a range of space to work on
-            startRange=MPMA::AtomicIntAdd((volatile nsint*)&runInfo.currentCount, chunkSize);
-            if (startRange>runInfo.maxCount) break;
-            nuint endRange=startRange+chunkSize;
-            if (endRange>runInfo.maxCount) endRange=runInfo.maxCount;
+            for (sint64 i=chunkBegin; i<chunkEnd; ++i)
+                func(i);
+        });
+    }
 
-            if (startRange>bigChunkLimit) //time to switch to smaller chunks
-            {
-                chunkSize>>=1;
-                chunkSize+=1;
-            }
+    template <typename Func>
+    void ParallelFor(sint64 begin, sint64 end, sint64 grain, const Func &func)
+    {
+        if (end<=begin) return;
 
-            //run them
-            for (nuint i=startRange; i<endRange; ++i)
-            {
-                func(i, *runInfo.param);
-            }
+        Internal_ParallelForParam<Func> runInfo;
+        runInfo.func=&func;
+        nuint threadCount=runInfo.range.Setup(begin, end, grain);
+        if (threadCount==1) //not worth splitting up
+        {
+            for (sint64 i=begin; i<end; ++i)
+                func(i);
+            return;
+        }
+
+        ThreadedTaskJob job(Internal_ParallelFor_JobProc<Func>, &runInfo);
+        Internal_RunParallelJob(job, threadCount);
+    }
 
-        } while (startRange<runInfo.maxCount);
+    //param to the ParallelReduce jobs
+    template <typename T, typename Func, typename Combine>
+    struct Internal_ParallelReduceParam
+    {
+        Internal_ParallelRange range;
+        const Func *func;
+        const Combine *combine;
+        const T *identity;
+        T *result;
+        volatile nuint resultLock;
+    };
+
+    //each thread that takes part in a ParallelReduce runs this
+    template <typename T, typename Func, typename Combine>
+    void Internal_ParallelReduce_JobProc(ThreadedTaskJob &job)
+    {
+        Internal_ParallelReduceParam<T, Func, Combine> &runInfo=*(Internal_ParallelReduceParam<T, Func, Combine>*)job.param;
+        const Func &func=*runInfo.func;
 
-        MPMA::AtomicIntDec(runInfo.threadsAlive);
-        //runInfo.block->Clear(); //TEMP TODO: race condition of ExecuteThreadedTask returning before this but after the dec, causing accessing bad memory
+        //accumulate our share locally
+        T local(*runInfo.identity);
+        runInfo.range.ForEachChunk([&func, &local](sint64 chunkBegin, sint64 chunkEnd)
+        {
+            for (sint64 i=chunkBegin; i<chunkEnd; ++i)
+                func(i, local);
+        });
+
+        //then merge it in.  This only happens once per thread so a simple lock is fine.
+        while (AtomicExchange(&runInfo.resultLock, (nuint)1, MEMORY_ORDER_ACQUIRE)!=0)
+            Sleep(0);
+        *runInfo.result=(*runInfo.combine)(*runInfo.result, local);
+        AtomicStore(&runInfo.resultLock, (nuint)0, MEMORY_ORDER_RELEASE);
     }
-}
 
-namespace MPMA
-{
-    //implementation of the function
-    template <typename FuncType, FuncType userFunc, typename UserParamType>
-    void ExecuteThreadedTask(nuint count, UserParamType userParam)
+    template <typename T, typename Func, typename Combine>
+    T ParallelReduce(sint64 begin, sint64 end, sint64 grain, const T &identity, const Func &func, const Combine &combine)
     {
-        if (count==0) return;
+        T result(identity);
+        if (end<=begin) return result;
 
-        //grab a blocking object to use, or add one if needed
-        MPMA::BlockingObject *block;
+        Internal_ParallelReduceParam<T, Func, Combine> runInfo;
+        runInfo.func=&func;
+        runInfo.combine=&combine;
+        runInfo.identity=&identity;
+        runInfo.result=&result;
+        runInfo.resultLock=0;
+        nuint threadCount=runInfo.range.Setup(begin, end, grain);
+        if (threadCount==1) //not worth splitting up
         {
-            MPMA::TakeSpinLock takeLock(*internalTaskLock);
-            if (internalTaskBlocks->size()>0)
+            for (sint64 i=begin; i<end; ++i)
+                func(i, result);
+            return result;
+        }
+
+        ThreadedTaskJob job(Internal_ParallelReduce_JobProc<T, Func, Combine>, &runInfo);
+        Internal_RunParallelJob(job, threadCount);
+        return result;
+    }
+
+    template <typename T, typename ValueFunc, typename Combine, typename OutputFunc>
+    void ParallelScan(sint64 begin, sint64 end, sint64 grain, const T &identity, const ValueFunc &value, const Combine &combine, const OutputFunc &output)
+    {
+        if (end<=begin) return;
+
+        //split into a fixed number of blocks, so we can keep the block sums on the stack
+        sint64 count=end-begin;
+        if (grain<1) grain=1;
+        sint64 blockCount=(sint64)SystemInfo::ProcessorCount*4;
+        if (blockCount>(sint64)PARALLEL_SCAN_MAX_BLOCKS) blockCount=(sint64)PARALLEL_SCAN_MAX_BLOCKS;
+        if (blockCount>(count+grain-1)/grain) blockCount=(count+grain-1)/grain;
+
+        if (blockCount<=2 || SystemInfo::ProcessorCount==1) //not worth splitting up
+        {
+            T running(identity);
+            for (sint64 i=begin; i<end; ++i)
             {
-                block=internalTaskBlocks->front();
-                internalTaskBlocks->pop_front();
+                running=combine(running, value(i));
+                output(i, running);
             }
-            else
-                block=new2(MPMA::BlockingObject(), MPMA::BlockingObject);
+            return;
         }
 
-        block->Set();
+        sint64 blockSize=(count+blockCount-1)/blockCount;
+        T blockSums[PARALLEL_SCAN_MAX_BLOCKS];
+
+        //first pass: total up each block
+        ParallelFor(0, blockCount, 1, [&](sint64 block)
+        {
+            sint64 blockBegin=begin+block*blockSize;
+            sint64 blockEnd=blockBegin+blockSize;
+            if (blockEnd>end) blockEnd=end;
 
-        //divide the tasks among threads
-        volatile nuint sharedCount=0;
-        nuint threadCount=SystemInfo::ProcessorCount;
-        if (threadCount>count) threadCount=count;
-        volatile nuint threadsAlive=threadCount;
-        TaskWorkerThreadParam<FuncType, userFunc, UserParamType> runInfo(&userParam, sharedCount, count, block, &threadsAlive);
-        for (nuint t=0; t<threadCount; ++t)
-            internalTaskPool->RunThread(ExecuteThreadedTask_ThreadProc<FuncType, userFunc, UserParamType>, MPMA::ThreadParam(&runInfo));
+            T sum(identity);
+            for (sint64 i=blockBegin; i<blockEnd; ++i)
+                sum=combine(sum, value(i));
+            blockSums[block]=sum;
+        });
 
-        //wait until they're done
-        while (threadsAlive>0)
+        //turn the block totals into the starting prefix for each block
+        T carry(identity);
+        for (sint64 block=0; block<blockCount; ++block)
         {
-            //block->WaitUntilClear(true); //TEMP TODO: race condition of this returning early and causing thread to access bad memory from this stack
-            MPMA::Sleep(0); //temporary hack around... TODO! fix this!
+            T blockTotal(blockSums[block]);
+            blockSums[block]=carry;
+            carry=combine(carry, blockTotal);
         }
 
-        //put the block back
-        MPMA::TakeSpinLock takeLock(*internalTaskLock);
-        internalTaskBlocks->push_back(block);
+        //second pass: scan each block from its starting prefix
+        ParallelFor(0, blockCount, 1, [&](sint64 block)
+        {
+            sint64 blockBegin=begin+block*blockSize;
+            sint64 blockEnd=blockBegin+blockSize;
+            if (blockEnd>end) blockEnd=end;
+
+            T running(blockSums[block]);
+            for (sint64 i=blockBegin; i<blockEnd; ++i)
+            {
+                running=combine(running, value(i));
+                output(i, running);
+            }
+        });
+    }
+
+    //implementation of the function
+    template <typename FuncType, FuncType userFunc, typename UserParamType>
+    void ExecuteThreadedTask(nuint count, UserParamType userParam)
+    {
+        ParallelFor(0, (sint64)count, 0, [&userParam](sint64 i)
+        {
+            userFunc((nuint)i, userParam);
+        });
     }
 }
 
@@ -125,39 +249,482 @@ namespace MPMA
 #else // -- start normal compiled section
 
 #include "../Setup.h"
+#include "../Config.h"
+#include "ThreadedTask.h"
 #include "Info.h"
 #include "Memory.h"
+#include "ObjectPool.h"
 #include "Thread.h"
+#include "Locks.h"
+#include "Atomic.h"
+#include <vector>
 
-//threadpool to execute tasks on
+//threadpool that the task scheduler's workers run on
 MPMA::ThreadPool *internalTaskPool=0;
-std::list<MPMA::BlockingObject*> *internalTaskBlocks=0;
-MPMA::SpinLock *internalTaskLock=0;
+
+namespace
+{
+    //number of jobs each worker (and the shared queue used by non-worker threads) can hold before new jobs are just run inline
+    const nuint TASK_QUEUE_SIZE=1024;
+
+    //number of times an idle thread will yield and look for work again before it blocks
+    const nuint TASK_IDLE_SPINS=64;
+
+    //Bounded work-stealing deque (Chase-Lev).  Only the owning worker pushes and pops the bottom, while any thread may steal from the top.
+    class TaskDeque
+    {
+    public:
+        TaskDeque(): top(0), bottom(0)
+            {}
+
+        //owner only: returns false if full
+        bool Push(MPMA::ThreadedTaskJob *job)
+        {
+            nuint b=MPMA::AtomicLoad(&bottom, MPMA::MEMORY_ORDER_RELAXED);
+            nuint t=MPMA::AtomicLoad(&top, MPMA::MEMORY_ORDER_ACQUIRE);
+            if ((nsint)(b-t)>=(nsint)TASK_QUEUE_SIZE)
+                return false;
+
+            MPMA::AtomicStore(&jobs[b%TASK_QUEUE_SIZE], job, MPMA::MEMORY_ORDER_RELAXED);
+            MPMA::AtomicStore(&bottom, b+1, MPMA::MEMORY_ORDER_RELEASE); //the job is visible before the new bottom is
+            return true;
+        }
+
+        //owner only: takes the most recently pushed job
+        MPMA::ThreadedTaskJob* Pop()
+        {
+            //reserve the bottom entry first, then see if a stealer is competing for it.  The fence keeps the read of top from moving before the reservation.
+            nuint b=MPMA::AtomicLoad(&bottom, MPMA::MEMORY_ORDER_RELAXED)-1;
+            MPMA::AtomicStore(&bottom, b, MPMA::MEMORY_ORDER_RELAXED);
+            MPMA::AtomicThreadFence(MPMA::MEMORY_ORDER_SEQ_CST);
+            nuint t=MPMA::AtomicLoad(&top, MPMA::MEMORY_ORDER_RELAXED);
+            if ((nsint)(b-t)<0) //was empty
+            {
+                MPMA::AtomicStore(&bottom, t, MPMA::MEMORY_ORDER_RELAXED);
+                return 0;
+            }
+
+            MPMA::ThreadedTaskJob *job=MPMA::AtomicLoad(&jobs[b%TASK_QUEUE_SIZE], MPMA::MEMORY_ORDER_RELAXED);
+            if (b!=t) //more than one left, so no stealer can reach this one
+                return job;
+
+            //last one, so race any stealers for it
+            if (!MPMA::AtomicCompareAndSwap(&top, t, t+1, MPMA::MEMORY_ORDER_SEQ_CST))
+                job=0;
+            MPMA::AtomicStore(&bottom, b+1, MPMA::MEMORY_ORDER_RELAXED);
+            return job;
+        }
+
+        //any thread: takes the oldest job.  This may fail if another thread took it first.
+        MPMA::ThreadedTaskJob* Steal()
+        {
+            nuint t=MPMA::AtomicLoad(&top, MPMA::MEMORY_ORDER_ACQUIRE);
+            MPMA::AtomicThreadFence(MPMA::MEMORY_ORDER_SEQ_CST);
+            nuint b=MPMA::AtomicLoad(&bottom, MPMA::MEMORY_ORDER_ACQUIRE);
+            if ((nsint)(b-t)<=0)
+                return 0;
+
+            MPMA::ThreadedTaskJob *job=MPMA::AtomicLoad(&jobs[t%TASK_QUEUE_SIZE], MPMA::MEMORY_ORDER_RELAXED);
+            if (!MPMA::AtomicCompareAndSwap(&top, t, t+1, MPMA::MEMORY_ORDER_SEQ_CST))
+                return 0;
+            return job;
+        }
+
+        inline bool IsEmpty() const
+            { return (nsint)(MPMA::AtomicLoad(&bottom, MPMA::MEMORY_ORDER_RELAXED)-MPMA::AtomicLoad(&top, MPMA::MEMORY_ORDER_RELAXED))<=0; }
+
+    private:
+        volatile nuint top;
+        uint8 padding[64]; //keep stealers and the owner from fighting over one cache line
+        volatile nuint bottom;
+        MPMA::ThreadedTaskJob *volatile jobs[TASK_QUEUE_SIZE];
+    };
+
+    //queue for jobs that are run from threads that are not workers
+    class TaskInjectionQueue
+    {
+    public:
+        TaskInjectionQueue(): head(0), tail(0)
+            {}
+
+        bool Push(MPMA::ThreadedTaskJob *job)
+        {
+            MPMA::TakeSpinLock takeLock(lock);
+            if (tail-head>=TASK_QUEUE_SIZE)
+                return false;
+
+            jobs[tail%TASK_QUEUE_SIZE]=job;
+            MPMA::AtomicStore(&tail, tail+1, MPMA::MEMORY_ORDER_RELEASE); //IsEmpty reads it without the lock
+            return true;
+        }
+
+        MPMA::ThreadedTaskJob* Pop()
+        {
+            if (IsEmpty())
+                return 0;
+
+            MPMA::TakeSpinLock takeLock(lock);
+            if (head==tail)
+                return 0;
+
+            MPMA::ThreadedTaskJob *job=jobs[head%TASK_QUEUE_SIZE];
+            MPMA::AtomicStore(&head, head+1, MPMA::MEMORY_ORDER_RELEASE);
+            return job;
+        }
+
+        inline bool IsEmpty() const
+            { return head==tail; }
+
+    private:
+        volatile nuint head;
+        volatile nuint tail;
+        MPMA::SpinLock lock;
+        MPMA::ThreadedTaskJob *jobs[TASK_QUEUE_SIZE];
+    };
+
+    //state for each worker thread in the pool
+    struct TaskWorker
+    {
+        TaskDeque deque;
+        MPMA::BlockingObject wakeBlock;
+        volatile nuint isSleeping;
+        nuint index;
+        nuint node; //numa node the worker is pinned to (0 if not pinned)
+    };
+
+    TaskWorker *taskWorkers=0;
+    nuint taskWorkerCount=0;
+    TaskInjectionQueue *taskInjectedJobs=0; //one per numa node
+    nuint taskNodeCount=1;
+    volatile nuint taskSleepingWorkers=0;
+    volatile bool taskSchedulerEnding=false;
+    volatile nuint taskStealRotor=0;
+
+    THREAD_LOCAL TaskWorker *currentTaskWorker=0;
+
+    //blocking objects for TaskGroup waiters to sleep on.  They are recycled rather than destructed, since a finishing job may still be clearing one after its waiter has given it back.
+    MPMA::ObjectPool<MPMA::BlockingObject> taskWaitBlocks("Task group wait blocks");
+
+    inline MPMA::BlockingObject* TakeWaitBlock()
+    {
+        return taskWaitBlocks.Acquire();
+    }
+
+    inline void ReturnWaitBlock(MPMA::BlockingObject *block)
+    {
+        taskWaitBlocks.Release(block);
+    }
+
+    //returns the numa node that jobs queued from the calling thread should go to
+    inline nuint CurrentTaskNode()
+    {
+        if (taskNodeCount==1)
+            return 0;
+        return MPMA::GetProcessorNumaNode(MPMA::GetCurrentLogicalProcessor())%taskNodeCount;
+    }
+
+    //returns true if any queue has something in it
+    bool IsAnyTaskQueued()
+    {
+        for (nuint i=0; i<taskNodeCount; ++i)
+        {
+            if (!taskInjectedJobs[i].IsEmpty())
+                return true;
+        }
+
+        for (nuint i=0; i<taskWorkerCount; ++i)
+        {
+            if (!taskWorkers[i].deque.IsEmpty())
+                return true;
+        }
+
+        return false;
+    }
+
+    //wakes up one worker that is blocked waiting for work, if there are any.  Must be called after a job is queued.
+    void WakeTaskWorker()
+    {
+        //the fence makes sure the job we just queued is visible before we check for sleepers
+        MPMA::AtomicThreadFence(MPMA::MEMORY_ORDER_SEQ_CST);
+        if (MPMA::AtomicLoad(&taskSleepingWorkers, MPMA::MEMORY_ORDER_RELAXED)==0)
+            return;
+
+        for (nuint i=0; i<taskWorkerCount; ++i)
+        {
+            nuint sleeping=1;
+            if (taskWorkers[i].isSleeping && MPMA::AtomicCompareAndSwap(&taskWorkers[i].isSleeping, sleeping, (nuint)0))
+            {
+                taskWorkers[i].wakeBlock.Clear();
+                return;
+            }
+        }
+    }
+
+    //finds a job to run: first from our own deque, then the shared queues, then by stealing from other workers.  Work from our own numa node is preferred over work from others.
+    MPMA::ThreadedTaskJob* FindTaskJob(TaskWorker *self)
+    {
+        MPMA::ThreadedTaskJob *job=0;
+        if (self)
+        {
+            job=self->deque.Pop();
+            if (job)
+                return job;
+        }
+
+        nuint node=self ? self->node : CurrentTaskNode();
+        for (nuint i=0; i<taskNodeCount; ++i)
+        {
+            job=taskInjectedJobs[(node+i)%taskNodeCount].Pop();
+            if (job)
+                return job;
+        }
+
+        //start at a different victim for each thief so they don't all pile onto the same worker
+        nuint start=self ? self->index+1 : MPMA::AtomicFetchAdd(&taskStealRotor, (nuint)1, MPMA::MEMORY_ORDER_RELAXED);
+        for (nuint pass=0; pass<2; ++pass)
+        {
+            //first pass is victims on our node, second is the rest (only needed with multiple nodes)
+            if (pass==1 && taskNodeCount==1)
+                break;
+
+            for (nuint i=0; i<taskWorkerCount; ++i)
+            {
+                TaskWorker &victim=taskWorkers[(start+i)%taskWorkerCount];
+                bool sameNode=(victim.node==node);
+                if (&victim==self || sameNode!=(pass==0))
+                    continue;
+
+                job=victim.deque.Steal();
+                if (job)
+                    return job;
+            }
+        }
+
+        return 0;
+    }
+
+    //each worker thread in the pool runs this until the scheduler shuts down
+    void TaskWorkerProc(MPMA::Thread &thread, MPMA::ThreadParam param)
+    {
+        TaskWorker *self=(TaskWorker*)param.ptr;
+        currentTaskWorker=self;
+
+#ifdef TASK_PIN_WORKERS_TO_CORES
+        std::vector<nuint> processors;
+        MPMA::GetThreadAffinityProcessors(MPMA::THREAD_AFFINITY_PER_CORE, self->index, processors);
+        if (!processors.empty())
+            thread.SetProcessorAffinity(processors);
+#endif
+
+        nuint idleSpins=0;
+        while (!taskSchedulerEnding)
+        {
+            MPMA::ThreadedTaskJob *job=FindTaskJob(self);
+            if (job)
+            {
+                MPMA::Internal_ExecuteTaskJob(job);
+                idleSpins=0;
+                continue;
+            }
+
+            if (idleSpins<TASK_IDLE_SPINS)
+            {
+                ++idleSpins;
+                MPMA::Sleep(0);
+                continue;
+            }
+
+            //nothing to do, so sleep until more work is queued.  We announce that we're sleeping before the final check, so a job queued after the check will always wake us.
+            self->wakeBlock.Set();
+            self->isSleeping=1;
+            MPMA::AtomicFetchAdd(&taskSleepingWorkers, (nuint)1);
+
+            if (!taskSchedulerEnding && !IsAnyTaskQueued())
+                self->wakeBlock.WaitUntilClear();
+
+            MPMA::AtomicStore(&self->isSleeping, (nuint)0);
+            MPMA::AtomicFetchSub(&taskSleepingWorkers, (nuint)1);
+            idleSpins=0;
+        }
+
+        currentTaskWorker=0;
+    }
+}
+
+namespace MPMA
+{
+    //runs a job and marks it as finished in its group
+    void Internal_ExecuteTaskJob(ThreadedTaskJob *job)
+    {
+        TaskGroup *group=job->group;
+        job->func(*job);
+        group->JobFinished();
+    }
+
+    //runs a job on the calling thread and threadCount-1 other threads, and waits for all of them
+    void Internal_RunParallelJob(ThreadedTaskJob &job, nuint threadCount)
+    {
+        //the same job is queued once per extra thread, since they all pull from the same shared state
+        TaskGroup group;
+        for (nuint t=1; t<threadCount; ++t)
+            group.Run(job);
+
+        //the calling thread does its share too, then helps with anything left until they're all done
+        job.func(job);
+        group.Wait();
+    }
+
+    // -- TaskGroup
+
+    TaskGroup::TaskGroup(): state(0), sleepBlock(0)
+    {
+    }
+
+    TaskGroup::~TaskGroup()
+    {
+        Wait();
+    }
+
+    //Queues a job to be run by the scheduler.
+    void TaskGroup::Run(ThreadedTaskJob &job)
+    {
+        job.group=this;
+        AtomicFetchAdd(&state, (nuint)2, MEMORY_ORDER_RELAXED); //queuing the job publishes this
+
+        bool queued=false;
+        if (taskWorkers && !taskSchedulerEnding)
+        {
+            if (currentTaskWorker)
+                queued=currentTaskWorker->deque.Push(&job);
+            else
+                queued=taskInjectedJobs[CurrentTaskNode()].Push(&job);
+        }
+
+        if (queued)
+            WakeTaskWorker();
+        else
+            Internal_ExecuteTaskJob(&job);
+    }
+
+    //Blocks until every job run in this group has finished.
+    void TaskGroup::Wait()
+    {
+        nuint idleSpins=0;
+        while ((AtomicLoad(&state, MEMORY_ORDER_ACQUIRE)>>1)!=0)
+        {
+            //help out while we wait
+            ThreadedTaskJob *job=taskWorkers ? FindTaskJob(currentTaskWorker) : 0;
+            if (job)
+            {
+                Internal_ExecuteTaskJob(job);
+                idleSpins=0;
+                continue;
+            }
+
+            if (idleSpins<TASK_IDLE_SPINS || IsAnyTaskQueued())
+            {
+                ++idleSpins;
+                Sleep(0);
+                continue;
+            }
+
+            //our remaining jobs are all running on other threads, so block until the last one finishes
+            BlockingObject *block=TakeWaitBlock();
+            block->Set();
+            sleepBlock=block;
+
+            nuint cur=state;
+            if ((cur>>1)!=0 && AtomicCompareAndSwap(&state, cur, cur|1))
+            {
+                block->WaitUntilClear();
+                AtomicFetchAnd(&state, ~(nuint)1);
+            }
+
+            sleepBlock=0;
+            ReturnWaitBlock(block);
+            idleSpins=0;
+        }
+    }
+
+    //called once for each job in the group after it has finished
+    void TaskGroup::JobFinished()
+    {
+        //the block must be read along with the state it was published under, since the group may be gone as soon as the count hits 0
+        nuint cur=AtomicLoad(&state, MEMORY_ORDER_ACQUIRE);
+        BlockingObject *block;
+        do
+        {
+            block=sleepBlock;
+        } while (!AtomicCompareAndSwap(&state, cur, cur-2, MEMORY_ORDER_ACQ_REL));
+
+        //that was the last job and the owner is blocked on it (the block is pooled so it's still valid even if the group is not)
+        if (cur==3)
+            block->Clear();
+    }
+}
 
 //init stuff
 namespace
 {
     void ThreadedTaskInitialize()
     {
-        //start with 0 threads in the pool and allow up to 2x the cpu count in it
+        //one worker per cpu.  The pool allows up to 2x the cpu count in it.
         internalTaskPool=new2(MPMA::ThreadPool(0, MPMA::SystemInfo::ProcessorCount*2), MPMA::ThreadPool);
-        internalTaskBlocks=new2(std::list<MPMA::BlockingObject*>(), std::list<MPMA::BlockingObject*>);
-        internalTaskLock=new2(MPMA::SpinLock(), MPMA::SpinLock);
+
+        taskSchedulerEnding=false;
+        taskSleepingWorkers=0;
+        taskWorkerCount=MPMA::SystemInfo::ProcessorCount;
+        taskNodeCount=1;
+
+#ifdef TASK_PIN_WORKERS_TO_CORES
+        //workers stay off the core reserved for audio, and get a queue per numa node
+        std::vector<nuint> reserved;
+        MPMA::GetReservedCoreProcessors(reserved);
+        if (!reserved.empty() && taskWorkerCount>1)
+            --taskWorkerCount;
+
+        if (!MPMA::SystemInfo::ProcessorLocations.empty())
+            taskNodeCount=MPMA::SystemInfo::NumaNodeCount;
+#endif
+
+        taskInjectedJobs=new2_array(TaskInjectionQueue, taskNodeCount, TaskInjectionQueue);
+        taskWorkers=new2_array(TaskWorker, taskWorkerCount, TaskWorker);
+        for (nuint i=0; i<taskWorkerCount; ++i)
+        {
+            taskWorkers[i].isSleeping=0;
+            taskWorkers[i].index=i;
+            taskWorkers[i].node=0;
+
+#ifdef TASK_PIN_WORKERS_TO_CORES
+            std::vector<nuint> processors;
+            MPMA::GetThreadAffinityProcessors(MPMA::THREAD_AFFINITY_PER_CORE, i, processors);
+            if (!processors.empty())
+                taskWorkers[i].node=MPMA::GetProcessorNumaNode(processors[0])%taskNodeCount;
+#endif
+        }
+
+        for (nuint i=0; i<taskWorkerCount; ++i)
+            internalTaskPool->RunThread(TaskWorkerProc, MPMA::ThreadParam(&taskWorkers[i]));
     }
     void ThreadedTaskShutdown()
     {
+        //stop the workers, and wait for them to return to the pool
+        taskSchedulerEnding=true;
+        for (nuint i=0; i<taskWorkerCount; ++i)
+            taskWorkers[i].wakeBlock.Clear();
+
         delete2(internalTaskPool);
         internalTaskPool=0;
 
-        for (std::list<MPMA::BlockingObject*>::iterator i=internalTaskBlocks->begin(); i!=internalTaskBlocks->end(); ++i)
-            delete2(*i);
-        delete2(internalTaskBlocks);
-        internalTaskBlocks=0;
+        delete2_array(taskWorkers);
+        taskWorkers=0;
+        taskWorkerCount=0;
 
-        delete2(internalTaskLock);
-        internalTaskLock=0;
+        delete2_array(taskInjectedJobs);
+        taskInjectedJobs=0;
+        taskNodeCount=1;
     }
-    
+
     class AutoInitThreadedTask
     {
     public:
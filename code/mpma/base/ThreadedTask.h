@@ -22,6 +22,81 @@ namespace MPMA
     */
     template <typename FuncType, FuncType userFunc, typename UserParamType>
     void ExecuteThreadedTask(nuint count, UserParamType userParam);
+
+    /*!\brief Calls func(i) for every i in [begin, end), in parallel using the task scheduler.
+    func may be any callable object (including a lambda), and will be called from multiple threads at once.  Indices are handed out in chunks that shrink near the end of the range to balance the load, but never below grain indices (0 lets it decide).  No heap allocation is done.
+    Example: \n
+    ParallelFor(0, vertexCount, 0, [&](sint64 i) { verts[i]*=scale; });
+    */
+    template <typename Func>
+    void ParallelFor(sint64 begin, sint64 end, sint64 grain, const Func &func);
+
+    //!\brief Reduces the range [begin, end) in parallel and returns the result.
+    //!Each participating thread starts from a copy of identity and accumulates indices into it by calling func(i, accumulator).  The per-thread results are then merged with combine(a, b), which must be associative and commutative.
+    template <typename T, typename Func, typename Combine>
+    T ParallelReduce(sint64 begin, sint64 end, sint64 grain, const T &identity, const Func &func, const Combine &combine);
+
+    //!\brief Computes an inclusive prefix scan of the range [begin, end) in parallel.
+    //!value(i) returns the element at i, and output(i, prefix) is called with the combination of value(begin) through value(i).  combine(a, b) must be associative.  value may be called twice for each index.  T must be default constructible.
+    template <typename T, typename ValueFunc, typename Combine, typename OutputFunc>
+    void ParallelScan(sint64 begin, sint64 end, sint64 grain, const T &identity, const ValueFunc &value, const Combine &combine, const OutputFunc &output);
+
+    // -- Task scheduler
+
+    class TaskGroup;
+
+    //!\brief A unit of work for the task scheduler.
+    //!The job is not copied when it is run, so it (and anything it refers to) must remain valid until the TaskGroup it was run with has finished waiting.  The same job may be run more than once in the same group, in which case func is called once per Run.
+    struct ThreadedTaskJob
+    {
+        //!The function that does the work.
+        void (*func)(ThreadedTaskJob &job);
+        //!User-defined parameter for func.
+        void *param;
+
+        //set by TaskGroup::Run
+        TaskGroup *group;
+
+        inline ThreadedTaskJob(): func(0), param(0), group(0) //!<ctor
+            {}
+        inline ThreadedTaskJob(void (*jobFunc)(ThreadedTaskJob&), void *jobParam): func(jobFunc), param(jobParam), group(0) //!<ctor
+            {}
+    };
+
+    //internal use: runs a job and marks it finished in its group
+    void Internal_ExecuteTaskJob(ThreadedTaskJob *job);
+
+    //internal use: runs a job on the calling thread and threadCount-1 other threads, and waits for all of them
+    void Internal_RunParallelJob(ThreadedTaskJob &job, nuint threadCount);
+
+    //!\brief Tracks the completion of a set of jobs that are run on the framework's work-stealing task scheduler.
+    //!Jobs may be run from any thread, including from inside another job.  A thread waiting on a group executes queued jobs while it waits instead of idling, so nested groups do not deadlock.
+    class TaskGroup
+    {
+    public:
+        TaskGroup();
+        //!Waits for all jobs in the group to finish.
+        ~TaskGroup();
+
+        //!Queues a job to be run by the scheduler.  If the scheduler is not running or its queues are full, the job is run immediately on the calling thread.
+        void Run(ThreadedTaskJob &job);
+
+        //!Blocks until every job run in this group has finished.  The calling thread helps execute queued jobs while it waits.
+        void Wait();
+
+    private:
+        //pending job count in the upper bits, low bit is set while a waiter is blocked on sleepBlock
+        volatile nuint state;
+        BlockingObject *volatile sleepBlock;
+
+        void JobFinished();
+
+        friend void Internal_ExecuteTaskJob(ThreadedTaskJob *job);
+
+        //you cannot duplicate this
+        TaskGroup(const TaskGroup&);
+        const TaskGroup& operator=(const TaskGroup&);
+    };
 }
 
 #ifndef THREADEDTASK_INCLUDE_INLINE
@@ -0,0 +1,174 @@
+//class for measuring time passed with a high degree of precision (sub ms level)
+//See /docs/License.txt for details on how this code may be used.
+
+#include "Timer.h"
+#include "Atomic.h"
+#include "Thread.h"
+
+namespace
+{
+    //a time stamp counter reading and a system clock reading taken at the same moment
+    struct ClockPair
+    {
+        uint64 tsc;
+        uint64 system;
+    };
+
+    volatile nuint pickingClock=0;
+
+    //ticks in a second of the clock that was picked.  Set before the clock is.
+    uint64 tickFrequency=0;
+
+#ifdef MPMA_TIMER_TSC
+    //how long the time stamp counter's rate is measured for, in seconds
+    const double CALIBRATION_TIME=0.02;
+
+    //reads both clocks, taking the time stamp counter on either side of the system clock so the pair is as close as it can be
+    ClockPair ReadClockPair()
+    {
+        ClockPair best={0, 0};
+        uint64 bestWindow=~(uint64)0;
+        for (int i=0; i<5; ++i)
+        {
+            uint64 before=__rdtsc();
+            uint64 system=MPMA::Internal_GetSystemClockTicks();
+            uint64 after=__rdtsc();
+            if (after-before<bestWindow)
+            {
+                bestWindow=after-before;
+                best.tsc=before+(after-before)/2;
+                best.system=system;
+            }
+        }
+        return best;
+    }
+
+    //measures the time stamp counter's rate against the system clock
+    uint64 CalibrateTsc()
+    {
+        uint64 systemFrequency=MPMA::Internal_GetSystemClockFrequency();
+        ClockPair start=ReadClockPair();
+        ClockPair end=start;
+        while (end.system-start.system<(uint64)(CALIBRATION_TIME*systemFrequency))
+        {
+            MPMA::Sleep(1);
+            end=ReadClockPair();
+        }
+
+        return (uint64)((double)(end.tsc-start.tsc)*(double)systemFrequency/(double)(end.system-start.system)+0.5);
+    }
+#endif
+
+    //picks the clock to use, if another thread hasn't already
+    nuint PickClock()
+    {
+        nuint expected=0;
+        if (MPMA::AtomicCompareAndSwap(&pickingClock, expected, (nuint)1, MPMA::MEMORY_ORDER_ACQUIRE))
+        {
+            MPMA::ClockSource source=MPMA::CLOCK_SOURCE_SYSTEM;
+            tickFrequency=MPMA::Internal_GetSystemClockFrequency();
+#ifdef MPMA_TIMER_TSC
+            if (MPMA::Internal_IsTscReliable())
+            {
+                source=MPMA::CLOCK_SOURCE_TSC;
+                tickFrequency=CalibrateTsc();
+            }
+#endif
+            MPMA::AtomicStore(&MPMA::Internal_timerClock, (nuint)(1+source), MPMA::MEMORY_ORDER_RELEASE);
+        }
+
+        nuint clock;
+        while ((clock=MPMA::AtomicLoad(&MPMA::Internal_timerClock, MPMA::MEMORY_ORDER_ACQUIRE))==0)
+            {}
+        return clock;
+    }
+
+    inline MPMA::ClockSource CurrentClock()
+    {
+        nuint clock=MPMA::AtomicLoad(&MPMA::Internal_timerClock, MPMA::MEMORY_ORDER_ACQUIRE);
+        if (clock==0)
+            clock=PickClock();
+        return (MPMA::ClockSource)(clock-1);
+    }
+}
+
+namespace MPMA
+{
+    volatile nuint Internal_timerClock=0;
+
+    //reads whichever clock isn't read inline
+    uint64 Internal_GetTicksSlow()
+    {
+#ifdef MPMA_TIMER_TSC
+        if (CurrentClock()==CLOCK_SOURCE_TSC)
+            return __rdtsc();
+#else
+        CurrentClock();
+#endif
+        return Internal_GetSystemClockTicks();
+    }
+
+    Timer::Timer()
+    {
+        lastTicks=GetTicks();
+    }
+
+    //Returns how much time has passed (in seconds) since the last call, or since construction if never.
+    double Timer::Step(bool updateStartTime)
+    {
+        uint64 curTicks=GetTicks();
+        double diff=(double)(curTicks-lastTicks)/(double)GetTickFrequency();
+        if (updateStartTime) lastTicks=curTicks;
+        return diff;
+    }
+
+    //Returns the number of ticks in a second.
+    uint64 Timer::GetTickFrequency()
+    {
+        CurrentClock(); //(which makes sure the frequency has been set)
+        return tickFrequency;
+    }
+
+    //Returns which clock is being read.
+    ClockSource Timer::GetClockSource()
+    {
+        return CurrentClock();
+    }
+
+    //Measures how long reading the clock takes, and how much it drifts from the system clock.
+    ClockInfo Timer::MeasureClock(double seconds)
+    {
+        ClockInfo info;
+        info.source=GetClockSource();
+        double systemFrequency=(double)Internal_GetSystemClockFrequency();
+
+        //read time, and that the clock never goes backwards
+        const nuint READS=100000;
+        info.backwardsReads=0;
+        uint64 previous=GetTicks();
+        uint64 systemStart=Internal_GetSystemClockTicks();
+        for (nuint i=0; i<READS; ++i)
+        {
+            uint64 ticks=GetTicks();
+            if (ticks<previous)
+                ++info.backwardsReads;
+            previous=ticks;
+        }
+        uint64 systemEnd=Internal_GetSystemClockTicks();
+        info.readTime=(double)(systemEnd-systemStart)/systemFrequency/READS;
+
+        //drift, against a clock that's independent of the one the time stamp counter was calibrated on
+        uint64 ticksStart=GetTicks();
+        uint64 referenceStart=Internal_GetReferenceClockNanoseconds();
+        while ((double)(Internal_GetReferenceClockNanoseconds()-referenceStart)<seconds*1.0e9)
+            Sleep(1);
+        uint64 ticksEnd=GetTicks();
+        uint64 referenceEnd=Internal_GetReferenceClockNanoseconds();
+
+        info.tickFrequency=(double)GetTickFrequency();
+        double clockTime=(double)(ticksEnd-ticksStart)/info.tickFrequency;
+        double referenceTime=(double)(referenceEnd-referenceStart)/1.0e9;
+        info.drift=(clockTime/referenceTime-1.0)*1000000.0;
+        return info;
+    }
+}
@@ -1,34 +1,93 @@
 //!\file Timer.h A class for measuring time passed with a high degree of precision (sub ms level).
+//!Where the cpu has a time stamp counter that runs at a constant rate (and TIMER_USE_TSC is defined), it is read directly, which takes only a few nanoseconds.  Otherwise the system's monotonic clock is used (CLOCK_MONOTONIC_RAW on linux, QueryPerformanceCounter on windows).
 //Luke Lenhart, 2007
 //See /docs/License.txt for details on how this code may be used.
 
 #pragma once
 
-#if defined(_WIN32) || defined(_WIN64)
-    //windows.h drags too much in and causes conflicts, so moved to .cpp
-    #include "Types.h"
-#else
-    #include <sys/time.h>
+#include "Types.h"
+#include "../Config.h"
+
+#if defined(TIMER_USE_TSC) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+    #define MPMA_TIMER_TSC
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <x86intrin.h>
+    #endif
 #endif
 
 namespace MPMA
 {
+    //!Which clock Timer reads.
+    enum ClockSource
+    {
+        CLOCK_SOURCE_TSC, //!<The cpu's time stamp counter.
+        CLOCK_SOURCE_SYSTEM //!<The operating system's monotonic clock.
+    };
+
+    //!What MeasureClock found out about the clock.
+    struct ClockInfo
+    {
+        ClockSource source; //!<Which clock is being read.
+        double tickFrequency; //!<Ticks in a second.
+        double readTime; //!<Seconds that a call to GetTicks takes, on average.
+        double drift; //!<How far the clock ran from a clock that is kept in step with real time by the operating system (CLOCK_MONOTONIC on linux, the system time on windows) while it was measured, in parts per million.  Positive if it ran fast.  This includes both how far off the time stamp counter's measured rate is, and how far the hardware's own oscillator is off.
+        nuint backwardsReads; //!<Number of reads that returned less than the read before (out of 100000 in a row on one thread).  This should always be 0.
+    };
+
+    //internal use: 0 until the clock is picked, then 1+ClockSource
+    extern volatile nuint Internal_timerClock;
+
+    //internal use: picks the clock the first time it's called, then reads whichever clock isn't read inline
+    uint64 Internal_GetTicksSlow();
+
     //!A timer.
     class Timer
     {
     public:
         Timer();
-        
+
         //!Returns how much time has passed (in seconds) since the last call, or since construction if never.
         double Step(bool updateStartTime=true);
-        
+
+        //!Returns a timestamp in units of GetTickFrequency.  This is cheaper than a Timer for timing many short sections of code, since turning ticks into seconds can be left until later.
+        static inline uint64 GetTicks()
+        {
+#ifdef MPMA_TIMER_TSC
+            if (Internal_timerClock==1+CLOCK_SOURCE_TSC)
+                return __rdtsc();
+#endif
+            return Internal_GetTicksSlow();
+        }
+
+        //!Returns the number of ticks in a second.  When the time stamp counter is used, its rate is measured against the system clock once, when the clock is first used (by any of Timer's functions), which waits about 20ms.
+        static uint64 GetTickFrequency();
+
+        //!Returns a number of ticks in seconds.
+        static inline double TicksToSeconds(uint64 ticks) { return (double)ticks/(double)GetTickFrequency(); }
+
+        //!Returns which clock is being read.
+        static ClockSource GetClockSource();
+
+        //!Measures how long reading the clock takes, whether it ever goes backwards, and how much it drifts from real time over the given number of seconds (which this waits for).
+        static ClockInfo MeasureClock(double seconds=0.25);
+
     private:
-        #if defined(_WIN32) || defined(_WIN64)
-            uint64 lastTime64;
-        #else
-            timeval lastTime;
-        #endif
-    
+        uint64 lastTicks;
     };
-}
 
+    // -- platform-specific, internal use
+
+    //reads the system's monotonic clock
+    uint64 Internal_GetSystemClockTicks();
+
+    //ticks in a second of Internal_GetSystemClockTicks
+    uint64 Internal_GetSystemClockFrequency();
+
+    //whether the time stamp counter runs at a constant rate, and is kept in step between cpus
+    bool Internal_IsTscReliable();
+
+    //reads a clock that the operating system keeps in step with real time (which may be slewed to do so), in nanoseconds
+    uint64 Internal_GetReferenceClockNanoseconds();
+}
@@ -0,0 +1,33 @@
+//Huge page allocation used by Arena.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "../Arena.h"
+#include <sys/mman.h>
+
+namespace MPMA
+{
+    //allocates memory backed by huge pages directly from the OS.  Returns 0 on failure.
+    void* Internal_AllocHugePages(nuint size)
+    {
+#ifdef MAP_HUGETLB
+        //pages reserved for hugetlbfs, if the system has any set aside
+        void *mem=mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        if (mem!=MAP_FAILED)
+            return mem;
+#endif
+
+        //otherwise ask for transparent huge pages, which the kernel may or may not give us
+        void *normal=mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (normal==MAP_FAILED)
+            return 0;
+#ifdef MADV_HUGEPAGE
+        madvise(normal, size, MADV_HUGEPAGE);
+#endif
+        return normal;
+    }
+
+    void Internal_FreeHugePages(void *mem, nuint size)
+    {
+        munmap(mem, size);
+    }
+}
@@ -0,0 +1,88 @@
+//Atomic operations with explicit memory ordering, using gcc's __atomic builtins
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+namespace MPMA
+{
+    //converts our memory order to gcc's.  When inlined with a constant order this is resolved at compile time.
+    inline int Internal_GccMemoryOrder(MemoryOrder order)
+    {
+        switch (order)
+        {
+            case MEMORY_ORDER_RELAXED: return __ATOMIC_RELAXED;
+            case MEMORY_ORDER_ACQUIRE: return __ATOMIC_ACQUIRE;
+            case MEMORY_ORDER_RELEASE: return __ATOMIC_RELEASE;
+            case MEMORY_ORDER_ACQ_REL: return __ATOMIC_ACQ_REL;
+            default: return __ATOMIC_SEQ_CST;
+        }
+    }
+
+    //the order a failed compare-and-swap uses, which may not be release
+    inline int Internal_GccFailureMemoryOrder(MemoryOrder order)
+    {
+        switch (order)
+        {
+            case MEMORY_ORDER_ACQUIRE: case MEMORY_ORDER_ACQ_REL: return __ATOMIC_ACQUIRE;
+            case MEMORY_ORDER_SEQ_CST: return __ATOMIC_SEQ_CST;
+            default: return __ATOMIC_RELAXED;
+        }
+    }
+
+    template <typename T> inline T AtomicLoad(const volatile T *p, MemoryOrder order)
+        { return __atomic_load_n(p, Internal_GccMemoryOrder(order)); }
+
+    template <typename T> inline void AtomicStore(volatile T *p, T value, MemoryOrder order)
+        { __atomic_store_n(p, value, Internal_GccMemoryOrder(order)); }
+
+    template <typename T> inline T AtomicExchange(volatile T *p, T value, MemoryOrder order)
+        { return __atomic_exchange_n(p, value, Internal_GccMemoryOrder(order)); }
+
+    template <typename T> inline T AtomicFetchAdd(volatile T *p, T value, MemoryOrder order)
+        { return __atomic_fetch_add(p, value, Internal_GccMemoryOrder(order)); }
+
+    template <typename T> inline T AtomicFetchSub(volatile T *p, T value, MemoryOrder order)
+        { return __atomic_fetch_sub(p, value, Internal_GccMemoryOrder(order)); }
+
+    template <typename T> inline T AtomicFetchOr(volatile T *p, T value, MemoryOrder order)
+        { return __atomic_fetch_or(p, value, Internal_GccMemoryOrder(order)); }
+
+    template <typename T> inline T AtomicFetchAnd(volatile T *p, T value, MemoryOrder order)
+        { return __atomic_fetch_and(p, value, Internal_GccMemoryOrder(order)); }
+
+    template <typename T> inline bool AtomicCompareAndSwap(volatile T *p, T &expected, T desired, MemoryOrder order)
+        { return __atomic_compare_exchange_n(p, &expected, desired, false, Internal_GccMemoryOrder(order), Internal_GccFailureMemoryOrder(order)); }
+
+    inline void AtomicThreadFence(MemoryOrder order)
+        { __atomic_thread_fence(Internal_GccMemoryOrder(order)); }
+
+    inline bool AtomicCompareAndSwapDoubleWord(volatile AtomicDoubleWord *p, AtomicDoubleWord &expected, const AtomicDoubleWord &desired)
+    {
+#if defined(__x86_64__)
+        //gcc only emits cmpxchg16b itself with -mcx16, and otherwise calls into libatomic
+        bool changed;
+        asm volatile("lock cmpxchg16b %1"
+                     : "=@ccz"(changed), "+m"(*p), "+a"(expected.low), "+d"(expected.high)
+                     : "b"(desired.low), "c"(desired.high)
+                     : "memory");
+        return changed;
+#elif defined(__i386__) || defined(__arm__)
+        uint64 expect=((uint64)expected.high<<32)|expected.low;
+        uint64 found=__sync_val_compare_and_swap((volatile uint64*)p, expect, ((uint64)desired.high<<32)|desired.low);
+        if (found==expect)
+            return true;
+        expected.low=(nuint)found;
+        expected.high=(nuint)(found>>32);
+        return false;
+#else
+        unsigned __int128 expect=((unsigned __int128)expected.high<<64)|expected.low;
+        unsigned __int128 found=__sync_val_compare_and_swap((volatile unsigned __int128*)p, expect, ((unsigned __int128)desired.high<<64)|desired.low);
+        if (found==expect)
+            return true;
+        expected.low=(nuint)found;
+        expected.high=(nuint)(found>>64);
+        return false;
+#endif
+    }
+
+}; //namespace MPMA
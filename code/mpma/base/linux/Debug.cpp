@@ -6,7 +6,9 @@
 #include "../MiscStuff.h"
 #include <execinfo.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <cxxabi.h>
+#include <dlfcn.h>
 
 namespace MPMA
 {
@@ -68,4 +70,49 @@ namespace MPMA
         return str;
     }
 #endif
+
+    //fills frames with the return addresses on the current thread's stack, starting with the caller
+    nuint GetRawCallStack(void **frames, nuint maxFrames)
+    {
+        void *traceList[129];
+        if (maxFrames>128)
+            maxFrames=128;
+
+        int listCount=backtrace(traceList, (int)maxFrames+1);
+        if (listCount<=1)
+            return 0;
+
+        for (int i=1; i<listCount; ++i)
+            frames[i-1]=traceList[i];
+        return (nuint)(listCount-1);
+    }
+
+    //returns the name of the function that contains a code address
+    std::string GetCodeAddressName(void *address)
+    {
+        char hex[32];
+        sprintf(hex, "%p", address);
+
+        //only exported symbols can be found this way, so link with -rdynamic to see everything
+        Dl_info info={};
+        bool found=(dladdr(address, &info)!=0);
+        if (!found || !info.dli_sname)
+        {
+            if (found && info.dli_fname)
+            {
+                std::string file=info.dli_fname;
+                return file.substr(file.find_last_of('/')+1)+"+"+hex;
+            }
+            return hex;
+        }
+
+        int status=0;
+        char *demangled=abi::__cxa_demangle(info.dli_sname, 0, 0, &status);
+        if (!demangled)
+            return info.dli_sname;
+
+        std::string name=demangled;
+        free(demangled);
+        return name;
+    }
 }
@@ -6,12 +6,167 @@
 #include "../Vary.h"
 
 #include <map>
+#include <algorithm>
+
+namespace
+{
+    //parses a list of numbers like "0-3,8,10-11", as used by sysfs
+    void ParseSysList(const std::string &list, std::vector<nuint> &outNumbers)
+    {
+        std::vector<std::string> ranges;
+        MISC::ExplodeString(MISC::StripPadding(list), ranges, ",");
+        for (std::vector<std::string>::iterator r=ranges.begin(); r!=ranges.end(); ++r)
+        {
+            std::string::size_type dash=r->find('-');
+            if (dash==std::string::npos)
+                outNumbers.push_back((nuint)(sint64)MPMA::Vary(*r));
+            else
+            {
+                nuint first=(nuint)(sint64)MPMA::Vary(r->substr(0, dash));
+                nuint last=(nuint)(sint64)MPMA::Vary(r->substr(dash+1));
+                for (nuint n=first; n<=last; ++n)
+                    outNumbers.push_back(n);
+            }
+        }
+    }
+
+    //reads a single number from a sysfs file, returns false if it's not there
+    bool ReadSysNumber(const std::string &path, sint64 &outValue)
+    {
+        std::string val=MISC::StripPadding(MISC::ReadFile(path));
+        if (val.empty())
+            return false;
+
+        outValue=MPMA::Vary(val);
+        return true;
+    }
+
+    //reads a cache size from sysfs (like "32K"), in KB
+    nuint ReadSysCacheSize(const std::string &path)
+    {
+        std::string val=MISC::StripPadding(MISC::ReadFile(path));
+        if (val.empty())
+            return 0;
+
+        nuint size=(nuint)(sint64)MPMA::Vary(val.substr(0, val.find_first_not_of("0123456789")));
+        if (val[val.length()-1]=='M')
+            size*=1024;
+        else if (val[val.length()-1]!='K')
+            size/=1024;
+        return size;
+    }
+
+    //fills in the topology info from /sys/devices/system
+    void InitTopology()
+    {
+        using MPMA::SystemInfo;
+        using MPMA::ProcessorLocation;
+
+        std::vector<nuint> cpus;
+        ParseSysList(MISC::ReadFile("/sys/devices/system/cpu/online"), cpus);
+        if (cpus.empty())
+            return;
+
+        //find which socket and core each cpu is
+        std::map<sint64, nuint> socketIndices;
+        std::map<std::pair<sint64, sint64>, nuint> coreIndices;
+        std::map<nuint, nuint> threadsInCore;
+        std::vector<ProcessorLocation> locations;
+        for (std::vector<nuint>::iterator cpu=cpus.begin(); cpu!=cpus.end(); ++cpu)
+        {
+            std::string path="/sys/devices/system/cpu/cpu"+(std::string)MPMA::VaryString(*cpu)+"/topology/";
+            sint64 package=0;
+            sint64 coreId=(sint64)*cpu;
+            ReadSysNumber(path+"physical_package_id", package);
+            ReadSysNumber(path+"core_id", coreId);
+
+            ProcessorLocation loc;
+            loc.logicalId=*cpu;
+
+            //(the size is read first, since it's unspecified whether operator[] inserts before or after it is read before c++17)
+            if (socketIndices.find(package)==socketIndices.end())
+            {
+                nuint socket=socketIndices.size();
+                socketIndices[package]=socket;
+            }
+            loc.socket=socketIndices[package];
+
+            std::pair<sint64, sint64> coreKey(package, coreId);
+            if (coreIndices.find(coreKey)==coreIndices.end())
+            {
+                nuint core=coreIndices.size();
+                coreIndices[coreKey]=core;
+            }
+            loc.core=coreIndices[coreKey];
+
+            loc.smtIndex=threadsInCore[loc.core]++;
+            loc.numaNode=0;
+            locations.push_back(loc);
+        }
+
+        //then which numa node they're on.  Nodes with only memory and no cpus are skipped.
+        nuint nodeCount=0;
+        std::vector<nuint> nodes;
+        ParseSysList(MISC::ReadFile("/sys/devices/system/node/online"), nodes);
+        for (std::vector<nuint>::iterator node=nodes.begin(); node!=nodes.end(); ++node)
+        {
+            std::vector<nuint> nodeCpus;
+            ParseSysList(MISC::ReadFile("/sys/devices/system/node/node"+(std::string)MPMA::VaryString(*node)+"/cpulist"), nodeCpus);
+            if (nodeCpus.empty())
+                continue;
+
+            for (std::vector<ProcessorLocation>::iterator loc=locations.begin(); loc!=locations.end(); ++loc)
+            {
+                if (std::find(nodeCpus.begin(), nodeCpus.end(), loc->logicalId)!=nodeCpus.end())
+                    loc->numaNode=nodeCount;
+            }
+            ++nodeCount;
+        }
+
+        std::sort(locations.begin(), locations.end(), [](const ProcessorLocation &a, const ProcessorLocation &b)
+            { return a.core<b.core || (a.core==b.core && a.smtIndex<b.smtIndex); });
+
+        SystemInfo::ProcessorLocations=locations;
+        SystemInfo::ProcessorLogicalCount=locations.size();
+        SystemInfo::ProcessorCoreCount=coreIndices.size();
+        SystemInfo::ProcessorSocketCount=socketIndices.size();
+        SystemInfo::NumaNodeCount=nodeCount>0 ? nodeCount : 1;
+
+        //caches, as seen by the first cpu
+        for (nuint index=0; ; ++index)
+        {
+            std::string path="/sys/devices/system/cpu/cpu"+(std::string)MPMA::VaryString(cpus[0])+"/cache/index"+(std::string)MPMA::VaryString(index)+"/";
+            sint64 level=0;
+            if (!ReadSysNumber(path+"level", level))
+                break;
+
+            std::string type=MISC::StripPadding(MISC::ReadFile(path+"type"));
+            nuint size=ReadSysCacheSize(path+"size");
+            if (size==0)
+                continue;
+
+            if (level==1 && type=="Data")
+            {
+                SystemInfo::CacheL1DataSize=size;
+
+                sint64 lineSize=0;
+                if (ReadSysNumber(path+"coherency_line_size", lineSize) && lineSize>0)
+                    SystemInfo::CacheLineSize=(nuint)lineSize;
+            }
+            else if (level==2)
+                SystemInfo::CacheL2Size=size;
+            else if (level==3)
+                SystemInfo::CacheL3Size=size;
+        }
+    }
+}
 
 namespace MPMA
 {
     void Internal_InitInfo()
     {
         // -- Populate cpu info
+        bool cpuCountParsed=false;
         std::string cpuinfo=MISC::ReadFile("/proc/cpuinfo");
         if (cpuinfo.empty()) //proc not mounted...?
         {
@@ -72,6 +227,7 @@ namespace MPMA
 
                 if (cpuCount>0)
                 {
+                    cpuCountParsed=true;
                     SystemInfo::ProcessorCount=cpuCount;
                     SystemInfo::ProcessorHyperthreading=(cpuCount!=siblingCount);
                 }
@@ -81,6 +237,14 @@ namespace MPMA
                 SystemInfo::ProcessorName="Could not parse /proc/cpuinfo";
         }
 
+        // -- Populate topology info, and use it for the counts if cpuinfo didn't have them (it doesn't on most arm systems)
+        InitTopology();
+        if (!cpuCountParsed && SystemInfo::ProcessorCoreCount>0)
+        {
+            SystemInfo::ProcessorCount=SystemInfo::ProcessorCoreCount;
+            SystemInfo::ProcessorHyperthreading=(SystemInfo::ProcessorCoreCount!=SystemInfo::ProcessorLogicalCount);
+        }
+
         // -- Populate memory information
         std::string meminfo=MISC::ReadFile("/proc/meminfo");
         if (!meminfo.empty())
@@ -6,89 +6,44 @@
 #include "../Memory.h"
 #include <errno.h>
 #include <time.h>
-
-#include <iostream> //debug
-
-// -- mutex setup
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 namespace MPMA
 {
 
-MutexLock::MutexLock()
-{
-    pthread_mutexattr_t mutexattr;
-    int ret=pthread_mutexattr_init(&mutexattr);
-    if (ret!=0)
-        std::cout<<"pthread_mutexattr_init returned "<<ret<<"\n";
-
-    ret=pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_RECURSIVE_NP);
-    if (ret!=0)
-        std::cout<<"pthread_mutexattr_settype returned "<<ret<<"\n";
-
-    pthread_mutex_t *m;
-    m=new2(pthread_mutex_t, pthread_mutex_t);
+// -- futex
 
-    ret=pthread_mutex_init(m, &mutexattr);
-    if (ret!=0)
-        std::cout<<"pthread_mutex_init returned "<<ret<<"\n";
-
-    ret=pthread_mutexattr_destroy(&mutexattr);
-    if (ret!=0)
-        std::cout<<"pthread_mutexattr_destroy returned "<<ret<<"\n";
-
-    Data().crit=m;
-}
-
-MutexLock::~MutexLock()
+//blocks the calling thread for as long as *address is equal to expectedValue
+void Internal_FutexWait(volatile uint32 *address, uint32 expectedValue)
 {
-    if (IsOnlyReference())
-    {
-        pthread_mutex_t* theCrit=(pthread_mutex_t*)Data().crit;
-        pthread_mutex_destroy(theCrit);
-
-        delete2(theCrit);
-        Data().crit=0;
-    }
+    syscall(SYS_futex, (uint32*)address, FUTEX_WAIT_PRIVATE, expectedValue, 0, 0, 0);
 }
 
-
-// -- mutex use
-
-TakeMutexLock::TakeMutexLock(MutexLock &critSection, bool takeNow):
-    crit(critSection), taken(false)
+//wakes one thread blocked in Internal_FutexWait on address
+void Internal_FutexWakeOne(volatile uint32 *address)
 {
-    if (takeNow)
-        Take();
+    syscall(SYS_futex, (uint32*)address, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
 }
 
-TakeMutexLock::~TakeMutexLock()
+//wakes all threads blocked in Internal_FutexWait on address
+void Internal_FutexWakeAll(volatile uint32 *address)
 {
-    Leave();
+    syscall(SYS_futex, (uint32*)address, FUTEX_WAKE_PRIVATE, 0x7fffffff, 0, 0, 0);
 }
 
-//Manually takes the lock.
-void TakeMutexLock::Take()
-{
-    if (!taken)
-    {
-        int ret=pthread_mutex_lock((pthread_mutex_t*)crit.Data().crit);
-        if (ret!=0)
-            std::cout<<"pthread_mutex_lock failed with "<<ret<<"\n";
-    }
-    taken=true;
-}
+#ifdef LOCK_CONTENTION_STATS
+// -- lock statistics
 
-//Manually releases the lock.
-void TakeMutexLock::Leave()
+//the current time in nanoseconds
+uint64 Internal_LockStatsTime()
 {
-    if (taken)
-    {
-        int ret=pthread_mutex_unlock((pthread_mutex_t*)crit.Data().crit);
-        if (ret!=0)
-            std::cout<<"pthread_mutex_unlock failed with "<<ret<<"\n";
-    }
-    taken=false;
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64)now.tv_sec*1000000000ull+(uint64)now.tv_nsec;
 }
+#endif
 
 
 // -- BlockingObject
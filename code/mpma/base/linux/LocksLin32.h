@@ -82,4 +82,45 @@ namespace MPMA
 #endif
     }
 
+    //Atomically adds one 32 bit integer to another and returns the value of the original
+    inline uint32 AtomicInt32Add(volatile uint32 *pint, uint32 addValue)
+    {
+        return __sync_fetch_and_add(pint, addValue);
+    }
+
+    //Atomically sets a 32 bit integer to newValue and returns the value it had before
+    inline uint32 AtomicInt32Exchange(volatile uint32 *pint, uint32 newValue)
+    {
+        __sync_synchronize(); //test_and_set is only an acquire barrier
+        return __sync_lock_test_and_set(pint, newValue);
+    }
+
+    //Same as AtomicCompareExchange, but for a 32 bit integer
+    inline bool AtomicInt32CompareExchange(volatile uint32 *pInt, uint32 expectedValue, uint32 newValue, volatile uint32 &outResultValue)
+    {
+        uint32 ret=__sync_val_compare_and_swap(pInt, expectedValue, newValue);
+        if (ret==expectedValue)
+        {
+            outResultValue=newValue;
+            return true;
+        }
+        else
+        {
+            outResultValue=ret;
+            return false;
+        }
+    }
+
+    //Hints to the cpu that the calling thread is in a spin-wait loop
+    inline void CpuPause()
+    {
+#if defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield" ::: "memory");
+#else
+        asm volatile("" ::: "memory");
+#endif
+    }
+
 }; //namespace MPMA
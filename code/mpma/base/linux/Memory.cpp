@@ -0,0 +1,41 @@
+//Guard page allocation used by the memory manager.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "../Memory.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef MEMMAN_TRACING
+
+namespace MPMA
+{
+    nuint Internal_GetPageSize()
+    {
+        static nuint pageSize=(nuint)sysconf(_SC_PAGESIZE);
+        return pageSize;
+    }
+
+    //maps size bytes of memory followed by a page that can't be touched.  Returns 0 on failure.
+    void* Internal_AllocGuardedPages(nuint size)
+    {
+        nuint pageSize=Internal_GetPageSize();
+        uint8 *mem=(uint8*)mmap(0, size+pageSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (mem==MAP_FAILED)
+            return 0;
+
+        if (mprotect(mem+size, pageSize, PROT_NONE)!=0)
+        {
+            munmap(mem, size+pageSize);
+            return 0;
+        }
+
+        return mem;
+    }
+
+    void Internal_FreeGuardedPages(void *mem, nuint size)
+    {
+        munmap(mem, size+Internal_GetPageSize());
+    }
+}
+
+#endif //MEMMAN_TRACING
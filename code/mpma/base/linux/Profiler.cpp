@@ -0,0 +1,103 @@
+//Hardware performance counters used by the profiler.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "../Profiler.h"
+
+#if defined(TIMEPROFILE_ENABLED) && defined(TIMEPROFILE_HARDWARE_COUNTERS)
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+
+namespace
+{
+    //the events for each of the profiler's counters, in the same order
+    const uint64 counterEvents[MPMA::Internal_PROFILE_COUNTER_COUNT]=
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    int OpenCounter(uint64 event, int groupFd)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size=sizeof(attr);
+        attr.type=PERF_TYPE_HARDWARE;
+        attr.config=event;
+        attr.exclude_kernel=1; //allowed without privileges, and the kernel's time isn't what's being profiled
+        attr.exclude_hv=1;
+        attr.read_format=PERF_FORMAT_GROUP|PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING; //(the times are needed to scale the values when the kernel shares the counters between more events than fit)
+
+        //the calling thread, on any cpu
+        return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+    }
+}
+
+namespace MPMA
+{
+    //opens the calling thread's counters as one group, so they can all be read at once
+    bool Internal_OpenProfileCounters(Internal_ProfileCounters &counters)
+    {
+        memset(&counters, 0, sizeof(counters));
+
+        //cycles lead the group.  Without them nothing else is worth opening.
+        int leader=OpenCounter(counterEvents[0], -1);
+        if (leader<0)
+            return false;
+
+        counters.handle=leader;
+        counters.available[0]=true;
+        counters.openCount=1;
+        for (nuint i=1; i<Internal_PROFILE_COUNTER_COUNT; ++i)
+        {
+            int fd=OpenCounter(counterEvents[i], leader);
+            if (fd<0)
+                continue;
+
+            counters.members[i]=fd;
+            counters.available[i]=true;
+            ++counters.openCount;
+        }
+
+        return true;
+    }
+
+    //reads the current value of every counter
+    bool Internal_ReadProfileCounters(const Internal_ProfileCounters &counters, Internal_ProfileCounterReading &outReading)
+    {
+        //the number of counters, the time the group was enabled and the time it was actually counting, followed by the value of each that was opened, in the order they were opened
+        const nuint HEADER=3;
+        uint64 buffer[HEADER+Internal_PROFILE_COUNTER_COUNT];
+        ssize_t bytes=read((int)counters.handle, buffer, sizeof(uint64)*(HEADER+counters.openCount));
+        if (bytes!=(ssize_t)(sizeof(uint64)*(HEADER+counters.openCount)) || buffer[0]!=counters.openCount)
+            return false;
+
+        outReading.timeEnabled=buffer[1];
+        outReading.timeRunning=buffer[2];
+
+        nuint next=HEADER;
+        for (nuint i=0; i<Internal_PROFILE_COUNTER_COUNT; ++i)
+            outReading.values[i]=counters.available[i] ? buffer[next++] : 0;
+        return true;
+    }
+
+    //closes the calling thread's counters
+    void Internal_CloseProfileCounters(Internal_ProfileCounters &counters)
+    {
+        for (nuint i=1; i<Internal_PROFILE_COUNTER_COUNT; ++i)
+        {
+            if (counters.available[i])
+                close((int)counters.members[i]);
+        }
+        if (counters.available[0])
+            close((int)counters.handle);
+
+        memset(&counters, 0, sizeof(counters));
+    }
+}
+
+#endif
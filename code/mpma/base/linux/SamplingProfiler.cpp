@@ -0,0 +1,427 @@
+//Signals and timers used by the sampling profiler.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "../SamplingProfiler.h"
+
+#ifdef SAMPLING_PROFILER
+
+#include "../Atomic.h"
+#include "../Locks.h"
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#ifndef sigev_notify_thread_id
+    #define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace
+{
+    //samples recorded on one thread by the signal handler, and collected by another thread.  Only the signal handler writes samples and written, and only the collector writes read.
+    struct SampleBuffer
+    {
+        volatile nuint written; //samples ever written
+        volatile nuint read; //samples ever collected
+        volatile nuint dropped; //samples not written because the buffer was full
+        nuint depths[SAMPLING_PROFILER_BUFFER_SAMPLES];
+        void *frames[SAMPLING_PROFILER_BUFFER_SAMPLES][SAMPLING_PROFILER_MAX_FRAMES];
+    };
+
+    //a registered thread
+    struct SamplingThread
+    {
+        SamplingThread *next;
+        pthread_t thread;
+        pid_t tid;
+        nuint stackLow, stackHigh; //the range of the thread's stack, for following frame pointers
+        SampleBuffer *volatile buffer; //0 until sampling is first started while the thread is registered
+        timer_t timer;
+        bool hasTimer;
+    };
+
+    //everything the signal handler uses is set up before it could run on a thread, so it never allocates or takes a lock
+    THREAD_LOCAL SamplingThread *volatile currentThread=0;
+
+    MPMA::AdaptiveLock threadsLock;
+    SamplingThread *threads=0;
+    uint64 droppedFromRemoved=0; //dropped samples of threads that were removed
+
+    class TakeThreadsLock
+    {
+    public:
+        inline TakeThreadsLock() { threadsLock.Lock(); }
+        inline ~TakeThreadsLock() { threadsLock.Unlock(); }
+    };
+
+    volatile nuint samplingRate=0; //samples per second while running, 0 when stopped
+    bool handlerInstalled=false;
+    bool processTimer=false; //whether one timer for the whole process is used, because per-thread timers aren't available
+
+    // -- runs in the signal handler
+
+    //gets the address the thread was running at, and its frame pointer
+    inline void GetContextRegisters(void *context, nuint &outPc, nuint &outFp)
+    {
+        const ucontext_t *uc=(const ucontext_t*)context;
+#if defined(__x86_64__)
+        outPc=(nuint)uc->uc_mcontext.gregs[REG_RIP];
+        outFp=(nuint)uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__i386__)
+        outPc=(nuint)uc->uc_mcontext.gregs[REG_EIP];
+        outFp=(nuint)uc->uc_mcontext.gregs[REG_EBP];
+#elif defined(__aarch64__)
+        outPc=(nuint)uc->uc_mcontext.pc;
+        outFp=(nuint)uc->uc_mcontext.regs[29];
+#else
+        outPc=0;
+        outFp=0;
+#endif
+    }
+
+    //records the stack that was interrupted.  The first frame is the address being run plus one, so it can be looked up the same way as the return addresses after it (which point after their call).
+    nuint CaptureStack(SamplingThread &thread, void *context, void **frames)
+    {
+        nuint pc, fp;
+        GetContextRegisters(context, pc, fp);
+        if (!pc)
+            return 0;
+
+        frames[0]=(void*)(pc+1);
+        nuint depth=1;
+
+#ifdef SAMPLING_PROFILER_FRAME_POINTERS
+        //each frame starts with the caller's frame pointer followed by the return address.  Stop at anything that isn't further up this thread's stack.
+        while (depth<SAMPLING_PROFILER_MAX_FRAMES && fp>=thread.stackLow && fp+2*sizeof(void*)<=thread.stackHigh && (fp&(sizeof(void*)-1))==0)
+        {
+            void **frame=(void**)fp;
+            if (!frame[1])
+                break;
+            frames[depth++]=frame[1];
+
+            nuint next=(nuint)frame[0];
+            if (next<=fp)
+                break;
+            fp=next;
+        }
+#else
+        (void)thread; //only needed to bound the frame pointer walk
+
+        //the unwinder passes through the signal handler and the frame the kernel made for it, and then gives the address that was interrupted, which is where to start from
+        void *trace[SAMPLING_PROFILER_MAX_FRAMES+8];
+        int traceCount=backtrace(trace, SAMPLING_PROFILER_MAX_FRAMES+8);
+        for (int i=0; i<traceCount; ++i)
+        {
+            if ((nuint)trace[i]!=pc)
+                continue;
+
+            for (++i; i<traceCount && depth<SAMPLING_PROFILER_MAX_FRAMES; ++i)
+                frames[depth++]=trace[i];
+            break;
+        }
+#endif
+
+        return depth;
+    }
+
+    void SampleHandler(int, siginfo_t*, void *context)
+    {
+        int savedErrno=errno;
+
+        SamplingThread *thread=currentThread;
+        SampleBuffer *buffer=thread ? thread->buffer : 0;
+        if (buffer && MPMA::AtomicLoad(&samplingRate, MPMA::MEMORY_ORDER_RELAXED)!=0)
+        {
+            nuint written=buffer->written;
+            if (written-MPMA::AtomicLoad(&buffer->read, MPMA::MEMORY_ORDER_ACQUIRE)>=SAMPLING_PROFILER_BUFFER_SAMPLES)
+            {
+                MPMA::AtomicFetchAdd(&buffer->dropped, (nuint)1, MPMA::MEMORY_ORDER_RELAXED); //(a lock-free read-modify-write, which is safe in a signal handler and can't lose a count to the collector's exchange)
+            }
+            else
+            {
+                nuint slot=written%SAMPLING_PROFILER_BUFFER_SAMPLES;
+                buffer->depths[slot]=CaptureStack(*thread, context, buffer->frames[slot]);
+                MPMA::AtomicStore(&buffer->written, written+1, MPMA::MEMORY_ORDER_RELEASE);
+            }
+        }
+
+        errno=savedErrno;
+    }
+
+    // -- the rest do not
+
+    bool InstallHandler()
+    {
+        if (handlerInstalled)
+            return true;
+
+        //once installed it's never removed, since a signal could still be on its way after the timers are stopped
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction=SampleHandler;
+        action.sa_flags=SA_SIGINFO|SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGPROF, &action, 0)!=0)
+            return false;
+
+        handlerInstalled=true;
+        return true;
+    }
+
+    //the first call can load libraries and allocate, which must never happen inside the signal handler
+    void PrepareUnwinder()
+    {
+#ifndef SAMPLING_PROFILER_FRAME_POINTERS
+        void *trace[2];
+        backtrace(trace, 2);
+#endif
+    }
+
+    //gives a thread a buffer, if it doesn't have one.  The threads lock must be held.
+    bool AllocateBuffer(SamplingThread &thread)
+    {
+        if (thread.buffer)
+            return true;
+
+        SampleBuffer *buffer=(SampleBuffer*)calloc(1, sizeof(SampleBuffer));
+        if (!buffer)
+            return false;
+
+        MPMA::AtomicStore(&thread.buffer, buffer, MPMA::MEMORY_ORDER_RELEASE);
+        return true;
+    }
+
+    //starts a timer that measures the cpu time of one thread, and signals that thread.  The threads lock must be held.
+    bool StartThreadTimer(SamplingThread &thread, nuint rate)
+    {
+        if (!AllocateBuffer(thread))
+            return false;
+        if (processTimer || thread.hasTimer)
+            return true;
+
+        clockid_t clock;
+        if (pthread_getcpuclockid(thread.thread, &clock)!=0)
+            return false;
+
+        sigevent event;
+        memset(&event, 0, sizeof(event));
+        event.sigev_notify=SIGEV_THREAD_ID;
+        event.sigev_signo=SIGPROF;
+        event.sigev_notify_thread_id=thread.tid;
+        if (timer_create(clock, &event, &thread.timer)!=0)
+            return false;
+
+        itimerspec interval;
+        interval.it_interval.tv_sec=0;
+        interval.it_interval.tv_nsec=1000000000/rate;
+        interval.it_value=interval.it_interval;
+        if (timer_settime(thread.timer, 0, &interval, 0)!=0)
+        {
+            timer_delete(thread.timer);
+            return false;
+        }
+
+        thread.hasTimer=true;
+        return true;
+    }
+
+    //the threads lock must be held
+    void StopThreadTimer(SamplingThread &thread)
+    {
+        if (!thread.hasTimer)
+            return;
+
+        timer_delete(thread.timer);
+        thread.hasTimer=false;
+    }
+
+    //starts or stops the timer for the whole process, which signals whichever thread is using the cpu
+    bool SetProcessTimer(nuint rate)
+    {
+        itimerval interval;
+        interval.it_interval.tv_sec=0;
+        interval.it_interval.tv_usec=rate ? 1000000/rate : 0;
+        interval.it_value=interval.it_interval;
+        return setitimer(ITIMER_PROF, &interval, 0)==0;
+    }
+
+    //passes the samples in a thread's buffer to callback.  The threads lock must be held.
+    void DrainBuffer(SamplingThread &thread, MPMA::Internal_SamplingStackCallback callback)
+    {
+        SampleBuffer *buffer=thread.buffer;
+        if (!buffer)
+            return;
+
+        nuint written=MPMA::AtomicLoad(&buffer->written, MPMA::MEMORY_ORDER_ACQUIRE);
+        for (nuint r=buffer->read; r!=written; ++r)
+        {
+            nuint slot=r%SAMPLING_PROFILER_BUFFER_SAMPLES;
+            callback(buffer->frames[slot], buffer->depths[slot]);
+        }
+        MPMA::AtomicStore(&buffer->read, written, MPMA::MEMORY_ORDER_RELEASE);
+    }
+
+    //counts and clears the samples a thread has dropped.  The threads lock must be held.
+    uint64 TakeDropped(SamplingThread &thread)
+    {
+        SampleBuffer *buffer=thread.buffer;
+        if (!buffer)
+            return 0;
+
+        return MPMA::AtomicExchange(&buffer->dropped, (nuint)0, MPMA::MEMORY_ORDER_RELAXED);
+    }
+}
+
+namespace MPMA
+{
+    //installs the signal handler and starts a timer for every registered thread
+    bool Internal_StartSampling(nuint samplesPerSecond)
+    {
+        if (samplesPerSecond==0)
+            return false;
+        if (samplesPerSecond>1000000)
+            samplesPerSecond=1000000;
+
+        PrepareUnwinder();
+        if (!InstallHandler())
+            return false;
+
+        TakeThreadsLock takeLock;
+        AtomicStore(&samplingRate, samplesPerSecond, MEMORY_ORDER_RELEASE);
+
+        //one timer per thread counts each thread's own cpu time, so busy threads are sampled as often as they should be.  Older kernels without them get a timer for the process.
+        processTimer=false;
+        bool anyStarted=false;
+        for (SamplingThread *thread=threads; thread; thread=thread->next)
+        {
+            if (StartThreadTimer(*thread, samplesPerSecond))
+                anyStarted=true;
+        }
+
+        if (!anyStarted && threads)
+        {
+            processTimer=true;
+            for (SamplingThread *thread=threads; thread; thread=thread->next)
+                AllocateBuffer(*thread);
+            if (!SetProcessTimer(samplesPerSecond))
+            {
+                processTimer=false;
+                AtomicStore(&samplingRate, (nuint)0, MEMORY_ORDER_RELEASE);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    //stops every thread's timer
+    void Internal_StopSampling()
+    {
+        TakeThreadsLock takeLock;
+        AtomicStore(&samplingRate, (nuint)0, MEMORY_ORDER_RELEASE);
+
+        if (processTimer)
+        {
+            SetProcessTimer(0);
+            processTimer=false;
+        }
+
+        for (SamplingThread *thread=threads; thread; thread=thread->next)
+            StopThreadTimer(*thread);
+    }
+
+    //adds the calling thread to those that are sampled
+    void Internal_AddSamplingThread()
+    {
+        if (currentThread)
+            return;
+
+        SamplingThread *thread=(SamplingThread*)calloc(1, sizeof(SamplingThread));
+        if (!thread)
+            return;
+
+        thread->thread=pthread_self();
+        thread->tid=(pid_t)syscall(SYS_gettid);
+
+        pthread_attr_t attr;
+        if (pthread_getattr_np(thread->thread, &attr)==0)
+        {
+            void *stack=0;
+            size_t stackSize=0;
+            if (pthread_attr_getstack(&attr, &stack, &stackSize)==0)
+            {
+                thread->stackLow=(nuint)stack;
+                thread->stackHigh=(nuint)stack+stackSize;
+            }
+            pthread_attr_destroy(&attr);
+        }
+
+        TakeThreadsLock takeLock;
+        thread->next=threads;
+        threads=thread;
+
+        //the handler only reads it, so setting it here makes sure it's been allocated first
+        currentThread=thread;
+
+        nuint rate=AtomicLoad(&samplingRate, MEMORY_ORDER_RELAXED);
+        if (rate!=0)
+        {
+            PrepareUnwinder();
+            StartThreadTimer(*thread, rate);
+        }
+    }
+
+    //removes the calling thread, passing its remaining samples to callback
+    void Internal_RemoveSamplingThread(Internal_SamplingStackCallback callback)
+    {
+        SamplingThread *thread=currentThread;
+        if (!thread)
+            return;
+
+        //the handler runs on this thread, so once this is cleared it can't be using the buffer
+        currentThread=0;
+        AtomicThreadFence(MEMORY_ORDER_SEQ_CST);
+
+        TakeThreadsLock takeLock;
+        StopThreadTimer(*thread);
+
+        for (SamplingThread **t=&threads; *t; t=&(*t)->next)
+        {
+            if (*t==thread)
+            {
+                *t=thread->next;
+                break;
+            }
+        }
+
+        DrainBuffer(*thread, callback);
+        droppedFromRemoved+=TakeDropped(*thread);
+        free(thread->buffer);
+        free(thread);
+    }
+
+    //passes the samples in every thread's buffer to callback, and returns the number dropped since the last call
+    uint64 Internal_CollectSamples(Internal_SamplingStackCallback callback)
+    {
+        TakeThreadsLock takeLock;
+
+        uint64 dropped=droppedFromRemoved;
+        droppedFromRemoved=0;
+        for (SamplingThread *thread=threads; thread; thread=thread->next)
+        {
+            DrainBuffer(*thread, callback);
+            dropped+=TakeDropped(*thread);
+        }
+
+        return dropped;
+    }
+}
+
+#endif
@@ -0,0 +1,40 @@
+//Address space reservation used by the small object allocator.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "../SmallObjects.h"
+#include <sys/mman.h>
+#include <stdio.h>
+#include <unistd.h>
+
+namespace MPMA
+{
+    //reserves address space without using any memory.  Returns 0 on failure.
+    void* Internal_ReserveAddressSpace(nuint bytes)
+    {
+        void *mem=mmap(0, bytes, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if (mem==MAP_FAILED)
+            return 0;
+        return mem;
+    }
+
+    //makes part of reserved address space usable
+    bool Internal_CommitAddressSpace(void *mem, nuint bytes)
+    {
+        return mprotect(mem, bytes, PROT_READ|PROT_WRITE)==0;
+    }
+
+    //returns the memory the process is using that is resident in ram, or 0 if it isn't known
+    nuint Internal_GetResidentBytes()
+    {
+        FILE *f=fopen("/proc/self/statm", "r");
+        if (!f)
+            return 0;
+
+        unsigned long totalPages=0, residentPages=0;
+        bool read=fscanf(f, "%lu %lu", &totalPages, &residentPages)==2;
+        fclose(f);
+        if (!read)
+            return 0;
+        return (nuint)residentPages*(nuint)sysconf(_SC_PAGESIZE);
+    }
+}
@@ -4,7 +4,9 @@
 
 #include "../Thread.h"
 #include "../Memory.h"
+#include "../SamplingProfiler.h"
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 
 namespace MPMA
@@ -32,9 +34,17 @@ namespace MPMA
         {
             ThreadInfo &info=*(ThreadInfo*)ptrParam;
 
+#ifdef SAMPLING_PROFILER
+            Internal_SamplingProfilerThreadStarted();
+#endif
+
             //enter main procedure
             info.func(*info.ownerThread,*info.param);
 
+#ifdef SAMPLING_PROFILER
+            Internal_SamplingProfilerThreadEnded();
+#endif
+
             info.alive=false;
             return 0;
         }
@@ -140,8 +150,40 @@ namespace MPMA
         }
     }
 
+    //Restricts the thread to run only on the given logical processors.
+    bool Thread::SetProcessorAffinity(const std::vector<nuint> &logicalProcessors)
+    {
+        ThreadInfo *data=(ThreadInfo*)internal;
+        if (!data) return false;
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        if (logicalProcessors.empty()) //everything
+        {
+            for (nuint i=0; i<CPU_SETSIZE; ++i)
+                CPU_SET(i, &cpus);
+        }
+        else
+        {
+            for (std::vector<nuint>::const_iterator i=logicalProcessors.begin(); i!=logicalProcessors.end(); ++i)
+            {
+                if (*i<CPU_SETSIZE)
+                    CPU_SET(*i, &cpus);
+            }
+        }
+
+        return pthread_setaffinity_np(data->thread, sizeof(cpus), &cpus)==0;
+    }
+
     // -- Thread-related helpers
 
+    //Returns the logical processor the calling thread is running on right now.
+    nuint GetCurrentLogicalProcessor()
+    {
+        int cpu=sched_getcpu();
+        return cpu>=0 ? (nuint)cpu : 0;
+    }
+
     //Causes the current thread to give block for at least time (in ms)
     void Sleep(nuint time)
     {
@@ -1,27 +1,58 @@
-//class for measuring time passed with a high degree of precision (sub ms level)
+//the system clocks that Timer reads
 //Luke Lenhart, 2007
 //See /docs/License.txt for details on how this code may be used.
 
 #include "../Timer.h"
-#include <sys/time.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <cpuid.h>
+#endif
 
 namespace MPMA
 {
+    //reads the system's monotonic clock.  The raw clock isn't adjusted by ntp, so it keeps a steady rate.
+    uint64 Internal_GetSystemClockTicks()
+    {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+        return (uint64)now.tv_sec*1000000000ull+(uint64)now.tv_nsec;
+    }
 
-    Timer::Timer()
+    uint64 Internal_GetSystemClockFrequency()
     {
-        gettimeofday(&lastTime,0);
+        return 1000000000ull;
     }
 
-    //Returns how much time has passed (in seconds) since the last call, or since construction if never.
-    double Timer::Step(bool updateStartTime)
+    //unlike the raw clock, ntp keeps this one in step with real time
+    uint64 Internal_GetReferenceClockNanoseconds()
     {
-        timeval curTime;
-        gettimeofday(&curTime,0);
-        
-        double diff=(double)(curTime.tv_sec-lastTime.tv_sec) + (curTime.tv_usec-lastTime.tv_usec)/1000000.0;
-        if (updateStartTime) lastTime=curTime;
-        return diff;
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64)now.tv_sec*1000000000ull+(uint64)now.tv_nsec;
     }
 
+    //whether the time stamp counter runs at a constant rate, and is kept in step between cpus
+    bool Internal_IsTscReliable()
+    {
+        //the kernel checks that the counter is stable and in step between cpus before it uses it as its own clock, which is a better test than the cpu's flag (especially in virtual machines)
+        FILE *f=fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+        if (f)
+        {
+            char name[32]={0};
+            bool read=fgets(name, sizeof(name), f)!=0;
+            fclose(f);
+            if (read)
+                return strncmp(name, "tsc", 3)==0 && (name[3]=='\n' || name[3]==0);
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        //otherwise trust the invariant tsc flag
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) && eax>=0x80000007 && __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+            return (edx&(1<<8))!=0;
+#endif
+        return false;
+    }
 }
@@ -0,0 +1,29 @@
+//Huge page allocation used by Arena.
+//(filename is different to work around a msvc ide bug that prevented compilation)
+//See /docs/License.txt for details on how this code may be used.
+
+#include "../Arena.h"
+#include "evil_windows.h"
+
+namespace MPMA
+{
+    //allocates memory backed by huge pages directly from the OS.  Returns 0 on failure.
+    void* Internal_AllocHugePages(nuint size)
+    {
+        //large pages need the "lock pages in memory" privilege, so this usually falls through to normal pages
+        nuint largePage=(nuint)GetLargePageMinimum();
+        if (largePage!=0 && size%largePage==0)
+        {
+            void *mem=VirtualAlloc(0, size, MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (mem)
+                return mem;
+        }
+
+        return VirtualAlloc(0, size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+    }
+
+    void Internal_FreeHugePages(void *mem, nuint size)
+    {
+        VirtualFree(mem, 0, MEM_RELEASE);
+    }
+}
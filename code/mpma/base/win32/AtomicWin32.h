@@ -0,0 +1,152 @@
+//Atomic operations with explicit memory ordering, using msvc's intrinsics
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include <intrin.h>
+
+namespace MPMA
+{
+    //On x86 and x64 every locked instruction is a full barrier and plain loads/stores already have acquire/release semantics, so the orderings only have to stop the compiler from moving things.
+
+    //the intrinsics for each size of value.  The operations pick one of these from the size of T, so only the intrinsics that match T are ever compiled.
+    template <nuint Size> struct Internal_AtomicIntrinsics;
+
+    template <> struct Internal_AtomicIntrinsics<1>
+    {
+        typedef char Type;
+        template <typename T> static inline T Load(const volatile T *p) { return *p; }
+        template <typename T> static inline void Store(volatile T *p, T value) { *p=value; }
+        static inline char Exchange(volatile void *p, char value) { return _InterlockedExchange8((volatile char*)p, value); }
+        static inline char FetchAdd(volatile void *p, char value) { return _InterlockedExchangeAdd8((volatile char*)p, value); }
+        static inline char FetchOr(volatile void *p, char value) { return _InterlockedOr8((volatile char*)p, value); }
+        static inline char FetchAnd(volatile void *p, char value) { return _InterlockedAnd8((volatile char*)p, value); }
+        static inline char CompareExchange(volatile void *p, char desired, char expected) { return _InterlockedCompareExchange8((volatile char*)p, desired, expected); }
+    };
+
+    template <> struct Internal_AtomicIntrinsics<2>
+    {
+        typedef short Type;
+        template <typename T> static inline T Load(const volatile T *p) { return *p; }
+        template <typename T> static inline void Store(volatile T *p, T value) { *p=value; }
+        static inline short Exchange(volatile void *p, short value) { return _InterlockedExchange16((volatile short*)p, value); }
+        static inline short FetchAdd(volatile void *p, short value) { return (short)_InterlockedExchangeAdd16((volatile short*)p, value); }
+        static inline short FetchOr(volatile void *p, short value) { return _InterlockedOr16((volatile short*)p, value); }
+        static inline short FetchAnd(volatile void *p, short value) { return _InterlockedAnd16((volatile short*)p, value); }
+        static inline short CompareExchange(volatile void *p, short desired, short expected) { return _InterlockedCompareExchange16((volatile short*)p, desired, expected); }
+    };
+
+    template <> struct Internal_AtomicIntrinsics<4>
+    {
+        typedef long Type;
+        template <typename T> static inline T Load(const volatile T *p) { return *p; }
+        template <typename T> static inline void Store(volatile T *p, T value) { *p=value; }
+        static inline long Exchange(volatile void *p, long value) { return _InterlockedExchange((volatile long*)p, value); }
+        static inline long FetchAdd(volatile void *p, long value) { return _InterlockedExchangeAdd((volatile long*)p, value); }
+        static inline long FetchOr(volatile void *p, long value) { return _InterlockedOr((volatile long*)p, value); }
+        static inline long FetchAnd(volatile void *p, long value) { return _InterlockedAnd((volatile long*)p, value); }
+        static inline long CompareExchange(volatile void *p, long desired, long expected) { return _InterlockedCompareExchange((volatile long*)p, desired, expected); }
+    };
+
+    template <> struct Internal_AtomicIntrinsics<8>
+    {
+        typedef __int64 Type;
+#ifdef _WIN64
+        template <typename T> static inline T Load(const volatile T *p) { return *p; }
+        template <typename T> static inline void Store(volatile T *p, T value) { *p=value; }
+#else //WIN32: a plain read or write of a 64 bit value could tear
+        template <typename T> static inline T Load(const volatile T *p) { return (T)_InterlockedCompareExchange64((volatile __int64*)p, 0, 0); }
+        template <typename T> static inline void Store(volatile T *p, T value) { _InterlockedExchange64((volatile __int64*)p, (__int64)value); }
+#endif
+        static inline __int64 Exchange(volatile void *p, __int64 value) { return _InterlockedExchange64((volatile __int64*)p, value); }
+        static inline __int64 FetchAdd(volatile void *p, __int64 value) { return _InterlockedExchangeAdd64((volatile __int64*)p, value); }
+        static inline __int64 FetchOr(volatile void *p, __int64 value) { return _InterlockedOr64((volatile __int64*)p, value); }
+        static inline __int64 FetchAnd(volatile void *p, __int64 value) { return _InterlockedAnd64((volatile __int64*)p, value); }
+        static inline __int64 CompareExchange(volatile void *p, __int64 desired, __int64 expected) { return _InterlockedCompareExchange64((volatile __int64*)p, desired, expected); }
+    };
+
+    template <typename T> inline T AtomicLoad(const volatile T *p, MemoryOrder order)
+    {
+        T value=Internal_AtomicIntrinsics<sizeof(T)>::Load(p);
+        if (order!=MEMORY_ORDER_RELAXED)
+            _ReadWriteBarrier();
+        return value;
+    }
+
+    template <typename T> inline void AtomicStore(volatile T *p, T value, MemoryOrder order)
+    {
+        if (order==MEMORY_ORDER_SEQ_CST)
+        {
+            AtomicExchange(p, value, order);
+            return;
+        }
+
+        if (order!=MEMORY_ORDER_RELAXED)
+            _ReadWriteBarrier();
+        Internal_AtomicIntrinsics<sizeof(T)>::Store(p, value);
+    }
+
+    template <typename T> inline T AtomicExchange(volatile T *p, T value, MemoryOrder)
+    {
+        typedef Internal_AtomicIntrinsics<sizeof(T)> Intrinsics;
+        return (T)Intrinsics::Exchange(p, (typename Intrinsics::Type)value);
+    }
+
+    template <typename T> inline T AtomicFetchAdd(volatile T *p, T value, MemoryOrder)
+    {
+        typedef Internal_AtomicIntrinsics<sizeof(T)> Intrinsics;
+        return (T)Intrinsics::FetchAdd(p, (typename Intrinsics::Type)value);
+    }
+
+    template <typename T> inline T AtomicFetchSub(volatile T *p, T value, MemoryOrder order)
+    {
+        return AtomicFetchAdd(p, (T)(0-value), order);
+    }
+
+    template <typename T> inline T AtomicFetchOr(volatile T *p, T value, MemoryOrder)
+    {
+        typedef Internal_AtomicIntrinsics<sizeof(T)> Intrinsics;
+        return (T)Intrinsics::FetchOr(p, (typename Intrinsics::Type)value);
+    }
+
+    template <typename T> inline T AtomicFetchAnd(volatile T *p, T value, MemoryOrder)
+    {
+        typedef Internal_AtomicIntrinsics<sizeof(T)> Intrinsics;
+        return (T)Intrinsics::FetchAnd(p, (typename Intrinsics::Type)value);
+    }
+
+    template <typename T> inline bool AtomicCompareAndSwap(volatile T *p, T &expected, T desired, MemoryOrder)
+    {
+        typedef Internal_AtomicIntrinsics<sizeof(T)> Intrinsics;
+        T found=(T)Intrinsics::CompareExchange(p, (typename Intrinsics::Type)desired, (typename Intrinsics::Type)expected);
+        if (found==expected)
+            return true;
+        expected=found;
+        return false;
+    }
+
+    inline void AtomicThreadFence(MemoryOrder order)
+    {
+        if (order==MEMORY_ORDER_SEQ_CST)
+            _mm_mfence();
+        else if (order!=MEMORY_ORDER_RELAXED)
+            _ReadWriteBarrier();
+    }
+
+    inline bool AtomicCompareAndSwapDoubleWord(volatile AtomicDoubleWord *p, AtomicDoubleWord &expected, const AtomicDoubleWord &desired)
+    {
+#ifdef _WIN64
+        //on failure this writes what it found into expected
+        return _InterlockedCompareExchange128((volatile __int64*)p, (__int64)desired.high, (__int64)desired.low, (__int64*)&expected)!=0;
+#else //WIN32
+        __int64 expect=((__int64)expected.high<<32)|expected.low;
+        __int64 found=_InterlockedCompareExchange64((volatile __int64*)p, ((__int64)desired.high<<32)|desired.low, expect);
+        if (found==expect)
+            return true;
+        expected.low=(nuint)found;
+        expected.high=(nuint)((unsigned __int64)found>>32);
+        return false;
+#endif
+    }
+
+}; //namespace MPMA
@@ -9,6 +9,7 @@
 #include "../Memory.h"
 #include "evil_windows.h"
 #include <dbghelp.h>
+#include <stdio.h>
 
 namespace
 {
@@ -149,6 +150,38 @@ namespace MPMA
         return str+"\n";
     }
 #endif //DEBUG_CALLSTACK_ENABLED
+
+    //fills frames with the return addresses on the current thread's stack, starting with the caller
+    nuint GetRawCallStack(void **frames, nuint maxFrames)
+    {
+        if (maxFrames>62) //limit of CaptureStackBackTrace on older versions of windows
+            maxFrames=62;
+        return CaptureStackBackTrace(1, (DWORD)maxFrames, frames, 0);
+    }
+
+    //returns the name of the function that contains a code address
+    std::string GetCodeAddressName(void *address)
+    {
+        char hex[32];
+        sprintf(hex, "0x%p", address);
+
+#ifdef DEBUG_CALLSTACK_ENABLED
+        if (symInit && walkLock)
+        {
+            TakeSpinLock takeLock(*walkLock);
+
+            ULONG64 symInfoBuffer[(sizeof(SYMBOL_INFO)+(MAX_SYM_NAME*sizeof(TCHAR))+(sizeof(ULONG64)-1))/sizeof(ULONG64)]={0};
+            SYMBOL_INFO *symInfo=(SYMBOL_INFO*)symInfoBuffer;
+            symInfo->SizeOfStruct=sizeof(SYMBOL_INFO);
+            symInfo->MaxNameLen=MAX_SYM_NAME;
+
+            if (SymFromAddr(GetCurrentProcess(), (DWORD64)address, 0, symInfo))
+                return symInfo->Name;
+        }
+#endif
+
+        return hex;
+    }
 }
 
 bool mpmaForceReferenceToDebugWin32CPP=false; //work around a problem using MPMA as a static library
@@ -6,6 +6,104 @@
 #include <intrin.h>
 #include "../Info.h"
 #include "../MiscStuff.h"
+#include <algorithm>
+
+namespace
+{
+    //fills in the topology info from GetLogicalProcessorInformationEx
+    void InitTopology()
+    {
+        using MPMA::SystemInfo;
+        using MPMA::ProcessorLocation;
+
+        DWORD requiredLength=0;
+        GetLogicalProcessorInformationEx(RelationAll, 0, &requiredLength);
+        if (requiredLength==0)
+            return;
+
+        std::vector<char> rawBytes;
+        rawBytes.resize(requiredLength);
+        if (!GetLogicalProcessorInformationEx(RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)&rawBytes[0], &requiredLength))
+            return;
+
+        //the entries are variable sized, so we walk them by their Size.  Cores come first, then we can fill in sockets and nodes from the masks of the others.
+        std::vector<ProcessorLocation> locations;
+        nuint socketCount=0;
+        nuint nodeCount=0;
+        for (int pass=0; pass<2; ++pass)
+        {
+            for (DWORD offset=0; offset<requiredLength; )
+            {
+                PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info=(PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)&rawBytes[offset];
+                offset+=info->Size;
+
+                if (pass==0 && info->Relationship==RelationProcessorCore)
+                {
+                    nuint core=locations.empty() ? 0 : locations.back().core+1;
+                    nuint smt=0;
+                    const GROUP_AFFINITY &group=info->Processor.GroupMask[0];
+                    for (nuint bit=0; bit<sizeof(KAFFINITY)*8; ++bit)
+                    {
+                        if (group.Mask&((KAFFINITY)1<<bit))
+                        {
+                            ProcessorLocation loc;
+                            loc.logicalId=group.Group*sizeof(KAFFINITY)*8+bit;
+                            loc.socket=0;
+                            loc.core=core;
+                            loc.smtIndex=smt++;
+                            loc.numaNode=0;
+                            locations.push_back(loc);
+                        }
+                    }
+                }
+                else if (pass==1 && (info->Relationship==RelationProcessorPackage || info->Relationship==RelationNumaNode))
+                {
+                    const GROUP_AFFINITY &group=(info->Relationship==RelationProcessorPackage) ? info->Processor.GroupMask[0] : info->NumaNode.GroupMask;
+                    for (std::vector<ProcessorLocation>::iterator loc=locations.begin(); loc!=locations.end(); ++loc)
+                    {
+                        if (loc->logicalId/(sizeof(KAFFINITY)*8)==group.Group && (group.Mask&((KAFFINITY)1<<(loc->logicalId%(sizeof(KAFFINITY)*8)))))
+                        {
+                            if (info->Relationship==RelationProcessorPackage)
+                                loc->socket=socketCount;
+                            else
+                                loc->numaNode=nodeCount;
+                        }
+                    }
+
+                    if (info->Relationship==RelationProcessorPackage)
+                        ++socketCount;
+                    else
+                        ++nodeCount;
+                }
+                else if (pass==1 && info->Relationship==RelationCache)
+                {
+                    const CACHE_RELATIONSHIP &cache=info->Cache;
+                    if (!(cache.GroupMask.Mask&1) || cache.GroupMask.Group!=0) //only look at the caches the first cpu sees
+                        continue;
+
+                    if (cache.Level==1 && cache.Type==CacheData)
+                    {
+                        SystemInfo::CacheL1DataSize=cache.CacheSize/1024;
+                        SystemInfo::CacheLineSize=cache.LineSize;
+                    }
+                    else if (cache.Level==2)
+                        SystemInfo::CacheL2Size=cache.CacheSize/1024;
+                    else if (cache.Level==3)
+                        SystemInfo::CacheL3Size=cache.CacheSize/1024;
+                }
+            }
+        }
+
+        if (locations.empty())
+            return;
+
+        SystemInfo::ProcessorLocations=locations;
+        SystemInfo::ProcessorLogicalCount=locations.size();
+        SystemInfo::ProcessorCoreCount=locations.back().core+1;
+        SystemInfo::ProcessorSocketCount=socketCount>0 ? socketCount : 1;
+        SystemInfo::NumaNodeCount=nodeCount>0 ? nodeCount : 1;
+    }
+}
 
 namespace MPMA
 {
@@ -96,6 +194,9 @@ namespace MPMA
             }
         }
 
+        // -- Topology and cache info
+        InitTopology();
+
         // -- Memory information we'll get from an api call
 
         MEMORYSTATUSEX meminfo;
@@ -6,59 +6,46 @@
 #include "../Memory.h"
 #include "evil_windows.h"
 
-// -- mutex setup
+#pragma comment(lib, "Synchronization.lib") //WaitOnAddress
 
 namespace MPMA
 {
 
-MutexLock::MutexLock()
-{
-    Data().crit=new2(CRITICAL_SECTION,CRITICAL_SECTION);
-    InitializeCriticalSection((CRITICAL_SECTION*)Data().crit);
-}
+// -- futex
 
-MutexLock::~MutexLock()
+//blocks the calling thread for as long as *address is equal to expectedValue
+void Internal_FutexWait(volatile uint32 *address, uint32 expectedValue)
 {
-    if (IsOnlyReference())
-    {
-        DeleteCriticalSection((CRITICAL_SECTION*)Data().crit);
-        CRITICAL_SECTION* theCrit=(CRITICAL_SECTION*)Data().crit;
-
-        delete2(theCrit);
-        Data().crit=0;
-    }
+    WaitOnAddress(address, &expectedValue, sizeof(uint32), INFINITE);
 }
 
-
-// -- mutex use
-
-TakeMutexLock::TakeMutexLock(MutexLock &critSection, bool takeNow):
-    crit(critSection), taken(false)
+//wakes one thread blocked in Internal_FutexWait on address
+void Internal_FutexWakeOne(volatile uint32 *address)
 {
-    if (takeNow)
-        Take();
+    WakeByAddressSingle((void*)address);
 }
 
-TakeMutexLock::~TakeMutexLock()
+//wakes all threads blocked in Internal_FutexWait on address
+void Internal_FutexWakeAll(volatile uint32 *address)
 {
-    Leave();
+    WakeByAddressAll((void*)address);
 }
 
-//Manually takes the lock.
-void TakeMutexLock::Take()
-{
-    if (!taken)
-        EnterCriticalSection((CRITICAL_SECTION*)crit.Data().crit);
-    taken=true;
-}
+#ifdef LOCK_CONTENTION_STATS
+// -- lock statistics
 
-//Manually releases the lock.
-void TakeMutexLock::Leave()
+//the current time in nanoseconds
+uint64 Internal_LockStatsTime()
 {
-    if (taken)
-        LeaveCriticalSection((CRITICAL_SECTION*)crit.Data().crit);
-    taken=false;
+    static LARGE_INTEGER frequency={0};
+    if (frequency.QuadPart==0)
+        QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (uint64)(now.QuadPart/frequency.QuadPart)*1000000000ull + (uint64)(now.QuadPart%frequency.QuadPart)*1000000000ull/(uint64)frequency.QuadPart;
 }
+#endif
 
 
 // -- BlockingObject
@@ -91,4 +91,38 @@ namespace MPMA
 #endif
     }
 
+    //Atomically adds one 32 bit integer to another and returns the value of the original
+    inline uint32 AtomicInt32Add(volatile uint32 *pint, uint32 addValue)
+    {
+        return (uint32)_InterlockedExchangeAdd((volatile long*)pint, (long)addValue);
+    }
+
+    //Atomically sets a 32 bit integer to newValue and returns the value it had before
+    inline uint32 AtomicInt32Exchange(volatile uint32 *pint, uint32 newValue)
+    {
+        return (uint32)_InterlockedExchange((volatile long*)pint, (long)newValue);
+    }
+
+    //Same as AtomicCompareExchange, but for a 32 bit integer
+    inline bool AtomicInt32CompareExchange(volatile uint32 *pInt, uint32 expectedValue, uint32 newValue, volatile uint32 &outResultValue)
+    {
+        uint32 rval=(uint32)_InterlockedCompareExchange((volatile long*)pInt, (long)newValue, (long)expectedValue);
+        if (rval==expectedValue)
+        {
+            outResultValue=newValue;
+            return true;
+        }
+        else
+        {
+            outResultValue=rval;
+            return false;
+        }
+    }
+
+    //Hints to the cpu that the calling thread is in a spin-wait loop
+    inline void CpuPause()
+    {
+        _mm_pause();
+    }
+
 }; //namespace Platform
@@ -0,0 +1,48 @@
+//Guard page allocation used by the memory manager.
+//(filename is different to work around a msvc ide bug that prevented compilation)
+//See /docs/License.txt for details on how this code may be used.
+
+#include "../Memory.h"
+#include "evil_windows.h"
+
+#ifdef MEMMAN_TRACING
+
+namespace MPMA
+{
+    nuint Internal_GetPageSize()
+    {
+        static nuint pageSize=0;
+        if (!pageSize)
+        {
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            pageSize=(nuint)info.dwPageSize;
+        }
+        return pageSize;
+    }
+
+    //maps size bytes of memory followed by a page that can't be touched.  Returns 0 on failure.
+    void* Internal_AllocGuardedPages(nuint size)
+    {
+        nuint pageSize=Internal_GetPageSize();
+        uint8 *mem=(uint8*)VirtualAlloc(0, size+pageSize, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+        if (!mem)
+            return 0;
+
+        DWORD oldProtect;
+        if (!VirtualProtect(mem+size, pageSize, PAGE_NOACCESS, &oldProtect))
+        {
+            VirtualFree(mem, 0, MEM_RELEASE);
+            return 0;
+        }
+
+        return mem;
+    }
+
+    void Internal_FreeGuardedPages(void *mem, nuint size)
+    {
+        VirtualFree(mem, 0, MEM_RELEASE);
+    }
+}
+
+#endif //MEMMAN_TRACING
@@ -0,0 +1,31 @@
+//Hardware performance counters used by the profiler.
+//(filename is different to work around a msvc ide bug that prevented compilation)
+//See /docs/License.txt for details on how this code may be used.
+
+#include "../Profiler.h"
+
+#if defined(TIMEPROFILE_ENABLED) && defined(TIMEPROFILE_HARDWARE_COUNTERS)
+
+#include <string.h>
+
+//windows has no per-thread counter interface that works without a driver, so the counters are never available
+
+namespace MPMA
+{
+    bool Internal_OpenProfileCounters(Internal_ProfileCounters &counters)
+    {
+        memset(&counters, 0, sizeof(counters));
+        return false;
+    }
+
+    bool Internal_ReadProfileCounters(const Internal_ProfileCounters &counters, Internal_ProfileCounterReading &outReading)
+    {
+        return false;
+    }
+
+    void Internal_CloseProfileCounters(Internal_ProfileCounters &counters)
+    {
+    }
+}
+
+#endif
@@ -0,0 +1,36 @@
+//Signals and timers used by the sampling profiler.
+//(filename is different to work around a msvc ide bug that prevented compilation)
+//See /docs/License.txt for details on how this code may be used.
+
+#include "../SamplingProfiler.h"
+
+#ifdef SAMPLING_PROFILER
+
+//windows has no signal that interrupts a thread to run code on its own stack, so sampling is never available
+
+namespace MPMA
+{
+    bool Internal_StartSampling(nuint samplesPerSecond)
+    {
+        return false;
+    }
+
+    void Internal_StopSampling()
+    {
+    }
+
+    void Internal_AddSamplingThread()
+    {
+    }
+
+    void Internal_RemoveSamplingThread(Internal_SamplingStackCallback callback)
+    {
+    }
+
+    uint64 Internal_CollectSamples(Internal_SamplingStackCallback callback)
+    {
+        return 0;
+    }
+}
+
+#endif
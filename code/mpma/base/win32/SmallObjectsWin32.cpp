@@ -0,0 +1,33 @@
+//Address space reservation used by the small object allocator.
+//(filename is different to work around a msvc ide bug that prevented compilation)
+//See /docs/License.txt for details on how this code may be used.
+
+#include "../SmallObjects.h"
+#include "evil_windows.h"
+#include <psapi.h>
+
+#pragma comment(lib, "psapi.lib") //GetProcessMemoryInfo
+
+namespace MPMA
+{
+    //reserves address space without using any memory.  Returns 0 on failure.
+    void* Internal_ReserveAddressSpace(nuint bytes)
+    {
+        return VirtualAlloc(0, bytes, MEM_RESERVE, PAGE_NOACCESS);
+    }
+
+    //makes part of reserved address space usable
+    bool Internal_CommitAddressSpace(void *mem, nuint bytes)
+    {
+        return VirtualAlloc(mem, bytes, MEM_COMMIT, PAGE_READWRITE)!=0;
+    }
+
+    //returns the memory the process is using that is resident in ram, or 0 if it isn't known
+    nuint Internal_GetResidentBytes()
+    {
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return 0;
+        return (nuint)counters.WorkingSetSize;
+    }
+}
@@ -6,7 +6,9 @@
 #include "../Debug.h"
 #include "../Memory.h"
 #include "../DebugRouter.h"
+#include "../SamplingProfiler.h"
 #include "evil_windows.h"
+#include <string.h>
 
 namespace MPMA
 {
@@ -32,8 +34,16 @@ namespace MPMA
         {
             ThreadInfo &info=*(ThreadInfo*)ptrParam;
     
+#ifdef SAMPLING_PROFILER
+            Internal_SamplingProfilerThreadStarted();
+#endif
+
             //enter main procedure
             info.func(*info.ownerThread,*info.param);
+
+#ifdef SAMPLING_PROFILER
+            Internal_SamplingProfilerThreadEnded();
+#endif
     
             //mark that we're done and end
             info.alive=false;
@@ -132,7 +142,45 @@ namespace MPMA
             SetThreadPriority(data->threadHandle, THREAD_PRIORITY_NORMAL);
     }
     
+    //Restricts the thread to run only on the given logical processors.
+    bool Thread::SetProcessorAffinity(const std::vector<nuint> &logicalProcessors)
+    {
+        ThreadInfo *data=(ThreadInfo*)internal;
+        if (!data) return false;
+
+        //a thread can only be in one processor group, so we use the group of the first processor and ignore any that are in other groups
+        const nuint groupSize=sizeof(KAFFINITY)*8;
+        GROUP_AFFINITY affinity;
+        memset(&affinity, 0, sizeof(affinity));
+        if (logicalProcessors.empty()) //everything in the thread's current group
+        {
+            if (!GetThreadGroupAffinity(data->threadHandle, &affinity))
+                return false;
+            nuint groupCount=GetActiveProcessorCount(affinity.Group);
+            affinity.Mask=(groupCount>=groupSize) ? ~(KAFFINITY)0 : (((KAFFINITY)1<<groupCount)-1);
+        }
+        else
+        {
+            affinity.Group=(unsigned short)(logicalProcessors[0]/groupSize);
+            for (std::vector<nuint>::const_iterator i=logicalProcessors.begin(); i!=logicalProcessors.end(); ++i)
+            {
+                if (*i/groupSize==affinity.Group)
+                    affinity.Mask|=(KAFFINITY)1<<(*i%groupSize);
+            }
+        }
+
+        return SetThreadGroupAffinity(data->threadHandle, &affinity, 0)!=0;
+    }
+
     // -- Thread-related helpers
+
+    //Returns the logical processor the calling thread is running on right now.
+    nuint GetCurrentLogicalProcessor()
+    {
+        PROCESSOR_NUMBER number;
+        GetCurrentProcessorNumberEx(&number);
+        return number.Group*sizeof(KAFFINITY)*8+number.Number;
+    }
     
     //Causes the current thread to give block for at least time ms
     void Sleep(nuint time)
@@ -0,0 +1,55 @@
+//the system clocks that Timer reads
+//(filename is different to work around a msvc ide bug that prevented compilation)
+//Luke Lenhart, 2007
+//See /docs/License.txt for details on how this code may be used.
+
+#include "../Timer.h"
+#include "evil_windows.h"
+#include <intrin.h>
+
+namespace MPMA
+{
+    //reads the system's monotonic clock
+    uint64 Internal_GetSystemClockTicks()
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return (uint64)now.QuadPart;
+    }
+
+    uint64 Internal_GetSystemClockFrequency()
+    {
+        static uint64 frequency=0;
+        if (!frequency)
+        {
+            LARGE_INTEGER freq;
+            QueryPerformanceFrequency(&freq);
+            frequency=(uint64)freq.QuadPart;
+        }
+        return frequency;
+    }
+
+    //the system time is kept in step with real time, and doesn't come from the performance counter
+    uint64 Internal_GetReferenceClockNanoseconds()
+    {
+        FILETIME now;
+        GetSystemTimePreciseAsFileTime(&now);
+        return ((uint64)now.dwHighDateTime<<32|(uint64)now.dwLowDateTime)*100; //(filetime is in 100ns units)
+    }
+
+    //whether the time stamp counter runs at a constant rate, and is kept in step between cpus
+    bool Internal_IsTscReliable()
+    {
+#if defined(_M_X64) || defined(_M_IX86)
+        int regs[4];
+        __cpuid(regs, 0x80000000);
+        if ((unsigned int)regs[0]<0x80000007)
+            return false;
+
+        __cpuid(regs, 0x80000007);
+        return (regs[3]&(1<<8))!=0; //invariant tsc
+#else
+        return false;
+#endif
+    }
+}
@@ -0,0 +1,456 @@
+//!\file FrameStats.cpp Frame time statistics, budgets for parts of a frame, and an on-screen overlay.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "FrameStats.h"
+
+#ifdef MPMA_COMPILE_GFX
+
+#include "../base/Histogram.h"
+#include "../base/Memory.h"
+#include "../base/Profiler.h"
+#include "../base/Timer.h"
+#include "../gfxsetup/GFXSetup.h"
+#include "../gfxsetup/GL.h"
+#include "../gfxsetup/Extensions.h"
+#include "TextWriter.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace GFX_INTERNAL
+{
+    void AddUpdateCallback(void (*callback)());
+    void AddAfterUpdateCallback(void (*callback)());
+    void AddWindowShutdownCallback(void (*callback)());
+}
+
+namespace
+{
+    //a part of the frame being watched
+    struct Stage
+    {
+        std::string name;
+        double budget;
+        double lastTime;
+        double averageTime;
+        nuint overBudgetFrames;
+        double lastTotalTime; //the profile's total the frame before
+        bool seen;
+    };
+
+    //how much each frame moves the stages' averages
+    const double STAGE_AVERAGE_WEIGHT=1.0/32;
+
+    //a frame is a hitch if it takes this many times the recent median
+    const double HITCH_FACTOR=2.0;
+
+    //hitches aren't looked for until there are this many frames to compare to
+    const nuint HITCH_MIN_HISTORY=16;
+
+    //how often the overlay's text is rebuilt, in seconds
+    const double OVERLAY_TEXT_INTERVAL=0.25;
+
+    //the number of profiles listed in the overlay
+    const nuint OVERLAY_TOP_PROFILES=5;
+
+    uint64 lastFrameTicks=0;
+    bool haveLastFrame=false;
+    double lastFrameTime=0;
+
+    double history[GFX::FRAME_STATS_HISTORY];
+    nuint historyCount=0;
+    nuint historyNext=0;
+
+    nuint frameCount=0;
+    MPMA::Histogram allFrames; //in microseconds
+    double frameTarget=1.0/60;
+    nuint hitchCount=0;
+    bool lastFrameWasHitch=false;
+
+    std::vector<Stage> stages;
+
+#ifdef GFX_SHOW_FRAME_STATS_OVERLAY
+    bool overlayShown=true;
+#else
+    bool overlayShown=false;
+#endif
+
+    //returns a value from the recent frames: 0 for the smallest, 1 for the largest
+    double RecentPercentile(double fraction)
+    {
+        if (historyCount==0)
+            return 0;
+
+        double sorted[GFX::FRAME_STATS_HISTORY];
+        std::copy(history, history+historyCount, sorted);
+        nuint index=(nuint)(fraction*(historyCount-1)+0.5);
+        std::nth_element(sorted, sorted+index, sorted+historyCount);
+        return sorted[index];
+    }
+
+    void UpdateStages()
+    {
+#ifdef TIMEPROFILE_ENABLED
+        for (std::vector<Stage>::iterator s=stages.begin(); s!=stages.end(); ++s)
+        {
+            uint64 count;
+            double total;
+            MPMA::GetProfileTotals(s->name, count, total);
+
+            if (s->seen)
+            {
+                s->lastTime=total-s->lastTotalTime;
+                s->averageTime+=(s->lastTime-s->averageTime)*STAGE_AVERAGE_WEIGHT;
+                if (s->lastTime>s->budget)
+                    ++s->overBudgetFrames;
+            }
+            s->lastTotalTime=total;
+            s->seen=true;
+        }
+#endif
+    }
+
+    //called after the back buffer is shown, which ends a frame
+    void FrameEnded()
+    {
+        uint64 now=MPMA::Timer::GetTicks();
+        if (!haveLastFrame)
+        {
+            lastFrameTicks=now;
+            haveLastFrame=true;
+            UpdateStages();
+            return;
+        }
+
+        lastFrameTime=MPMA::Timer::TicksToSeconds(now-lastFrameTicks);
+        lastFrameTicks=now;
+        ++frameCount;
+        allFrames.Add((uint64)(lastFrameTime*1000000.0));
+
+        //compare to the frames before adding this one
+        lastFrameWasHitch=false;
+        if (historyCount>=HITCH_MIN_HISTORY && lastFrameTime>frameTarget && lastFrameTime>HITCH_FACTOR*RecentPercentile(0.5))
+        {
+            lastFrameWasHitch=true;
+            ++hitchCount;
+            MPMAProfileInstant("Frame hitch");
+        }
+
+        history[historyNext]=lastFrameTime;
+        historyNext=(historyNext+1)%GFX::FRAME_STATS_HISTORY;
+        if (historyCount<GFX::FRAME_STATS_HISTORY)
+            ++historyCount;
+
+        UpdateStages();
+    }
+
+    // -- overlay
+
+#ifdef GFX_USES_FREETYPE
+    GFX::TextWriter *overlayText=0;
+    uint64 overlayTextTicks=0;
+
+#ifdef TIMEPROFILE_ENABLED
+    MPMA::ProfileSnapshot *overlaySnapshot=0; //when the text was last rebuilt, to find what took time since
+#endif
+
+    //rebuilds the overlay's text
+    void UpdateOverlayText()
+    {
+        if (!overlayText)
+        {
+            overlayText=new3(GFX::TextWriter);
+            overlayText->TextFont=GFX::FIXED_SANSERIF;
+            overlayText->FontSize=12;
+        }
+
+        GFX::FrameStats stats;
+        GFX::GetFrameStats(stats);
+
+        char buf[256];
+        GFX::EncodedText &text=overlayText->Text;
+        text.Clear();
+        sprintf(buf, "%.2f ms (%.0f fps)  p50 %.2f  p99 %.2f  max %.2f\n", stats.AverageFrameTime*1000, stats.AverageFrameTime>0 ? 1.0/stats.AverageFrameTime : 0.0, stats.P50FrameTime*1000, stats.P99FrameTime*1000, stats.MaxFrameTime*1000);
+        text<<(stats.P99FrameTime>frameTarget ? GFX::TextColor(255, 200, 80) : GFX::TextColor(200, 255, 200))<<buf;
+        sprintf(buf, "hitches: %d\n", (int)stats.HitchCount);
+        text<<GFX::TextColor()<<buf;
+
+        for (std::vector<GFX::FrameStageStats>::iterator s=stats.Stages.begin(); s!=stats.Stages.end(); ++s)
+        {
+            sprintf(buf, "%.2f / %.2f ms  ", s->AverageTime*1000, s->Budget*1000);
+            text<<(s->AverageTime>s->Budget ? GFX::TextColor(255, 100, 100) : GFX::TextColor(200, 255, 200))<<buf<<s->Name<<"\n";
+        }
+
+#ifdef TIMEPROFILE_ENABLED
+        //the profiles that took the most time since the last rebuild, per frame
+        MPMA::ProfileSnapshot now, recent;
+        MPMA::GetProfileSnapshot(now);
+        if (!overlaySnapshot)
+        {
+            overlaySnapshot=new3(MPMA::ProfileSnapshot);
+            *overlaySnapshot=now;
+        }
+        MPMA::DiffProfileSnapshots(now, *overlaySnapshot, recent);
+        std::swap(*overlaySnapshot, now);
+
+        double frames=(stats.AverageFrameTime>0 && recent.duration>0) ? recent.duration/stats.AverageFrameTime : 1.0;
+        text<<GFX::TextColor(180, 180, 180);
+        for (nuint i=0; i<recent.scopes.size() && i<OVERLAY_TOP_PROFILES; ++i)
+        {
+            sprintf(buf, "%.2f ms  ", recent.scopes[i].totalTime*1000/frames);
+            text<<buf<<recent.scopes[i].name<<"\n";
+        }
+#endif
+
+        overlayText->CreateTextImage();
+        overlayText->CreateTexture();
+    }
+
+    //the window is going away, so free what uses opengl
+    void WindowShutdown()
+    {
+        if (overlayText)
+        {
+            delete3(overlayText);
+            overlayText=0;
+        }
+
+#ifdef TIMEPROFILE_ENABLED
+        if (overlaySnapshot)
+        {
+            delete3(overlaySnapshot);
+            overlaySnapshot=0;
+        }
+#endif
+    }
+#endif
+
+    //draws the overlay over whatever was rendered this frame, leaving opengl's state as it was
+    void DrawOverlay()
+    {
+        const GFX::GraphicsSetup *state=GFX::GetWindowState();
+        if (!state || state->Minimized)
+            return;
+
+        MPMAProfileScope("FrameStats Overlay");
+
+        glPushAttrib(GL_ALL_ATTRIB_BITS);
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho(0, state->Width, 0, state->Height, -1, 1);
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+
+#ifdef OPENGL_LOAD_COMMON_EXTENSIONS
+        GLint program=0;
+        if (GFX_OPENGL_EXTENSIONS::glUseProgram)
+        {
+            glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+            GFX_OPENGL_EXTENSIONS::glUseProgram(0);
+        }
+#endif
+
+        glViewport(0, 0, state->Width, state->Height);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_LIGHTING);
+        glDisable(GL_SCISSOR_TEST);
+        glDisable(GL_TEXTURE_2D);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        //graph of the recent frames, where the target is half way up
+        const float left=8, graphWidth=(float)GFX::FRAME_STATS_HISTORY, graphHeight=60;
+        float top=(float)state->Height-8;
+        float bottom=top-graphHeight;
+        float scale=(float)(graphHeight/(2*frameTarget));
+
+        glColor4f(0, 0, 0, 0.6f);
+        glBegin(GL_QUADS);
+        glVertex2f(left, bottom);
+        glVertex2f(left+graphWidth, bottom);
+        glVertex2f(left+graphWidth, top);
+        glVertex2f(left, top);
+        glEnd();
+
+        glBegin(GL_LINES);
+        for (nuint i=0; i<historyCount; ++i)
+        {
+            double time=history[(historyNext+GFX::FRAME_STATS_HISTORY-historyCount+i)%GFX::FRAME_STATS_HISTORY];
+            float height=std::min((float)time*scale, graphHeight);
+            if (time>frameTarget)
+                glColor4f(1, 0.3f, 0.3f, 0.9f);
+            else
+                glColor4f(0.3f, 1, 0.3f, 0.9f);
+            glVertex2f(left+i+0.5f, bottom);
+            glVertex2f(left+i+0.5f, bottom+height);
+        }
+
+        glColor4f(1, 1, 1, 0.5f);
+        glVertex2f(left, bottom+graphHeight/2);
+        glVertex2f(left+graphWidth, bottom+graphHeight/2);
+        glEnd();
+
+#ifdef GFX_USES_FREETYPE
+        uint64 now=MPMA::Timer::GetTicks();
+        if (!overlayText || MPMA::Timer::TicksToSeconds(now-overlayTextTicks)>=OVERLAY_TEXT_INTERVAL)
+        {
+            overlayTextTicks=now;
+            UpdateOverlayText();
+        }
+
+        if (overlayText->GetTextHeight()>0)
+        {
+            float textTop=bottom-4;
+            float textWidth=(float)overlayText->GetRenderWidth();
+            float textHeight=(float)overlayText->GetRenderHeight();
+            glColor4f(0, 0, 0, 0.6f);
+            glBegin(GL_QUADS);
+            glVertex2f(left, textTop-textHeight-4);
+            glVertex2f(left+textWidth+8, textTop-textHeight-4);
+            glVertex2f(left+textWidth+8, textTop);
+            glVertex2f(left, textTop);
+            glEnd();
+
+            glColor4f(1, 1, 1, 1);
+            overlayText->RenderTexture(left+4, textTop-2);
+        }
+#endif
+
+#ifdef OPENGL_LOAD_COMMON_EXTENSIONS
+        if (GFX_OPENGL_EXTENSIONS::glUseProgram)
+            GFX_OPENGL_EXTENSIONS::glUseProgram(program);
+#endif
+
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glPopAttrib();
+    }
+
+    //called at the start of UpdateWindow, before the back buffer is shown
+    void BeforeFrameShown()
+    {
+        if (overlayShown)
+            DrawOverlay();
+    }
+
+    class AutoInitFrameStats
+    {
+    public:
+        //hookup window callbacks
+        AutoInitFrameStats()
+        {
+            GFX_INTERNAL::AddUpdateCallback(BeforeFrameShown);
+            GFX_INTERNAL::AddAfterUpdateCallback(FrameEnded);
+#ifdef GFX_USES_FREETYPE
+            GFX_INTERNAL::AddWindowShutdownCallback(WindowShutdown);
+#endif
+        }
+    } autoInitFrameStats;
+}
+
+namespace GFX
+{
+    //Returns the time between the last two calls to UpdateWindow.
+    double GetLastFrameTime()
+    {
+        return lastFrameTime;
+    }
+
+    //Fills in the frame statistics.
+    void GetFrameStats(FrameStats &outStats)
+    {
+        outStats.FrameCount=frameCount;
+        outStats.LastFrameTime=lastFrameTime;
+
+        double total=0;
+        double maxTime=0;
+        for (nuint i=0; i<historyCount; ++i)
+        {
+            total+=history[i];
+            maxTime=std::max(maxTime, history[i]);
+        }
+        outStats.AverageFrameTime=historyCount ? total/historyCount : 0;
+        outStats.P50FrameTime=RecentPercentile(0.5);
+        outStats.P90FrameTime=RecentPercentile(0.9);
+        outStats.P99FrameTime=RecentPercentile(0.99);
+        outStats.MaxFrameTime=maxTime;
+        outStats.AllP99FrameTime=allFrames.GetPercentile(99)/1000000.0;
+        outStats.HitchCount=hitchCount;
+        outStats.LastFrameWasHitch=lastFrameWasHitch;
+
+        outStats.Stages.resize(stages.size());
+        for (nuint i=0; i<stages.size(); ++i)
+        {
+            FrameStageStats &stage=outStats.Stages[i];
+            stage.Name=stages[i].name;
+            stage.Budget=stages[i].budget;
+            stage.LastTime=stages[i].lastTime;
+            stage.AverageTime=stages[i].averageTime;
+            stage.OverBudgetFrames=stages[i].overBudgetFrames;
+        }
+    }
+
+    //Returns the times of the recent frames, oldest first.
+    void GetRecentFrameTimes(std::vector<double> &outTimes)
+    {
+        outTimes.resize(historyCount);
+        for (nuint i=0; i<historyCount; ++i)
+            outTimes[i]=history[(historyNext+FRAME_STATS_HISTORY-historyCount+i)%FRAME_STATS_HISTORY];
+    }
+
+    //Sets how long a frame is meant to take.
+    void SetFrameTimeTarget(double seconds)
+    {
+        frameTarget=seconds;
+    }
+
+    //Watches a profile as a part of the frame with a budget.
+    void SetFrameStageBudget(const std::string &profileName, double budgetSeconds)
+    {
+        for (std::vector<Stage>::iterator s=stages.begin(); s!=stages.end(); ++s)
+        {
+            if (s->name==profileName)
+            {
+                if (budgetSeconds>0)
+                    s->budget=budgetSeconds;
+                else
+                    stages.erase(s);
+                return;
+            }
+        }
+
+        if (budgetSeconds<=0)
+            return;
+
+        Stage stage;
+        stage.name=profileName;
+        stage.budget=budgetSeconds;
+        stage.lastTime=0;
+        stage.averageTime=0;
+        stage.overBudgetFrames=0;
+        stage.lastTotalTime=0;
+        stage.seen=false;
+        stages.push_back(stage);
+    }
+
+    //Shows or hides the overlay.
+    void ShowFrameStatsOverlay(bool show)
+    {
+        overlayShown=show;
+    }
+
+    //Returns whether the overlay is shown.
+    bool IsFrameStatsOverlayShown()
+    {
+        return overlayShown;
+    }
+}
+
+#endif //#ifdef MPMA_COMPILE_GFX
+
+bool mpmaForceReferenceToFrameStatsCPP=false; //work around a problem using MPMA as a static library
@@ -0,0 +1,86 @@
+//!\file FrameStats.h Frame time statistics, budgets for parts of a frame, and an on-screen overlay.
+//!Frames are timed automatically from one GFX::UpdateWindow to the next.  Everything here must be used from the thread that owns the window.
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include "../Config.h"
+
+#ifdef MPMA_COMPILE_GFX
+
+#include "../base/Types.h"
+#include <string>
+#include <vector>
+
+/*
+An example of watching the frame rate and parts of the frame:
+  //a part of the frame is a profile (see Profiler.h), given a budget in seconds
+  GFX::SetFrameStageBudget("Render Scene", 0.008);
+  GFX::ShowFrameStatsOverlay(true); //or define GFX_SHOW_FRAME_STATS_OVERLAY in Config.h
+
+  while (GFX::GetWindowState())
+  {
+      GFX::UpdateWindow();
+      float timePassed=(float)GFX::GetLastFrameTime();
+
+      {
+          MPMAProfileScope("Render Scene");
+          //...
+      }
+  }
+*/
+
+namespace GFX
+{
+    //!How one part of the frame has been doing against its budget.  Times are in seconds.
+    struct FrameStageStats
+    {
+        std::string Name; //!<The name of the profile that times this part of the frame.
+        double Budget; //!<How long it is allowed to take each frame.
+        double LastTime; //!<How long it took during the last frame.
+        double AverageTime; //!<Average of the recent frames.
+        nuint OverBudgetFrames; //!<Number of frames it went over its budget in.
+    };
+
+    //!Frame times over the whole run and over the recent frames.  Times are in seconds.
+    struct FrameStats
+    {
+        nuint FrameCount; //!<Frames since the first UpdateWindow.
+        double LastFrameTime; //!<Time between the last two UpdateWindow calls.
+        double AverageFrameTime; //!<Average of the recent frames.
+        double P50FrameTime; //!<Percentiles of the recent frames.
+        double P90FrameTime; //!<
+        double P99FrameTime; //!<
+        double MaxFrameTime; //!<Longest of the recent frames.
+        double AllP99FrameTime; //!<99th percentile over the whole run.
+        nuint HitchCount; //!<Frames that took more than twice as long as the recent median, and longer than the target.
+        bool LastFrameWasHitch; //!<Whether the last frame was a hitch.
+        std::vector<FrameStageStats> Stages; //!<Each part of the frame given a budget.
+    };
+
+    //!The number of recent frames that are kept for the rolling statistics and the overlay's graph.
+    const nuint FRAME_STATS_HISTORY=240;
+
+    //!Returns the time in seconds between the last two calls to UpdateWindow, which is how much time a frame should move things forward by.
+    double GetLastFrameTime();
+
+    //!Fills in the frame statistics.
+    void GetFrameStats(FrameStats &outStats);
+
+    //!Returns the times of the recent frames in seconds, oldest first.
+    void GetRecentFrameTimes(std::vector<double> &outTimes);
+
+    //!Sets how long a frame is meant to take, in seconds.  Frames shorter than this are never hitches.  Default is 1/60th of a second.
+    void SetFrameTimeTarget(double seconds);
+
+    //!Watches a profile (see Profiler.h) as a part of the frame with a budget in seconds, which is shown in the stats and the overlay.  A budget of 0 stops watching it.  Does nothing if TIMEPROFILE_ENABLED is not defined.
+    void SetFrameStageBudget(const std::string &profileName, double budgetSeconds);
+
+    //!Shows or hides the overlay, which draws a graph of the recent frame times, the frame stats, the parts of the frame and the profiles that took the most time, in the top left of the window.  It is drawn during UpdateWindow, over whatever was rendered.  The text is only updated a few times a second, so it's cheap enough to leave on.
+    void ShowFrameStatsOverlay(bool show);
+
+    //!Returns whether the overlay is shown.
+    bool IsFrameStatsOverlayShown();
+}
+
+#endif //#ifdef MPMA_COMPILE_GFX
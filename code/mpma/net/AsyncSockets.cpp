@@ -0,0 +1,303 @@
+//Lets coroutines wait on sockets without holding a thread.
+//See /docs/License.txt for details on how this code may be used.
+
+#include "AsyncSockets.h"
+
+#ifdef MPMA_COMPILE_NET
+#ifdef MPMA_COROUTINES_AVAILABLE
+
+#include "../base/Thread.h"
+#include "../base/Timer.h"
+#include "../base/Memory.h"
+#include "../base/DebugRouter.h"
+#include "../Setup.h"
+#include "PlatformSockets.h"
+
+using namespace NET_INTERNAL;
+
+namespace
+{
+    //a single thread polls every socket that a coroutine is waiting on
+    MPMA::Thread *reactorThread=0;
+    MPMA::SpinLock *waitersLock=0;
+    std::vector<NET::SocketWaitAwaiter*> *waiters=0;
+    bool reactorEnding=true;
+    MPMA::Timer *reactorClock=0; //time since init
+
+    //a udp socket on the loopback that we send to ourselves to interrupt a poll when something new is waiting
+    nsint wakeSock=-1;
+    sockaddr_in wakeAddr;
+
+    void WakeReactor()
+    {
+        char b=0;
+        sendto(wakeSock, &b, 1, 0, (sockaddr*)&wakeAddr, sizeof(wakeAddr));
+    }
+
+    void ReactorThreadProc(MPMA::Thread &thread, MPMA::ThreadParam)
+    {
+        std::vector<pollfd> fds;
+        std::vector<NET::SocketWaitAwaiter*> finished;
+        while (!thread.IsEnding())
+        {
+            //build the list of sockets to watch, and find the nearest timeout
+            fds.clear();
+            pollfd wakeFd;
+            wakeFd.fd=wakeSock;
+            wakeFd.events=POLLIN;
+            wakeFd.revents=0;
+            fds.push_back(wakeFd);
+
+            int timeoutMs=-1;
+            nuint watchCount;
+            {
+                MPMA::TakeSpinLock takeLock(*waitersLock);
+                if (reactorEnding)
+                    break;
+
+                double now=reactorClock->Step(false);
+                for (std::vector<NET::SocketWaitAwaiter*>::iterator w=waiters->begin(); w!=waiters->end(); ++w)
+                {
+                    pollfd fd;
+                    fd.fd=(*w)->sock;
+                    fd.events=POLLIN;
+                    fd.revents=0;
+                    fds.push_back(fd);
+
+                    if ((*w)->deadline>=0)
+                    {
+                        int ms=(int)(((*w)->deadline-now)*1000.0)+1;
+                        if (ms<0)
+                            ms=0;
+                        if (timeoutMs<0 || ms<timeoutMs)
+                            timeoutMs=ms;
+                    }
+                }
+                watchCount=waiters->size();
+            }
+
+            if (Internal_PollSockets(&fds[0], fds.size(), timeoutMs)<0)
+                MPMA::ErrorReport()<<"Socket reactor: poll failed: "<<Internal_GetLastError()<<"\n";
+
+            //empty the wake socket
+            if (fds[0].revents!=0)
+            {
+                char b[64];
+                while (recv(wakeSock, b, sizeof(b), 0)>0) {}
+            }
+
+            //take out anything that is ready or has timed out.  Only we remove waiters, so the first watchCount are still the ones that were polled.
+            {
+                MPMA::TakeSpinLock takeLock(*waitersLock);
+                double now=reactorClock->Step(false);
+                nuint kept=0;
+                for (nuint i=0; i<waiters->size(); ++i)
+                {
+                    NET::SocketWaitAwaiter *w=(*waiters)[i];
+                    if (i<watchCount && fds[i+1].revents!=0)
+                    {
+                        w->ready=true;
+                        finished.push_back(w);
+                    }
+                    else if (w->deadline>=0 && now>=w->deadline)
+                    {
+                        w->ready=false;
+                        finished.push_back(w);
+                    }
+                    else
+                        (*waiters)[kept++]=w;
+                }
+                waiters->resize(kept);
+            }
+
+            for (std::vector<NET::SocketWaitAwaiter*>::iterator w=finished.begin(); w!=finished.end(); ++w)
+                MPMA::Internal_ResumeOnTaskScheduler((*w)->job, (*w)->coroutine);
+            finished.clear();
+        }
+    }
+
+    NET::SocketWaitAwaiter MakeSocketWait(nsint sock, double timeout)
+    {
+        NET::SocketWaitAwaiter awaiter;
+        awaiter.sock=sock;
+        awaiter.timeout=timeout;
+        awaiter.deadline=-1;
+        awaiter.ready=false;
+        return awaiter;
+    }
+
+    //how much of a timeout is left after some time has passed, or 0 if it's all used
+    double RemainingTimeout(double timeout, MPMA::Timer &timer)
+    {
+        if (timeout<0)
+            return -1;
+
+        double remaining=timeout-timer.Step(false);
+        return remaining>0 ? remaining : 0;
+    }
+}
+
+namespace NET
+{
+    void SocketWaitAwaiter::await_suspend(std::coroutine_handle<> handle)
+    {
+        coroutine=handle;
+        ready=false;
+        if (waitersLock)
+        {
+            MPMA::TakeSpinLock takeLock(*waitersLock);
+            if (!reactorEnding)
+            {
+                deadline=(timeout<0) ? -1 : reactorClock->Step(false)+timeout;
+                waiters->push_back(this);
+                WakeReactor();
+                return; //the reactor may resume us as soon as the lock is released, so this must not be touched after
+            }
+        }
+
+        //shutting down, so don't wait
+        MPMA::Internal_ResumeOnTaskScheduler(job, coroutine);
+    }
+
+    //Waits until the socket is readable.
+    SocketWaitAwaiter WaitReadable(const TCPClient &client, double timeout)
+    {
+        return MakeSocketWait(client.Internal_GetSocket(), timeout);
+    }
+
+    SocketWaitAwaiter WaitReadable(const UDPClient &client, double timeout)
+    {
+        return MakeSocketWait(client.Internal_GetSocket(), timeout);
+    }
+
+    SocketWaitAwaiter WaitReadable(const TCPServer &server, double timeout)
+    {
+        return MakeSocketWait(server.Internal_GetSocket(), timeout);
+    }
+
+    //Waits for data from the remote, then works the same as TCPClient::Receive.
+    MPMA::Task<nuint> ReceiveAsync(TCPClient &client, std::vector<uint8> &data, nuint exactBytesToRetrieve, double timeout)
+    {
+        MPMA::Timer timer;
+        for (;;)
+        {
+            nuint count=client.Receive(data, exactBytesToRetrieve);
+            if (count!=0 || !client.IsConnected())
+                co_return count;
+
+            double remaining=RemainingTimeout(timeout, timer);
+            if (remaining==0 || !co_await WaitReadable(client, remaining))
+                co_return 0;
+        }
+    }
+
+    //Waits for the next packet, then works the same as UDPClient::Receive.
+    MPMA::Task<bool> ReceiveAsync(UDPClient &client, std::vector<uint8> &data, Address *source, double timeout)
+    {
+        MPMA::Timer timer;
+        for (;;)
+        {
+            if (client.Receive(data, source))
+                co_return true;
+
+            double remaining=RemainingTimeout(timeout, timer);
+            if (remaining==0 || !co_await WaitReadable(client, remaining))
+                co_return false;
+        }
+    }
+
+    //Waits for the next connection to the server and returns it.
+    MPMA::Task<TCPClient*> AcceptAsync(TCPServer &server, double timeout)
+    {
+        MPMA::Timer timer;
+        for (;;)
+        {
+            TCPClient *client=server.GetNextConnection();
+            if (client)
+                co_return client;
+
+            double remaining=RemainingTimeout(timeout, timer);
+            if (remaining==0 || !co_await WaitReadable(server, remaining))
+                co_return 0;
+        }
+    }
+}
+
+//init stuff
+namespace
+{
+    void ReactorInitialize()
+    {
+        //set up the socket used to wake the reactor
+        wakeSock=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        memset(&wakeAddr, 0, sizeof(wakeAddr));
+        wakeAddr.sin_family=AF_INET;
+        wakeAddr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+        wakeAddr.sin_port=0;
+        socklen_t wakeAddrLen=sizeof(wakeAddr);
+        if (wakeSock<0 || bind(wakeSock, (sockaddr*)&wakeAddr, sizeof(wakeAddr)) || getsockname(wakeSock, (sockaddr*)&wakeAddr, &wakeAddrLen))
+        {
+            MPMA::ErrorReport()<<"Failed to create the socket reactor's wake socket: "<<Internal_GetLastError()<<".  Waiting on sockets will not work.\n";
+            if (wakeSock>=0)
+                Internal_CloseSocket(wakeSock);
+            wakeSock=-1;
+            return;
+        }
+        Internal_SetSocketBlocking(wakeSock, false);
+
+        reactorClock=new2(MPMA::Timer(), MPMA::Timer);
+        waitersLock=new2(MPMA::SpinLock(), MPMA::SpinLock);
+        waiters=new2(std::vector<NET::SocketWaitAwaiter*>(), std::vector<NET::SocketWaitAwaiter*>);
+        reactorEnding=false;
+        reactorThread=new2(MPMA::Thread(ReactorThreadProc, MPMA::ThreadParam()), MPMA::Thread);
+    }
+    void ReactorShutdown()
+    {
+        if (!reactorThread)
+            return;
+
+        //stop the reactor, then give up on anything still waiting
+        std::vector<NET::SocketWaitAwaiter*> cancelled;
+        {
+            MPMA::TakeSpinLock takeLock(*waitersLock);
+            reactorEnding=true;
+            WakeReactor();
+            cancelled.swap(*waiters);
+        }
+        delete2(reactorThread);
+        reactorThread=0;
+
+        for (std::vector<NET::SocketWaitAwaiter*>::iterator w=cancelled.begin(); w!=cancelled.end(); ++w)
+        {
+            (*w)->ready=false;
+            MPMA::Internal_ResumeOnTaskScheduler((*w)->job, (*w)->coroutine);
+        }
+
+        delete2(waiters);
+        waiters=0;
+        delete2(waitersLock);
+        waitersLock=0;
+        delete2(reactorClock);
+        reactorClock=0;
+
+        Internal_CloseSocket(wakeSock);
+        wakeSock=-1;
+    }
+
+    class AutoInitReactor
+    {
+    public:
+        //hookup init callbacks
+        AutoInitReactor()
+        {
+            MPMA::Internal_AddInitCallback(ReactorInitialize, 1020);
+            MPMA::Internal_AddShutdownCallback(ReactorShutdown, 1020);
+        }
+    } autoInitReactor;
+}
+
+#endif //MPMA_COROUTINES_AVAILABLE
+
+bool mpmaForceReferenceToAsyncSocketsCPP=false; //work around a problem using MPMA as a static library
+
+#endif //#ifdef MPMA_COMPILE_NET
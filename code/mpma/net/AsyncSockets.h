@@ -0,0 +1,79 @@
+//!\file AsyncSockets.h Lets coroutines wait on sockets without holding a thread.
+//See /docs/License.txt for details on how this code may be used.
+
+#pragma once
+
+#include "../Config.h"
+
+#ifdef MPMA_COMPILE_NET
+
+#include "../base/Coroutine.h"
+
+#ifdef MPMA_COROUTINES_AVAILABLE
+
+#include "TCP.h"
+#include "UDP.h"
+
+/*
+An example of a server that handles each connection with its own coroutine.  A single background thread watches every socket, so thousands of connections can be waiting at once:
+  MPMA::Task<> HandleClient(NET::TCPClient *client)
+  {
+      std::vector<uint8> request;
+      while (co_await NET::ReceiveAsync(*client, request, 4)!=0)
+      {
+          client->Send(&request[0], request.size());
+          request.clear();
+      }
+      NET::TCPClient::FreeClient(client);
+  }
+
+  MPMA::Task<> Serve(NET::TCPServer *server)
+  {
+      while (NET::TCPClient *client=co_await NET::AcceptAsync(*server))
+          MPMA::StartTask(HandleClient(client));
+  }
+*/
+
+namespace NET
+{
+    //!Awaiter returned by WaitReadable.  The result of the co_await is true if the socket is ready, or false if the wait timed out or the framework is shutting down.  The coroutine continues on the task scheduler.
+    struct SocketWaitAwaiter
+    {
+        nsint sock;
+        double timeout;
+
+        inline bool await_ready() const noexcept
+            { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        inline bool await_resume() const noexcept
+            { return ready; }
+
+        //internal use
+        double deadline;
+        std::coroutine_handle<> coroutine;
+        MPMA::ThreadedTaskJob job;
+        bool ready;
+    };
+
+    //!co_await the result of this to wait until the client has data to receive, or has been disconnected.  If timeout (in seconds) is not negative, the wait gives up after that long.
+    SocketWaitAwaiter WaitReadable(const TCPClient &client, double timeout=-1);
+
+    //!co_await the result of this to wait until the client has a packet to receive.  If timeout (in seconds) is not negative, the wait gives up after that long.
+    SocketWaitAwaiter WaitReadable(const UDPClient &client, double timeout=-1);
+
+    //!co_await the result of this to wait until the server has a connection to accept.  If timeout (in seconds) is not negative, the wait gives up after that long.
+    SocketWaitAwaiter WaitReadable(const TCPServer &server, double timeout=-1);
+
+    //!Waits for data from the remote, then works the same as TCPClient::Receive.  Returns 0 only if the client was disconnected, the timeout (if not negative) passed, or the framework is shutting down.
+    MPMA::Task<nuint> ReceiveAsync(TCPClient &client, std::vector<uint8> &data, nuint exactBytesToRetrieve=0, double timeout=-1);
+
+    //!Waits for the next packet, then works the same as UDPClient::Receive.  Returns false only if the timeout (if not negative) passed, or the framework is shutting down.
+    MPMA::Task<bool> ReceiveAsync(UDPClient &client, std::vector<uint8> &data, Address *source=0, double timeout=-1);
+
+    //!Waits for the next connection to the server and returns it.  Returns 0 only if the timeout (if not negative) passed, or the framework is shutting down.
+    MPMA::Task<TCPClient*> AcceptAsync(TCPServer &server, double timeout=-1);
+}
+
+#endif //MPMA_COROUTINES_AVAILABLE
+
+#endif //#ifdef MPMA_COMPILE_NET
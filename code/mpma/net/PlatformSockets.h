@@ -27,6 +27,7 @@ typedef int socklen_t;
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <unistd.h>
 
 #else // ?
@@ -56,6 +57,9 @@ namespace NET_INTERNAL
 
     //gets our subnet mask and subnet address
     bool Internal_GetSubnet(uint32 &mask, uint32 &net, uint32 &localIp);
+
+    //waits up to timeoutMs (or forever if negative) for any of the sockets to have one of the events they ask for, and fills in the events that happened.  Returns the number of sockets with events, or -1 on error.
+    int Internal_PollSockets(pollfd *fds, nuint count, int timeoutMs);
 }
 
 #endif //#ifdef MPMA_COMPILE_NET
@@ -8,6 +8,7 @@
 
 #include "UPNP.h"
 #include "../base/Memory.h"
+#include "../base/ObjectPool.h"
 #include "../base/DebugRouter.h"
 #include "PlatformSockets.h"
 
@@ -17,6 +18,12 @@ using namespace NET_INTERNAL;
 
 namespace NET
 {
+    namespace
+    {
+        //a server that is accepting a flood of connections makes a lot of these
+        MPMA::ObjectPool<TCPClient> tcpClients("TCP clients");
+    }
+
     // -- client
 
     TCPClient::TCPClient()
@@ -39,7 +46,7 @@ namespace NET
         }
 
         //set us up the socket
-        TCPClient *client=new2(TCPClient,TCPClient);
+        TCPClient *client=tcpClients.New();
         client->port=localPort;
         client->remoteAddr=addr;
         client->sock=socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -110,7 +117,7 @@ namespace NET
         {
             Internal_SetSocketBlocking(client->sock, true);
             Internal_CloseSocket(client->sock);
-            delete2(client);
+            tcpClients.Delete(client);
         }
     }
 
@@ -319,7 +326,7 @@ namespace NET
             return 0;
 
         //create a client to represent it
-        TCPClient *client=new2(TCPClient,TCPClient);
+        TCPClient *client=tcpClients.New();
         client->port=port;
         client->remoteAddr.SetAddress(inet_ntoa(saddr.sin_addr));
         client->remoteAddr.SetPort(ntohs(saddr.sin_port));
@@ -12,6 +12,7 @@
 #include <vector>
 
 class MPMAMemoryManager; //FD
+namespace MPMA { template <typename T> class ObjectPool; } //FD
 
 namespace NET
 {
@@ -43,6 +44,9 @@ namespace NET
         //!Improves network bandwidth at the expense of latency (on by default).
         void EnableSendCoalescing(bool allow);
 
+        //internal use: the platform's handle for the socket
+        inline nsint Internal_GetSocket() const { return sock; }
+
         //TODO: Some sort of callback mechanism for notifications.
 
     private:
@@ -52,6 +56,7 @@ namespace NET
         inline TCPClient(const TCPClient&) {}
         inline void operator=(const TCPClient&) {}
         friend class ::MPMAMemoryManager;
+        template <typename T> friend class MPMA::ObjectPool;
         friend class TCPServer;
 
         //
@@ -78,6 +83,9 @@ namespace NET
         //!Returns the local port that the server is listening on.
         inline uint16 GetListenPort() const { return port; }
 
+        //internal use: the platform's handle for the socket
+        inline nsint Internal_GetSocket() const { return sock; }
+
         //TODO: Some sort of callback mechanism for notifications.
 
     private:
@@ -36,6 +36,9 @@ namespace NET
          //!Receives the next packet and appends it to data.  source (if not 0) will be filled with the address the packet came from.  Returns false if there was nothing to receive (does not block).
         bool Receive(std::vector<uint8> &data, Address *source=0);
 
+        //internal use: the platform's handle for the socket
+        inline nsint Internal_GetSocket() const { return sock; }
+
         //TODO: callback system for data coming in
 
     private:
@@ -148,6 +148,15 @@ namespace NET_INTERNAL
         shutdown(s, SHUT_RDWR);
         return found;
     }
+
+    //waits for any of the sockets to have one of the events they ask for
+    int Internal_PollSockets(pollfd *fds, nuint count, int timeoutMs)
+    {
+        int ret=poll(fds, (nfds_t)count, timeoutMs);
+        if (ret<0 && errno==EINTR)
+            return 0;
+        return ret;
+    }
 }
 
 #endif //#ifdef MPMA_COMPILE_NET
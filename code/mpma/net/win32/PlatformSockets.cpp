@@ -115,6 +115,15 @@ namespace NET_INTERNAL
         shutdown(s, SD_BOTH);
         return found;
     }
+
+    //waits for any of the sockets to have one of the events they ask for
+    int Internal_PollSockets(pollfd *fds, nuint count, int timeoutMs)
+    {
+        int ret=WSAPoll(fds, (ULONG)count, timeoutMs);
+        if (ret==SOCKET_ERROR)
+            return -1;
+        return ret;
+    }
 }
 
 #endif //#ifdef MPMA_COMPILE_NET